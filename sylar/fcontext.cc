@@ -0,0 +1,112 @@
+#include "fcontext.h"
+#include <stdint.h>
+#include <string.h>
+
+namespace hr {
+
+#if defined(__x86_64__)
+
+//System V x86_64
+//栈上依次保存: mxcsr/x87控制字(16字节), r12, r13, r14, r15, rbx, rbp, 返回地址
+asm(R"(
+    .text
+    .globl hr_swap_fcontext
+    .type hr_swap_fcontext,@function
+    .align 16
+hr_swap_fcontext:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    leaq -16(%rsp), %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    leaq 16(%rsp), %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+    .size hr_swap_fcontext,.-hr_swap_fcontext
+)");
+
+fcontext_t hr_make_fcontext(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    //ret之后rsp+8需要16字节对齐，和正常call进入函数时一致
+    uint64_t* sp = (uint64_t*)(top - 64 - 16);
+    memset(sp, 0, 64 + 16);
+    //mxcsr, x87控制字使用默认值
+    *(uint32_t*)sp = 0x1f80;
+    *(uint16_t*)((char*)sp + 4) = 0x037f;
+    //sp[2..7]为r12..rbp，sp[8]为返回地址，sp[9]为fn的返回地址(fn不会返回)
+    sp[8] = (uint64_t)fn;
+    return sp;
+}
+
+#elif defined(__aarch64__)
+
+//AAPCS64
+//栈上依次保存: d8-d15, x19-x28, x29(fp), x30(lr)
+asm(R"(
+    .text
+    .globl hr_swap_fcontext
+    .type hr_swap_fcontext,%function
+    .align 4
+hr_swap_fcontext:
+    sub sp, sp, #0xb0
+    stp d8, d9, [sp, #0x00]
+    stp d10, d11, [sp, #0x10]
+    stp d12, d13, [sp, #0x20]
+    stp d14, d15, [sp, #0x30]
+    stp x19, x20, [sp, #0x40]
+    stp x21, x22, [sp, #0x50]
+    stp x23, x24, [sp, #0x60]
+    stp x25, x26, [sp, #0x70]
+    stp x27, x28, [sp, #0x80]
+    stp x29, x30, [sp, #0x90]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0x00]
+    ldp d10, d11, [sp, #0x10]
+    ldp d12, d13, [sp, #0x20]
+    ldp d14, d15, [sp, #0x30]
+    ldp x19, x20, [sp, #0x40]
+    ldp x21, x22, [sp, #0x50]
+    ldp x23, x24, [sp, #0x60]
+    ldp x25, x26, [sp, #0x70]
+    ldp x27, x28, [sp, #0x80]
+    ldp x29, x30, [sp, #0x90]
+    add sp, sp, #0xb0
+    ret
+    .size hr_swap_fcontext,.-hr_swap_fcontext
+)");
+
+fcontext_t hr_make_fcontext(void* stack, size_t size, void (*fn)()) {
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t* sp = (uint64_t*)(top - 0xb0);
+    memset(sp, 0, 0xb0);
+    //x30(lr)，ret之后跳转到fn
+    sp[0x98 / 8] = (uint64_t)fn;
+    return sp;
+}
+
+#endif
+
+const char* FiberContextBackend() {
+#ifdef SYLAR_FIBER_UCONTEXT
+    return "ucontext";
+#else
+    return "fcontext";
+#endif
+}
+
+}
@@ -0,0 +1,49 @@
+//协程上下文切换
+//x86_64/aarch64使用汇编实现的上下文切换(参考boost.context的fcontext)，只保存callee-saved寄存器，
+//不像swapcontext那样每次切换都通过系统调用保存/恢复信号掩码
+//其他平台或定义了SYLAR_FIBER_UCONTEXT(cmake -DFIBER_UCONTEXT=ON)时使用ucontext
+
+#ifndef __SYLAR_FCONTEXT_H__
+#define __SYLAR_FCONTEXT_H__
+
+#include <stddef.h>
+#include <ucontext.h>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#   define SYLAR_HAVE_FCONTEXT
+#endif
+
+#ifndef SYLAR_HAVE_FCONTEXT
+#   ifndef SYLAR_FIBER_UCONTEXT
+#       define SYLAR_FIBER_UCONTEXT
+#   endif
+#endif
+
+namespace hr {
+
+#ifdef SYLAR_HAVE_FCONTEXT
+//汇编上下文，指向保存寄存器的栈顶
+typedef void* fcontext_t;
+
+//保存当前上下文到from，切换到to
+extern "C" void hr_swap_fcontext(fcontext_t* from, fcontext_t to);
+
+//在栈上构造初始上下文，第一次切换到该上下文时执行fn
+// stack 栈内存起始地址
+// size 栈大小
+// fn 执行函数，不能返回
+fcontext_t hr_make_fcontext(void* stack, size_t size, void (*fn)());
+#endif
+
+#ifdef SYLAR_FIBER_UCONTEXT
+typedef ucontext_t fiber_context_t;
+#else
+typedef fcontext_t fiber_context_t;
+#endif
+
+//当前Fiber使用的上下文切换实现
+const char* FiberContextBackend();
+
+}
+
+#endif
@@ -6,15 +6,22 @@
 
 namespace hr {
 
-FdCtx::FdCtx(int fd)
+FdCtx::FdCtx(int fd, bool nonblock_socket)
     :m_isInit(false)
     ,m_isSocket(false)
     ,m_sysNonblock(false)
     ,m_userNonblock(false)
-    ,m_isClosed(false)
     ,m_fd(fd)
     ,m_recvTimeout(-1)
-    ,m_sendTimeout(-1) {
+    ,m_sendTimeout(-1)
+    ,m_isClosed(false)
+    ,m_generation(0) {
+    if(nonblock_socket) {
+        m_isInit = true;
+        m_isSocket = true;
+        m_sysNonblock = true;
+        return;
+    }
     init();
 }
 
@@ -67,6 +74,25 @@ bool FdCtx::init() {
     return m_isInit;
 }
 
+void FdCtx::reopen(bool nonblock_socket) {
+    m_isInit = false;
+    m_isSocket = false;
+    m_sysNonblock = false;
+    m_userNonblock = false;
+    m_recvTimeout = -1;
+    m_sendTimeout = -1;
+    ++m_generation;
+    if(nonblock_socket) {
+        m_isInit = true;
+        m_isSocket = true;
+        m_sysNonblock = true;
+    } else {
+        init();
+    }
+    //最后清除关闭标记,读到未关闭时其他字段已经初始化好
+    m_isClosed = false;
+}
+
 void FdCtx::setTimeout(int type, uint64_t v) {
     if(type == SO_RCVTIMEO) {
         m_recvTimeout = v;
@@ -84,41 +110,37 @@ uint64_t FdCtx::getTimeout(int type) {
 }
 
 FdManager::FdManager() {
-    m_datas.resize(64);
 }
 
-FdCtx::ptr FdManager::get(int fd, bool auto_create) {
-    if(fd == -1) {
-        return nullptr;
-    }
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
-        if(auto_create == false) {
-            return nullptr;
+FdCtx::ptr FdManager::get(int fd, bool auto_create, bool nonblock_socket) {
+    FdCtx::ptr* slot = m_datas.get(fd);
+    if(SYLAR_LIKELY(slot)) {
+        FdCtx::ptr& ctx = *slot;
+        if(!ctx->isClose()) {
+            return ctx;
         }
-    } else {
-        if(m_datas[fd] || !auto_create) {
-            return m_datas[fd];
+        if(!auto_create) {
+            return nullptr;
         }
+        //fd号被复用
+        ctx->reopen(nonblock_socket);
+        return ctx;
     }
-    lock.unlock();
-
-    //超出大小需要扩容
-    RWMutexType::WriteLock lock2(m_mutex);
-    FdCtx::ptr ctx(new FdCtx(fd));
-    if(fd >= (int)m_datas.size()) {
-        m_datas.resize(fd * 1.5);
+    if(!auto_create) {
+        return nullptr;
     }
-    m_datas[fd] = ctx;
-    return ctx;
+    slot = m_datas.getOrCreate(fd, [fd, nonblock_socket]() {
+        return new FdCtx::ptr(new FdCtx(fd, nonblock_socket));
+    });
+    return slot ? *slot : nullptr;
 }
 
 void FdManager::del(int fd) {
-    RWMutexType::WriteLock lock(m_mutex);
-    if((int)m_datas.size() <= fd) {
-        return;
+    FdCtx::ptr* slot = m_datas.get(fd);
+    //还持有FdCtx的协程(close唤醒的io)据此返回EBADF,不会操作复用了fd号的新句柄
+    if(slot) {
+        (*slot)->setClose(true);
     }
-    m_datas[fd].reset();
 }
 
-}
\ No newline at end of file
+}
@@ -5,9 +5,10 @@
 #define __FD_MANAGER_H__
 
 #include <memory>
-#include <vector>
+#include <atomic>
 #include "thread.h"
 #include "singleton.h"
+#include "fd_table.h"
 
 namespace hr {
 
@@ -19,7 +20,8 @@ public:
     typedef std::shared_ptr<FdCtx> ptr;
 
     //通过文件句柄构造FdCtx
-    FdCtx(int fd);
+    // nonblock_socket 调用方已知是非阻塞socket(accept4 SOCK_NONBLOCK),跳过fstat和fcntl
+    FdCtx(int fd, bool nonblock_socket = false);
 
     //析构函数
     ~FdCtx();
@@ -33,6 +35,12 @@ public:
     //是否已经关闭
     bool isClose() const {return m_isClosed;}
 
+    //设置是否已经关闭
+    void setClose(bool v) {m_isClosed = v;}
+
+    //fd号每复用一次加1,等待io的协程醒来后据此判断句柄是否还是原来的
+    uint32_t getGeneration() const {return m_generation;}
+
     //设置用户主动设置非阻塞
     // v 是否阻塞
     void setUserNonblock(bool v) {m_userNonblock = v;}
@@ -61,6 +69,10 @@ private:
     //初始化
     bool init();
 
+    //关闭后fd号被复用,重新初始化
+    void reopen(bool nonblock_socket);
+
+    friend class FdManager;
 private:
     /// 是否初始化
     bool m_isInit: 1;
@@ -70,39 +82,39 @@ private:
     bool m_sysNonblock: 1;
     /// 是否用户主动设置非阻塞
     bool m_userNonblock: 1;
-    /// 是否关闭
-    bool m_isClosed: 1;
     /// 文件句柄
     int m_fd;
     /// 读超时时间毫秒
     uint64_t m_recvTimeout;
     /// 写超时时间毫秒
     uint64_t m_sendTimeout;
+    /// 是否关闭
+    std::atomic<bool> m_isClosed;
+    /// fd号复用的次数
+    std::atomic<uint32_t> m_generation;
 };
 
 //文件句柄管理类
+//FdCtx创建后不释放,fd关闭后标记关闭,fd号复用时重新初始化,所以读不需要加锁
 class FdManager {
 public:
-    typedef RWMutex RWMutexType;
-
     //无参构造函数
     FdManager();
 
     //获取/创建文件句柄类FdCtx
     // fd 文件句柄
     // auto_create 是否自动创建
+    // nonblock_socket 创建时已知是非阻塞socket
     //返回对应文件句柄类FdCtx::ptr
-    FdCtx::ptr get(int fd, bool auto_create = false);
+    FdCtx::ptr get(int fd, bool auto_create = false, bool nonblock_socket = false);
 
     //删除文件句柄类
     // fd 文件句柄
     void del(int fd);
 
 private:
-    /// 读写锁
-    RWMutexType m_mutex;
     /// 文件句柄集合
-    std::vector<FdCtx::ptr> m_datas;
+    FdTable<FdCtx::ptr> m_datas;
 };
 
 /// 文件句柄单例
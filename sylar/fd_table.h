@@ -0,0 +1,100 @@
+//按文件句柄索引的表
+
+#ifndef __SYLAR_FD_TABLE_H__
+#define __SYLAR_FD_TABLE_H__
+
+#include <atomic>
+#include <stddef.h>
+#include "noncopyable.h"
+#include "macro.h"
+
+namespace hr {
+
+//两级基数表: 第一级是固定大小的块指针数组,第二级是固定大小的块
+//块只会新增不会移动或释放,读不加锁,扩容只是CAS一个新块,不会阻塞读
+//表里的对象创建后一直有效,直到表析构时统一释放
+template<class T>
+class FdTable : Noncopyable {
+public:
+    //每块1024个句柄,最多4096块(4M个句柄)
+    static const int CHUNK_BITS = 10;
+    static const int CHUNK_SIZE = 1 << CHUNK_BITS;
+    static const int MAX_CHUNKS = 4096;
+    static const int MAX_FD = CHUNK_SIZE * MAX_CHUNKS;
+
+    FdTable() {
+        for(int i = 0; i < MAX_CHUNKS; ++i) {
+            m_chunks[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    ~FdTable() {
+        for(int i = 0; i < MAX_CHUNKS; ++i) {
+            Chunk* chunk = m_chunks[i].load(std::memory_order_relaxed);
+            if(!chunk) {
+                continue;
+            }
+            for(int j = 0; j < CHUNK_SIZE; ++j) {
+                delete chunk->slots[j].load(std::memory_order_relaxed);
+            }
+            delete chunk;
+        }
+    }
+
+    //返回fd对应的对象,不存在返回nullptr,不加锁
+    T* get(int fd) const {
+        if(SYLAR_UNLIKELY(fd < 0 || fd >= MAX_FD)) {
+            return nullptr;
+        }
+        Chunk* chunk = m_chunks[fd >> CHUNK_BITS].load(std::memory_order_acquire);
+        if(!chunk) {
+            return nullptr;
+        }
+        return chunk->slots[fd & (CHUNK_SIZE - 1)].load(std::memory_order_acquire);
+    }
+
+    //返回fd对应的对象,不存在时用creator()创建
+    //并发创建时只有一个对象会放进表里,其他的被释放
+    template<class Creator>
+    T* getOrCreate(int fd, Creator creator) {
+        T* v = get(fd);
+        if(SYLAR_LIKELY(v) || fd < 0 || fd >= MAX_FD) {
+            return v;
+        }
+        std::atomic<Chunk*>& cp = m_chunks[fd >> CHUNK_BITS];
+        Chunk* chunk = cp.load(std::memory_order_acquire);
+        if(!chunk) {
+            Chunk* nc = new Chunk;
+            //失败时chunk是其他线程放进去的块
+            if(cp.compare_exchange_strong(chunk, nc, std::memory_order_acq_rel)) {
+                chunk = nc;
+            } else {
+                delete nc;
+            }
+        }
+
+        std::atomic<T*>& slot = chunk->slots[fd & (CHUNK_SIZE - 1)];
+        T* nv = creator();
+        T* expected = nullptr;
+        if(slot.compare_exchange_strong(expected, nv, std::memory_order_acq_rel)) {
+            return nv;
+        }
+        delete nv;
+        return expected;
+    }
+private:
+    struct Chunk {
+        Chunk() {
+            for(int i = 0; i < CHUNK_SIZE; ++i) {
+                slots[i].store(nullptr, std::memory_order_relaxed);
+            }
+        }
+        std::atomic<T*> slots[CHUNK_SIZE];
+    };
+
+    std::atomic<Chunk*> m_chunks[MAX_CHUNKS];
+};
+
+}
+
+#endif
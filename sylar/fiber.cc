@@ -4,6 +4,11 @@
 #include "log.h"
 #include "scheduler.h"
 #include <atomic>
+#include <map>
+#include <vector>
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 namespace hr {
 
@@ -26,20 +31,180 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = 
     Config::Lookup<uint32_t>("fiber.stack_size", 128 * 1024, "fiber stack size");
 
-//栈内存分配器
-class MallocStackAllocator {
+//每个线程每种大小缓存的栈数量上限，超过后释放到低水位
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_high =
+    Config::Lookup<uint32_t>("fiber.stack_pool.high_water", 64, "fiber stack pool high watermark per thread");
+
+//每个线程每种大小缓存的栈数量下限，超过的空闲栈才会被madvise
+static ConfigVar<uint32_t>::ptr g_fiber_stack_pool_low =
+    Config::Lookup<uint32_t>("fiber.stack_pool.low_water", 16, "fiber stack pool low watermark per thread");
+
+//是否对超过低水位的空闲栈madvise(MADV_DONTNEED)，归还物理内存
+static ConfigVar<bool>::ptr g_fiber_stack_pool_madvise =
+    Config::Lookup<bool>("fiber.stack_pool.madvise", false, "madvise idle fiber stacks above low watermark");
+
+static uint32_t s_stack_pool_high = 64;
+static uint32_t s_stack_pool_low = 16;
+static bool s_stack_pool_madvise = false;
+
+struct _StackPoolIniter {
+    _StackPoolIniter() {
+        s_stack_pool_high = g_fiber_stack_pool_high->getValue();
+        s_stack_pool_low = g_fiber_stack_pool_low->getValue();
+        s_stack_pool_madvise = g_fiber_stack_pool_madvise->getValue();
+
+        g_fiber_stack_pool_high->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_stack_pool_high = new_value;
+        });
+        g_fiber_stack_pool_low->addListener([](const uint32_t& old_value, const uint32_t& new_value){
+            s_stack_pool_low = new_value;
+        });
+        g_fiber_stack_pool_madvise->addListener([](const bool& old_value, const bool& new_value){
+            s_stack_pool_madvise = new_value;
+        });
+    }
+};
+
+static _StackPoolIniter s_stack_pool_initer;
+
+//栈分配统计
+static std::atomic<uint64_t> s_stack_mmaps {0};
+static std::atomic<uint64_t> s_stack_munmaps {0};
+static std::atomic<uint64_t> s_stack_hits {0};
+static std::atomic<uint64_t> s_stack_in_use {0};
+static std::atomic<uint64_t> s_stack_cached {0};
+static std::atomic<uint64_t> s_stack_madvised {0};
+
+//mmap栈分配器
+//栈底(低地址)有一页PROT_NONE保护页，栈溢出时直接SIGSEGV而不是破坏其他内存
+//释放的栈按大小放入当前线程的空闲链表，同样大小的栈下次直接复用
+class PooledStackAllocator {
 public:
     static void* Alloc(size_t size) {
-        return malloc(size);
+        ++s_stack_in_use;
+        if(SYLAR_UNLIKELY(t_free_lists_destroyed)) {
+            return Map(size);
+        }
+        std::vector<void*>& stacks = t_free_lists.lists[size];
+        if(!stacks.empty()) {
+            void* vp = stacks.back();
+            stacks.pop_back();
+            --s_stack_cached;
+            ++s_stack_hits;
+            return vp;
+        }
+        return Map(size);
     }
 
     static void Dealloc(void* vp, size_t size) {
-        return free(vp);
+        --s_stack_in_use;
+        //线程退出或静态析构时空闲链表可能已经析构，直接释放
+        if(s_stack_pool_high == 0 || SYLAR_UNLIKELY(t_free_lists_destroyed)) {
+            Unmap(vp, size);
+            return;
+        }
+        //水位按每种大小分别计算
+        std::vector<void*>& stacks = t_free_lists.lists[size];
+        if(s_stack_pool_madvise && stacks.size() >= s_stack_pool_low) {
+            madvise(vp, size, MADV_DONTNEED);
+            ++s_stack_madvised;
+        }
+        stacks.push_back(vp);
+        ++s_stack_cached;
+        if(stacks.size() > s_stack_pool_high) {
+            Clear(stacks, size, s_stack_pool_low);
+        }
+    }
+private:
+    struct FreeLists {
+        ~FreeLists() {
+            for(auto& i : lists) {
+                Clear(i.second, i.first, 0);
+            }
+            t_free_lists_destroyed = true;
+        }
+
+        //栈大小到空闲栈的映射
+        std::map<size_t, std::vector<void*> > lists;
+    };
+
+    //释放到只剩keep个
+    static void Clear(std::vector<void*>& stacks, size_t size, size_t keep) {
+        while(stacks.size() > keep) {
+            Unmap(stacks.back(), size);
+            stacks.pop_back();
+            --s_stack_cached;
+        }
     }
+
+    static void* Map(size_t size) {
+        size_t page = getpagesize();
+        void* base = mmap(nullptr, size + page, PROT_READ | PROT_WRITE
+                        , MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        SYLAR_ASSERT2(base != MAP_FAILED, "mmap fiber stack");
+        if(mprotect(base, page, PROT_NONE)) {
+            HR_LOG_ERROR(g_logger) << "mprotect fiber stack guard page errno="
+                << errno << " errstr=" << strerror(errno);
+        }
+        ++s_stack_mmaps;
+        return (char*)base + page;
+    }
+
+    static void Unmap(void* vp, size_t size) {
+        size_t page = getpagesize();
+        munmap((char*)vp - page, size + page);
+        ++s_stack_munmaps;
+    }
+
+    static thread_local bool t_free_lists_destroyed;
+    static thread_local FreeLists t_free_lists;
 };
 
+thread_local bool PooledStackAllocator::t_free_lists_destroyed = false;
+thread_local PooledStackAllocator::FreeLists PooledStackAllocator::t_free_lists;
+
 //取别名
-using StackAllocator = MallocStackAllocator;
+using StackAllocator = PooledStackAllocator;
+
+#ifdef SYLAR_FIBER_UCONTEXT
+//获取当前上下文
+static void get_context(fiber_context_t* ctx) {
+    if(getcontext(ctx)) {
+        //报错
+        SYLAR_ASSERT2(false, "getcontext");
+    }
+}
+
+//在栈上构造上下文
+static void make_context(fiber_context_t* ctx, void* stack, size_t size, void (*fn)()) {
+    get_context(ctx);
+    ctx->uc_link = nullptr;
+    ctx->uc_stack.ss_sp = stack;
+    ctx->uc_stack.ss_size = size;
+    makecontext(ctx, fn, 0);
+}
+
+//保存当前上下文到from，切换到to
+static void swap_context(fiber_context_t* from, fiber_context_t* to) {
+    if(swapcontext(from, to)) {
+        //报错
+        SYLAR_ASSERT2(false, "swapcontext");
+    }
+}
+#else
+//汇编切换时上下文保存在栈上，切出时才写入
+static void get_context(fiber_context_t* ctx) {
+    *ctx = nullptr;
+}
+
+static void make_context(fiber_context_t* ctx, void* stack, size_t size, void (*fn)()) {
+    *ctx = hr_make_fcontext(stack, size, fn);
+}
+
+static void swap_context(fiber_context_t* from, fiber_context_t* to) {
+    hr_swap_fcontext(from, *to);
+}
+#endif
 
 //获取协程id
 uint64_t Fiber::GetFiberId() {
@@ -54,10 +219,7 @@ Fiber::Fiber() {
     m_state = EXEC;
     SetThis(this);
 
-    if(getcontext(&m_ctx)) {
-        //报错
-        SYLAR_ASSERT2(false, "getcontext");
-    }
+    get_context(&m_ctx);
 
     ++s_fiber_count;
 
@@ -70,23 +232,19 @@ Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
     ,m_cb(cb){
     ++s_fiber_count;
     m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
+    //按页对齐，保证同样配置的栈可以复用
+    size_t page = getpagesize();
+    m_stacksize = (m_stacksize + page - 1) / page * page;
 
     m_stack = StackAllocator::Alloc(m_stacksize);
-    if(getcontext(&m_ctx)) {
-        //报错
-        SYLAR_ASSERT2(false, "getcontext");
-    }
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
 
     //不使用主线程的协程
     if(!use_caller) {
         //回到主协程
-        makecontext(&m_ctx, &Fiber::MainFunc, 0);
+        make_context(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
     } else {
         //将当前协程的上下文与执行函数绑定
-        makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+        make_context(&m_ctx, m_stack, m_stacksize, &Fiber::CallerMainFunc);
     }
     HR_LOG_DEBUG(g_logger) << "Fiber::Fiber id = " << m_id;
 }
@@ -122,16 +280,7 @@ void Fiber::reset(std::function<void()> cb) {
             || m_state == EXCEPT
             || m_state == INIT);
     m_cb = cb;
-    if(getcontext(&m_ctx)) {
-        //报错
-        SYLAR_ASSERT2(false, "getcontext");
-    }
-
-    m_ctx.uc_link = nullptr;
-    m_ctx.uc_stack.ss_sp = m_stack;
-    m_ctx.uc_stack.ss_size = m_stacksize;
-
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
+    make_context(&m_ctx, m_stack, m_stacksize, &Fiber::MainFunc);
     m_state = INIT;
 }
 
@@ -139,19 +288,13 @@ void Fiber::reset(std::function<void()> cb) {
 void Fiber::call() {
     SetThis(this);
     m_state = EXEC;
-    if(swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-        //报错
-        SYLAR_ASSERT2(false, "swapcontext");
-    }
+    swap_context(&t_threadFiber->m_ctx, &m_ctx);
 }
 
 //从当前协程返回到主线程
 void Fiber::back() {
     SetThis(t_threadFiber.get());
-    if(swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-        //报错
-        SYLAR_ASSERT2(false, "swapcontext");
-    }
+    swap_context(&m_ctx, &t_threadFiber->m_ctx);
 }
 
 //当前协程开始执行
@@ -161,20 +304,13 @@ void Fiber::swapIn() {
     SYLAR_ASSERT(m_state != EXEC);
     m_state = EXEC;
     //从调度协程切换到当前协程
-    if(swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-        //报错
-        SYLAR_ASSERT2(false, "swapcontext");
-    }
-
+    swap_context(&Scheduler::GetMainFiber()->m_ctx, &m_ctx);
 }
 
 //从当前协程切换到调度协程
 void Fiber::swapOut() {
     SetThis(Scheduler::GetMainFiber());
-    if(swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-        //报错
-        SYLAR_ASSERT2(false, "swapcontext");
-    }
+    swap_context(&m_ctx, &Scheduler::GetMainFiber()->m_ctx);
 }
 
 //设置当前协程
@@ -221,6 +357,18 @@ uint64_t Fiber::TotalFibers() {
     return s_fiber_count;
 }
 
+//协程栈分配统计
+Fiber::StackStats Fiber::GetStackStats() {
+    StackStats st;
+    st.mmaps = s_stack_mmaps;
+    st.munmaps = s_stack_munmaps;
+    st.hits = s_stack_hits;
+    st.in_use = s_stack_in_use;
+    st.cached = s_stack_cached;
+    st.madvised = s_stack_madvised;
+    return st;
+}
+
 //协程执行函数
 void Fiber::MainFunc() {
     //初始化主协程
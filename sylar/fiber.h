@@ -5,7 +5,7 @@
 
 #include <memory>
 #include <functional>
-#include <ucontext.h>
+#include "fcontext.h"
 
 namespace hr {
 
@@ -33,6 +33,22 @@ public:
         EXCEPT
     };
 
+    //协程栈分配统计
+    struct StackStats {
+        //mmap次数
+        uint64_t mmaps = 0;
+        //munmap次数
+        uint64_t munmaps = 0;
+        //从空闲链表复用次数
+        uint64_t hits = 0;
+        //正在使用的栈数量
+        uint64_t in_use = 0;
+        //所有线程空闲链表中的栈数量
+        uint64_t cached = 0;
+        //madvise(MADV_DONTNEED)次数
+        uint64_t madvised = 0;
+    };
+
 private:
     //无参构造函数
     //每个线程第一个协程的构造
@@ -92,6 +108,9 @@ public:
     //返回当前协程的总数量
     static uint64_t TotalFibers();
 
+    //返回协程栈分配统计
+    static StackStats GetStackStats();
+
     //协程执行函数
     //执行完成返回到线程主协程
     static void MainFunc();
@@ -111,7 +130,7 @@ private:
     //协程状态
     State m_state = INIT;
     //协程上下文
-    ucontext_t m_ctx;
+    fiber_context_t m_ctx;
     //协程运行栈指针
     void* m_stack = nullptr;
     //协程运行函数
@@ -1,5 +1,7 @@
 #include "hook.h"
 #include <dlfcn.h>
+#include <string.h>
+#include <signal.h>
 
 #include "config.h"
 #include "log.h"
@@ -24,6 +26,7 @@ static thread_local bool t_hook_enable = false;
     XX(socket) \
     XX(connect) \
     XX(accept) \
+    XX(accept4) \
     XX(read) \
     XX(readv) \
     XX(recv) \
@@ -34,6 +37,7 @@ static thread_local bool t_hook_enable = false;
     XX(send) \
     XX(sendto) \
     XX(sendmsg) \
+    XX(sendfile) \
     XX(close) \
     XX(fcntl) \
     XX(ioctl) \
@@ -82,8 +86,124 @@ struct timer_info {
     int cancelled = 0;
 };
 
-template<typename OriginFun, typename... Args>
-static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
+//io_uring后端: 不先尝试系统调用,直接提交请求,协程挂起到请求完成
+//prep填写sqe,返回false表示这次调用不走io_uring
+//不能走io_uring(prep返回false、队列满、内核返回EAGAIN)时返回false,由调用方走epoll的流程
+template<typename Prep>
+static bool do_uring(hr::IOManager* iom, hr::FdCtx::ptr ctx, int fd, Prep& prep,
+        uint32_t event, uint64_t to, ssize_t& n) {
+    uint32_t gen = ctx->getGeneration();
+    std::shared_ptr<timer_info> tinfo(new timer_info);
+    io_uring_sqe sqe;
+    while(true) {
+        memset(&sqe, 0, sizeof(sqe));
+        if(!prep(sqe)) {
+            return false;
+        }
+        hr::Timer::ptr timer;
+        std::weak_ptr<timer_info> winfo(tinfo);
+        if(to != (uint64_t)-1) {
+            //超时取消请求,请求以ECANCELED完成后协程才会醒来
+            timer = iom->addConditionTimer(to, [winfo, fd, iom, event]() {
+                auto t = winfo.lock();
+                if(!t || t->cancelled) {
+                    return;
+                }
+                t->cancelled = ETIMEDOUT;
+                iom->cancelEvent(fd, (hr::IOManager::Event)(event));
+            }, winfo);
+        }
+        int res = 0;
+        bool submitted = iom->submitIo(fd, (hr::IOManager::Event)(event), sqe, res);
+        if(timer) {
+            timer->cancel();
+        }
+        if(!submitted) {
+            return false;
+        }
+        //取消和完成同时发生时以完成的结果为准,数据已经读进缓冲区了
+        if(res >= 0) {
+            n = res;
+            return true;
+        }
+        if(res == -ECANCELED || res == -EINTR) {
+            if(tinfo->cancelled) {
+                errno = tinfo->cancelled;
+                n = -1;
+                return true;
+            }
+            if(ctx->isClose() || ctx->getGeneration() != gen) {
+                errno = EBADF;
+                n = -1;
+                return true;
+            }
+            //被cancelEvent/cancelAll取消,和epoll一样重新等待
+            continue;
+        }
+        if(res == -EAGAIN) {
+            return false;
+        }
+        errno = -res;
+        n = -1;
+        return true;
+    }
+}
+
+//不走io_uring的调用
+struct no_uring {
+    bool operator()(io_uring_sqe& sqe) const { return false;}
+};
+
+//读写类操作的sqe
+static bool prep_rw(io_uring_sqe& sqe, uint8_t opcode, int fd, const void* addr
+                    ,size_t len, uint32_t msg_flags = 0) {
+    //MSG_DONTWAIT要求不阻塞,io_uring会一直等到完成
+    if(len > 0x7fffffff || (msg_flags & MSG_DONTWAIT)) {
+        return false;
+    }
+    sqe.opcode = opcode;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)(uintptr_t)addr;
+    sqe.len = len;
+    //read/write的off为-1表示使用文件当前位置,收发类操作off和addr2共用,必须为0
+    if(opcode == IORING_OP_READ || opcode == IORING_OP_WRITE
+            || opcode == IORING_OP_READV || opcode == IORING_OP_WRITEV) {
+        sqe.off = (uint64_t)-1;
+    }
+    sqe.msg_flags = msg_flags;
+    return true;
+}
+
+//fd是否是FdManager管理的socket
+static bool is_socket(int fd) {
+    hr::FdCtx::ptr ctx = hr::FdMgr::GetInstance()->get(fd);
+    return ctx && ctx->isSocket();
+}
+
+//sendfile没有MSG_NOSIGNAL,调用期间在本线程屏蔽SIGPIPE,对端关闭时只返回EPIPE
+//屏蔽和恢复都在一次系统调用前后,中间不会切换协程
+static ssize_t sendfile_nosigpipe(int out_fd, int in_fd, off_t* offset, size_t count) {
+    sigset_t pipe_set;
+    sigset_t old_set;
+    sigset_t pending;
+    sigemptyset(&pipe_set);
+    sigaddset(&pipe_set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipe_set, &old_set);
+    sigpending(&pending);
+    bool was_pending = sigismember(&pending, SIGPIPE);
+    ssize_t rt = sendfile_f(out_fd, in_fd, offset, count);
+    if(rt < 0 && errno == EPIPE && !was_pending) {
+        //取走这次调用产生的SIGPIPE
+        struct timespec ts = {0, 0};
+        sigtimedwait(&pipe_set, nullptr, &ts);
+        errno = EPIPE;
+    }
+    pthread_sigmask(SIG_SETMASK, &old_set, nullptr);
+    return rt;
+}
+
+template<typename Prep, typename OriginFun, typename... Args>
+static ssize_t do_io(int fd, Prep prep, OriginFun fun, const char* hook_fun_name,
         uint32_t event, int timeout_so, Args&&... args) {
     if(!hr::t_hook_enable) {
         return fun(fd, std::forward<Args>(args)...);
@@ -107,8 +227,17 @@ static ssize_t do_io(int fd, OriginFun fun, const char* hook_fun_name,
     }
 
     uint64_t to = ctx->getTimeout(timeout_so);
+    uint32_t gen = ctx->getGeneration();
     std::shared_ptr<timer_info> tinfo(new timer_info);
 
+    hr::IOManager* uring_iom = hr::IOManager::GetThis();
+    if(uring_iom && uring_iom->isUring()) {
+        ssize_t n = 0;
+        if(do_uring(uring_iom, ctx, fd, prep, event, to, n)) {
+            return n;
+        }
+    }
+
 retry:
     ssize_t n = fun(fd, std::forward<Args>(args)...);
     while(n == -1 && errno == EINTR) {
@@ -134,7 +263,13 @@ retry:
         }
 
         int rt = iom->addEvent(fd, (hr::IOManager::Event)(event));
-        if(SYLAR_UNLIKELY(rt)) {
+        if(rt == 1) {
+            //持久注册模式下事件已经就绪,直接重试
+            if(timer) {
+                timer->cancel();
+            }
+            goto retry;
+        } else if(SYLAR_UNLIKELY(rt)) {
             HR_LOG_ERROR(g_logger) << hook_fun_name << " addEvent("
                 << fd << ", " << event << ")";
             if(timer) {
@@ -142,6 +277,10 @@ retry:
             }
             return -1;
         } else{
+            //注册时fd正好被关闭: close的cancelAll可能在注册之前,没有人会再触发这个事件
+            if(SYLAR_UNLIKELY(ctx->isClose() || ctx->getGeneration() != gen)) {
+                iom->cancelEvent(fd, (hr::IOManager::Event)(event));
+            }
             hr::Fiber::YieldToHold();
             if(timer) {
                 timer->cancel();
@@ -150,6 +289,11 @@ retry:
                 errno = tinfo->cancelled;
                 return -1;
             }
+            //等待期间fd被关闭,fd号可能已经分配给了别的句柄
+            if(ctx->isClose() || ctx->getGeneration() != gen) {
+                errno = EBADF;
+                return -1;
+            }
             goto retry;
         }
     }
@@ -162,44 +306,45 @@ extern "C" {
 #undef XX
 
 unsigned int sleep(unsigned int seconds) {
-    if(!hr::t_hook_enable) {
+    //普通的Scheduler没有定时器,直接睡眠
+    hr::IOManager* iom = hr::IOManager::GetThis();
+    if(!hr::t_hook_enable || !iom) {
         return sleep_f(seconds);
     }
 
     //初始化协程
     hr::Fiber::ptr fiber = hr::Fiber::GetThis();
-    hr::IOManager* iom = hr::IOManager::GetThis();
     iom->addTimer(seconds * 1000, std::bind((void(hr::Scheduler::*)
             (hr::Fiber::ptr, int thread))&hr::IOManager::schedule
-            ,iom, fiber, -1));
+            ,iom, fiber, hr::Scheduler::GetTaskThread()));
     hr::Fiber::YieldToHold();
     return 0;
 }
 
 int usleep(useconds_t usec) {
-    if(!hr::t_hook_enable) {
+    hr::IOManager* iom = hr::IOManager::GetThis();
+    if(!hr::t_hook_enable || !iom) {
         return usleep_f(usec);
     }
     hr::Fiber::ptr fiber = hr::Fiber::GetThis();
-    hr::IOManager* iom = hr::IOManager::GetThis();
     iom->addTimer(usec / 1000, std::bind((void(hr::Scheduler::*)
             (hr::Fiber::ptr, int thread))&hr::IOManager::schedule
-            ,iom, fiber, -1));
+            ,iom, fiber, hr::Scheduler::GetTaskThread()));
     hr::Fiber::YieldToHold();
     return 0;
 }
 
 int nanosleep(const struct timespec *req, struct timespec *rem) {
-    if(!hr::t_hook_enable) {
+    hr::IOManager* iom = hr::IOManager::GetThis();
+    if(!hr::t_hook_enable || !iom) {
         return nanosleep_f(req, rem);
     }
 
     int timeout_ms = req->tv_sec * 1000 + req->tv_nsec / 1000 /1000;
     hr::Fiber::ptr fiber = hr::Fiber::GetThis();
-    hr::IOManager* iom = hr::IOManager::GetThis();
     iom->addTimer(timeout_ms, std::bind((void(hr::Scheduler::*)
             (hr::Fiber::ptr, int thread))&hr::IOManager::schedule
-            ,iom, fiber, -1));
+            ,iom, fiber, hr::Scheduler::GetTaskThread()));
     hr::Fiber::YieldToHold();
     return 0;
 }
@@ -242,7 +387,26 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
         return connect_f(fd, addr, addrlen);
     }
 
-    int n = connect_f(fd, addr, addrlen);
+    int n = -1;
+    ssize_t un = 0;
+    hr::IOManager* uring_iom = hr::IOManager::GetThis();
+    auto prep = [=](io_uring_sqe& sqe) -> bool {
+        sqe.opcode = IORING_OP_CONNECT;
+        sqe.fd = fd;
+        sqe.addr = (uint64_t)(uintptr_t)addr;
+        sqe.off = addrlen;
+        return true;
+    };
+    //io_uring完成整个连接过程,超时由定时器取消请求;
+    //内核返回EINPROGRESS时连接已经发起,接着用epoll等待
+    if(uring_iom && uring_iom->isUring()
+            && do_uring(uring_iom, ctx, fd, prep, hr::IOManager::WRITE, timeout_ms, un)) {
+        if(un == 0 || errno != EINPROGRESS) {
+            return un;
+        }
+    } else {
+        n = connect_f(fd, addr, addrlen);
+    }
     if(n == 0) {
         return 0;
     } 
@@ -277,6 +441,11 @@ int connect_with_timeout(int fd, const struct sockaddr* addr, socklen_t addrlen,
             errno = tinfo->cancelled;
             return -1;
         }
+    } else if(rt == 1) {
+        //已经可写,连接已经完成
+        if(timer) {
+            timer->cancel();
+        }
     } else {
         if(timer) {
             timer->cancel();
@@ -326,51 +495,148 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 int accept(int s, struct sockaddr *addr, socklen_t *addrlen) {
-    int fd = do_io(s, accept_f, "accept", hr::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
+    auto prep = [=](io_uring_sqe& sqe) -> bool {
+        sqe.opcode = IORING_OP_ACCEPT;
+        sqe.fd = s;
+        sqe.addr = (uint64_t)(uintptr_t)addr;
+        sqe.addr2 = (uint64_t)(uintptr_t)addrlen;
+        return true;
+    };
+    int fd = do_io(s, prep, accept_f, "accept", hr::IOManager::READ, SO_RCVTIMEO, addr, addrlen);
     if(fd >= 0) {
         hr::FdMgr::GetInstance()->get(fd, true);
     }
     return fd;
 }
 
+int accept4(int s, struct sockaddr *addr, socklen_t *addrlen, int flags) {
+    auto prep = [=](io_uring_sqe& sqe) -> bool {
+        sqe.opcode = IORING_OP_ACCEPT;
+        sqe.fd = s;
+        sqe.addr = (uint64_t)(uintptr_t)addr;
+        sqe.addr2 = (uint64_t)(uintptr_t)addrlen;
+        sqe.accept_flags = flags;
+        return true;
+    };
+    int fd = do_io(s, prep, accept4_f, "accept4", hr::IOManager::READ, SO_RCVTIMEO, addr, addrlen, flags);
+    if(fd >= 0) {
+        //SOCK_NONBLOCK接收的一定是非阻塞socket,不用再fstat和fcntl
+        hr::FdMgr::GetInstance()->get(fd, true, flags & SOCK_NONBLOCK);
+    }
+    return fd;
+}
+
 ssize_t read(int fd, void *buf, size_t count) {
-    return do_io(fd, read_f, "read", hr::IOManager::READ, SO_RCVTIMEO, buf, count);
+    auto prep = [=](io_uring_sqe& sqe) {
+        return prep_rw(sqe, IORING_OP_READ, fd, buf, count);
+    };
+    return do_io(fd, prep, read_f, "read", hr::IOManager::READ, SO_RCVTIMEO, buf, count);
 }
 
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, readv_f, "readv", hr::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
+    auto prep = [=](io_uring_sqe& sqe) {
+        return iovcnt >= 0 && prep_rw(sqe, IORING_OP_READV, fd, iov, iovcnt);
+    };
+    return do_io(fd, prep, readv_f, "readv", hr::IOManager::READ, SO_RCVTIMEO, iov, iovcnt);
 }
 
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
-    return do_io(sockfd, recv_f, "recv", hr::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
+    auto prep = [=](io_uring_sqe& sqe) {
+        return prep_rw(sqe, IORING_OP_RECV, sockfd, buf, len, flags);
+    };
+    return do_io(sockfd, prep, recv_f, "recv", hr::IOManager::READ, SO_RCVTIMEO, buf, len, flags);
 }
 
 ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags, struct sockaddr *src_addr, socklen_t *addrlen) {
-    return do_io(sockfd, recvfrom_f, "recvfrom", hr::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    //io_uring没有recvfrom,用recvmsg代替
+    iovec iov;
+    iov.iov_base = buf;
+    iov.iov_len = len;
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = src_addr;
+    msg.msg_namelen = (src_addr && addrlen) ? *addrlen : 0;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    socklen_t old_len = msg.msg_namelen;
+    auto prep = [&](io_uring_sqe& sqe) {
+        return prep_rw(sqe, IORING_OP_RECVMSG, sockfd, &msg, 1, flags);
+    };
+    ssize_t n = do_io(sockfd, prep, recvfrom_f, "recvfrom", hr::IOManager::READ, SO_RCVTIMEO, buf, len, flags, src_addr, addrlen);
+    //走io_uring时地址长度写在msg里,recvfrom_f直接写*addrlen,没有被改写的一方还是原来的值
+    if(n >= 0 && src_addr && addrlen && *addrlen == old_len) {
+        *addrlen = msg.msg_namelen;
+    }
+    return n;
 }
 
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
-    return do_io(sockfd, recvmsg_f, "recvmsg", hr::IOManager::READ, SO_RCVTIMEO, msg, flags);
+    auto prep = [=](io_uring_sqe& sqe) {
+        return prep_rw(sqe, IORING_OP_RECVMSG, sockfd, msg, 1, flags);
+    };
+    return do_io(sockfd, prep, recvmsg_f, "recvmsg", hr::IOManager::READ, SO_RCVTIMEO, msg, flags);
 }
 
 ssize_t write(int fd, const void *buf, size_t count) {
-    return do_io(fd, write_f, "write", hr::IOManager::WRITE, SO_SNDTIMEO, buf, count);
+    if(is_socket(fd)) {
+        //socket上的write等同于send,加上MSG_NOSIGNAL,对端关闭时返回EPIPE而不是收到SIGPIPE
+        //SSL_write等通过write写socket的也不会收到SIGPIPE
+        return send(fd, buf, count, MSG_NOSIGNAL);
+    }
+    auto prep = [=](io_uring_sqe& sqe) {
+        return prep_rw(sqe, IORING_OP_WRITE, fd, buf, count);
+    };
+    return do_io(fd, prep, write_f, "write", hr::IOManager::WRITE, SO_SNDTIMEO, buf, count);
 }
 
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
-    return do_io(fd, writev_f, "writev", hr::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
+    if(iovcnt >= 0 && is_socket(fd)) {
+        //同write,改用sendmsg加上MSG_NOSIGNAL
+        msghdr mh;
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov = (iovec*)iov;
+        mh.msg_iovlen = iovcnt;
+        return sendmsg(fd, &mh, MSG_NOSIGNAL);
+    }
+    auto prep = [=](io_uring_sqe& sqe) {
+        return iovcnt >= 0 && prep_rw(sqe, IORING_OP_WRITEV, fd, iov, iovcnt);
+    };
+    return do_io(fd, prep, writev_f, "writev", hr::IOManager::WRITE, SO_SNDTIMEO, iov, iovcnt);
 }
 
 ssize_t send(int s, const void *msg, size_t len, int flags) {
-    return do_io(s, send_f, "send", hr::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
+    auto prep = [=](io_uring_sqe& sqe) {
+        return prep_rw(sqe, IORING_OP_SEND, s, msg, len, flags);
+    };
+    return do_io(s, prep, send_f, "send", hr::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags);
 }
 
 ssize_t sendto(int s, const void *msg, size_t len, int flags, const struct sockaddr *to, socklen_t tolen) {
-    return do_io(s, sendto_f, "sendto", hr::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
+    //io_uring没有sendto,用sendmsg代替
+    iovec iov;
+    iov.iov_base = (void*)msg;
+    iov.iov_len = len;
+    msghdr mh;
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_name = (void*)to;
+    mh.msg_namelen = to ? tolen : 0;
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    auto prep = [&](io_uring_sqe& sqe) {
+        return prep_rw(sqe, IORING_OP_SENDMSG, s, &mh, 1, flags);
+    };
+    return do_io(s, prep, sendto_f, "sendto", hr::IOManager::WRITE, SO_SNDTIMEO, msg, len, flags, to, tolen);
 }
 
 ssize_t sendmsg(int s, const struct msghdr *msg, int flags) {
-    return do_io(s, sendmsg_f, "sendmsg", hr::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+    auto prep = [=](io_uring_sqe& sqe) {
+        return prep_rw(sqe, IORING_OP_SENDMSG, s, msg, 1, flags);
+    };
+    return do_io(s, prep, sendmsg_f, "sendmsg", hr::IOManager::WRITE, SO_SNDTIMEO, msg, flags);
+}
+
+ssize_t sendfile(int out_fd, int in_fd, off_t* offset, size_t count) {
+    return do_io(out_fd, no_uring(), sendfile_nosigpipe, "sendfile", hr::IOManager::WRITE, SO_SNDTIMEO, in_fd, offset, count);
 }
 
 int close(int fd) {
@@ -380,12 +646,13 @@ int close(int fd) {
 
     hr::FdCtx::ptr ctx = hr::FdMgr::GetInstance()->get(fd);
     if(ctx) {
+        //先标记关闭,被唤醒的协程看到关闭直接返回EBADF,不会重新注册事件
+        hr::FdMgr::GetInstance()->del(fd);
         //取消fd上监听的所有事件会触发一次回调
         auto iom = hr::IOManager::GetThis();
         if(iom) {
             iom->cancelAll(fd);
         }
-        hr::FdMgr::GetInstance()->del(fd);
     }
     return close_f(fd);
 }
@@ -7,6 +7,7 @@
 #include <sys/ioctl.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
 #include <stdint.h>
 #include <unistd.h>
 
@@ -39,6 +40,9 @@ extern connect_fun connect_f;
 typedef int (*accept_fun)(int s, struct sockaddr *addr, socklen_t *addrlen);
 extern accept_fun accept_f;
 
+typedef int (*accept4_fun)(int s, struct sockaddr *addr, socklen_t *addrlen, int flags);
+extern accept4_fun accept4_f;
+
 //read
 typedef ssize_t (*read_fun)(int fd, void *buf, size_t count);
 extern read_fun read_f;
@@ -71,6 +75,9 @@ extern sendto_fun sendto_f;
 typedef ssize_t (*sendmsg_fun)(int s, const struct msghdr *msg, int flags);
 extern sendmsg_fun sendmsg_f;
 
+typedef ssize_t (*sendfile_fun)(int out_fd, int in_fd, off_t* offset, size_t count);
+extern sendfile_fun sendfile_f;
+
 typedef int (*close_fun)(int fd);
 extern close_fun close_f;
 
@@ -1,5 +1,10 @@
 #include "http.h"
+#include "multipart.h"
 #include "../util.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace hr {
 namespace http {
@@ -55,6 +60,191 @@ bool CaseInsensitiveLess::operator()(const std::string& lhs
     return strcasecmp(lhs.c_str(), rhs.c_str()) < 0;
 }
 
+//和HttpHeaders::Known的顺序一致
+static const char* s_known_headers[] = {
+    "host",
+    "content-length",
+    "content-type",
+    "connection",
+    "cookie",
+    "transfer-encoding",
+    "upgrade"
+};
+
+static uint8_t KnownHeader(const char* key, size_t len, uint32_t hash) {
+    static uint32_t s_hashs[HttpHeaders::KNOWN_COUNT] = {0};
+    static bool s_init = [](){
+        for(int i = 0; i < HttpHeaders::KNOWN_COUNT; ++i) {
+            s_hashs[i] = HttpHeaders::Hash(s_known_headers[i], strlen(s_known_headers[i]));
+        }
+        return true;
+    }();
+    (void)s_init;
+    for(int i = 0; i < HttpHeaders::KNOWN_COUNT; ++i) {
+        if(s_hashs[i] == hash && strlen(s_known_headers[i]) == len
+                && strncasecmp(s_known_headers[i], key, len) == 0) {
+            return i;
+        }
+    }
+    return HttpHeaders::UNKNOWN;
+}
+
+HttpHeaders::HttpHeaders() {
+    memset(m_known, 0, sizeof(m_known));
+}
+
+uint32_t HttpHeaders::Hash(const char* key, size_t len) {
+    //FNV-1a, |0x20把大写字母转成小写,头部名字里其他字符的碰撞由比较名字处理
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < len; ++i) {
+        hash ^= (uint8_t)(key[i] | 0x20);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+StringPiece HttpHeaders::name(size_t i) const {
+    const Field& f = at(i);
+    return StringPiece(f.ownName ? m_arena.data() + f.name : (const char*)f.name, f.nameLen);
+}
+
+StringPiece HttpHeaders::value(size_t i) const {
+    const Field& f = at(i);
+    return StringPiece(f.ownValue ? m_arena.data() + f.value : (const char*)f.value, f.valueLen);
+}
+
+int HttpHeaders::find(const char* key, size_t len) const {
+    uint32_t hash = Hash(key, len);
+    for(size_t i = 0; i < m_size; ++i) {
+        const Field& f = at(i);
+        if(f.hash == hash && f.nameLen == len
+                && strncasecmp(name(i).data, key, len) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+HttpHeaders::Field& HttpHeaders::slot(const char* key, size_t len, uint32_t hash, bool& created) {
+    int idx = find(key, len);
+    if(idx >= 0) {
+        created = false;
+        Field& f = at(idx);
+        if(f.ownValue) {
+            release(f.valueLen);
+        }
+        return f;
+    }
+    created = true;
+    if(m_size >= INLINE_SIZE) {
+        m_overflow.push_back(Field());
+    }
+    Field& f = at(m_size++);
+    f = Field();
+    f.hash = hash;
+    f.known = KnownHeader(key, len, hash);
+    if(f.known != UNKNOWN) {
+        m_known[f.known] = m_size;
+    }
+    return f;
+}
+
+uintptr_t HttpHeaders::store(const char* str, size_t len) {
+    uintptr_t offset = m_arena.size();
+    m_arena.append(str, len);
+    return offset;
+}
+
+void HttpHeaders::release(size_t len) {
+    m_waste += len;
+}
+
+void HttpHeaders::compact() {
+    std::string arena;
+    arena.reserve(m_arena.size() - m_waste);
+    for(size_t i = 0; i < m_size; ++i) {
+        Field& f = at(i);
+        if(f.ownName) {
+            uintptr_t offset = arena.size();
+            arena.append(m_arena, f.name, f.nameLen);
+            f.name = offset;
+        }
+        if(f.ownValue) {
+            uintptr_t offset = arena.size();
+            arena.append(m_arena, f.value, f.valueLen);
+            f.value = offset;
+        }
+    }
+    m_arena.swap(arena);
+    m_waste = 0;
+}
+
+void HttpHeaders::set(const std::string& key, const std::string& val) {
+    bool created = false;
+    Field& f = slot(key.c_str(), key.size(), Hash(key.c_str(), key.size()), created);
+    if(created) {
+        f.ownName = true;
+        f.name = store(key.c_str(), key.size());
+        f.nameLen = key.size();
+    }
+    f.ownValue = true;
+    f.value = store(val.c_str(), val.size());
+    f.valueLen = val.size();
+    if(m_waste > 1024 && m_waste * 2 > m_arena.size()) {
+        compact();
+    }
+}
+
+void HttpHeaders::setView(const char* key, size_t klen, const char* val, size_t vlen) {
+    bool created = false;
+    Field& f = slot(key, klen, Hash(key, klen), created);
+    if(created) {
+        f.name = (uintptr_t)key;
+        f.nameLen = klen;
+    }
+    f.ownValue = false;
+    f.value = (uintptr_t)val;
+    f.valueLen = vlen;
+}
+
+bool HttpHeaders::del(const std::string& key) {
+    int idx = find(key);
+    if(idx < 0) {
+        return false;
+    }
+    Field& f = at(idx);
+    if(f.ownName) {
+        release(f.nameLen);
+    }
+    if(f.ownValue) {
+        release(f.valueLen);
+    }
+    for(size_t i = idx + 1; i < m_size; ++i) {
+        at(i - 1) = at(i);
+    }
+    --m_size;
+    if(m_size >= INLINE_SIZE) {
+        m_overflow.pop_back();
+    }
+    for(int i = 0; i < KNOWN_COUNT; ++i) {
+        if(m_known[i] == (uint32_t)idx + 1) {
+            m_known[i] = 0;
+        } else if(m_known[i] > (uint32_t)idx + 1) {
+            --m_known[i];
+        }
+    }
+    return true;
+}
+
+void HttpHeaders::clear() {
+    m_size = 0;
+    m_overflow.clear();
+    memset(m_known, 0, sizeof(m_known));
+    m_arena.clear();
+    m_waste = 0;
+    m_holder.reset();
+}
+
 HttpRequest::HttpRequest(uint8_t version, bool close)
     :m_method(HttpMethod::GET)
     ,m_version(version)
@@ -64,10 +254,25 @@ HttpRequest::HttpRequest(uint8_t version, bool close)
     ,m_path("/") {
 }
 
+void HttpRequest::setBodyView(const char* data, size_t len, std::shared_ptr<char> holder) {
+    m_body.clear();
+    m_bodyView = data;
+    m_bodySize = len;
+    m_bodyHolder = holder;
+    clearParamViews(0x2);
+}
+
+const std::string& HttpRequest::getBody() const {
+    if(m_bodyHolder && m_body.size() != m_bodySize) {
+        m_body.assign(m_bodyView, m_bodySize);
+    }
+    return m_body;
+}
+
 std::string HttpRequest::getHeader(const std::string& key
                             ,const std::string& def) const {
-    auto it = m_headers.find(key);
-    return it == m_headers.end() ? def : it->second;
+    StringPiece val;
+    return m_headers.get(key, val) ? val.toString() : def;
 }
 
 std::shared_ptr<HttpResponse> HttpRequest::createResponse() {
@@ -80,8 +285,32 @@ std::string HttpRequest::getParam(const std::string& key
                             ,const std::string& def) {
     initQueryParam();
     initBodyParam();
-    auto it = m_params.find(key);
-    return it == m_params.end() ? def : it->second;
+    StringPiece val;
+    return findParam(key, val) ? val.toString() : def;
+}
+
+const HttpRequest::MapType& HttpRequest::getParams() const {
+    for(auto& i : m_paramViews) {
+        if(!i.deleted) {
+            m_params.insert(std::make_pair(i.getKey().toString(), i.getValue().toString()));
+        }
+    }
+    return m_params;
+}
+
+const std::vector<MultipartPart::ptr>& HttpRequest::getFiles() {
+    initBodyParam();
+    return m_files;
+}
+
+MultipartPart::ptr HttpRequest::getFile(const std::string& name) {
+    initBodyParam();
+    for(auto& i : m_files) {
+        if(i->getName() == name) {
+            return i;
+        }
+    }
+    return nullptr;
 }
 
 std::string HttpRequest::getCookie(const std::string& key
@@ -92,7 +321,7 @@ std::string HttpRequest::getCookie(const std::string& key
 }
 
 void HttpRequest::setHeader(const std::string& key, const std::string& val) {
-    m_headers[key] = val;
+    m_headers.set(key, val);
 }
 
 void HttpRequest::setParam(const std::string& key, const std::string& val) {
@@ -104,11 +333,17 @@ void HttpRequest::setCookie(const std::string& key, const std::string& val) {
 }
 
 void HttpRequest::delHeader(const std::string& key) {
-    m_headers.erase(key);
+    m_headers.del(key);
 }
 
 void HttpRequest::delParam(const std::string& key) {
     m_params.erase(key);
+    for(auto& i : m_paramViews) {
+        StringPiece k = i.getKey();
+        if(k.size == key.size() && strncasecmp(k.data, key.c_str(), k.size) == 0) {
+            i.deleted = true;
+        }
+    }
 }
 
 void HttpRequest::delCookie(const std::string& key) {
@@ -116,12 +351,12 @@ void HttpRequest::delCookie(const std::string& key) {
 }
 
 bool HttpRequest::hasHeader(const std::string& key, std::string* val) {
-    auto it = m_headers.find(key);
-    if(it == m_headers.end()) {
+    StringPiece str;
+    if(!m_headers.get(key, str)) {
         return false;
     }
     if(val) {
-        *val = it->second;
+        val->assign(str.data, str.size);
     }
     return true;
 }
@@ -129,12 +364,12 @@ bool HttpRequest::hasHeader(const std::string& key, std::string* val) {
 bool HttpRequest::hasParam(const std::string& key, std::string* val) {
     initQueryParam();
     initBodyParam();
-    auto it = m_params.find(key);
-    if(it == m_params.end()) {
+    StringPiece str;
+    if(!findParam(key, str)) {
         return false;
     }
     if(val) {
-        *val = it->second;
+        val->assign(str.data, str.size);
     }
     return true;
 }
@@ -176,16 +411,20 @@ std::ostream& HttpRequest::dump(std::ostream& os) const {
     if(!m_websocket) {
         os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
     }
-    for(auto& i : m_headers) {
-        if(!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
+    int conn = m_websocket ? -1 : m_headers.find(HttpHeaders::CONNECTION);
+    for(size_t i = 0; i < m_headers.size(); ++i) {
+        if((int)i == conn) {
             continue;
         }
-        os << i.first << ": " << i.second << "\r\n";
+        StringPiece name = m_headers.name(i);
+        StringPiece value = m_headers.value(i);
+        os.write(name.data, name.size) << ": ";
+        os.write(value.data, value.size) << "\r\n";
     }
 
-    if(!m_body.empty()) {
-        os << "content-length: " << m_body.size() << "\r\n\r\n"
-           << m_body;
+    if(getBodySize()) {
+        os << "content-length: " << getBodySize() << "\r\n\r\n";
+        os.write(getBodyData(), getBodySize());
     } else {
         os << "\r\n";
     }
@@ -193,13 +432,9 @@ std::ostream& HttpRequest::dump(std::ostream& os) const {
 }
 
 void HttpRequest::init() {
-    std::string conn = getHeader("connection");
-    if(!conn.empty()) {
-        if(strcasecmp(conn.c_str(), "keep-alive") == 0) {
-            m_close = false;
-        } else {
-            m_close = true;
-        }
+    StringPiece conn;
+    if(m_headers.get(HttpHeaders::CONNECTION, conn) && !conn.empty()) {
+        m_close = !conn.equalsIgnoreCase("keep-alive");
     }
 }
 
@@ -209,57 +444,206 @@ void HttpRequest::initParam() {
     initCookies();
 }
 
+//解析 k1=v1&k2=v2, 用memchr找分隔符,只扫描一遍,不复制
+//没有=的部分当做值为空
+template<class CB>
+static void ParseUrlEncoded(const char* data, size_t len, char sep, CB cb) {
+    const char* end = data + len;
+    while(data < end) {
+        const char* next = (const char*)memchr(data, sep, end - data);
+        if(!next) {
+            next = end;
+        }
+        const char* eq = (const char*)memchr(data, '=', next - data);
+        if(!eq) {
+            eq = next;
+        }
+        if(eq > data) {
+            cb(data, eq - data, eq == next ? next : eq + 1
+               ,eq == next ? 0 : next - eq - 1);
+        }
+        data = next + 1;
+    }
+}
+
+static bool NeedUrlDecode(const char* str, size_t len) {
+    return memchr(str, '%', len) || memchr(str, '+', len);
+}
+
+StringPiece HttpRequest::ParamView::getKey() const {
+    return ownKey ? StringPiece(keyBuf.data(), keyBuf.size()) : StringPiece(key, keyLen);
+}
+
+StringPiece HttpRequest::ParamView::getValue() {
+    if(!decoded) {
+        decoded = true;
+        if(!ownValue && NeedUrlDecode(value, valueLen)) {
+            hr::StringUtil::UrlDecode(value, valueLen, valueBuf);
+            ownValue = true;
+        }
+    }
+    return ownValue ? StringPiece(valueBuf.data(), valueBuf.size()) : StringPiece(value, valueLen);
+}
+
+bool HttpRequest::findParam(const std::string& key, StringPiece& val) const {
+    auto it = m_params.find(key);
+    if(it != m_params.end()) {
+        val = StringPiece(it->second.data(), it->second.size());
+        return true;
+    }
+    for(auto& i : m_paramViews) {
+        if(i.deleted) {
+            continue;
+        }
+        StringPiece k = i.getKey();
+        if(k.size == key.size() && strncasecmp(k.data, key.c_str(), k.size) == 0) {
+            val = i.getValue();
+            return true;
+        }
+    }
+    return false;
+}
+
+void HttpRequest::addParamView(const char* key, size_t klen, const char* val, size_t vlen, uint8_t source) {
+    if(m_paramViews.empty()) {
+        m_paramViews.reserve(16);
+    }
+    m_paramViews.push_back(ParamView());
+    ParamView& p = m_paramViews.back();
+    if(NeedUrlDecode(key, klen)) {
+        hr::StringUtil::UrlDecode(key, klen, p.keyBuf);
+        p.ownKey = true;
+    } else {
+        p.key = key;
+        p.keyLen = klen;
+    }
+    p.value = val;
+    p.valueLen = vlen;
+    p.source = source;
+}
+
+void HttpRequest::clearParamViews(uint8_t source) {
+    if(!(m_parserParamFlag & source)) {
+        return;
+    }
+    m_parserParamFlag &= ~source;
+    m_paramViews.erase(std::remove_if(m_paramViews.begin(), m_paramViews.end()
+                ,[source](const ParamView& p) {
+                    return p.source == source;
+                }), m_paramViews.end());
+    if(source == 0x2) {
+        m_files.clear();
+        m_parserParamFlag &= ~0x18;
+    }
+}
+
 void HttpRequest::initQueryParam() {
     if(m_parserParamFlag & 0x1) {
         return;
     }
-
-#define PARSE_PARAM(str, m, flag, trim) \
-    size_t pos = 0; \
-    do { \
-        size_t last = pos; \
-        pos = str.find('=', pos); \
-        if(pos == std::string::npos) { \
-            break; \
-        } \
-        size_t key = pos; \
-        pos = str.find(flag, pos); \
-        m.insert(std::make_pair(trim(str.substr(last, key - last)), \
-                    hr::StringUtil::UrlDecode(str.substr(key + 1, pos - key - 1)))); \
-        if(pos == std::string::npos) { \
-            break; \
-        } \
-        ++pos; \
-    } while(true);
-
-    PARSE_PARAM(m_query, m_params, '&',);
     m_parserParamFlag |= 0x1;
+    ParseUrlEncoded(m_query.data(), m_query.size(), '&'
+            ,[this](const char* k, size_t klen, const char* v, size_t vlen) {
+        addParamView(k, klen, v, vlen, 0x1);
+    });
 }
 
 void HttpRequest::initBodyParam() {
     if(m_parserParamFlag & 0x2) {
         return;
     }
-    std::string content_type = getHeader("content-type");
-    if(strcasestr(content_type.c_str(), "application/x-www-form-urlencoded") == nullptr) {
+    StringPiece type;
+    //流式的消息体不在这里读,由处理函数自己读或者调用parseMultipart
+    if(m_bodyStream || !getBodySize()
+            || !m_headers.get(HttpHeaders::CONTENT_TYPE, type)) {
+        m_parserParamFlag |= 0x2;
+        return;
+    }
+    std::string content_type = type.toString();
+    if(!strcasestr(content_type.c_str(), "application/x-www-form-urlencoded")) {
+        parseMultipart();
         m_parserParamFlag |= 0x2;
         return;
     }
-    PARSE_PARAM(m_body, m_params, '&',);
     m_parserParamFlag |= 0x2;
+    //消息体是视图或者m_body,请求存在期间不会移动
+    ParseUrlEncoded(getBodyData(), getBodySize(), '&'
+            ,[this](const char* k, size_t klen, const char* v, size_t vlen) {
+        addParamView(k, klen, v, vlen, 0x2);
+    });
+}
+
+bool HttpRequest::parseMultipart() {
+    if(m_parserParamFlag & 0x8) {
+        //流只能读一次,重复调用返回第一次的结果
+        return !(m_parserParamFlag & 0x10);
+    }
+    StringPiece type;
+    if(!m_headers.get(HttpHeaders::CONTENT_TYPE, type)) {
+        return false;
+    }
+    std::string boundary = MultipartParser::GetBoundary(type.toString());
+    if(boundary.empty()) {
+        return false;
+    }
+    clearParamViews(0x2);
+    m_parserParamFlag |= 0x2 | 0x8;
+    MultipartParser parser(boundary);
+    bool ok = true;
+    if(m_bodyStream) {
+        //边收边解析,大文件直接写入临时文件
+        std::string buf;
+        buf.resize(64 * 1024);
+        int rt = 0;
+        while((rt = m_bodyStream->read(&buf[0], buf.size())) > 0) {
+            if(!parser.execute(buf.data(), rt)) {
+                break;
+            }
+        }
+        ok = rt == 0;
+    } else {
+        ok = parser.execute(getBodyData(), getBodySize());
+    }
+    if(!ok || !parser.isFinished()) {
+        //格式错误、超过上限或者消息体不完整,已经解析的部分也不用
+        m_parserParamFlag |= 0x10;
+        return false;
+    }
+    for(auto& i : parser.getParts()) {
+        if(i->isFile()) {
+            m_files.push_back(i);
+            continue;
+        }
+        //普通字段作为参数
+        m_paramViews.push_back(ParamView());
+        ParamView& p = m_paramViews.back();
+        p.keyBuf = i->getName();
+        p.valueBuf = i->getData();
+        p.ownKey = p.ownValue = p.decoded = true;
+        p.source = 0x2;
+    }
+    return true;
 }
 
 void HttpRequest::initCookies() {
     if(m_parserParamFlag & 0x4) {
         return;
     }
-    std::string cookie = getHeader("cookie");
-    if(cookie.empty()) {
-        m_parserParamFlag |= 0x4;
+    m_parserParamFlag |= 0x4;
+    StringPiece cookie;
+    if(!m_headers.get(HttpHeaders::COOKIE, cookie)) {
         return;
     }
-    PARSE_PARAM(cookie, m_cookies, ';', hr::StringUtil::Trim);
-    m_parserParamFlag |= 0x4;
+    ParseUrlEncoded(cookie.data, cookie.size, ';'
+            ,[this](const char* k, size_t klen, const char* v, size_t vlen) {
+        std::string key = hr::StringUtil::Trim(std::string(k, klen));
+        if(key.empty()) {
+            return;
+        }
+        std::string val;
+        hr::StringUtil::UrlDecode(v, vlen, val);
+        m_cookies.insert(std::make_pair(key, val));
+    });
 }
 
 
@@ -267,20 +651,21 @@ HttpResponse::HttpResponse(uint8_t version, bool close)
     :m_status(HttpStatus::OK)
     ,m_version(version)
     ,m_close(close)
-    ,m_websocket(false) {
+    ,m_websocket(false)
+    ,m_stream(false) {
 }
 
 std::string HttpResponse::getHeader(const std::string& key, const std::string& def) const {
-    auto it = m_headers.find(key);
-    return it == m_headers.end() ? def : it->second;
+    StringPiece val;
+    return m_headers.get(key, val) ? val.toString() : def;
 }
 
 void HttpResponse::setHeader(const std::string& key, const std::string& val) {
-    m_headers[key] = val;
+    m_headers.set(key, val);
 }
 
 void HttpResponse::delHeader(const std::string& key) {
-    m_headers.erase(key);
+    m_headers.del(key);
 }
 
 void HttpResponse::setRedirect(const std::string& uri) {
@@ -315,34 +700,101 @@ std::string HttpResponse::toString() const {
     return ss.str();
 }
 
-std::ostream& HttpResponse::dump(std::ostream& os) const {
-    os << "HTTP/"
-       << ((uint32_t)(m_version >> 4))
-       << "."
-       << ((uint32_t)(m_version & 0x0F))
-       << " "
-       << (uint32_t)m_status
-       << " "
-       << (m_reason.empty() ? HttpStatusToString(m_status) : m_reason)
-       << "\r\n";
+HttpResponse::BodyFile::~BodyFile() {
+    if(fd >= 0) {
+        close(fd);
+    }
+}
+
+bool HttpResponse::setBodyFile(const std::string& path, uint64_t offset, uint64_t length) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return false;
+    }
+    std::shared_ptr<BodyFile> file(new BodyFile);
+    file->fd = fd;
+    struct stat st;
+    if(fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    uint64_t size = st.st_size;
+    file->offset = std::min(offset, size);
+    file->length = std::min(length, size - file->offset);
+    m_body.clear();
+    m_bodyFile = file;
+    return true;
+}
 
-    for(auto& i : m_headers) {
-        if(!m_websocket && strcasecmp(i.first.c_str(), "connection") == 0) {
+void HttpResponse::dumpHeader(std::string& out) const {
+    out.append("HTTP/");
+    out.append(1, '0' + (m_version >> 4));
+    out.append(1, '.');
+    out.append(1, '0' + (m_version & 0x0F));
+    out.append(1, ' ');
+    out.append(std::to_string((uint32_t)m_status));
+    out.append(1, ' ');
+    if(m_reason.empty()) {
+        out.append(HttpStatusToString(m_status));
+    } else {
+        out.append(m_reason);
+    }
+    out.append("\r\n");
+
+    uint64_t length = getBodyLength();
+    bool has_length = !m_stream && (length || (!m_websocket && (uint32_t)m_status >= 200
+            && m_status != HttpStatus::NO_CONTENT
+            && m_status != HttpStatus::NOT_MODIFIED));
+    bool chunked = m_stream && m_version >= 0x11;
+    int conn = m_websocket ? -1 : m_headers.find(HttpHeaders::CONNECTION);
+    //content-length按实际的消息体输出,流式发送时不输出
+    int clen = has_length || m_stream ? m_headers.find(HttpHeaders::CONTENT_LENGTH) : -1;
+    int te = chunked ? m_headers.find(HttpHeaders::TRANSFER_ENCODING) : -1;
+    for(size_t i = 0; i < m_headers.size(); ++i) {
+        if((int)i == conn || (int)i == clen || (int)i == te) {
             continue;
         }
-        os << i.first << ": " << i.second << "\r\n";
+        StringPiece name = m_headers.name(i);
+        StringPiece value = m_headers.value(i);
+        out.append(name.data, name.size).append(": ")
+           .append(value.data, value.size).append("\r\n");
     }
     for(auto& i : m_cookies) {
-        os << "Set-Cookie: " << i << "\r\n";
+        out.append("Set-Cookie: ").append(i).append("\r\n");
     }
     if(!m_websocket) {
-        os << "connection: " << (m_close ? "close" : "keep-alive") << "\r\n";
+        out.append(m_close ? "connection: close\r\n" : "connection: keep-alive\r\n");
     }
+    if(has_length) {
+        //长连接和pipeline时客户端靠content-length找到响应的结尾
+        out.append("content-length: ").append(std::to_string(length)).append("\r\n");
+    } else if(chunked) {
+        out.append("transfer-encoding: chunked\r\n");
+    }
+    out.append("\r\n");
+}
+
+std::ostream& HttpResponse::dump(std::ostream& os) const {
+    std::string header;
+    dumpHeader(header);
+    os << header;
     if(!m_body.empty()) {
-        os << "content-length: " << m_body.size() << "\r\n\r\n"
-           << m_body;
-    } else {
-        os << "\r\n";
+        os << m_body;
+    } else if(m_bodyFile) {
+        //发送走sendfile，这里读出文件内容，保证toString的结果是完整的响应
+        char buf[16 * 1024];
+        uint64_t offset = m_bodyFile->offset;
+        uint64_t end = offset + m_bodyFile->length;
+        while(offset < end) {
+            ssize_t rt = pread(m_bodyFile->fd, buf, std::min(end - offset, (uint64_t)sizeof(buf)), offset);
+            if(rt < 0 && errno == EINTR) {
+                continue;
+            }
+            if(rt <= 0) {
+                break;
+            }
+            os.write(buf, rt);
+            offset += rt;
+        }
     }
     return os;
 }
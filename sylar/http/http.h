@@ -5,11 +5,13 @@
 
 #include <memory>
 #include <string>
+#include <string.h>
 #include <map>
 #include <vector>
 #include <iostream>
 #include <sstream>
 #include <boost/lexical_cast.hpp>
+#include "sylar/stream.h"
 
 namespace hr {
 
@@ -175,6 +177,134 @@ struct CaseInsensitiveLess {
     bool operator()(const std::string& lhs, const std::string& rhs) const;
 };
 
+/**
+ * @brief 字符串片段,只引用外部内存,不持有
+ */
+struct StringPiece {
+    StringPiece(const char* d = "", size_t s = 0)
+        :data(d), size(s) {}
+
+    std::string toString() const { return std::string(data, size);}
+    bool empty() const { return size == 0;}
+    /// 忽略大小写比较
+    bool equalsIgnoreCase(const char* str) const {
+        return strlen(str) == size && strncasecmp(data, str, size) == 0;
+    }
+
+    const char* data;
+    size_t size;
+};
+
+/**
+ * @brief HTTP头部容器
+ * @details 头部按添加顺序放在小数组里,前INLINE_SIZE个不需要额外分配内存.
+ *          名字预先计算忽略大小写的hash,查找时先比较hash.
+ *          常用头部(Known)记录下标,直接访问.
+ *          值可以引用外部内存(setView),外部内存由holder保证有效;
+ *          其他名字和值复制到内部的连续内存中.
+ *          同名头部后设置的覆盖先设置的.
+ */
+class HttpHeaders {
+public:
+    /// 常用头部
+    enum Known {
+        HOST = 0,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        CONNECTION,
+        COOKIE,
+        TRANSFER_ENCODING,
+        UPGRADE,
+        KNOWN_COUNT,
+        UNKNOWN = 0xFF
+    };
+
+    /// 内嵌存储的头部个数
+    static const size_t INLINE_SIZE = 16;
+
+    HttpHeaders();
+
+    /// 头部个数
+    size_t size() const { return m_size;}
+    bool empty() const { return m_size == 0;}
+
+    /// 第i个头部的名字(保持设置时的大小写)
+    StringPiece name(size_t i) const;
+    /// 第i个头部的值
+    StringPiece value(size_t i) const;
+
+    /**
+     * @brief 查找头部,名字忽略大小写
+     * @return 返回下标,不存在返回-1
+     */
+    int find(const char* key, size_t len) const;
+    int find(const std::string& key) const { return find(key.c_str(), key.size());}
+    int find(Known k) const { return (int)m_known[k] - 1;}
+
+    /**
+     * @brief 获取头部的值
+     * @return 是否存在
+     */
+    template<class K>
+    bool get(const K& key, StringPiece& val) const {
+        int idx = find(key);
+        if(idx < 0) {
+            return false;
+        }
+        val = value(idx);
+        return true;
+    }
+
+    /// 设置头部,名字和值复制到内部
+    void set(const std::string& key, const std::string& val);
+
+    /// 设置头部,名字和值引用外部内存,内存需要通过setHolder保持有效
+    void setView(const char* key, size_t klen, const char* val, size_t vlen);
+
+    /// 设置setView引用的外部内存
+    void setHolder(std::shared_ptr<char> holder) { m_holder = holder;}
+
+    /// 删除头部,返回是否存在
+    bool del(const std::string& key);
+
+    void clear();
+
+    /// 忽略大小写的名字hash
+    static uint32_t Hash(const char* key, size_t len);
+private:
+    struct Field {
+        uint32_t hash = 0;
+        uint8_t known = UNKNOWN;
+        /// 名字/值在m_arena中时为偏移,否则为外部指针
+        bool ownName = false;
+        bool ownValue = false;
+        uintptr_t name = 0;
+        uintptr_t value = 0;
+        uint32_t nameLen = 0;
+        uint32_t valueLen = 0;
+    };
+
+    Field& at(size_t i) { return i < INLINE_SIZE ? m_inline[i] : m_overflow[i - INLINE_SIZE];}
+    const Field& at(size_t i) const { return i < INLINE_SIZE ? m_inline[i] : m_overflow[i - INLINE_SIZE];}
+    /// 找到同名头部或者新加一个
+    Field& slot(const char* key, size_t len, uint32_t hash, bool& created);
+    uintptr_t store(const char* str, size_t len);
+    void release(size_t len);
+    void compact();
+private:
+    Field m_inline[INLINE_SIZE];
+    std::vector<Field> m_overflow;
+    size_t m_size = 0;
+    /// 常用头部的下标+1,0表示不存在
+    uint32_t m_known[KNOWN_COUNT];
+    /// 复制进来的名字和值
+    std::string m_arena;
+    /// m_arena中已经不用的字节数
+    size_t m_waste = 0;
+    /// setView引用的外部内存
+    std::shared_ptr<char> m_holder;
+};
+
 /**
  * @brief 获取Map中的key值,并转成对应类型,返回是否成功
  * @param[in] m Map数据结构
@@ -221,7 +351,45 @@ T getAs(const MapType& m, const std::string& key, const T& def = T()) {
     return def;
 }
 
+/**
+ * @brief 字符串片段转成对应类型,返回是否成功,失败时val = def
+ */
+template<class T>
+bool castAs(const StringPiece& str, T& val, const T& def = T()) {
+    try {
+        val = boost::lexical_cast<T>(str.data, str.size);
+        return true;
+    } catch (...) {
+        val = def;
+    }
+    return false;
+}
+
+/**
+ * @brief 获取头部的值,并转成对应类型,返回是否成功
+ */
+template<class T>
+bool checkGetAs(const HttpHeaders& m, const std::string& key, T& val, const T& def = T()) {
+    StringPiece str;
+    if(!m.get(key, str)) {
+        val = def;
+        return false;
+    }
+    return castAs(str, val, def);
+}
+
+/**
+ * @brief 获取头部的值,并转成对应类型
+ */
+template<class T>
+T getAs(const HttpHeaders& m, const std::string& key, const T& def = T()) {
+    T val;
+    checkGetAs(m, key, val, def);
+    return val;
+}
+
 class HttpResponse;
+class MultipartPart;
 
 class HttpRequest {
 public:
@@ -250,11 +418,12 @@ public:
     //返回HTTP请求的查询参数
     const std::string& getQuery() const {return m_query;}
 
-    //返回HTTP请求的消息头MAP
-    const MapType& getHeaders() const {return m_headers;}
+    //返回HTTP请求的消息头
+    const HttpHeaders& getHeaders() const {return m_headers;}
 
     //返回HTTP请求的参数MAP
-    const MapType& getParams() const {return m_params;}
+    //已经解析出来的参数在这时才解码放进MAP
+    const MapType& getParams() const;
 
     //返回HTTP请求的cookie MAP
     const MapType& getCookies() const {return m_cookies;}
@@ -273,7 +442,7 @@ public:
 
     //设置HTTP请求的查询参数
     // v 查询参数
-    void setQuery(const std::string& v) {m_query = v;}
+    void setQuery(const std::string& v) {m_query = v; clearParamViews(0x1);}
 
     //设置HTTP请求的Fragment
     // v fragment
@@ -281,7 +450,33 @@ public:
 
     //设置HTTP请求的消息体
     // v 消息体
-    void setBody(const std::string& v) {m_body = v;}
+    void setBody(const std::string& v) {m_body = v; m_bodyHolder.reset(); clearParamViews(0x2);}
+    void setBody(std::string&& v) {m_body = std::move(v); m_bodyHolder.reset(); clearParamViews(0x2);}
+
+    //设置HTTP请求的消息体为外部内存的视图，不复制数据
+    // data 消息体数据
+    // len 消息体长度
+    // holder 持有data所在的内存，保证请求对象存在期间有效
+    void setBodyView(const char* data, size_t len, std::shared_ptr<char> holder);
+
+    //返回HTTP请求的消息体
+    //消息体是视图时，第一次调用复制一份
+    const std::string& getBody() const;
+
+    //返回HTTP请求的消息体数据，不复制
+    const char* getBodyData() const {return m_bodyHolder ? m_bodyView : m_body.data();}
+
+    //返回HTTP请求的消息体长度
+    size_t getBodySize() const {return m_bodyHolder ? m_bodySize : m_body.size();}
+
+    //返回HTTP请求的消息体流
+    //消息体超过http.request.stream_threshold(或者是较大的chunked消息体)时不放在请求里，
+    //处理函数从流中边收边读，读到0表示消息体结束，没有流时返回nullptr
+    //参数相关的接口不会去读流，multipart表单要先调用parseMultipart
+    Stream::ptr getBodyStream() const {return m_bodyStream;}
+
+    //设置HTTP请求的消息体流
+    void setBodyStream(Stream::ptr v) {m_bodyStream = v; clearParamViews(0x2);}
 
     //是否自动关闭
     bool isClose() const {return m_close;}
@@ -295,9 +490,8 @@ public:
     //设置是否websocket
     void setWebsocket(bool v) {m_websocket = v;}
 
-    //设置HTTP请求的头部MAP
-    // v map
-    void setHeaders(const MapType& v) {m_headers = v;}
+    //设置HTTP请求的头部
+    void setHeaders(const HttpHeaders& v) {m_headers = v;}
 
     //设置HTTP请求的参数MAP
     // v map
@@ -317,8 +511,30 @@ public:
     // key 关键字
     // def 默认值
     // 如果存在则返回对应值，否则返回默认值
+    // 流式的消息体不会被读取，其中的表单字段要先调用parseMultipart
     std::string getParam(const std::string& key, const std::string& def = "");
 
+    /**
+     * @brief 解析multipart/form-data消息体,普通字段加入参数,文件通过getFiles返回
+     * @details 消息体是流时从流中读完整个消息体,只能解析一次,重复调用返回第一次的结果。
+     *          缓冲的消息体在第一次访问参数时会自动解析
+     * @return 格式错误、超过http.multipart.memory_limit、消息体不完整或者不是multipart时返回false,
+     *         失败时不加入任何字段和文件
+     */
+    bool parseMultipart();
+
+    /**
+     * @brief 返回multipart/form-data上传的文件
+     * @details 流式的消息体要先调用parseMultipart
+     */
+    const std::vector<std::shared_ptr<MultipartPart> >& getFiles();
+
+    /**
+     * @brief 返回字段名为name的上传文件,不存在返回nullptr
+     * @details 流式的消息体要先调用parseMultipart
+     */
+    std::shared_ptr<MultipartPart> getFile(const std::string& name);
+
 
     /**
      * @brief 获取HTTP请求的Cookie参数
@@ -336,6 +552,18 @@ public:
      */
     void setHeader(const std::string& key, const std::string& val);
 
+    /**
+     * @brief 设置HTTP请求的头部参数,名字和值引用接收缓冲区,不复制
+     */
+    void setHeaderView(const char* key, size_t klen, const char* val, size_t vlen) {
+        m_headers.setView(key, klen, val, vlen);
+    }
+
+    /**
+     * @brief 设置头部视图引用的接收缓冲区
+     */
+    void setHeaderHolder(std::shared_ptr<char> holder) {m_headers.setHolder(holder);}
+
     /**
      * @brief 设置HTTP请求的请求参数
      * @param[in] key 关键字
@@ -429,7 +657,12 @@ public:
     bool checkGetParamAs(const std::string& key, T& val, const T& def = T()) {
         initQueryParam();
         initBodyParam();
-        return checkGetAs(m_params, key, val, def);
+        StringPiece str;
+        if(!findParam(key, str)) {
+            val = def;
+            return false;
+        }
+        return castAs(str, val, def);
     }
 
     /**
@@ -441,9 +674,9 @@ public:
      */
     template<class T>
     T getParamAs(const std::string& key, const T& def = T()) {
-        initQueryParam();
-        initBodyParam();
-        return getAs(m_params, key, def);
+        T val;
+        checkGetParamAs(key, val, def);
+        return val;
     }
 
     /**
@@ -492,6 +725,44 @@ public:
     void initBodyParam();
     void initCookies();
 
+private:
+    /**
+     * @brief 解析出来的参数,名字和值引用m_query或者消息体,访问时才解码
+     */
+    struct ParamView {
+        const char* key = nullptr;
+        size_t keyLen = 0;
+        const char* value = nullptr;
+        size_t valueLen = 0;
+        /// 来源 0x1: query 0x2: 消息体
+        uint8_t source = 0;
+        bool deleted = false;
+        /// 名字/值在keyBuf/valueBuf中
+        bool ownKey = false;
+        bool ownValue = false;
+        /// 值是否已经检查过需不需要解码
+        bool decoded = false;
+        std::string keyBuf;
+        std::string valueBuf;
+
+        StringPiece getKey() const;
+        StringPiece getValue();
+    };
+
+    /**
+     * @brief 查找参数,setParam设置的优先,其次query,最后消息体
+     */
+    bool findParam(const std::string& key, StringPiece& val) const;
+
+    /**
+     * @brief 添加一个解析出来的参数,名字需要解码时才复制
+     */
+    void addParamView(const char* key, size_t klen, const char* val, size_t vlen, uint8_t source);
+
+    /**
+     * @brief query或者消息体修改后,删除引用它们的参数
+     */
+    void clearParamViews(uint8_t source);
 private:
     /// HTTP方法
     HttpMethod m_method;
@@ -502,6 +773,8 @@ private:
     /// 是否为websocket
     bool m_websocket;
 
+    /// 0x1 查询参数已解析 0x2 消息体参数已解析 0x4 cookie已解析
+    /// 0x8 multipart已解析 0x10 multipart解析失败
     uint8_t m_parserParamFlag;
     /// 请求路径
     std::string m_path;
@@ -510,13 +783,25 @@ private:
     /// 请求fragment
     std::string m_fragment;
     /// 请求消息体
-    std::string m_body;
-    /// 请求头部MAP
-    MapType m_headers;
-    /// 请求参数MAP
-    MapType m_params;
+    mutable std::string m_body;
+    /// 消息体视图
+    const char* m_bodyView = nullptr;
+    /// 消息体视图长度
+    size_t m_bodySize = 0;
+    /// 消息体视图所在的内存
+    std::shared_ptr<char> m_bodyHolder;
+    /// 消息体流
+    Stream::ptr m_bodyStream;
+    /// 请求头部
+    HttpHeaders m_headers;
+    /// 请求参数MAP, setParam设置的和getParams时解码的参数
+    mutable MapType m_params;
+    /// 解析出来的参数
+    mutable std::vector<ParamView> m_paramViews;
     /// 请求Cookie MAP
     MapType m_cookies;
+    /// multipart/form-data上传的文件
+    std::vector<std::shared_ptr<MultipartPart> > m_files;
 
 };
 
@@ -550,9 +835,8 @@ public:
     //返回响应原因
     const std::string& getReason() const {return m_reason;}
 
-    //返回响应头部MAP
-    // MAP
-    const MapType& getHeaders() const {return m_headers;}
+    //返回响应头部
+    const HttpHeaders& getHeaders() const {return m_headers;}
 
     /**
      * @brief 设置响应状态
@@ -567,22 +851,49 @@ public:
 
     //设置响应消息体
     // v 消息体
-    void setBody(const std::string& v) {m_body = v;}
+    void setBody(const std::string& v) {m_body = v; m_bodyFile.reset();}
+    void setBody(std::string&& v) {m_body = std::move(v); m_bodyFile.reset();}
+
+    //使用文件内容作为响应消息体，发送时用sendfile，不读入内存
+    // path 文件路径
+    // offset 开始位置
+    // length 长度，超过文件末尾时截断到文件末尾
+    //打开文件失败返回false
+    bool setBodyFile(const std::string& path, uint64_t offset = 0, uint64_t length = ~0ull);
+
+    //消息体是否为文件
+    bool hasBodyFile() const {return (bool)m_bodyFile;}
+
+    //返回消息体文件句柄，没有时返回-1
+    int getBodyFileFd() const {return m_bodyFile ? m_bodyFile->fd : -1;}
+
+    //返回消息体文件的开始位置
+    uint64_t getBodyFileOffset() const {return m_bodyFile ? m_bodyFile->offset : 0;}
+
+    //返回消息体长度
+    uint64_t getBodyLength() const {return m_bodyFile ? m_bodyFile->length : m_body.size();}
 
     //设置响应原因
     // v 原因
     void setReason(const std::string& v) {m_reason = v;}
 
-    //设置响应头部MAP
-    // v MAP
-    void setHeaders(const MapType& v) {m_headers = v;}
+    //设置响应头部
+    void setHeaders(const HttpHeaders& v) {m_headers = v;}
 
     //是否自动关闭
     bool isClose(bool v) const {return m_close;}
+    bool isClose() const {return m_close;}
 
     //设置是否自动关闭
     void setClose(bool v) {m_close = v;}
 
+    //消息体是否流式发送(HttpSession::startResponse)
+    //HTTP/1.1使用Transfer-Encoding: chunked，HTTP/1.0不输出长度，发送完关闭连接
+    bool isStream() const {return m_stream;}
+
+    //设置消息体是否流式发送
+    void setStream(bool v) {m_stream = v;}
+
     //是否websocket
     bool isWebsocket() const {return m_websocket;}
 
@@ -637,11 +948,18 @@ public:
 
     /**
      * @brief 序列化输出到流
+     * @details 消息体是文件时读出文件的对应范围
      * @param[in, out] os 输出流
      * @return 输出流
      */
     std::ostream& dump(std::ostream& os) const;
 
+    /**
+     * @brief 将状态行和头部(包括结尾的空行)追加到out，不包括消息体
+     * @param[in, out] out 输出缓冲区
+     */
+    void dumpHeader(std::string& out) const;
+
     /**
      * @brief 转成字符串
      */
@@ -660,15 +978,25 @@ private:
     bool m_close;
     /// 是否为websocket
     bool m_websocket;
+    /// 消息体是否流式发送
+    bool m_stream;
     /// 响应消息体
     std::string m_body;
     /// 响应原因
     std::string m_reason;
-    /// 响应头部MAP
-    MapType m_headers;
+    /// 响应头部
+    HttpHeaders m_headers;
 
     std::vector<std::string> m_cookies;
 
+    /// 文件消息体，析构时关闭文件
+    struct BodyFile {
+        ~BodyFile();
+        int fd = -1;
+        uint64_t offset = 0;
+        uint64_t length = 0;
+    };
+    std::shared_ptr<BodyFile> m_bodyFile;
 };
 
 /**
@@ -2451,3 +2451,9 @@ int http_parser_has_error(http_parser *parser) {
 int http_parser_is_finished(http_parser *parser) {
 	return parser->cs >= http_parser_first_final;
 }
+
+void http_parser_set_finished(http_parser *parser, size_t body_start) {
+	parser->cs = http_parser_first_final;
+	parser->body_start = body_start;
+	parser->nread = body_start;
+}
@@ -0,0 +1,592 @@
+#include "http_connection.h"
+#include "http_parser.h"
+#include "sylar/hook.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include <string.h>
+
+namespace hr {
+namespace http {
+
+static hr::Logger::ptr g_logger = HR_LOG_NAME("system");
+
+std::string HttpResult::toString() const {
+    std::stringstream ss;
+    ss << "[HttpResult result=" << result
+       << " error=" << error
+       << " response=" << (response ? response->toString() : "nullptr")
+       << "]";
+    return ss.str();
+}
+
+static void set_timeout(Socket::ptr sock, uint64_t timeout_ms) {
+    if(timeout_ms != (uint64_t)-1) {
+        sock->setRecvTimeout(timeout_ms);
+        sock->setSendTimeout(timeout_ms);
+    }
+}
+
+//在[data, data + len)中找一行,返回行尾'\n'之后的位置,没有完整的行返回0
+static size_t find_line(const char* data, size_t len) {
+    const char* p = (const char*)memchr(data, '\n', len);
+    return p ? p - data + 1 : 0;
+}
+
+//用httpclient_parser解析缓冲区开头完整的响应头或者chunk头,解析完从缓冲区移除
+static bool parse_head(HttpResponseParser::ptr parser, char* data, size_t& len
+                      ,size_t size, bool chunck) {
+    //httpclient_parser要求数据以'\0'结尾
+    char saved = data[size];
+    data[size] = '\0';
+    size_t nparse = parser->execute(data, size, chunck);
+    if(parser->hasError() || !parser->isFinished() || nparse != size) {
+        return false;
+    }
+    data[size] = saved;
+    memmove(data, data + size, len - size);
+    len -= size;
+    data[len] = '\0';
+    return true;
+}
+
+HttpConnection::HttpConnection(Socket::ptr sock, bool owner)
+    :SocketStream(sock, owner) {
+    m_createTime = hr::GetCurrentMS();
+}
+
+HttpConnection::~HttpConnection() {
+    HR_LOG_DEBUG(g_logger) << "HttpConnection::~HttpConnection";
+}
+
+HttpResponse::ptr HttpConnection::recvResponse() {
+    HttpResponseParser::ptr parser(new HttpResponseParser);
+    uint64_t buff_size = HttpResponseParser::GetHttpResponseBufferSize();
+    uint64_t max_body = HttpResponseParser::GetHttpResponseMaxBodySize();
+    std::shared_ptr<char> buffer(
+            new char[buff_size + 1], [](char* ptr){
+                delete[] ptr;
+            });
+    char* data = buffer.get();
+    size_t len = 0;
+
+    //失败时关闭连接,保留errno(超时是ETIMEDOUT)
+    auto fail = [this]() {
+        int err = errno;
+        close();
+        errno = err;
+        return nullptr;
+    };
+    //读到缓冲区末尾,返回false表示出错或者缓冲区已满
+    auto fill = [&]() {
+        if(len >= buff_size) {
+            errno = EMSGSIZE;
+            return false;
+        }
+        int rt = read(data + len, buff_size - len);
+        if(rt <= 0) {
+            if(rt == 0) {
+                errno = ECONNRESET;
+            }
+            return false;
+        }
+        len += rt;
+        data[len] = '\0';
+        return true;
+    };
+
+    //响应头收全之后一次交给httpclient_parser,避免字段被read截断
+    size_t head_len = 0;
+    while(true) {
+        const char* end = (const char*)memmem(data, len, "\r\n\r\n", 4);
+        if(end) {
+            head_len = end - data + 4;
+            break;
+        }
+        if(!fill()) {
+            return fail();
+        }
+    }
+    if(!parse_head(parser, data, len, head_len, false)) {
+        HR_LOG_WARN(g_logger) << "invalid http response from " << getRemoteAddressString();
+        errno = EPROTO;
+        return fail();
+    }
+
+    auto& client_parser = parser->getParser();
+    //解析chunk头时会重新初始化client_parser,先保存响应头里的状态
+    bool peer_close = client_parser.close;
+    HttpResponse::ptr rsp = parser->getData();
+    int status = (int)rsp->getStatus();
+    std::string body;
+    bool read_to_close = false;
+    if(m_head || status / 100 == 1 || status == 204 || status == 304) {
+        //没有消息体
+    } else if(client_parser.chunked) {
+        while(true) {
+            size_t line = 0;
+            while(!(line = find_line(data, len))) {
+                if(!fill()) {
+                    return fail();
+                }
+            }
+            if(!parse_head(parser, data, len, line, true)) {
+                errno = EPROTO;
+                return fail();
+            }
+            if(client_parser.chunks_done) {
+                break;
+            }
+            size_t size = client_parser.content_len;
+            if(body.size() + size > max_body) {
+                errno = EMSGSIZE;
+                return fail();
+            }
+            size_t n = std::min(size, len);
+            body.append(data, n);
+            memmove(data, data + n, len - n);
+            len -= n;
+            if(n < size) {
+                //大块直接读到body里
+                size_t offset = body.size();
+                body.resize(offset + size - n);
+                if(readFixSize(&body[offset], size - n) <= 0) {
+                    return fail();
+                }
+            }
+            while(len < 2) {
+                if(!fill()) {
+                    return fail();
+                }
+            }
+            if(data[0] != '\r' || data[1] != '\n') {
+                errno = EPROTO;
+                return fail();
+            }
+            memmove(data, data + 2, len - 2);
+            len -= 2;
+            data[len] = '\0';
+        }
+        //trailer直到空行
+        while(true) {
+            size_t line = 0;
+            while(!(line = find_line(data, len))) {
+                if(!fill()) {
+                    return fail();
+                }
+            }
+            bool empty = line <= 2 && (line == 1 || data[0] == '\r');
+            memmove(data, data + line, len - line);
+            len -= line;
+            if(empty) {
+                break;
+            }
+        }
+    } else if(client_parser.content_len >= 0) {
+        size_t length = parser->getContentLength();
+        if(length > max_body) {
+            errno = EMSGSIZE;
+            return fail();
+        }
+        size_t n = std::min(length, len);
+        body.assign(data, n);
+        memmove(data, data + n, len - n);
+        len -= n;
+        if(n < length) {
+            body.resize(length);
+            if(readFixSize(&body[n], length - n) <= 0) {
+                return fail();
+            }
+        }
+    } else {
+        //没有长度也不是chunked,消息体直到连接关闭(RFC 7230 3.3.3)
+        read_to_close = true;
+        body.assign(data, len);
+        len = 0;
+        char tmp[4096];
+        int rt = 0;
+        while((rt = read(tmp, sizeof(tmp))) > 0) {
+            if(body.size() + rt > max_body) {
+                errno = EMSGSIZE;
+                return fail();
+            }
+            body.append(tmp, rt);
+        }
+        if(rt < 0) {
+            return fail();
+        }
+    }
+    rsp->setBody(std::move(body));
+
+    std::string conn = rsp->getHeader("connection");
+    bool close = read_to_close || peer_close
+        || (rsp->getVersion() == 0x10 && strcasecmp(conn.c_str(), "keep-alive"))
+        || len > 0; //多出来的数据无法对应请求,不再复用
+    rsp->setClose(close);
+    return rsp;
+}
+
+int HttpConnection::sendRequest(HttpRequest::ptr req) {
+    m_head = req->getMethod() == HttpMethod::HEAD;
+    std::stringstream ss;
+    ss << *req;
+    std::string data = ss.str();
+    return writeFixSize(data.c_str(), data.size());
+}
+
+bool HttpConnection::isStale() {
+    if(!isConnected()) {
+        return true;
+    }
+    char c;
+    int rt = recv_f(m_socket->getSocket(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return !(rt < 0 && (errno == EAGAIN || errno == EWOULDBLOCK));
+}
+
+HttpResult::ptr HttpConnection::doRequest(HttpRequest::ptr req, const std::string& peer
+                                          ,uint64_t timeout_ms) {
+    int rt = sendRequest(req);
+    if(rt == 0) {
+        close();
+        return std::make_shared<HttpResult>((int)HttpResult::Error::SEND_CLOSE_BY_PEER
+                , nullptr, "send request closed by peer: " + peer);
+    }
+    if(rt < 0) {
+        int err = errno;
+        close();
+        return std::make_shared<HttpResult>((int)HttpResult::Error::SEND_SOCKET_ERROR
+                    , nullptr, "send request socket error errno=" + std::to_string(err)
+                    + " errstr=" + std::string(strerror(err)));
+    }
+    auto rsp = recvResponse();
+    if(!rsp) {
+        int err = errno;
+        if(err == ETIMEDOUT || err == EAGAIN) {
+            return std::make_shared<HttpResult>((int)HttpResult::Error::TIMEOUT
+                    , nullptr, "recv response timeout: " + peer
+                    + " timeout_ms:" + std::to_string(timeout_ms));
+        }
+        return std::make_shared<HttpResult>((int)HttpResult::Error::RECV_ERROR
+                , nullptr, "recv response error: " + peer
+                + " errno=" + std::to_string(err) + " errstr=" + std::string(strerror(err)));
+    }
+    ++m_request;
+    if(rsp->isClose() || req->isClose()) {
+        close();
+    }
+    return std::make_shared<HttpResult>((int)HttpResult::Error::OK, rsp, "ok");
+}
+
+HttpResult::ptr HttpConnection::DoGet(const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    Uri::ptr uri = Uri::Create(url);
+    if(!uri) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::INVALID_URL
+                , nullptr, "invalid url: " + url);
+    }
+    return DoGet(uri, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnection::DoGet(Uri::ptr uri
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    return DoRequest(HttpMethod::GET, uri, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnection::DoPost(const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    Uri::ptr uri = Uri::Create(url);
+    if(!uri) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::INVALID_URL
+                , nullptr, "invalid url: " + url);
+    }
+    return DoPost(uri, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnection::DoPost(Uri::ptr uri
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    return DoRequest(HttpMethod::POST, uri, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnection::DoRequest(HttpMethod method
+                            , const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    Uri::ptr uri = Uri::Create(url);
+    if(!uri) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::INVALID_URL
+                , nullptr, "invalid url: " + url);
+    }
+    return DoRequest(method, uri, timeout_ms, headers, body);
+}
+
+//根据参数构造请求,Host没有指定时使用vhost
+static HttpRequest::ptr make_request(HttpMethod method
+                            , const std::string& path
+                            , const std::string& query
+                            , const std::string& fragment
+                            , const std::string& vhost
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    HttpRequest::ptr req = std::make_shared<HttpRequest>();
+    req->setMethod(method);
+    req->setPath(path);
+    req->setQuery(query);
+    req->setFragment(fragment);
+    bool has_host = false;
+    for(auto& i : headers) {
+        if(strcasecmp(i.first.c_str(), "connection") == 0) {
+            if(strcasecmp(i.second.c_str(), "keep-alive") == 0) {
+                req->setClose(false);
+            }
+            continue;
+        }
+        if(!has_host && strcasecmp(i.first.c_str(), "host") == 0) {
+            has_host = !i.second.empty();
+        }
+        req->setHeader(i.first, i.second);
+    }
+    if(!has_host) {
+        req->setHeader("Host", vhost);
+    }
+    req->setBody(body);
+    return req;
+}
+
+HttpResult::ptr HttpConnection::DoRequest(HttpMethod method
+                            , Uri::ptr uri
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers
+                            , const std::string& body) {
+    HttpRequest::ptr req = make_request(method, uri->getPath(), uri->getQuery()
+            , uri->getFragment(), uri->getHost(), headers, body);
+    return DoRequest(req, uri, timeout_ms);
+}
+
+HttpResult::ptr HttpConnection::DoRequest(HttpRequest::ptr req
+                            , Uri::ptr uri
+                            , uint64_t timeout_ms) {
+    Address::ptr addr = uri->createAddress();
+    if(!addr) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::INVALID_HOST
+                , nullptr, "invalid host: " + uri->getHost());
+    }
+    Socket::ptr sock = Socket::CreateTCP(addr);
+    if(!sock) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::CREATE_SOCKET_ERROR
+                , nullptr, "create socket fail: " + addr->toString()
+                        + " errno=" + std::to_string(errno)
+                        + " errstr=" + std::string(strerror(errno)));
+    }
+    if(!sock->connect(addr, timeout_ms)) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::CONNECT_FAIL
+                , nullptr, "connect fail: " + addr->toString());
+    }
+    set_timeout(sock, timeout_ms);
+    HttpConnection::ptr conn = std::make_shared<HttpConnection>(sock);
+    return conn->doRequest(req, addr->toString(), timeout_ms);
+}
+
+HttpConnectionPool::ptr HttpConnectionPool::Create(const std::string& uri
+                                                   ,const std::string& vhost
+                                                   ,uint32_t max_size
+                                                   ,uint32_t max_alive_time
+                                                   ,uint32_t max_idle_time
+                                                   ,uint32_t max_request) {
+    Uri::ptr turi = Uri::Create(uri);
+    if(!turi || turi->getHost().empty()) {
+        HR_LOG_ERROR(g_logger) << "invalid uri=" << uri;
+        return nullptr;
+    }
+    return std::make_shared<HttpConnectionPool>(turi->getHost()
+            , vhost, turi->getPort(), max_size, max_alive_time, max_idle_time
+            , max_request);
+}
+
+HttpConnectionPool::HttpConnectionPool(const std::string& host
+                                       ,const std::string& vhost
+                                       ,uint32_t port
+                                       ,uint32_t max_size
+                                       ,uint32_t max_alive_time
+                                       ,uint32_t max_idle_time
+                                       ,uint32_t max_request)
+    :m_host(host)
+    ,m_vhost(vhost)
+    ,m_port(port ? port : 80)
+    ,m_maxSize(max_size)
+    ,m_maxAliveTime(max_alive_time)
+    ,m_maxIdleTime(max_idle_time)
+    ,m_maxRequest(max_request) {
+}
+
+HttpConnectionPool::~HttpConnectionPool() {
+    MutexType::Lock lock(m_mutex);
+    for(auto i : m_conns) {
+        delete i;
+    }
+    m_total -= m_conns.size();
+    m_conns.clear();
+}
+
+size_t HttpConnectionPool::getIdleSize() {
+    MutexType::Lock lock(m_mutex);
+    return m_conns.size();
+}
+
+bool HttpConnectionPool::isReusable(HttpConnection* conn, uint64_t now) const {
+    if(!conn->isConnected()) {
+        return false;
+    }
+    if(m_maxAliveTime && conn->m_createTime + m_maxAliveTime <= now) {
+        return false;
+    }
+    if(m_maxIdleTime && conn->m_lastUseTime + m_maxIdleTime <= now) {
+        return false;
+    }
+    if(m_maxRequest && conn->m_request >= m_maxRequest) {
+        return false;
+    }
+    return true;
+}
+
+HttpConnection::ptr HttpConnectionPool::getConnection(uint64_t timeout_ms) {
+    uint64_t now = hr::GetCurrentMS();
+    HttpConnection* ptr = nullptr;
+    while(true) {
+        HttpConnection* conn = nullptr;
+        {
+            //后放回的连接先用,多余的连接空闲超时后关闭
+            MutexType::Lock lock(m_mutex);
+            if(m_conns.empty()) {
+                break;
+            }
+            conn = m_conns.back();
+            m_conns.pop_back();
+        }
+        if(isReusable(conn, now) && !conn->isStale()) {
+            ptr = conn;
+            break;
+        }
+        delete conn;
+        --m_total;
+    }
+
+    if(!ptr) {
+        Address::ptr addr;
+        {
+            MutexType::Lock lock(m_mutex);
+            addr = m_addr;
+        }
+        if(!addr) {
+            IPAddress::ptr ipaddr = Address::LookupAnyIPAddress(m_host);
+            if(!ipaddr) {
+                HR_LOG_ERROR(g_logger) << "get addr fail: " << m_host;
+                return nullptr;
+            }
+            ipaddr->setPort(m_port);
+            addr = ipaddr;
+            MutexType::Lock lock(m_mutex);
+            m_addr = addr;
+        }
+        Socket::ptr sock = Socket::CreateTCP(addr);
+        if(!sock) {
+            HR_LOG_ERROR(g_logger) << "create sock fail: " << *addr;
+            return nullptr;
+        }
+        if(!sock->connect(addr, timeout_ms)) {
+            HR_LOG_ERROR(g_logger) << "sock connect fail: " << *addr;
+            return nullptr;
+        }
+        ptr = new HttpConnection(sock);
+        ++m_total;
+        ++m_createCount;
+    }
+    return HttpConnection::ptr(ptr, std::bind(&HttpConnectionPool::ReleasePtr
+                               , std::placeholders::_1, this));
+}
+
+void HttpConnectionPool::ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool) {
+    uint64_t now = hr::GetCurrentMS();
+    ptr->m_lastUseTime = now;
+    if(pool->isReusable(ptr, now)) {
+        MutexType::Lock lock(pool->m_mutex);
+        if(pool->m_conns.size() < pool->m_maxSize) {
+            pool->m_conns.push_back(ptr);
+            return;
+        }
+    }
+    delete ptr;
+    --pool->m_total;
+}
+
+HttpResult::ptr HttpConnectionPool::doGet(const std::string& url
+                                          , uint64_t timeout_ms
+                                          , const std::map<std::string, std::string>& headers
+                                          , const std::string& body) {
+    return doRequest(HttpMethod::GET, url, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnectionPool::doPost(const std::string& url
+                                           , uint64_t timeout_ms
+                                           , const std::map<std::string, std::string>& headers
+                                           , const std::string& body) {
+    return doRequest(HttpMethod::POST, url, timeout_ms, headers, body);
+}
+
+HttpResult::ptr HttpConnectionPool::doRequest(HttpMethod method
+                                              , const std::string& url
+                                              , uint64_t timeout_ms
+                                              , const std::map<std::string, std::string>& headers
+                                              , const std::string& body) {
+    Uri::ptr uri = Uri::Create(url);
+    if(!uri) {
+        return std::make_shared<HttpResult>((int)HttpResult::Error::INVALID_URL
+                , nullptr, "invalid url: " + url);
+    }
+    HttpRequest::ptr req = make_request(method, uri->getPath(), uri->getQuery()
+            , uri->getFragment(), m_vhost.empty() ? m_host : m_vhost, headers, body);
+    req->setClose(false);
+    return doRequest(req, timeout_ms);
+}
+
+HttpResult::ptr HttpConnectionPool::doRequest(HttpRequest::ptr req
+                                              , uint64_t timeout_ms) {
+    HttpMethod method = req->getMethod();
+    bool idempotent = method == HttpMethod::GET || method == HttpMethod::HEAD
+        || method == HttpMethod::PUT || method == HttpMethod::DELETE
+        || method == HttpMethod::OPTIONS;
+    for(int retry = 0; ; ++retry) {
+        auto conn = getConnection(timeout_ms);
+        if(!conn) {
+            return std::make_shared<HttpResult>((int)HttpResult::Error::POOL_GET_CONNECTION
+                    , nullptr, "pool host:" + m_host + " port:" + std::to_string(m_port));
+        }
+        auto sock = conn->getSocket();
+        if(!sock) {
+            return std::make_shared<HttpResult>((int)HttpResult::Error::POOL_INVALID_CONNECTION
+                    , nullptr, "pool host:" + m_host + " port:" + std::to_string(m_port));
+        }
+        set_timeout(sock, timeout_ms);
+        bool reused = conn->getRequestCount() > 0;
+        auto result = conn->doRequest(req, m_host + ":" + std::to_string(m_port), timeout_ms);
+        //复用的连接可能刚好被对端按keep-alive超时关闭,换新连接重试一次
+        if(reused && retry == 0
+                && (result->result == (int)HttpResult::Error::SEND_CLOSE_BY_PEER
+                    || result->result == (int)HttpResult::Error::SEND_SOCKET_ERROR
+                    || (idempotent && result->result == (int)HttpResult::Error::RECV_ERROR))) {
+            HR_LOG_DEBUG(g_logger) << "retry on new connection: " << result->error;
+            continue;
+        }
+        return result;
+    }
+}
+
+}
+}
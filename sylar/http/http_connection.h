@@ -0,0 +1,396 @@
+/**
+ * @file http_connection.h
+ * @brief HTTP客户端连接及连接池
+ */
+
+#ifndef __SYLAR_HTTP_HTTP_CONNECTION_H__
+#define __SYLAR_HTTP_HTTP_CONNECTION_H__
+
+#include "sylar/streams/socket_stream.h"
+#include "sylar/mutex.h"
+#include "sylar/uri.h"
+#include "http.h"
+#include <atomic>
+#include <list>
+
+namespace hr {
+namespace http {
+
+/**
+ * @brief HTTP请求结果
+ */
+struct HttpResult {
+    /// 智能指针类型定义
+    typedef std::shared_ptr<HttpResult> ptr;
+
+    /**
+     * @brief 错误码定义
+     */
+    enum class Error {
+        /// 正常
+        OK = 0,
+        /// 非法URL
+        INVALID_URL = 1,
+        /// 无法解析HOST
+        INVALID_HOST = 2,
+        /// 连接失败
+        CONNECT_FAIL = 3,
+        /// 连接被对端关闭
+        SEND_CLOSE_BY_PEER = 4,
+        /// 发送请求产生Socket错误
+        SEND_SOCKET_ERROR = 5,
+        /// 超时
+        TIMEOUT = 6,
+        /// 创建Socket失败
+        CREATE_SOCKET_ERROR = 7,
+        /// 从连接池中取连接失败
+        POOL_GET_CONNECTION = 8,
+        /// 无效的连接
+        POOL_INVALID_CONNECTION = 9,
+        /// 接收响应失败(连接关闭或者响应格式错误)
+        RECV_ERROR = 10
+    };
+
+    /**
+     * @brief 构造函数
+     * @param[in] _result 错误码
+     * @param[in] _response HTTP响应结构体
+     * @param[in] _error 错误描述
+     */
+    HttpResult(int _result
+               ,HttpResponse::ptr _response
+               ,const std::string& _error)
+        :result(_result)
+        ,response(_response)
+        ,error(_error) {}
+
+    /// 错误码
+    int result;
+    /// HTTP响应结构体
+    HttpResponse::ptr response;
+    /// 错误描述
+    std::string error;
+
+    std::string toString() const;
+};
+
+class HttpConnectionPool;
+
+/**
+ * @brief HTTP客户端连接
+ * @details 一个连接上依次发送请求、接收响应,响应支持content-length、chunked
+ *          和读到连接关闭三种消息体。读写超时通过Socket的超时设置实现,
+ *          由hook中的TimerManager定时器取消等待
+ */
+class HttpConnection : public SocketStream {
+friend class HttpConnectionPool;
+public:
+    /// HTTP客户端连接智能指针
+    typedef std::shared_ptr<HttpConnection> ptr;
+
+    /**
+     * @brief 发送HTTP的GET请求
+     * @param[in] url 请求的url
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @param[in] headers HTTP请求头部参数
+     * @param[in] body 请求消息体
+     * @return 返回HTTP结果结构体
+     */
+    static HttpResult::ptr DoGet(const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers = {}
+                            , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP的GET请求
+     * @param[in] uri URI结构体
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @param[in] headers HTTP请求头部参数
+     * @param[in] body 请求消息体
+     * @return 返回HTTP结果结构体
+     */
+    static HttpResult::ptr DoGet(Uri::ptr uri
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers = {}
+                            , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP的POST请求
+     * @param[in] url 请求的url
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @param[in] headers HTTP请求头部参数
+     * @param[in] body 请求消息体
+     * @return 返回HTTP结果结构体
+     */
+    static HttpResult::ptr DoPost(const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers = {}
+                            , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP的POST请求
+     * @param[in] uri URI结构体
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @param[in] headers HTTP请求头部参数
+     * @param[in] body 请求消息体
+     * @return 返回HTTP结果结构体
+     */
+    static HttpResult::ptr DoPost(Uri::ptr uri
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers = {}
+                            , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP请求
+     * @param[in] method 请求类型
+     * @param[in] url 请求的url
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @param[in] headers HTTP请求头部参数
+     * @param[in] body 请求消息体
+     * @return 返回HTTP结果结构体
+     */
+    static HttpResult::ptr DoRequest(HttpMethod method
+                            , const std::string& url
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers = {}
+                            , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP请求
+     * @param[in] method 请求类型
+     * @param[in] uri URI结构体
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @param[in] headers HTTP请求头部参数
+     * @param[in] body 请求消息体
+     * @return 返回HTTP结果结构体
+     */
+    static HttpResult::ptr DoRequest(HttpMethod method
+                            , Uri::ptr uri
+                            , uint64_t timeout_ms
+                            , const std::map<std::string, std::string>& headers = {}
+                            , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP请求
+     * @param[in] req 请求结构体
+     * @param[in] uri URI结构体
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @return 返回HTTP结果结构体
+     */
+    static HttpResult::ptr DoRequest(HttpRequest::ptr req
+                            , Uri::ptr uri
+                            , uint64_t timeout_ms);
+
+    /**
+     * @brief 构造函数
+     * @param[in] sock Socket类
+     * @param[in] owner 是否掌握所有权
+     */
+    HttpConnection(Socket::ptr sock, bool owner = true);
+
+    /**
+     * @brief 析构函数
+     */
+    ~HttpConnection();
+
+    /**
+     * @brief 接收HTTP响应
+     * @return 失败返回nullptr并关闭连接,超时时errno为ETIMEDOUT
+     */
+    HttpResponse::ptr recvResponse();
+
+    /**
+     * @brief 发送HTTP请求
+     * @param[in] req HTTP请求结构
+     * @return 成功返回发送的字节数
+     */
+    int sendRequest(HttpRequest::ptr req);
+
+    /**
+     * @brief 返回在这个连接上完成的请求数
+     */
+    uint64_t getRequestCount() const { return m_request;}
+
+    /**
+     * @brief 对端在空闲期间是否关闭了连接(或者发来了多余的数据)
+     * @details 用MSG_PEEK|MSG_DONTWAIT检查,不会阻塞
+     */
+    bool isStale();
+private:
+    /**
+     * @brief 发送请求并接收响应,失败时返回对应的错误
+     */
+    HttpResult::ptr doRequest(HttpRequest::ptr req, const std::string& peer
+                              ,uint64_t timeout_ms);
+private:
+    /// 创建时间(毫秒)
+    uint64_t m_createTime = 0;
+    /// 最后一次放回连接池的时间(毫秒)
+    uint64_t m_lastUseTime = 0;
+    /// 完成的请求数
+    uint64_t m_request = 0;
+    /// 最后发送的是HEAD请求,响应没有消息体
+    bool m_head = false;
+};
+
+/**
+ * @brief HTTP客户端连接池
+ * @details 一个连接池对应一个host:port,保存空闲的keep-alive连接。
+ *          空闲连接数超过max_size、存活超过max_alive_time、空闲超过max_idle_time
+ *          或者请求数超过max_request的连接会被关闭
+ */
+class HttpConnectionPool {
+public:
+    /// 智能指针类型
+    typedef std::shared_ptr<HttpConnectionPool> ptr;
+    /// 互斥锁类型
+    typedef Mutex MutexType;
+
+    /**
+     * @brief 根据uri创建连接池
+     * @param[in] uri 目标地址,如http://127.0.0.1:8080
+     * @param[in] vhost 请求头中的Host,为空时使用uri中的host
+     * @param[in] max_size 最多保留的空闲连接数
+     * @param[in] max_alive_time 连接最长存活时间(毫秒),0表示不限制
+     * @param[in] max_idle_time 连接最长空闲时间(毫秒),0表示不限制
+     * @param[in] max_request 一个连接上最多发送的请求数,0表示不限制
+     * @return 非法的uri返回nullptr
+     */
+    static HttpConnectionPool::ptr Create(const std::string& uri
+                                          ,const std::string& vhost
+                                          ,uint32_t max_size
+                                          ,uint32_t max_alive_time
+                                          ,uint32_t max_idle_time
+                                          ,uint32_t max_request);
+
+    /**
+     * @brief 构造函数
+     */
+    HttpConnectionPool(const std::string& host
+                       ,const std::string& vhost
+                       ,uint32_t port
+                       ,uint32_t max_size
+                       ,uint32_t max_alive_time
+                       ,uint32_t max_idle_time
+                       ,uint32_t max_request);
+
+    /**
+     * @brief 析构函数,关闭所有空闲连接
+     * @details 取出的连接必须在连接池析构前释放
+     */
+    ~HttpConnectionPool();
+
+    /**
+     * @brief 取一个连接,没有可用的空闲连接时新建连接
+     * @param[in] timeout_ms 新建连接时的连接超时(毫秒)
+     * @return 连接失败返回nullptr。连接释放时自动放回连接池
+     */
+    HttpConnection::ptr getConnection(uint64_t timeout_ms = -1);
+
+    /**
+     * @brief 发送HTTP的GET请求
+     * @param[in] url 请求的路径,如/index.html?a=1
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @param[in] headers HTTP请求头部参数
+     * @param[in] body 请求消息体
+     * @return 返回HTTP结果结构体
+     */
+    HttpResult::ptr doGet(const std::string& url
+                          , uint64_t timeout_ms
+                          , const std::map<std::string, std::string>& headers = {}
+                          , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP的POST请求
+     * @param[in] url 请求的路径
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @param[in] headers HTTP请求头部参数
+     * @param[in] body 请求消息体
+     * @return 返回HTTP结果结构体
+     */
+    HttpResult::ptr doPost(const std::string& url
+                           , uint64_t timeout_ms
+                           , const std::map<std::string, std::string>& headers = {}
+                           , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP请求
+     * @param[in] method 请求类型
+     * @param[in] url 请求的路径
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @param[in] headers HTTP请求头部参数
+     * @param[in] body 请求消息体
+     * @return 返回HTTP结果结构体
+     */
+    HttpResult::ptr doRequest(HttpMethod method
+                              , const std::string& url
+                              , uint64_t timeout_ms
+                              , const std::map<std::string, std::string>& headers = {}
+                              , const std::string& body = "");
+
+    /**
+     * @brief 发送HTTP请求
+     * @details 复用的空闲连接在发送前已经被对端关闭时,换一个新连接重试一次
+     * @param[in] req 请求结构体
+     * @param[in] timeout_ms 超时时间(毫秒)
+     * @return 返回HTTP结果结构体
+     */
+    HttpResult::ptr doRequest(HttpRequest::ptr req
+                              , uint64_t timeout_ms);
+
+    /**
+     * @brief 当前连接总数(包括正在使用的)
+     */
+    int32_t getTotal() const { return m_total;}
+
+    /**
+     * @brief 当前空闲连接数
+     */
+    size_t getIdleSize();
+
+    /**
+     * @brief 新建连接的次数
+     */
+    uint64_t getCreateCount() const { return m_createCount;}
+private:
+    /**
+     * @brief 连接释放时调用,放回连接池或者关闭
+     */
+    static void ReleasePtr(HttpConnection* ptr, HttpConnectionPool* pool);
+
+    /**
+     * @brief 连接是否还可以复用
+     */
+    bool isReusable(HttpConnection* conn, uint64_t now) const;
+private:
+    /// 目标host
+    std::string m_host;
+    /// 请求头中的Host
+    std::string m_vhost;
+    /// 目标端口
+    uint32_t m_port;
+    /// 最多保留的空闲连接数
+    uint32_t m_maxSize;
+    /// 连接最长存活时间(毫秒)
+    uint32_t m_maxAliveTime;
+    /// 连接最长空闲时间(毫秒)
+    uint32_t m_maxIdleTime;
+    /// 一个连接上最多的请求数
+    uint32_t m_maxRequest;
+    /// 解析好的目标地址
+    Address::ptr m_addr;
+
+    /// 互斥锁
+    MutexType m_mutex;
+    /// 空闲连接,最近放回的在后面
+    std::list<HttpConnection*> m_conns;
+    /// 连接总数
+    std::atomic<int32_t> m_total = {0};
+    /// 新建连接的次数
+    std::atomic<uint64_t> m_createCount = {0};
+};
+
+}
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "http_parser.h"
+#include "http_scanner.h"
 #include "sylar/log.h"
 #include "sylar/config.h"
 #include <string.h>
@@ -16,6 +17,14 @@ static hr::ConfigVar<uint64_t>::ptr g_http_request_max_body_size =
     hr::Config::Lookup("http.request.max_body_size"
                 ,(uint64_t)(64 * 1024 * 1024), "http request max body size");
 
+static hr::ConfigVar<uint64_t>::ptr g_http_request_stream_threshold =
+    hr::Config::Lookup("http.request.stream_threshold"
+                ,(uint64_t)(1024 * 1024), "http request body larger than this is streamed");
+
+static hr::ConfigVar<uint64_t>::ptr g_http_request_max_stream_size =
+    hr::Config::Lookup("http.request.max_stream_size"
+                ,(uint64_t)(1024 * 1024 * 1024), "http request streamed body max size");
+
 static hr::ConfigVar<uint64_t>::ptr g_http_response_buffer_size =
     hr::Config::Lookup("http.response.buffer_size"
                 ,(uint64_t)(4 * 1024), "http response buffer size");
@@ -26,6 +35,8 @@ static hr::ConfigVar<uint64_t>::ptr g_http_response_max_body_size =
 
 static uint64_t s_http_request_buffer_size = 0;
 static uint64_t s_http_request_max_body_size = 0;
+static uint64_t s_http_request_stream_threshold = 0;
+static uint64_t s_http_request_max_stream_size = 0;
 static uint64_t s_http_response_buffer_size = 0;
 static uint64_t s_http_response_max_body_size = 0;
 
@@ -37,6 +48,14 @@ uint64_t HttpRequestParser::GetHttpRequestMaxBodySize() {
     return s_http_request_max_body_size;
 }
 
+uint64_t HttpRequestParser::GetHttpRequestStreamThreshold() {
+    return s_http_request_stream_threshold;
+}
+
+uint64_t HttpRequestParser::GetHttpRequestMaxStreamSize() {
+    return s_http_request_max_stream_size;
+}
+
 uint64_t HttpResponseParser::GetHttpResponseBufferSize() {
     return s_http_response_buffer_size;
 }
@@ -51,6 +70,8 @@ struct _RequestSizeIniter {
     _RequestSizeIniter() {
         s_http_request_buffer_size = g_http_request_buffer_size->getValue();
         s_http_request_max_body_size = g_http_request_max_body_size->getValue();
+        s_http_request_stream_threshold = g_http_request_stream_threshold->getValue();
+        s_http_request_max_stream_size = g_http_request_max_stream_size->getValue();
         s_http_response_buffer_size = g_http_response_buffer_size->getValue();
         s_http_response_max_body_size = g_http_response_max_body_size->getValue();
 
@@ -64,6 +85,16 @@ struct _RequestSizeIniter {
                 s_http_request_max_body_size = nv;
         });
 
+        g_http_request_stream_threshold->addListener(
+                [](const uint64_t& ov, const uint64_t& nv){
+                s_http_request_stream_threshold = nv;
+        });
+
+        g_http_request_max_stream_size->addListener(
+                [](const uint64_t& ov, const uint64_t& nv){
+                s_http_request_max_stream_size = nv;
+        });
+
         g_http_response_buffer_size->addListener(
                 [](const uint64_t& ov, const uint64_t& nv){
                 s_http_response_buffer_size = nv;
@@ -138,12 +169,17 @@ void on_request_http_field(void *data, const char *field, size_t flen
         //parser->setError(1002);
         return;
     }
-    parser->getData()->setHeader(std::string(field, flen)
-                                ,std::string(value, vlen));
+    if(parser->isView()) {
+        parser->getData()->setHeaderView(field, flen, value, vlen);
+    } else {
+        parser->getData()->setHeader(std::string(field, flen)
+                                    ,std::string(value, vlen));
+    }
 }
 
 HttpRequestParser::HttpRequestParser()
-    :m_error(0) {
+    :m_error(0)
+    ,m_view(false) {
     m_data.reset(new hr::http::HttpRequest);
     http_parser_init(&m_parser);
     m_parser.request_method = on_request_method;
@@ -165,11 +201,29 @@ uint64_t HttpRequestParser::getContentLength() {
 //-1: 有错误
 //>0: 已处理的字节数，且data有效数据为len - v;
 size_t HttpRequestParser::execute(char* data, size_t len) {
+    //解析后数据会被移动，头部要复制
+    m_view = false;
     size_t offset = http_parser_execute(&m_parser, data, len, 0);
     memmove(data, data + offset, (len - offset));
     return offset;
 }
 
+size_t HttpRequestParser::parse(const char* data, size_t len) {
+    m_view = true;
+    //完整的请求头先快速扫描,不支持的格式再交给Ragel解析
+    size_t rt = HttpScanner::Scan(&m_parser, data, len);
+    if(rt) {
+        return rt;
+    }
+    return http_parser_execute(&m_parser, data, len, 0);
+}
+
+void HttpRequestParser::reset() {
+    m_data = std::make_shared<hr::http::HttpRequest>();
+    http_parser_init(&m_parser);
+    m_error = 0;
+}
+
 int HttpRequestParser::isFinished() {
     return http_parser_finish(&m_parser);
 }
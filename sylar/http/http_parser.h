@@ -38,6 +38,21 @@ public:
      */
     size_t execute(char* data, size_t len);
 
+    /**
+     * @brief 解析协议，不移动数据
+     * @details 头部的名字和值直接引用data,调用方要保证HttpRequest使用期间data有效
+     *          (HttpRequest::setHeaderHolder)
+     * @param[in] data 协议文本内存
+     * @param[in] len 协议文本内存长度
+     * @return 返回实际解析的长度
+     */
+    size_t parse(const char* data, size_t len);
+
+    /**
+     * @brief 重置解析状态和HttpRequest，用于解析同一连接上的下一个请求
+     */
+    void reset();
+
     /**
      * @brief 是否解析完成
      * @return 是否解析完成
@@ -61,6 +76,11 @@ public:
      */
     void setError(int v) { m_error = v;}
 
+    /**
+     * @brief 头部是否直接引用解析的数据
+     */
+    bool isView() const { return m_view;}
+
     /**
      * @brief 获取消息体长度
      */
@@ -80,6 +100,18 @@ public:
      * @brief 返回HttpRequest协议的最大消息体大小
      */
     static uint64_t GetHttpRequestMaxBodySize();
+
+    /**
+     * @brief 返回HttpRequest消息体改为流式读取的大小
+     * @details 超过这个大小的消息体不读进内存,由处理函数通过HttpRequest::getBodyStream读取
+     */
+    static uint64_t GetHttpRequestStreamThreshold();
+
+    /**
+     * @brief 返回HttpRequest流式消息体的最大大小
+     * @details Content-Length超过时直接关闭连接,chunked消息体读到超过时HttpBodyStream::read返回错误
+     */
+    static uint64_t GetHttpRequestMaxStreamSize();
 private:
     /// http_parser
     http_parser m_parser;
@@ -90,6 +122,8 @@ private:
     /// 1001: invalid version
     /// 1002: invalid field
     int m_error;
+    /// 头部是否直接引用解析的数据
+    bool m_view;
 };
 
 /**
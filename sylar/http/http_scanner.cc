@@ -0,0 +1,429 @@
+#include "http_scanner.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include <ctype.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HR_HTTP_SCANNER_X86 1
+#endif
+
+namespace hr {
+namespace http {
+
+static hr::Logger::ptr g_logger = HR_LOG_NAME("system");
+
+static hr::ConfigVar<std::string>::ptr g_http_request_scanner =
+    hr::Config::Lookup("http.request.scanner"
+                ,std::string("auto"), "http request header scanner: auto, avx2, sse4.2, scalar, ragel");
+
+//字符分类
+enum {
+    /// 头部名字(token)
+    CHAR_TOKEN = 0x1,
+    /// URI(pchar | "/" | "?",不含"#")
+    CHAR_URI = 0x2,
+    /// 头部值(除\t以外的控制字符都不是)
+    CHAR_VALUE = 0x4
+};
+
+static uint8_t s_char_map[256];
+
+//AVX2查表用: 低4位为下标,第hi位表示(hi << 4 | lo)属于该分类
+static uint8_t s_token_bitmap[16] __attribute__((aligned(16)));
+static uint8_t s_uri_bitmap[16] __attribute__((aligned(16)));
+static uint8_t s_value_bitmap[16] __attribute__((aligned(16)));
+
+//SSE4.2 pcmpestri用的区间,区间内的字符不属于该分类
+//token的区间和picohttpparser一样是超集('|'和'~'也在里面),命中后再查表确认
+static const char s_token_ranges[17] __attribute__((aligned(16))) =
+    "\x00 \"\"()"",,//:@[]{\xff";
+static const char s_uri_ranges[17] __attribute__((aligned(16))) =
+    "\x00\x20\x22\x23<<>>\x5b\x5e``{}\x7f\x7f";
+static const char s_value_ranges[16] __attribute__((aligned(16))) =
+    "\x00\x08\x0a\x1f\x7f\x7f";
+
+static bool s_support_sse42 = false;
+static bool s_support_avx2 = false;
+static HttpScanner::Type s_type = HttpScanner::SCALAR;
+
+static void InitCharMap() {
+    const char* separators = "()<>@,;:\\\"/[]?={} \t";
+    for(int i = 0x21; i < 0x7f; ++i) {
+        if(!strchr(separators, i)) {
+            s_char_map[i] |= CHAR_TOKEN;
+        }
+    }
+    const char* uri = "-._~!$&'()*+,;=:@/?%";
+    for(int i = 0; i < 256; ++i) {
+        if(i >= 0x80 || isalnum(i) || (i && strchr(uri, i))) {
+            s_char_map[i] |= CHAR_URI;
+        }
+        if(i >= 0x20 && i != 0x7f) {
+            s_char_map[i] |= CHAR_VALUE;
+        }
+    }
+    s_char_map[(uint8_t)'\t'] |= CHAR_VALUE;
+
+    for(int lo = 0; lo < 16; ++lo) {
+        for(int hi = 0; hi < 8; ++hi) {
+            uint8_t c = s_char_map[hi << 4 | lo];
+            if(c & CHAR_TOKEN) {
+                s_token_bitmap[lo] |= 1 << hi;
+            }
+            if(c & CHAR_URI) {
+                s_uri_bitmap[lo] |= 1 << hi;
+            }
+            if(c & CHAR_VALUE) {
+                s_value_bitmap[lo] |= 1 << hi;
+            }
+        }
+    }
+}
+
+static HttpScanner::Type TypeFromString(const std::string& v) {
+    if(v == "avx2") {
+        return HttpScanner::AVX2;
+    } else if(v == "sse4.2" || v == "sse42") {
+        return HttpScanner::SSE42;
+    } else if(v == "scalar") {
+        return HttpScanner::SCALAR;
+    } else if(v == "ragel") {
+        return HttpScanner::RAGEL;
+    } else if(v != "auto") {
+        HR_LOG_WARN(g_logger) << "invalid http.request.scanner: " << v;
+    }
+    return HttpScanner::AVX2;
+}
+
+namespace {
+struct _ScannerIniter {
+    _ScannerIniter() {
+        InitCharMap();
+#ifdef HR_HTTP_SCANNER_X86
+        __builtin_cpu_init();
+        s_support_sse42 = __builtin_cpu_supports("sse4.2");
+        s_support_avx2 = __builtin_cpu_supports("avx2");
+#endif
+        HttpScanner::SetType(TypeFromString(g_http_request_scanner->getValue()));
+        g_http_request_scanner->addListener(
+                [](const std::string& ov, const std::string& nv){
+                HttpScanner::SetType(TypeFromString(nv));
+        });
+    }
+};
+static _ScannerIniter _init;
+}
+
+/**
+ * 查找第一个不属于分类bit的字符,没有时返回end
+ */
+template<uint8_t bit>
+static inline const char* FindEndScalar(const char* p, const char* end) {
+    while(p < end && (s_char_map[(uint8_t)*p] & bit)) {
+        ++p;
+    }
+    return p;
+}
+
+#ifdef HR_HTTP_SCANNER_X86
+template<uint8_t bit>
+__attribute__((target("sse4.2")))
+static const char* FindEndSSE42(const char* p, const char* end
+                                ,const char* ranges, int ranges_len) {
+    __m128i r = _mm_load_si128((const __m128i*)ranges);
+    while(end - p >= 16) {
+        __m128i b = _mm_loadu_si128((const __m128i*)p);
+        int idx = _mm_cmpestri(r, ranges_len, b, 16
+                    ,_SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if(idx == 16) {
+            p += 16;
+            continue;
+        }
+        p += idx;
+        if(!(s_char_map[(uint8_t)*p] & bit)) {
+            return p;
+        }
+        ++p;
+    }
+    return FindEndScalar<bit>(p, end);
+}
+
+//bitmap[lo]的第hi位表示字符是否属于分类,高位为1的字符(>=0x80)由high决定
+template<uint8_t bit>
+__attribute__((target("avx2")))
+static const char* FindEndAVX2(const char* p, const char* end, const uint8_t* bitmap) {
+    const __m256i table = _mm256_broadcastsi128_si256(
+                            _mm_load_si128((const __m128i*)bitmap));
+    const __m256i bits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128
+                            ,0, 0, 0, 0, 0, 0, 0, 0
+                            ,1, 2, 4, 8, 16, 32, 64, -128
+                            ,0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i zero = _mm256_setzero_si256();
+    const bool high = s_char_map[0x80] & bit;
+    while(end - p >= 32) {
+        __m256i b = _mm256_loadu_si256((const __m256i*)p);
+        __m256i row = _mm256_shuffle_epi8(table, _mm256_and_si256(b, nibble));
+        __m256i col = _mm256_shuffle_epi8(bits
+                        ,_mm256_and_si256(_mm256_srli_epi16(b, 4), nibble));
+        __m256i miss = _mm256_cmpeq_epi8(_mm256_and_si256(row, col), zero);
+        if(high) {
+            miss = _mm256_andnot_si256(_mm256_cmpgt_epi8(zero, b), miss);
+        }
+        uint32_t mask = _mm256_movemask_epi8(miss);
+        if(mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return FindEndScalar<bit>(p, end);
+}
+#endif
+
+struct ScalarKernel {
+    static const char* token(const char* p, const char* end) {
+        return FindEndScalar<CHAR_TOKEN>(p, end);
+    }
+    static const char* uri(const char* p, const char* end) {
+        return FindEndScalar<CHAR_URI>(p, end);
+    }
+    static const char* value(const char* p, const char* end) {
+        return FindEndScalar<CHAR_VALUE>(p, end);
+    }
+};
+
+#ifdef HR_HTTP_SCANNER_X86
+struct SSE42Kernel {
+    static const char* token(const char* p, const char* end) {
+        return FindEndSSE42<CHAR_TOKEN>(p, end, s_token_ranges, 16);
+    }
+    static const char* uri(const char* p, const char* end) {
+        return FindEndSSE42<CHAR_URI>(p, end, s_uri_ranges, 16);
+    }
+    static const char* value(const char* p, const char* end) {
+        return FindEndSSE42<CHAR_VALUE>(p, end, s_value_ranges, 6);
+    }
+};
+
+struct AVX2Kernel {
+    static const char* token(const char* p, const char* end) {
+        return FindEndAVX2<CHAR_TOKEN>(p, end, s_token_bitmap);
+    }
+    static const char* uri(const char* p, const char* end) {
+        return FindEndAVX2<CHAR_URI>(p, end, s_uri_bitmap);
+    }
+    static const char* value(const char* p, const char* end) {
+        return FindEndAVX2<CHAR_VALUE>(p, end, s_value_bitmap);
+    }
+};
+#endif
+
+static inline bool IsXDigit(char c) {
+    return (c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+namespace {
+struct Field {
+    const char* name;
+    size_t name_len;
+    const char* value;
+    size_t value_len;
+};
+}
+
+//超过这个数量的头部交给Ragel解析器
+static const size_t s_max_fields = 64;
+
+/**
+ * 先完整校验请求头并记录各部分的位置,全部通过后再调用回调,
+ * 中途发现不支持的格式直接返回0,不会留下解析了一半的状态
+ */
+template<class Kernel>
+static size_t DoScan(http_parser* parser, const char* data, size_t len) {
+    const char* p = data;
+    const char* end = data + len;
+
+    //Method = (upper | digit){1,20}
+    const char* method = p;
+    while(p < end && p - method <= 20
+            && ((*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9'))) {
+        ++p;
+    }
+    size_t method_len = p - method;
+    if(method_len == 0 || method_len > 20 || p >= end || *p != ' ') {
+        return 0;
+    }
+    ++p;
+
+    //只处理"/"开头的URI,"//"开头的是authority
+    if(end - p < 2 || p[0] != '/' || p[1] == '/') {
+        return 0;
+    }
+    const char* uri = p;
+    p = Kernel::uri(p, end);
+    const char* uri_end = p;
+    const char* fragment = nullptr;
+    if(p < end && *p == '#') {
+        fragment = ++p;
+        p = Kernel::uri(p, end);
+    }
+    const char* fragment_end = p;
+    if(p >= end || *p != ' ') {
+        return 0;
+    }
+    for(const char* pct = (const char*)memchr(uri, '%', p - uri); pct;
+            pct = (const char*)memchr(pct + 1, '%', p - pct - 1)) {
+        if(p - pct < 3 || !IsXDigit(pct[1]) || !IsXDigit(pct[2])) {
+            return 0;
+        }
+    }
+    const char* query = (const char*)memchr(uri, '?', uri_end - uri);
+    ++p;
+
+    //HTTP/1.0 或 HTTP/1.1
+    if(end - p < 10 || memcmp(p, "HTTP/1.", 7) != 0
+            || (p[7] != '0' && p[7] != '1') || p[8] != '\r' || p[9] != '\n') {
+        return 0;
+    }
+    const char* version = p;
+    p += 10;
+
+    Field fields[s_max_fields];
+    size_t nfields = 0;
+    while(true) {
+        if(p >= end) {
+            return 0;
+        }
+        if(*p == '\r') {
+            if(end - p < 2 || p[1] != '\n') {
+                return 0;
+            }
+            p += 2;
+            break;
+        }
+        const char* name = p;
+        p = Kernel::token(p, end);
+        if(p == name || p >= end || *p != ':') {
+            return 0;
+        }
+        size_t name_len = p - name;
+        ++p;
+        while(p < end && (*p == ' ' || *p == '\t')) {
+            ++p;
+        }
+        const char* value = p;
+        p = Kernel::value(p, end);
+        //空值、单独的\n和折行都交给Ragel
+        if(p == value || end - p < 3 || p[0] != '\r' || p[1] != '\n'
+                || p[2] == ' ' || p[2] == '\t' || nfields == s_max_fields) {
+            return 0;
+        }
+        Field& f = fields[nfields++];
+        f.name = name;
+        f.name_len = name_len;
+        f.value = value;
+        f.value_len = p - value;
+        p += 2;
+    }
+
+    size_t body_start = p - data;
+    void* cb_data = parser->data;
+    if(parser->request_method) {
+        parser->request_method(cb_data, method, method_len);
+    }
+    if(parser->request_path) {
+        parser->request_path(cb_data, uri, (query ? query : uri_end) - uri);
+    }
+    if(query && parser->query_string) {
+        parser->query_string(cb_data, query + 1, uri_end - query - 1);
+    }
+    if(parser->request_uri) {
+        parser->request_uri(cb_data, uri, uri_end - uri);
+    }
+    if(fragment && parser->fragment) {
+        parser->fragment(cb_data, fragment, fragment_end - fragment);
+    }
+    if(parser->http_version) {
+        parser->http_version(cb_data, version, 8);
+    }
+    if(parser->http_field) {
+        for(size_t i = 0; i < nfields; ++i) {
+            parser->http_field(cb_data, fields[i].name, fields[i].name_len
+                               ,fields[i].value, fields[i].value_len);
+        }
+    }
+    http_parser_set_finished(parser, body_start);
+    if(parser->header_done) {
+        parser->header_done(cb_data, data + body_start, len - body_start);
+    }
+    return body_start;
+}
+
+size_t HttpScanner::Scan(http_parser* parser, const char* data, size_t len) {
+    return Scan(s_type, parser, data, len);
+}
+
+size_t HttpScanner::Scan(Type type, http_parser* parser, const char* data, size_t len) {
+    //只处理还没开始解析的http_parser
+    if(parser->nread || http_parser_has_error(parser)
+            || http_parser_is_finished(parser)) {
+        return 0;
+    }
+    switch(type) {
+        case SCALAR:
+            return DoScan<ScalarKernel>(parser, data, len);
+#ifdef HR_HTTP_SCANNER_X86
+        case SSE42:
+            return s_support_sse42 ? DoScan<SSE42Kernel>(parser, data, len) : 0;
+        case AVX2:
+            return s_support_avx2 ? DoScan<AVX2Kernel>(parser, data, len) : 0;
+#endif
+        default:
+            return 0;
+    }
+}
+
+HttpScanner::Type HttpScanner::GetType() {
+    return s_type;
+}
+
+void HttpScanner::SetType(Type type) {
+    if(type == AVX2 && !s_support_avx2) {
+        type = SSE42;
+    }
+    if(type == SSE42 && !s_support_sse42) {
+        type = SCALAR;
+    }
+    s_type = type;
+}
+
+bool HttpScanner::IsSupported(Type type) {
+    switch(type) {
+        case AVX2:
+            return s_support_avx2;
+        case SSE42:
+            return s_support_sse42;
+        default:
+            return true;
+    }
+}
+
+const char* HttpScanner::TypeToString(Type type) {
+    switch(type) {
+        case RAGEL:
+            return "ragel";
+        case SCALAR:
+            return "scalar";
+        case SSE42:
+            return "sse4.2";
+        case AVX2:
+            return "avx2";
+        default:
+            return "unknown";
+    }
+}
+
+}
+}
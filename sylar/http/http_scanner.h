@@ -0,0 +1,78 @@
+/**
+ * @file http_scanner.h
+ * @brief HTTP请求头快速扫描
+ */
+#ifndef __SYLAR_HTTP_SCANNER_H__
+#define __SYLAR_HTTP_SCANNER_H__
+
+#include "http11_parser.h"
+#include <stddef.h>
+
+namespace hr {
+namespace http {
+
+/**
+ * @brief HTTP请求头快速扫描
+ * @details 参考picohttpparser,用SSE4.2/AVX2一次检查16/32个字节,找到\r\n和':'的位置,
+ *          然后按Ragel解析器相同的顺序调用http_parser上的回调。
+ *          只处理常见格式(origin-form的URI,\r\n换行,没有折行),
+ *          其他情况返回0,由Ragel解析器处理,所以结果和Ragel解析器一致。
+ *          使用的指令集在运行时检测,可以通过配置http.request.scanner指定
+ */
+class HttpScanner {
+public:
+    /**
+     * @brief 扫描实现
+     */
+    enum Type {
+        /// 不扫描,全部交给Ragel解析器
+        RAGEL = 0,
+        /// 逐字节查表
+        SCALAR = 1,
+        /// SSE4.2 pcmpestri,一次16字节
+        SSE42 = 2,
+        /// AVX2 pshufb查表,一次32字节
+        AVX2 = 3
+    };
+
+    /**
+     * @brief 解析完整的请求头
+     * @param[in] parser 刚初始化的http_parser,成功后处于完成状态
+     * @param[in] data 请求数据,需要包含结尾的空行
+     * @param[in] len 数据长度
+     * @return 成功返回请求头长度(包括结尾的空行),
+     *         返回0表示格式不在快速路径内,没有调用任何回调
+     */
+    static size_t Scan(http_parser* parser, const char* data, size_t len);
+
+    /**
+     * @brief 用指定的实现解析完整的请求头
+     * @details 当前CPU不支持的实现返回0
+     */
+    static size_t Scan(Type type, http_parser* parser, const char* data, size_t len);
+
+    /**
+     * @brief 返回当前使用的实现
+     */
+    static Type GetType();
+
+    /**
+     * @brief 设置使用的实现,当前CPU不支持时使用支持的最好实现
+     */
+    static void SetType(Type type);
+
+    /**
+     * @brief 当前CPU是否支持该实现
+     */
+    static bool IsSupported(Type type);
+
+    /**
+     * @brief 返回实现的名字
+     */
+    static const char* TypeToString(Type type);
+};
+
+}
+}
+
+#endif
@@ -1,4 +1,5 @@
 #include "http_server.h"
+#include "sylar/config.h"
 #include "sylar/log.h"
 
 
@@ -7,6 +8,25 @@ namespace http {
 
 static hr::Logger::ptr g_logger = HR_LOG_NAME("system");
 
+static hr::ConfigVar<uint32_t>::ptr g_http_pipeline_max =
+    hr::Config::Lookup("http.server.pipeline_max"
+                ,(uint32_t)64, "http server max pipelined responses per writev");
+
+static uint32_t s_http_pipeline_max = 0;
+
+namespace {
+struct _PipelineIniter {
+    _PipelineIniter() {
+        s_http_pipeline_max = g_http_pipeline_max->getValue();
+        g_http_pipeline_max->addListener(
+                [](const uint32_t& ov, const uint32_t& nv){
+                s_http_pipeline_max = nv;
+        });
+    }
+};
+static _PipelineIniter _init;
+}
+
 HttpServer::HttpServer(bool keepalive
                ,hr::IOManager* worker
                ,hr::IOManager* io_worker
@@ -25,11 +45,27 @@ void HttpServer::setName(const std::string& v) {
     m_dispatch->setDefault(std::make_shared<NotFoundServlet>(v));
 }
 
+void HttpServer::rejectClient(Socket::ptr client) {
+    //新连接的发送缓冲区是空的,写入不会挂起接收协程
+    static const std::string s_rsp = "HTTP/1.1 503 Service Unavailable\r\n"
+        "Connection: close\r\nContent-Length: 0\r\n\r\n";
+    client->send(s_rsp.c_str(), s_rsp.size());
+    client->close();
+}
+
 void HttpServer::handleClient(Socket::ptr client) {
     HR_LOG_DEBUG(g_logger) << "handleClient " << *client;
     HttpSession::ptr session(new HttpSession(client));
+    ClientState::ptr state = getClientState(client);
+    bool first = true;
     do {
+        //长连接等待下一个请求时是空闲的,drain时直接结束;新连接的第一个请求总是处理
+        if(!first && !session->hasBufferedData() && !setClientIdle(state, true)) {
+            break;
+        }
+        first = false;
         auto req = session->recvRequest();
+        setClientIdle(state, false);
         if(!req) {
             HR_LOG_DEBUG(g_logger) << "recv http request fail, errno="
                 << errno << " errstr=" << strerror(errno)
@@ -37,13 +73,44 @@ void HttpServer::handleClient(Socket::ptr client) {
             break;
         }
 
-        HttpResponse::ptr rsp(new HttpResponse(req->getVersion()
-                            ,req->isClose() || !m_isKeepalive));
+        bool close = req->isClose() || !m_isKeepalive || isDraining();
+        HttpResponse::ptr rsp(new HttpResponse(req->getVersion(), close));
         rsp->setHeader("Server", getName());
         m_dispatch->handle(req, rsp, session);
-        session->sendResponse(rsp);
 
-        if(!m_isKeepalive || req->isClose()) {
+        //处理期间开始drain,这个响应之后关闭连接
+        if(!close && isDraining()) {
+            close = true;
+            rsp->setClose(true);
+        }
+
+        //流式的消息体没有读完时不再读下一个请求,直接关闭连接
+        auto body = session->getBodyStream();
+        if(body && !body->isFinished()) {
+            close = true;
+            rsp->setClose(true);
+        }
+
+        //流式响应已经直接发送,结束最后一个chunk,不进入发送队列
+        auto out = session->getResponseStream();
+        if(out) {
+            if(out->finish() <= 0 || close || out->isClose()) {
+                break;
+            }
+            continue;
+        }
+
+        //pipeline: 缓冲区里还有完整的请求头时先处理，响应按顺序攒起来一起写
+        //后面请求的消息体还没到时，recvRequest读连接之前会先发出攒着的响应
+        session->queueResponse(rsp);
+        if(close || !session->hasBufferedRequest()
+                || session->getQueuedResponses() >= s_http_pipeline_max) {
+            if(session->flushResponses() <= 0) {
+                break;
+            }
+        }
+
+        if(close) {
             break;
         }
     } while(true);
@@ -49,6 +49,11 @@ public:
     virtual void setName(const std::string& v) override;
 protected:
     virtual void handleClient(Socket::ptr client) override;
+
+    /**
+     * @brief 超过最大连接数时回复503再关闭,客户端可以换个实例重试
+     */
+    virtual void rejectClient(Socket::ptr client) override;
 private:
     /// 是否支持长连接
     bool m_isKeepalive;
@@ -1,76 +1,682 @@
 #include "http_session.h"
 #include "http_parser.h"
+#include "sylar/config.h"
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <sys/uio.h>
 
 namespace hr {
 namespace http {
 
+static hr::ConfigVar<uint32_t>::ptr g_http_response_chunk_size =
+    hr::Config::Lookup("http.response.chunk_size"
+                ,(uint32_t)(16 * 1024), "http streaming response small writes are merged up to this size");
+
+static uint32_t s_http_response_chunk_size = 0;
+
+namespace {
+struct _ChunkSizeIniter {
+    _ChunkSizeIniter() {
+        s_http_response_chunk_size = g_http_response_chunk_size->getValue();
+        g_http_response_chunk_size->addListener(
+                [](const uint32_t& ov, const uint32_t& nv){
+                s_http_response_chunk_size = nv;
+        });
+    }
+};
+static _ChunkSizeIniter _init;
+}
+
+//chunk大小和trailer一行的最大长度
+static const size_t s_max_chunk_line = 1024;
+
+HttpBodyStream::HttpBodyStream(HttpSession* session, uint64_t length, bool chunked)
+    :m_session(session)
+    ,m_length(length)
+    ,m_readSize(0)
+    ,m_maxSize(HttpRequestParser::GetHttpRequestMaxStreamSize())
+    ,m_chunkLeft(0)
+    ,m_prefixOffset(0)
+    ,m_chunked(chunked)
+    ,m_chunkEnd(false)
+    ,m_finished(!chunked && length == 0)
+    ,m_error(false) {
+}
+
+int HttpBodyStream::readChunkSize() {
+    std::string line;
+    if(m_chunkEnd) {
+        //上一个chunk数据后面的\r\n
+        if(m_session->readLine(line, s_max_chunk_line) <= 0 || !line.empty()) {
+            return -1;
+        }
+        m_chunkEnd = false;
+    }
+    if(m_session->readLine(line, s_max_chunk_line) <= 0) {
+        return -1;
+    }
+    //chunk-size [; chunk-ext]
+    uint64_t size = 0;
+    size_t i = 0;
+    for(; i < line.size(); ++i) {
+        char c = line[i];
+        int v = 0;
+        if(c >= '0' && c <= '9') {
+            v = c - '0';
+        } else if((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            v = (c | 0x20) - 'a' + 10;
+        } else {
+            break;
+        }
+        if(i >= 15) {
+            return -1;
+        }
+        size = size << 4 | v;
+    }
+    if(i == 0 || (i < line.size() && line[i] != ';' && line[i] != ' ' && line[i] != '\t')) {
+        return -1;
+    }
+    if(size > 0) {
+        if(size > m_maxSize - m_readSize) {
+            //chunked没有总长度,只能读到超过时报错
+            errno = EMSGSIZE;
+            return -1;
+        }
+        m_chunkLeft = size;
+        m_chunkEnd = true;
+        return 1;
+    }
+    //最后一个chunk,跳过trailer直到空行
+    do {
+        if(m_session->readLine(line, s_max_chunk_line) <= 0) {
+            return -1;
+        }
+    } while(!line.empty());
+    m_finished = true;
+    return 0;
+}
+
+int HttpBodyStream::read(void* buffer, size_t length) {
+    if(m_prefixOffset < m_prefix.size()) {
+        size_t n = std::min(length, m_prefix.size() - m_prefixOffset);
+        memcpy(buffer, &m_prefix[m_prefixOffset], n);
+        m_prefixOffset += n;
+        if(m_prefixOffset == m_prefix.size()) {
+            std::string().swap(m_prefix);
+            m_prefixOffset = 0;
+        }
+        return n;
+    }
+    if(m_finished) {
+        return 0;
+    }
+    if(m_error || !m_session || length == 0) {
+        return -1;
+    }
+    uint64_t left = 0;
+    if(m_chunked) {
+        if(m_chunkLeft == 0) {
+            int rt = readChunkSize();
+            if(rt <= 0) {
+                m_error = rt < 0;
+                return rt;
+            }
+        }
+        left = m_chunkLeft;
+    } else {
+        left = m_length - m_readSize;
+    }
+    int rt = m_session->readBuffered(buffer, std::min((uint64_t)length, left));
+    if(rt <= 0) {
+        //消息体没读完连接就断了
+        m_error = true;
+        return -1;
+    }
+    m_readSize += rt;
+    if(m_chunked) {
+        m_chunkLeft -= rt;
+    } else if(m_readSize == m_length) {
+        m_finished = true;
+    }
+    return rt;
+}
+
+int HttpBodyStream::read(ByteArray::ptr ba, size_t length) {
+    std::vector<iovec> iovs;
+    ba->getWriteBuffers(iovs, length);
+    if(iovs.empty()) {
+        return -1;
+    }
+    int rt = read(iovs[0].iov_base, iovs[0].iov_len);
+    if(rt > 0) {
+        ba->setPosition(ba->getPosition() + rt);
+    }
+    return rt;
+}
+
+void HttpBodyStream::close() {
+    m_session = nullptr;
+}
+
+HttpResponseStream::HttpResponseStream(HttpSession* session, HttpResponse::ptr rsp)
+    :m_session(session)
+    ,m_rsp(rsp)
+    ,m_writeSize(0)
+    ,m_chunks(0)
+    ,m_headSent(false)
+    ,m_finished(false)
+    ,m_error(false) {
+}
+
+int HttpResponseStream::send(const char* data, size_t length, bool last) {
+    if(!m_session) {
+        m_error = true;
+        return -1;
+    }
+    std::vector<iovec> iovs;
+    iovec iov;
+    if(!m_headSent) {
+        //头部在第一次发送时才序列化,之前处理函数还可以修改
+        m_rsp->dumpHeader(m_head);
+        iov.iov_base = &m_head[0];
+        iov.iov_len = m_head.size();
+        iovs.push_back(iov);
+    }
+    bool chunked = isChunked();
+    size_t total = m_pending.size() + length;
+    char size[32];
+    if(total && chunked) {
+        iov.iov_base = size;
+        iov.iov_len = snprintf(size, sizeof(size), "%zx\r\n", total);
+        iovs.push_back(iov);
+    }
+    if(!m_pending.empty()) {
+        iov.iov_base = &m_pending[0];
+        iov.iov_len = m_pending.size();
+        iovs.push_back(iov);
+    }
+    if(length) {
+        iov.iov_base = (void*)data;
+        iov.iov_len = length;
+        iovs.push_back(iov);
+    }
+    if(chunked) {
+        static const char s_tail[] = "\r\n0\r\n\r\n";
+        //chunk结尾的\r\n,最后再加上结束的chunk
+        size_t offset = total ? 0 : 2;
+        size_t len = (total ? 2 : 0) + (last ? 5 : 0);
+        if(len) {
+            iov.iov_base = (void*)(s_tail + offset);
+            iov.iov_len = len;
+            iovs.push_back(iov);
+        }
+    }
+    if(iovs.empty()) {
+        return 1;
+    }
+    int rt = m_session->sendIovecs(iovs);
+    if(rt <= 0) {
+        m_error = true;
+        return rt;
+    }
+    m_headSent = true;
+    std::string().swap(m_head);
+    m_pending.clear();
+    if(total) {
+        ++m_chunks;
+    }
+    return rt;
+}
+
+int HttpResponseStream::write(const void* buffer, size_t length) {
+    if(m_finished || m_error) {
+        return -1;
+    }
+    if(length == 0) {
+        return 0;
+    }
+    m_writeSize += length;
+    if(m_pending.size() + length < s_http_response_chunk_size) {
+        //小块先合并
+        m_pending.append((const char*)buffer, length);
+        return length;
+    }
+    //大块不复制,和缓冲区中的数据一起作为一个chunk发送
+    int rt = send((const char*)buffer, length, false);
+    return rt > 0 ? (int)length : rt;
+}
+
+int HttpResponseStream::write(ByteArray::ptr ba, size_t length) {
+    std::vector<iovec> iovs;
+    ba->getReadBuffers(iovs, length);
+    size_t total = 0;
+    for(auto& i : iovs) {
+        int rt = write(i.iov_base, i.iov_len);
+        if(rt <= 0) {
+            return rt;
+        }
+        total += rt;
+    }
+    ba->setPosition(ba->getPosition() + total);
+    return total;
+}
+
+int HttpResponseStream::flush() {
+    if(m_error) {
+        return -1;
+    }
+    if(m_finished || (m_headSent && m_pending.empty())) {
+        return 1;
+    }
+    return send(nullptr, 0, false);
+}
+
+int HttpResponseStream::finish() {
+    if(m_finished) {
+        return m_error ? -1 : 1;
+    }
+    m_finished = true;
+    if(m_error) {
+        return -1;
+    }
+    return send(nullptr, 0, true);
+}
+
 HttpSession::HttpSession(Socket::ptr sock, bool owner)
     :SocketStream(sock, owner) {
 }
 
-HttpRequest::ptr HttpSession::recvRequest() {
-    HttpRequestParser::ptr parser(new HttpRequestParser);
-    uint64_t buff_size = HttpRequestParser::GetHttpRequestBufferSize();
-    //uint64_t buff_size = 100;
-    std::shared_ptr<char> buffer(
-            new char[buff_size], [](char* ptr){
+HttpSession::~HttpSession() {
+    if(m_bodyStream) {
+        m_bodyStream->close();
+    }
+    if(m_responseStream) {
+        m_responseStream->m_session = nullptr;
+    }
+}
+
+HttpResponseStream::ptr HttpSession::startResponse(HttpResponse::ptr rsp) {
+    if(m_responseStream) {
+        return m_responseStream;
+    }
+    if(flushResponses() <= 0) {
+        return nullptr;
+    }
+    rsp->setStream(true);
+    if(rsp->getVersion() < 0x11) {
+        //HTTP/1.0没有chunked,靠关闭连接表示结束
+        rsp->setClose(true);
+    }
+    m_responseStream = std::make_shared<HttpResponseStream>(this, rsp);
+    return m_responseStream;
+}
+
+void HttpSession::prepareBuffer(size_t size) {
+    if(m_buffer && m_capacity == size && m_buffer.use_count() == 1) {
+        //其他线程释放请求对象之前对消息体的读取，要在之后写入缓冲区之前完成
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return;
+    }
+    //第一次使用、缓冲区大小配置修改、或者还被上一个请求引用
+    size_t cap = std::max(size, m_end - m_begin);
+    std::shared_ptr<char> buffer(new char[cap], [](char* ptr){
                 delete[] ptr;
             });
-    char* data = buffer.get();
-    int offset = 0;
-    do {
-        int len = read(data + offset, buff_size - offset);
-        if(len <= 0) {
+    if(m_end > m_begin) {
+        memcpy(buffer.get(), m_buffer.get() + m_begin, m_end - m_begin);
+    }
+    m_end -= m_begin;
+    m_begin = 0;
+    m_buffer = buffer;
+    m_capacity = cap;
+}
+
+void HttpSession::compactBuffer() {
+    if(m_begin == 0) {
+        return;
+    }
+    if(m_buffer.use_count() > 1) {
+        //请求的头部还引用着缓冲区，换一块新的
+        prepareBuffer(m_capacity);
+        return;
+    }
+    memmove(m_buffer.get(), m_buffer.get() + m_begin, m_end - m_begin);
+    m_end -= m_begin;
+    m_begin = 0;
+}
+
+int HttpSession::readSocket(void* buffer, size_t length) {
+    //读可能阻塞，先发出排队的响应，对端可能要收到响应才继续发送
+    int rt = flushResponses();
+    if(rt <= 0) {
+        return rt;
+    }
+    return read(buffer, length);
+}
+
+int HttpSession::fillBuffer() {
+    int len = readSocket(m_buffer.get() + m_end, m_capacity - m_end);
+    if(len > 0) {
+        m_end += len;
+    }
+    return len;
+}
+
+int HttpSession::readBuffered(void* buffer, size_t length) {
+    if(m_end == m_begin) {
+        if(m_buffer.use_count() == 1) {
+            m_begin = m_end = 0;
+        }
+        if(length >= m_capacity / 2 || m_end == m_capacity) {
+            //大块的读直接读到调用方的内存
+            return readSocket(buffer, length);
+        }
+        int rt = fillBuffer();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+    size_t n = std::min(length, m_end - m_begin);
+    memcpy(buffer, m_buffer.get() + m_begin, n);
+    m_begin += n;
+    return n;
+}
+
+int HttpSession::readLine(std::string& line, size_t max) {
+    size_t scan = m_begin;
+    while(true) {
+        const char* data = m_buffer.get();
+        const char* eol = (const char*)memmem(data + scan, m_end - scan, "\r\n", 2);
+        if(eol) {
+            line.assign(data + m_begin, eol - data - m_begin);
+            m_begin = eol + 2 - data;
+            return 1;
+        }
+        if(m_end - m_begin > max) {
+            return -1;
+        }
+        size_t offset = (m_end > m_begin ? m_end - 1 : m_begin) - m_begin;
+        if(m_end == m_capacity) {
+            compactBuffer();
+        }
+        scan = m_begin + offset;
+        int rt = fillBuffer();
+        if(rt <= 0) {
+            return rt;
+        }
+    }
+}
+
+bool HttpSession::discardBody() {
+    HttpBodyStream::ptr body = m_bodyStream;
+    m_bodyStream.reset();
+    if(!body->m_session) {
+        //调用过close,消息体的位置已经不确定
+        return body->isFinished();
+    }
+    char buf[4096];
+    int rt = 0;
+    while((rt = body->read(buf, sizeof(buf))) > 0);
+    body->close();
+    return rt == 0;
+}
+
+HttpRequest::ptr HttpSession::recvRequest() {
+    if(m_responseStream) {
+        m_responseStream->finish();
+        m_responseStream->m_session = nullptr;
+        m_responseStream.reset();
+    }
+    if(m_bodyStream && !discardBody()) {
+        close();
+        return nullptr;
+    }
+    //先释放上一个请求，它不再被使用时缓冲区可以复用
+    if(m_parser) {
+        m_parser->reset();
+    } else {
+        m_parser.reset(new HttpRequestParser);
+    }
+    prepareBuffer(HttpRequestParser::GetHttpRequestBufferSize());
+
+    //等待完整的请求头，上一次多读的数据可能已经包含
+    //compactBuffer可能换一块新的缓冲区，不能缓存m_buffer.get()
+    size_t scan = m_begin;
+    char* header_end = nullptr;
+    while(true) {
+        header_end = (char*)memmem(m_buffer.get() + scan, m_end - scan, "\r\n\r\n", 4);
+        if(header_end) {
+            break;
+        }
+        scan = m_end - m_begin >= 3 ? m_end - 3 : m_begin;
+        if(m_end - m_begin == m_capacity) {
+            uint64_t size = HttpRequestParser::GetHttpRequestBufferSize();
+            if(size <= m_capacity) {
+                //请求头超过缓冲区大小
+                close();
+                return nullptr;
+            }
+            //等待请求期间缓冲区大小配置改大了，换成新的大小继续读
+            size_t offset = scan - m_begin;
+            prepareBuffer(size);
+            scan = offset;
+        }
+        if(m_end == m_capacity) {
+            size_t offset = scan - m_begin;
+            compactBuffer();
+            scan = offset;
+        }
+        if(fillBuffer() <= 0) {
             close();
             return nullptr;
         }
-        len += offset;
-        size_t nparse = parser->execute(data, len);
-        if(parser->hasError()) {
+    }
+
+    size_t header_len = header_end + 4 - (m_buffer.get() + m_begin);
+    size_t nparse = m_parser->parse(m_buffer.get() + m_begin, header_len);
+    if(m_parser->hasError() || !m_parser->isFinished()) {
+        close();
+        return nullptr;
+    }
+    m_begin += nparse;
+
+    HttpRequest::ptr req = m_parser->getData();
+    req->setHeaderHolder(m_buffer);
+    StringPiece te;
+    bool chunked = false;
+    if(req->getHeaders().get(HttpHeaders::TRANSFER_ENCODING, te) && !te.empty()) {
+        //只支持chunked,其他编码(比如gzip, chunked)不支持
+        const char* begin = te.data;
+        const char* end = te.data + te.size;
+        while(begin < end && (*begin == ' ' || *begin == '\t')) {
+            ++begin;
+        }
+        while(end > begin && (end[-1] == ' ' || end[-1] == '\t')) {
+            --end;
+        }
+        if(!StringPiece(begin, end - begin).equalsIgnoreCase("chunked")) {
             close();
             return nullptr;
         }
-        offset = len - nparse;
-        if(offset == (int)buff_size) {
+        chunked = true;
+    }
+    uint64_t length = chunked ? 0 : m_parser->getContentLength();
+    uint64_t threshold = HttpRequestParser::GetHttpRequestStreamThreshold();
+    if(chunked) {
+        //读到threshold还没结束的chunked消息体改为流式读取,已读的部分先返回
+        m_bodyStream = std::make_shared<HttpBodyStream>(this, 0, true);
+        std::string body;
+        uint64_t max = std::min(threshold, HttpRequestParser::GetHttpRequestMaxBodySize());
+        int rt = 1;
+        while(body.size() < max) {
+            size_t offset = body.size();
+            body.resize(std::min(max, (uint64_t)offset + 16 * 1024));
+            rt = m_bodyStream->read(&body[offset], body.size() - offset);
+            body.resize(offset + std::max(rt, 0));
+            if(rt <= 0) {
+                break;
+            }
+        }
+        if(rt < 0) {
             close();
             return nullptr;
         }
-        if(parser->isFinished()) {
-            break;
-        }
-    } while(true);
-    int64_t length = parser->getContentLength();
-    if(length > 0) {
-        std::string body;
-        body.resize(length);
-
-        int len = 0;
-        if(length >= offset) {
-            memcpy(&body[0], data, offset);
-            len = offset;
+        if(m_bodyStream->isFinished()) {
+            m_bodyStream->close();
+            m_bodyStream.reset();
+            req->setBody(std::move(body));
         } else {
-            memcpy(&body[0], data, length);
-            len = length;
+            m_bodyStream->m_prefix.swap(body);
+            req->setBodyStream(m_bodyStream);
         }
-        length -= offset;
-        if(length > 0) {
-            if(readFixSize(&body[len], length) <= 0) {
+    } else if(length > threshold) {
+        if(length > HttpRequestParser::GetHttpRequestMaxStreamSize()) {
+            close();
+            return nullptr;
+        }
+        //大的消息体不读进内存,由处理函数从流中读取
+        m_bodyStream = std::make_shared<HttpBodyStream>(this, length, false);
+        req->setBodyStream(m_bodyStream);
+    } else if(length > 0) {
+        if(length > HttpRequestParser::GetHttpRequestMaxBodySize()) {
+            close();
+            return nullptr;
+        }
+        if(length <= m_capacity) {
+            //消息体放在缓冲区里，请求直接引用
+            if(m_begin + length > m_capacity) {
+                compactBuffer();
+            }
+            while(m_end - m_begin < length) {
+                if(fillBuffer() <= 0) {
+                    close();
+                    return nullptr;
+                }
+            }
+            req->setBodyView(m_buffer.get() + m_begin, length, m_buffer);
+            m_begin += length;
+        } else {
+            //消息体比缓冲区大，已读的部分一定不超过消息体
+            std::string body;
+            body.resize(length);
+            size_t len = m_end - m_begin;
+            memcpy(&body[0], m_buffer.get() + m_begin, len);
+            m_begin = m_end = 0;
+            if(flushResponses() <= 0 || readFixSize(&body[len], length - len) <= 0) {
                 close();
                 return nullptr;
             }
+            req->setBody(std::move(body));
+        }
+    }
+    if(m_begin == m_end && !m_bodyStream) {
+        m_begin = m_end = 0;
+    }
+
+    req->init();
+    return req;
+}
+
+bool HttpSession::hasBufferedRequest() const {
+    return m_end - m_begin >= 4
+        && memmem(m_buffer.get() + m_begin, m_end - m_begin, "\r\n\r\n", 4);
+}
+
+void HttpSession::queueResponse(HttpResponse::ptr rsp) {
+    Output out;
+    out.offset = m_outHeaders.size();
+    rsp->dumpHeader(m_outHeaders);
+    out.length = m_outHeaders.size() - out.offset;
+    out.rsp = rsp;
+    m_outputs.push_back(out);
+}
+
+int HttpSession::sendIovecs(std::vector<iovec>& iovs) {
+    int rt = 1;
+    size_t idx = 0;
+    while(idx < iovs.size()) {
+        int cnt = std::min(iovs.size() - idx, (size_t)IOV_MAX);
+        rt = getSocket()->send(&iovs[idx], cnt);
+        if(rt <= 0) {
+            return rt;
+        }
+        //跳过已经发送完的部分
+        size_t n = rt;
+        while(n > 0 && idx < iovs.size()) {
+            if(n >= iovs[idx].iov_len) {
+                n -= iovs[idx].iov_len;
+                ++idx;
+            } else {
+                iovs[idx].iov_base = (char*)iovs[idx].iov_base + n;
+                iovs[idx].iov_len -= n;
+                n = 0;
+            }
+        }
+        while(idx < iovs.size() && iovs[idx].iov_len == 0) {
+            ++idx;
         }
-        parser->getData()->setBody(body);
     }
+    return rt;
+}
 
-    parser->getData()->init();
-    return parser->getData();
+int HttpSession::sendFileFully(int fd, uint64_t offset, uint64_t length) {
+    off_t off = offset;
+    while(length > 0) {
+        int rt = getSocket()->sendFile(fd, &off, std::min(length, (uint64_t)(1 << 30)));
+        if(rt <= 0) {
+            return rt;
+        }
+        length -= rt;
+    }
+    return 1;
+}
+
+int HttpSession::flushResponses() {
+    if(m_outputs.empty()) {
+        return 1;
+    }
+    //m_outHeaders在发送完之前不会再追加，指针保持有效
+    int rt = 1;
+    m_iovs.clear();
+    for(auto& i : m_outputs) {
+        iovec iov;
+        iov.iov_base = &m_outHeaders[i.offset];
+        iov.iov_len = i.length;
+        m_iovs.push_back(iov);
+        const std::string& body = i.rsp->getBody();
+        if(!body.empty()) {
+            iov.iov_base = (void*)body.data();
+            iov.iov_len = body.size();
+            m_iovs.push_back(iov);
+        } else if(i.rsp->hasBodyFile() && i.rsp->getBodyLength()) {
+            //文件前面的数据先写出，再sendfile
+            rt = sendIovecs(m_iovs);
+            m_iovs.clear();
+            if(rt <= 0) {
+                break;
+            }
+            rt = sendFileFully(i.rsp->getBodyFileFd(), i.rsp->getBodyFileOffset()
+                    ,i.rsp->getBodyLength());
+            if(rt <= 0) {
+                break;
+            }
+        }
+    }
+    if(rt > 0 && !m_iovs.empty()) {
+        rt = sendIovecs(m_iovs);
+    }
+    m_iovs.clear();
+    m_outputs.clear();
+    m_outHeaders.clear();
+    return rt;
 }
 
 int HttpSession::sendResponse(HttpResponse::ptr rsp) {
-    std::stringstream ss;
-    ss << *rsp;
-    std::string data = ss.str();
-    return writeFixSize(data.c_str(), data.size());
+    queueResponse(rsp);
+    return flushResponses();
 }
 
 }
@@ -16,10 +16,230 @@
 namespace hr {
 namespace http {
 
+class HttpRequestParser;
+class HttpSession;
+
+/**
+ * @brief HTTP请求消息体流
+ * @details 从HttpSession的输入缓冲区和Socket中按需读取消息体,支持Content-Length和chunked,
+ *          数据没到时读操作挂起当前协程,处理函数读得慢时对方的发送也会被TCP窗口限制。
+ *          只在HttpSession存在期间有效,下一次recvRequest会读完并丢弃没读的部分。
+ *          chunked消息体累计超过http.request.max_stream_size时读操作返回错误
+ */
+class HttpBodyStream : public Stream {
+public:
+    /// 智能指针类型定义
+    typedef std::shared_ptr<HttpBodyStream> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] session 所属的HttpSession
+     * @param[in] length 消息体长度,chunked时忽略
+     * @param[in] chunked 是否是chunked消息体
+     */
+    HttpBodyStream(HttpSession* session, uint64_t length, bool chunked);
+
+    /**
+     * @brief 读消息体
+     * @return >0 读到的长度
+     *         =0 消息体结束
+     *         <0 连接断开、出错、chunked格式错误或者超过最大长度
+     */
+    virtual int read(void* buffer, size_t length) override;
+
+    /**
+     * @brief 读消息体到ByteArray
+     */
+    virtual int read(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 消息体流不能写,返回-1
+     */
+    virtual int write(const void* buffer, size_t length) override { return -1;}
+
+    /**
+     * @brief 消息体流不能写,返回-1
+     */
+    virtual int write(ByteArray::ptr ba, size_t length) override { return -1;}
+
+    /**
+     * @brief 不再读取消息体,连接不能继续复用
+     */
+    virtual void close() override;
+
+    /**
+     * @brief 消息体是否已经读完
+     */
+    bool isFinished() const { return m_finished && m_prefix.size() == m_prefixOffset;}
+
+    /**
+     * @brief 是否是chunked消息体
+     */
+    bool isChunked() const { return m_chunked;}
+
+    /**
+     * @brief 返回消息体长度,chunked时返回0
+     */
+    uint64_t getContentLength() const { return m_chunked ? 0 : m_length;}
+
+    /**
+     * @brief 返回已经从连接上读取的消息体长度
+     */
+    uint64_t getReadSize() const { return m_readSize;}
+private:
+    friend class HttpSession;
+
+    /**
+     * @brief 读取下一个chunk的大小,最后一个chunk时读完trailer
+     * @return >0 成功 =0 消息体结束 <0 出错
+     */
+    int readChunkSize();
+private:
+    /// 所属的HttpSession,HttpSession释放后为nullptr
+    HttpSession* m_session;
+    /// 消息体长度
+    uint64_t m_length;
+    /// 已经读取的长度
+    uint64_t m_readSize;
+    /// 最大长度,创建时的http.request.max_stream_size
+    uint64_t m_maxSize;
+    /// 当前chunk剩余的长度
+    uint64_t m_chunkLeft;
+    /// recvRequest预读的数据,先于连接上的数据返回
+    std::string m_prefix;
+    size_t m_prefixOffset;
+    /// 是否是chunked消息体
+    bool m_chunked;
+    /// chunk数据后面的\r\n还没读
+    bool m_chunkEnd;
+    /// 消息体是否读完
+    bool m_finished;
+    /// 是否出错
+    bool m_error;
+};
+
+/**
+ * @brief HTTP响应消息体流
+ * @details 由HttpSession::startResponse创建,HTTP/1.1按Transfer-Encoding: chunked发送,
+ *          HTTP/1.0不输出长度,发送完关闭连接。
+ *          小块的写入先合并到缓冲区,超过http.response.chunk_size或者flush时才作为一个chunk发出,
+ *          状态行和头部和第一个chunk一起发送,在那之前还可以修改响应的头部
+ */
+class HttpResponseStream : public Stream {
+public:
+    /// 智能指针类型定义
+    typedef std::shared_ptr<HttpResponseStream> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] session 所属的HttpSession
+     * @param[in] rsp 响应,提供状态行和头部
+     */
+    HttpResponseStream(HttpSession* session, HttpResponse::ptr rsp);
+
+    /**
+     * @brief 响应流不能读,返回-1
+     */
+    virtual int read(void* buffer, size_t length) override { return -1;}
+
+    /**
+     * @brief 响应流不能读,返回-1
+     */
+    virtual int read(ByteArray::ptr ba, size_t length) override { return -1;}
+
+    /**
+     * @brief 写消息体
+     * @return >0 写入的长度(可能还在缓冲区中)
+     *         <=0 连接断开或者已经结束
+     */
+    virtual int write(const void* buffer, size_t length) override;
+
+    /**
+     * @brief 写ByteArray中的数据
+     */
+    virtual int write(ByteArray::ptr ba, size_t length) override;
+
+    /**
+     * @brief 发送缓冲区中的数据,还没发送头部时也发送头部
+     * @return >0 成功 <=0 连接断开
+     */
+    int flush();
+
+    /**
+     * @brief 发送剩余数据和结束的chunk,之后不能再写
+     * @return >0 成功 <=0 连接断开
+     */
+    int finish();
+
+    /**
+     * @brief 结束消息体,同finish
+     */
+    virtual void close() override { finish();}
+
+    /**
+     * @brief 是否已经结束
+     */
+    bool isFinished() const { return m_finished;}
+
+    /**
+     * @brief 是否使用chunked
+     */
+    bool isChunked() const { return m_rsp->getVersion() >= 0x11;}
+
+    /**
+     * @brief 发送完后是否要关闭连接
+     */
+    bool isClose() const { return m_rsp->isClose();}
+
+    /**
+     * @brief 是否发送失败
+     */
+    bool hasError() const { return m_error;}
+
+    /**
+     * @brief 返回已经写入的消息体长度
+     */
+    uint64_t getWriteSize() const { return m_writeSize;}
+
+    /**
+     * @brief 返回已经发送的chunk数
+     */
+    uint64_t getChunks() const { return m_chunks;}
+private:
+    friend class HttpSession;
+
+    /**
+     * @brief 把缓冲区和data作为一个chunk发送
+     * @param[in] last 是否同时发送结束的chunk
+     */
+    int send(const char* data, size_t length, bool last);
+private:
+    /// 所属的HttpSession,HttpSession释放后为nullptr
+    HttpSession* m_session;
+    /// 响应
+    HttpResponse::ptr m_rsp;
+    /// 等待合并发送的小块数据
+    std::string m_pending;
+    /// 状态行和头部
+    std::string m_head;
+    /// 已经写入的长度
+    uint64_t m_writeSize;
+    /// 已经发送的chunk数
+    uint64_t m_chunks;
+    /// 头部是否已经发送
+    bool m_headSent;
+    /// 是否已经结束
+    bool m_finished;
+    /// 是否发送失败
+    bool m_error;
+};
+
 /**
  * @brief HTTPSession封装
  */
 class HttpSession : public SocketStream {
+friend class HttpBodyStream;
+friend class HttpResponseStream;
 public:
     /// 智能指针类型定义
     typedef std::shared_ptr<HttpSession> ptr;
@@ -31,19 +251,169 @@ public:
      */
     HttpSession(Socket::ptr sock, bool owner = true);
 
+    /**
+     * @brief 析构函数
+     */
+    ~HttpSession();
+
     /**
      * @brief 接收HTTP请求
+     * @details 使用连接上复用的输入缓冲区，多读到的数据(pipeline的后续请求)留给下一次调用。
+     *          消息体能放进缓冲区时，请求的消息体是缓冲区的视图，不复制
      */
     HttpRequest::ptr recvRequest();
 
     /**
      * @brief 发送HTTP响应
+     * @details 先发送队列中还没发送的响应，保证顺序
      * @param[in] rsp HTTP响应
      * @return >0 发送成功
      *         =0 对方关闭
      *         <0 Socket异常
      */
     int sendResponse(HttpResponse::ptr rsp);
+
+    /**
+     * @brief 将HTTP响应加入发送队列，不立即发送
+     * @details 用于pipeline，连续处理的多个请求的响应由flushResponses一次写出。
+     *          状态行和头部序列化到复用的缓冲区，消息体不复制
+     * @param[in] rsp HTTP响应
+     */
+    void queueResponse(HttpResponse::ptr rsp);
+
+    /**
+     * @brief 发送队列中的所有响应
+     * @details 头部和消息体作为iovec一起writev，文件消息体用sendfile发送
+     * @return >0 发送成功(队列为空时也返回1)
+     *         =0 对方关闭
+     *         <0 Socket异常
+     */
+    int flushResponses();
+
+    /**
+     * @brief 返回发送队列中的响应数
+     */
+    size_t getQueuedResponses() const { return m_outputs.size();}
+
+    /**
+     * @brief 开始流式发送响应
+     * @details 先发送队列中的响应保证顺序,之后消息体通过返回的流边生成边发送。
+     *          HttpServer在处理函数返回后调用finish结束响应,处理函数也可以自己结束
+     * @param[in] rsp 响应,第一次发送前还可以修改状态和头部
+     * @return 返回消息体流,连接已经断开时返回nullptr
+     */
+    HttpResponseStream::ptr startResponse(HttpResponse::ptr rsp);
+
+    /**
+     * @brief 返回当前请求的响应流,没有调用startResponse时返回nullptr
+     */
+    HttpResponseStream::ptr getResponseStream() const { return m_responseStream;}
+
+    /**
+     * @brief 返回当前请求的消息体流,消息体在请求里时返回nullptr
+     */
+    HttpBodyStream::ptr getBodyStream() const { return m_bodyStream;}
+
+    /**
+     * @brief 输入缓冲区中是否还有未处理的数据
+     */
+    bool hasBufferedData() const { return m_end > m_begin;}
+
+    /**
+     * @brief 输入缓冲区中是否已经有完整的请求头
+     * @details 为true时下一次recvRequest不需要等待请求头。
+     *          消息体可能还不完整,recvRequest需要读取时会先发送队列中的响应
+     */
+    bool hasBufferedRequest() const;
+private:
+    /**
+     * @brief 保证输入缓冲区可写
+     * @details 缓冲区还被上一个请求的消息体视图引用时，换一块新的，并复制未处理的数据
+     */
+    void prepareBuffer(size_t size);
+
+    /**
+     * @brief 将未处理的数据移动到缓冲区开头
+     */
+    void compactBuffer();
+
+    /**
+     * @brief 从连接读取数据,先发送队列中的响应
+     * @details pipeline的请求头已经在缓冲区里但消息体不完整时,对端可能在等前面的响应,
+     *          不先发送会互相等待
+     * @return >0 读到的长度 <=0 连接关闭或出错
+     */
+    int readSocket(void* buffer, size_t length);
+
+    /**
+     * @brief 读取数据追加到缓冲区末尾
+     * @return 返回读取的字节数，<=0表示连接关闭或出错
+     */
+    int fillBuffer();
+
+    /**
+     * @brief 读取消息体数据,先读缓冲区里的数据
+     * @details 缓冲区为空并且length较大时直接读到buffer,不经过缓冲区。
+     *          不会读取超过length的数据,后面pipeline的请求留在连接上
+     * @return >0 读到的长度 <=0 连接关闭或出错
+     */
+    int readBuffered(void* buffer, size_t length);
+
+    /**
+     * @brief 从缓冲区读取一行,不包括结尾的\r\n
+     * @param[out] line 读到的行
+     * @param[in] max 行的最大长度
+     * @return >0 成功 <=0 连接关闭、出错或者行太长
+     */
+    int readLine(std::string& line, size_t max);
+
+    /**
+     * @brief 读完并丢弃上一个请求没读的消息体
+     * @return 是否成功
+     */
+    bool discardBody();
+
+    /**
+     * @brief 发送iovs中的全部数据
+     * @return >0 发送成功 =0 对方关闭 <0 Socket异常
+     */
+    int sendIovecs(std::vector<iovec>& iovs);
+
+    /**
+     * @brief 用sendfile发送文件的[offset, offset + length)
+     * @return >0 发送成功 =0 对方关闭 <0 Socket异常
+     */
+    int sendFileFully(int fd, uint64_t offset, uint64_t length);
+private:
+    /// 等待发送的响应
+    struct Output {
+        /// 头部在m_outHeaders中的位置
+        size_t offset;
+        /// 头部长度
+        size_t length;
+        /// 响应，持有消息体
+        HttpResponse::ptr rsp;
+    };
+    /// 输入缓冲区，跨keep-alive请求复用
+    std::shared_ptr<char> m_buffer;
+    /// 输入缓冲区大小
+    size_t m_capacity = 0;
+    /// 未处理数据的开始位置
+    size_t m_begin = 0;
+    /// 未处理数据的结束位置
+    size_t m_end = 0;
+    /// 请求解析器，每个请求重置后复用
+    std::shared_ptr<HttpRequestParser> m_parser;
+    /// 当前请求的消息体流
+    HttpBodyStream::ptr m_bodyStream;
+    /// 当前请求的响应流
+    HttpResponseStream::ptr m_responseStream;
+    /// 等待发送的响应
+    std::vector<Output> m_outputs;
+    /// 等待发送的响应的状态行和头部，跨请求复用
+    std::string m_outHeaders;
+    /// 发送用的iovec，跨请求复用
+    std::vector<iovec> m_iovs;
 };
 
 }
@@ -0,0 +1,344 @@
+#include "multipart.h"
+#include "sylar/config.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace hr {
+namespace http {
+
+static hr::Logger::ptr g_logger = HR_LOG_NAME("system");
+
+static hr::ConfigVar<uint64_t>::ptr g_multipart_memory_limit =
+    hr::Config::Lookup("http.multipart.memory_limit"
+                ,(uint64_t)(64 * 1024), "multipart body size kept in memory");
+
+static hr::ConfigVar<std::string>::ptr g_multipart_tmp_dir =
+    hr::Config::Lookup("http.multipart.tmp_dir"
+                ,std::string("/tmp"), "multipart temp file dir");
+
+static uint64_t s_multipart_memory_limit = 0;
+
+namespace {
+struct _MultipartIniter {
+    _MultipartIniter() {
+        s_multipart_memory_limit = g_multipart_memory_limit->getValue();
+        g_multipart_memory_limit->addListener(
+                [](const uint64_t& ov, const uint64_t& nv){
+                s_multipart_memory_limit = nv;
+        });
+    }
+};
+static _MultipartIniter _init;
+}
+
+//部分头部的最大长度
+static const size_t s_max_header_size = 8 * 1024;
+
+static bool WriteAll(int fd, const char* data, size_t len) {
+    while(len > 0) {
+        ssize_t rt = ::write(fd, data, len);
+        if(rt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += rt;
+        len -= rt;
+    }
+    return true;
+}
+
+//去掉引号,处理\"转义
+static std::string Unquote(const std::string& str) {
+    if(str.size() < 2 || str[0] != '"' || str[str.size() - 1] != '"') {
+        return str;
+    }
+    std::string rt;
+    for(size_t i = 1; i < str.size() - 1; ++i) {
+        if(str[i] == '\\' && i + 1 < str.size() - 1) {
+            ++i;
+        }
+        rt.push_back(str[i]);
+    }
+    return rt;
+}
+
+MultipartPart::MultipartPart()
+    :m_file(false)
+    ,m_size(0)
+    ,m_fd(-1)
+    ,m_keep(false) {
+}
+
+MultipartPart::~MultipartPart() {
+    if(m_fd >= 0) {
+        ::close(m_fd);
+    }
+    if(!m_path.empty() && !m_keep) {
+        ::unlink(m_path.c_str());
+    }
+}
+
+bool MultipartPart::append(const char* data, size_t len, uint64_t& memory) {
+    if(m_fd < 0 && memory + len > s_multipart_memory_limit) {
+        if(!m_file) {
+            HR_LOG_WARN(g_logger) << "multipart field " << m_name
+                << " exceeds memory limit " << s_multipart_memory_limit;
+            return false;
+        }
+        std::string path = g_multipart_tmp_dir->getValue() + "/hr_multipart_XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if(fd < 0) {
+            HR_LOG_ERROR(g_logger) << "multipart mkstemp " << path << " errno="
+                << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+        m_fd = fd;
+        m_path = path;
+        if(!WriteAll(m_fd, m_data.data(), m_data.size())) {
+            return false;
+        }
+        memory -= m_data.size();
+        std::string().swap(m_data);
+    }
+    if(m_fd >= 0) {
+        if(!WriteAll(m_fd, data, len)) {
+            HR_LOG_ERROR(g_logger) << "multipart write " << m_path << " errno="
+                << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+    } else {
+        m_data.append(data, len);
+        memory += len;
+    }
+    m_size += len;
+    return true;
+}
+
+bool MultipartPart::read(std::string& out) const {
+    if(m_fd < 0) {
+        out = m_data;
+        return true;
+    }
+    out.resize(m_size);
+    uint64_t offset = 0;
+    while(offset < m_size) {
+        ssize_t rt = ::pread(m_fd, &out[offset], m_size - offset, offset);
+        if(rt < 0 && errno == EINTR) {
+            continue;
+        }
+        if(rt <= 0) {
+            out.clear();
+            return false;
+        }
+        offset += rt;
+    }
+    return true;
+}
+
+bool MultipartPart::saveAs(const std::string& path) {
+    if(m_fd >= 0 && ::rename(m_path.c_str(), path.c_str()) == 0) {
+        m_path = path;
+        m_keep = true;
+        return true;
+    }
+    //不在同一个文件系统,复制一份
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        return false;
+    }
+    bool ok = true;
+    if(m_fd < 0) {
+        ok = WriteAll(fd, m_data.data(), m_data.size());
+    } else {
+        char buf[64 * 1024];
+        uint64_t offset = 0;
+        while(ok && offset < m_size) {
+            ssize_t rt = ::pread(m_fd, buf, std::min((uint64_t)sizeof(buf), m_size - offset), offset);
+            if(rt < 0 && errno == EINTR) {
+                continue;
+            }
+            ok = rt > 0 && WriteAll(fd, buf, rt);
+            offset += rt;
+        }
+    }
+    ::close(fd);
+    return ok;
+}
+
+MultipartParser::MultipartParser(const std::string& boundary)
+    :m_state(PREAMBLE)
+    ,m_delimiter("\r\n--" + boundary)
+    ,m_buffer("\r\n")
+    ,m_memory(0) {
+    //第一个分隔符在数据开头时前面没有\r\n
+}
+
+std::string MultipartParser::GetBoundary(const std::string& content_type) {
+    std::string type = StringUtil::Trim(content_type);
+    if(strncasecmp(type.c_str(), "multipart/form-data", 19) != 0) {
+        return "";
+    }
+    const char* pos = strcasestr(type.c_str(), "boundary=");
+    if(!pos) {
+        return "";
+    }
+    pos += 9;
+    const char* end = strchr(pos, ';');
+    std::string boundary = Unquote(StringUtil::Trim(
+                end ? std::string(pos, end - pos) : std::string(pos)));
+    //RFC2046 boundary最长70个字符
+    if(boundary.empty() || boundary.size() > 70) {
+        return "";
+    }
+    return boundary;
+}
+
+uint64_t MultipartParser::GetMemoryLimit() {
+    return s_multipart_memory_limit;
+}
+
+bool MultipartParser::parseHeaders(const char* data, size_t len) {
+    m_part.reset(new MultipartPart);
+    const char* end = data + len;
+    while(data < end) {
+        const char* eol = (const char*)memmem(data, end - data, "\r\n", 2);
+        if(!eol) {
+            eol = end;
+        }
+        const char* colon = (const char*)memchr(data, ':', eol - data);
+        if(!colon) {
+            return false;
+        }
+        std::string name(data, colon - data);
+        std::string value = StringUtil::Trim(std::string(colon + 1, eol - colon - 1));
+        data = eol + 2;
+        if(strcasecmp(name.c_str(), "content-type") == 0) {
+            m_part->m_contentType = value;
+            continue;
+        }
+        if(strcasecmp(name.c_str(), "content-disposition") != 0) {
+            continue;
+        }
+        //form-data; name="field"; filename="a.txt"
+        size_t next = value.find(';');
+        while(next != std::string::npos) {
+            size_t start = next + 1;
+            next = value.find(';', start);
+            std::string item = StringUtil::Trim(value.substr(start
+                        ,next == std::string::npos ? std::string::npos : next - start));
+            size_t eq = item.find('=');
+            if(eq == std::string::npos) {
+                continue;
+            }
+            std::string key = StringUtil::Trim(item.substr(0, eq));
+            std::string val = Unquote(StringUtil::Trim(item.substr(eq + 1)));
+            if(strcasecmp(key.c_str(), "name") == 0) {
+                m_part->m_name = val;
+            } else if(strcasecmp(key.c_str(), "filename") == 0) {
+                m_part->m_filename = val;
+                m_part->m_file = true;
+            }
+        }
+    }
+    return true;
+}
+
+bool MultipartParser::execute(const char* data, size_t len) {
+    if(m_state == DONE) {
+        //结束分隔符之后的内容忽略
+        return true;
+    }
+    if(m_state == ERROR) {
+        return false;
+    }
+    m_buffer.append(data, len);
+    size_t pos = 0;
+    bool more = true;
+    while(more) {
+        const char* begin = m_buffer.data() + pos;
+        size_t avail = m_buffer.size() - pos;
+        switch(m_state) {
+            case PREAMBLE:
+            case BODY: {
+                const char* found = (const char*)memmem(begin, avail
+                            ,m_delimiter.data(), m_delimiter.size());
+                //没找到时保留可能是分隔符开头的尾部
+                size_t n = found ? found - begin
+                    : (avail >= m_delimiter.size() ? avail - m_delimiter.size() + 1 : 0);
+                if(m_state == BODY && n && !m_part->append(begin, n, m_memory)) {
+                    m_state = ERROR;
+                    return false;
+                }
+                pos += n;
+                if(!found) {
+                    more = false;
+                    break;
+                }
+                pos += m_delimiter.size();
+                if(m_state == BODY) {
+                    m_parts.push_back(m_part);
+                    m_part.reset();
+                }
+                m_state = BOUNDARY;
+                break;
+            }
+            case BOUNDARY: {
+                //分隔符后面是--表示结束,否则跳过空白后是\r\n
+                if(avail < 2) {
+                    more = false;
+                    break;
+                }
+                if(begin[0] == '-' && begin[1] == '-') {
+                    m_state = DONE;
+                    more = false;
+                } else if(begin[0] == ' ' || begin[0] == '\t') {
+                    ++pos;
+                } else if(begin[0] == '\r' && begin[1] == '\n') {
+                    //\r\n留给头部,头部的结尾是\r\n\r\n
+                    m_state = HEADERS;
+                } else {
+                    m_state = ERROR;
+                    return false;
+                }
+                break;
+            }
+            case HEADERS: {
+                const char* found = (const char*)memmem(begin, avail, "\r\n\r\n", 4);
+                if(!found) {
+                    if(avail > s_max_header_size) {
+                        m_state = ERROR;
+                        return false;
+                    }
+                    more = false;
+                    break;
+                }
+                size_t n = found - begin;
+                //解析出来的头部也留在内存里,很多空的部分同样要受限制
+                m_memory += n;
+                if(m_memory > s_multipart_memory_limit
+                        || !parseHeaders(begin + 2, n > 2 ? n - 2 : 0)) {
+                    m_state = ERROR;
+                    return false;
+                }
+                pos += n + 4;
+                m_state = BODY;
+                break;
+            }
+            default:
+                more = false;
+                break;
+        }
+    }
+    m_buffer.erase(0, pos);
+    return true;
+}
+
+}
+}
@@ -0,0 +1,195 @@
+/**
+ * @file multipart.h
+ * @brief multipart/form-data 流式解析
+ */
+#ifndef __SYLAR_HTTP_MULTIPART_H__
+#define __SYLAR_HTTP_MULTIPART_H__
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace hr {
+namespace http {
+
+/**
+ * @brief multipart中的一个部分
+ * @details 内容先保存在内存里,整个消息体留在内存中的大小超过上限(http.multipart.memory_limit)后
+ *          文件写入临时目录(http.multipart.tmp_dir)下的临时文件,析构时删除临时文件,
+ *          普通字段不写文件,超过上限时解析失败
+ */
+class MultipartPart {
+public:
+    /// 智能指针类型定义
+    typedef std::shared_ptr<MultipartPart> ptr;
+
+    MultipartPart();
+    ~MultipartPart();
+
+    /**
+     * @brief 返回表单字段名
+     */
+    const std::string& getName() const { return m_name;}
+
+    /**
+     * @brief 返回文件名,普通字段为空
+     */
+    const std::string& getFilename() const { return m_filename;}
+
+    /**
+     * @brief 返回Content-Type
+     */
+    const std::string& getContentType() const { return m_contentType;}
+
+    /**
+     * @brief 是否是上传的文件
+     */
+    bool isFile() const { return m_file;}
+
+    /**
+     * @brief 返回内容长度
+     */
+    uint64_t getSize() const { return m_size;}
+
+    /**
+     * @brief 内容是否在内存中
+     */
+    bool inMemory() const { return m_fd < 0;}
+
+    /**
+     * @brief 返回内存中的内容,内容在临时文件中时为空
+     */
+    const std::string& getData() const { return m_data;}
+
+    /**
+     * @brief 返回临时文件路径,内容在内存中时为空
+     */
+    const std::string& getTempPath() const { return m_path;}
+
+    /**
+     * @brief 读出全部内容
+     * @param[out] out 内容
+     * @return 是否成功
+     */
+    bool read(std::string& out) const;
+
+    /**
+     * @brief 把内容保存到path,临时文件在同一个文件系统时直接rename
+     * @return 是否成功
+     */
+    bool saveAs(const std::string& path);
+private:
+    friend class MultipartParser;
+
+    /**
+     * @brief 追加内容,超过内存上限时文件写入临时文件,普通字段返回失败
+     * @param[in,out] memory 整个消息体留在内存中的大小
+     */
+    bool append(const char* data, size_t len, uint64_t& memory);
+private:
+    /// 表单字段名
+    std::string m_name;
+    /// 文件名
+    std::string m_filename;
+    /// Content-Type
+    std::string m_contentType;
+    /// 是否是文件(Content-Disposition中有filename)
+    bool m_file;
+    /// 内容长度
+    uint64_t m_size;
+    /// 内存中的内容
+    std::string m_data;
+    /// 临时文件
+    int m_fd;
+    std::string m_path;
+    /// 临时文件已经通过saveAs保存,析构时不删除
+    bool m_keep;
+};
+
+/**
+ * @brief multipart/form-data 解析器
+ * @details 数据可以分多次传入,只缓存不足一个分隔符长度的尾部和正在解析的头部,
+ *          部分的内容直接写入MultipartPart。
+ *          留在内存中的头部和内容合计不超过http.multipart.memory_limit,超过时文件改写临时文件,
+ *          其他情况解析失败,客户端不能用很多字段或者很大的字段占满内存
+ */
+class MultipartParser {
+public:
+    /// 智能指针类型定义
+    typedef std::shared_ptr<MultipartParser> ptr;
+
+    /**
+     * @brief 构造函数
+     * @param[in] boundary Content-Type中的boundary
+     */
+    MultipartParser(const std::string& boundary);
+
+    /**
+     * @brief 解析一段数据
+     * @return 是否成功,格式错误、超过内存上限或者写临时文件失败时返回false
+     */
+    bool execute(const char* data, size_t len);
+
+    /**
+     * @brief 是否解析到结束的分隔符
+     */
+    bool isFinished() const { return m_state == DONE;}
+
+    /**
+     * @brief 是否有错误
+     */
+    bool hasError() const { return m_state == ERROR;}
+
+    /**
+     * @brief 返回已经完整解析的部分
+     */
+    const std::vector<MultipartPart::ptr>& getParts() const { return m_parts;}
+
+    /**
+     * @brief 从Content-Type中取出boundary
+     * @return 不是multipart/form-data时返回空
+     */
+    static std::string GetBoundary(const std::string& content_type);
+
+    /**
+     * @brief 返回一个消息体留在内存中的上限
+     */
+    static uint64_t GetMemoryLimit();
+private:
+    /**
+     * @brief 解析部分的头部
+     */
+    bool parseHeaders(const char* data, size_t len);
+private:
+    enum State {
+        /// 第一个分隔符之前
+        PREAMBLE,
+        /// 分隔符之后,判断是下一部分还是结束
+        BOUNDARY,
+        /// 部分的头部
+        HEADERS,
+        /// 部分的内容
+        BODY,
+        /// 结束
+        DONE,
+        /// 出错
+        ERROR
+    };
+    State m_state;
+    /// "\r\n--" + boundary
+    std::string m_delimiter;
+    /// 未处理的数据
+    std::string m_buffer;
+    /// 正在解析的部分
+    MultipartPart::ptr m_part;
+    /// 解析完成的部分
+    std::vector<MultipartPart::ptr> m_parts;
+    /// 留在内存中的头部和内容的大小
+    uint64_t m_memory;
+};
+
+}
+}
+
+#endif
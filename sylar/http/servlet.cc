@@ -1,9 +1,230 @@
 #include "servlet.h"
+#include "sylar/macro.h"
 #include <fnmatch.h>
 
 namespace hr {
 namespace http {
 
+//模糊匹配规则是否只是 前缀+结尾的*,这种规则可以放进前缀树
+static bool IsPrefixGlob(const std::string& uri) {
+    return !uri.empty() && uri.back() == '*'
+        && uri.find_first_of("*?[\\") == uri.size() - 1;
+}
+
+//压缩前缀树节点,path是从父节点到本节点的静态字符串
+struct RouteNode {
+    typedef std::unique_ptr<RouteNode> ptr;
+
+    std::string path;
+    //子节点path的首字符,和children一一对应
+    std::string indices;
+    std::vector<ptr> children;
+    //:name 参数子节点,path为空
+    ptr param;
+
+    //路由终点,routeNames是路径上参数的名字
+    IServletCreator::ptr route;
+    std::vector<std::string> routeNames;
+    //路由通配(结尾的*)
+    IServletCreator::ptr any;
+    std::vector<std::string> anyNames;
+    //前缀模糊匹配,globIndex是在m_globs中的顺序
+    IServletCreator::ptr glob;
+    size_t globIndex = 0;
+};
+
+//路由表快照,生成后只读
+struct RouteTable {
+    //路由参数在uri中的位置(offset, length)
+    typedef std::vector<std::pair<size_t, size_t> > Captures;
+
+    struct Glob {
+        size_t index;
+        std::string uri;
+        IServletCreator::ptr creator;
+    };
+
+    //精准匹配
+    std::unordered_map<std::string, IServletCreator::ptr> exact;
+    RouteNode root;
+    //不能放进前缀树的模糊匹配,按添加顺序排列
+    std::vector<Glob> globs;
+    bool hasRoutes = false;
+
+    //插入静态字符串,返回对应的节点,必要时拆分已有节点
+    static RouteNode* insert(RouteNode* n, const std::string& s) {
+        size_t pos = 0;
+        while(pos < s.size()) {
+            size_t i = n->indices.find(s[pos]);
+            if(i == std::string::npos) {
+                RouteNode::ptr child(new RouteNode);
+                child->path = s.substr(pos);
+                n->indices.push_back(s[pos]);
+                n->children.push_back(std::move(child));
+                return n->children.back().get();
+            }
+            RouteNode* child = n->children[i].get();
+            size_t len = std::min(child->path.size(), s.size() - pos);
+            size_t l = 0;
+            while(l < len && child->path[l] == s[pos + l]) {
+                ++l;
+            }
+            if(l < child->path.size()) {
+                RouteNode::ptr mid(new RouteNode);
+                mid->path = child->path.substr(0, l);
+                child->path.erase(0, l);
+                mid->indices.push_back(child->path[0]);
+                mid->children.push_back(std::move(n->children[i]));
+                n->children[i] = std::move(mid);
+                child = n->children[i].get();
+            }
+            pos += l;
+            n = child;
+        }
+        return n;
+    }
+
+    //解析路由规则插入前缀树, :name 和 *name 只能出现在一段路径的开头
+    bool addRoute(const std::string& pattern, IServletCreator::ptr creator) {
+        if(pattern.empty() || pattern[0] != '/') {
+            return false;
+        }
+        RouteNode* n = &root;
+        std::vector<std::string> names;
+        std::string str;
+        size_t i = 0;
+        while(i < pattern.size()) {
+            char c = pattern[i];
+            if((c != ':' && c != '*') || pattern[i - 1] != '/') {
+                str.push_back(c);
+                ++i;
+                continue;
+            }
+            n = insert(n, str);
+            str.clear();
+            size_t end = pattern.find('/', i);
+            if(end == std::string::npos) {
+                end = pattern.size();
+            }
+            names.push_back(pattern.substr(i + 1, end - i - 1));
+            if(c == '*') {
+                if(end != pattern.size()) {
+                    return false;
+                }
+                n->any = creator;
+                n->anyNames.swap(names);
+                hasRoutes = true;
+                return true;
+            }
+            if(names.back().empty()) {
+                return false;
+            }
+            if(!n->param) {
+                n->param.reset(new RouteNode);
+            }
+            n = n->param.get();
+            i = end;
+        }
+        n = insert(n, str);
+        n->route = creator;
+        n->routeNames.swap(names);
+        hasRoutes = true;
+        return true;
+    }
+
+    //路由匹配,静态节点优先,其次参数,最后通配,失败时回溯
+    const RouteNode* matchRoute(const RouteNode* n, const std::string& uri
+                                ,size_t pos, Captures& caps, bool& any) const {
+        if(pos == uri.size() && n->route) {
+            any = false;
+            return n;
+        }
+        if(pos < uri.size()) {
+            size_t i = n->indices.find(uri[pos]);
+            if(i != std::string::npos) {
+                const RouteNode* child = n->children[i].get();
+                if(!uri.compare(pos, child->path.size(), child->path)) {
+                    auto rt = matchRoute(child, uri, pos + child->path.size(), caps, any);
+                    if(rt) {
+                        return rt;
+                    }
+                }
+            }
+            if(n->param && uri[pos] != '/') {
+                size_t end = uri.find('/', pos);
+                if(end == std::string::npos) {
+                    end = uri.size();
+                }
+                caps.push_back(std::make_pair(pos, end - pos));
+                auto rt = matchRoute(n->param.get(), uri, end, caps, any);
+                if(rt) {
+                    return rt;
+                }
+                caps.pop_back();
+            }
+        }
+        if(n->any) {
+            caps.push_back(std::make_pair(pos, uri.size() - pos));
+            any = true;
+            return n;
+        }
+        return nullptr;
+    }
+
+    //返回匹配的servlet,names为参数名字,和caps一一对应
+    const IServletCreator::ptr* match(const std::string& uri, Captures& caps
+                                      ,const std::vector<std::string>*& names) const {
+        auto it = exact.find(uri);
+        if(it != exact.end()) {
+            return &it->second;
+        }
+
+        //沿静态节点走一遍,得到顺序最靠前的前缀模糊匹配
+        const RouteNode* n = &root;
+        const RouteNode* glob = nullptr;
+        size_t pos = 0;
+        while(true) {
+            if(n->glob && (!glob || n->globIndex < glob->globIndex)) {
+                glob = n;
+            }
+            if(pos == uri.size()) {
+                break;
+            }
+            size_t i = n->indices.find(uri[pos]);
+            if(i == std::string::npos) {
+                break;
+            }
+            const RouteNode* child = n->children[i].get();
+            if(uri.compare(pos, child->path.size(), child->path)) {
+                break;
+            }
+            pos += child->path.size();
+            n = child;
+        }
+
+        if(hasRoutes) {
+            bool any = false;
+            const RouteNode* rt = matchRoute(&root, uri, 0, caps, any);
+            if(rt) {
+                names = any ? &rt->anyNames : &rt->routeNames;
+                return any ? &rt->any : &rt->route;
+            }
+        }
+
+        //只有顺序在前缀模糊匹配之前的复杂规则需要fnmatch
+        size_t limit = glob ? glob->globIndex : (size_t)-1;
+        for(auto& i : globs) {
+            if(i.index >= limit) {
+                break;
+            }
+            if(!fnmatch(i.uri.c_str(), uri.c_str(), 0)) {
+                return &i.creator;
+            }
+        }
+        return glob ? &glob->glob : nullptr;
+    }
+};
+
 FunctionServlet::FunctionServlet(callback cb)
     :Servlet("FunctionServlet")
     ,m_cb(cb) {
@@ -25,7 +246,7 @@ ServletDispatch::ServletDispatch()
 int32_t ServletDispatch::handle(hr::http::HttpRequest::ptr request
                , hr::http::HttpResponse::ptr response
                , hr::http::HttpSession::ptr session) {
-    auto slt = getMatchedServlet(request->getPath());
+    auto slt = getMatchedServlet(request->getPath(), request.get());
     if(slt) {
         slt->handle(request, response, session);
     }
@@ -35,11 +256,13 @@ int32_t ServletDispatch::handle(hr::http::HttpRequest::ptr request
 void ServletDispatch::addServlet(const std::string& uri, Servlet::ptr slt) {
     RWMutexType::WriteLock lock(m_mutex);
     m_datas[uri] = std::make_shared<HoldServletCreator>(slt);
+    invalidate();
 }
 
 void ServletDispatch::addServletCreator(const std::string& uri, IServletCreator::ptr creator) {
     RWMutexType::WriteLock lock(m_mutex);
     m_datas[uri] = creator;
+    invalidate();
 }
 
 void ServletDispatch::addGlobServletCreator(const std::string& uri, IServletCreator::ptr creator) {
@@ -52,6 +275,7 @@ void ServletDispatch::addGlobServletCreator(const std::string& uri, IServletCrea
         }
     }
     m_globs.push_back(std::make_pair(uri, creator));
+    invalidate();
 }
 
 void ServletDispatch::addServlet(const std::string& uri
@@ -59,6 +283,7 @@ void ServletDispatch::addServlet(const std::string& uri
     RWMutexType::WriteLock lock(m_mutex);
     m_datas[uri] = std::make_shared<HoldServletCreator>(
                         std::make_shared<FunctionServlet>(cb));
+    invalidate();
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri
@@ -73,6 +298,7 @@ void ServletDispatch::addGlobServlet(const std::string& uri
     }
     m_globs.push_back(std::make_pair(uri
                 , std::make_shared<HoldServletCreator>(slt)));
+    invalidate();
 }
 
 void ServletDispatch::addGlobServlet(const std::string& uri
@@ -83,6 +309,7 @@ void ServletDispatch::addGlobServlet(const std::string& uri
 void ServletDispatch::delServlet(const std::string& uri) {
     RWMutexType::WriteLock lock(m_mutex);
     m_datas.erase(uri);
+    invalidate();
 }
 
 void ServletDispatch::delGlobServlet(const std::string& uri) {
@@ -91,11 +318,39 @@ void ServletDispatch::delGlobServlet(const std::string& uri) {
             it != m_globs.end(); ++it) {
         if(it->first == uri) {
             m_globs.erase(it);
+            invalidate();
             break;
         }
     }
 }
 
+bool ServletDispatch::addRoute(const std::string& pattern, Servlet::ptr slt) {
+    return addRouteCreator(pattern, std::make_shared<HoldServletCreator>(slt));
+}
+
+bool ServletDispatch::addRoute(const std::string& pattern
+                               ,FunctionServlet::callback cb) {
+    return addRoute(pattern, std::make_shared<FunctionServlet>(cb));
+}
+
+bool ServletDispatch::addRouteCreator(const std::string& pattern, IServletCreator::ptr creator) {
+    RouteTable check;
+    if(!check.addRoute(pattern, creator)) {
+        return false;
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    m_routes[pattern] = creator;
+    invalidate();
+    return true;
+}
+
+void ServletDispatch::delRoute(const std::string& pattern) {
+    RWMutexType::WriteLock lock(m_mutex);
+    if(m_routes.erase(pattern)) {
+        invalidate();
+    }
+}
+
 Servlet::ptr ServletDispatch::getServlet(const std::string& uri) {
     RWMutexType::ReadLock lock(m_mutex);
     auto it = m_datas.find(uri);
@@ -114,18 +369,62 @@ Servlet::ptr ServletDispatch::getGlobServlet(const std::string& uri) {
 }
 
 Servlet::ptr ServletDispatch::getMatchedServlet(const std::string& uri) {
-    RWMutexType::ReadLock lock(m_mutex);
-    auto mit = m_datas.find(uri);
-    if(mit != m_datas.end()) {
-        return mit->second->get();
+    return getMatchedServlet(uri, nullptr);
+}
+
+Servlet::ptr ServletDispatch::getMatchedServlet(const std::string& uri, HttpRequest* request) {
+    //持有快照直到取出servlet,期间快照被替换也不会释放
+    std::shared_ptr<const RouteTable> table = getTable();
+    RouteTable::Captures caps;
+    const std::vector<std::string>* names = nullptr;
+    auto creator = table->match(uri, caps, names);
+    if(!creator) {
+        return m_default;
     }
-    for(auto it = m_globs.begin();
-            it != m_globs.end(); ++it) {
-        if(!fnmatch(it->first.c_str(), uri.c_str(), 0)) {
-            return it->second->get();
+    if(request && names) {
+        for(size_t i = 0; i < caps.size(); ++i) {
+            if(!(*names)[i].empty()) {
+                request->setParam((*names)[i], uri.substr(caps[i].first, caps[i].second));
+            }
         }
     }
-    return m_default;
+    return (*creator)->get();
+}
+
+std::shared_ptr<const RouteTable> ServletDispatch::getTable() {
+    std::shared_ptr<const RouteTable> rt = std::atomic_load(&m_table);
+    if(SYLAR_LIKELY(rt)) {
+        return rt;
+    }
+    RWMutexType::WriteLock lock(m_mutex);
+    rt = std::atomic_load(&m_table);
+    if(rt) {
+        return rt;
+    }
+    std::shared_ptr<RouteTable> table(new RouteTable);
+    table->exact = m_datas;
+    for(size_t i = 0; i < m_globs.size(); ++i) {
+        auto& uri = m_globs[i].first;
+        if(IsPrefixGlob(uri)) {
+            RouteNode* n = RouteTable::insert(&table->root, uri.substr(0, uri.size() - 1));
+            if(!n->glob) {
+                n->glob = m_globs[i].second;
+                n->globIndex = i;
+            }
+        } else {
+            table->globs.push_back({i, uri, m_globs[i].second});
+        }
+    }
+    for(auto& i : m_routes) {
+        table->addRoute(i.first, i.second);
+    }
+    rt = table;
+    std::atomic_store(&m_table, rt);
+    return rt;
+}
+
+void ServletDispatch::invalidate() {
+    std::atomic_store(&m_table, std::shared_ptr<const RouteTable>());
 }
 
 void ServletDispatch::listAllServletCreator(std::map<std::string, IServletCreator::ptr>& infos) {
@@ -142,6 +441,13 @@ void ServletDispatch::listAllGlobServletCreator(std::map<std::string, IServletCr
     }
 }
 
+void ServletDispatch::listAllRouteCreator(std::map<std::string, IServletCreator::ptr>& infos) {
+    RWMutexType::ReadLock lock(m_mutex);
+    for(auto& i : m_routes) {
+        infos[i.first] = i.second;
+    }
+}
+
 NotFoundServlet::NotFoundServlet(const std::string& name)
     :Servlet("NotFoundServlet")
     ,m_name(name) {
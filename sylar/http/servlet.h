@@ -13,6 +13,8 @@
 #include <functional>
 #include <string>
 #include <vector>
+#include <map>
+#include <atomic>
 #include <unordered_map>
 #include "http.h"
 #include "http_session.h"
@@ -131,8 +133,15 @@ public:
     }
 };
 
+struct RouteTable;
+
 /**
  * @brief Servlet分发器
+ * @details 所有规则编译成一棵压缩前缀树(RouteTable)的只读快照,
+ *          查找时用std::atomic_load取得快照,不加读写锁.
+ *          修改规则时在锁内更新规则表并作废快照,下一次查找时重建,
+ *          旧快照在最后一个使用它的查找结束后释放.
+ *          匹配顺序: 精准匹配 > 路由(静态 > 参数 > 通配) > 模糊匹配(按添加顺序) > 默认
  */
 class ServletDispatch : public Servlet {
 public:
@@ -145,6 +154,7 @@ public:
      * @brief 构造函数
      */
     ServletDispatch();
+
     virtual int32_t handle(hr::http::HttpRequest::ptr request
                    , hr::http::HttpResponse::ptr response
                    , hr::http::HttpSession::ptr session) override;
@@ -190,6 +200,31 @@ public:
         addGlobServletCreator(uri, std::make_shared<ServletCreator<T> >());
     }
 
+    /**
+     * @brief 添加路由servlet
+     * @param[in] pattern 路由规则
+     *      /user/:id/info  :id匹配一段路径,结果通过request的param返回
+     *      *path  放在最后一段,匹配剩余路径(可以为空),*后面的名字可选
+     * @param[in] slt servlet
+     * @return 规则是否合法
+     */
+    bool addRoute(const std::string& pattern, Servlet::ptr slt);
+
+    /**
+     * @brief 添加路由servlet
+     * @param[in] pattern 路由规则
+     * @param[in] cb FunctionServlet回调函数
+     * @return 规则是否合法
+     */
+    bool addRoute(const std::string& pattern, FunctionServlet::callback cb);
+
+    bool addRouteCreator(const std::string& pattern, IServletCreator::ptr creator);
+
+    template<class T>
+    bool addRouteCreator(const std::string& pattern) {
+        return addRouteCreator(pattern, std::make_shared<ServletCreator<T> >());
+    }
+
     /**
      * @brief 删除servlet
      * @param[in] uri uri
@@ -202,6 +237,12 @@ public:
      */
     void delGlobServlet(const std::string& uri);
 
+    /**
+     * @brief 删除路由servlet
+     * @param[in] pattern 路由规则
+     */
+    void delRoute(const std::string& pattern);
+
     /**
      * @brief 返回默认servlet
      */
@@ -235,8 +276,26 @@ public:
      */
     Servlet::ptr getMatchedServlet(const std::string& uri);
 
+    /**
+     * @brief 通过uri获取servlet,并把路由参数写入request
+     * @param[in] uri uri
+     * @param[in] request 非空时保存路由参数
+     */
+    Servlet::ptr getMatchedServlet(const std::string& uri, HttpRequest* request);
+
     void listAllServletCreator(std::map<std::string, IServletCreator::ptr>& infos);
     void listAllGlobServletCreator(std::map<std::string, IServletCreator::ptr>& infos);
+    void listAllRouteCreator(std::map<std::string, IServletCreator::ptr>& infos);
+private:
+    /**
+     * @brief 返回当前快照,快照失效时重建
+     */
+    std::shared_ptr<const RouteTable> getTable();
+
+    /**
+     * @brief 作废当前快照,需要持有写锁
+     */
+    void invalidate();
 private:
     /// 读写互斥量
     RWMutexType m_mutex;
@@ -246,6 +305,11 @@ private:
     /// 模糊匹配servlet 数组
     /// uri(/sylar/*) -> servlet
     std::vector<std::pair<std::string, IServletCreator::ptr> > m_globs;
+    /// 路由servlet
+    /// pattern(/user/:id) -> servlet
+    std::map<std::string, IServletCreator::ptr> m_routes;
+    /// 当前快照,nullptr表示需要重建,只用std::atomic_load/atomic_store读写
+    std::shared_ptr<const RouteTable> m_table;
     /// 默认servlet，所有路径都没匹配到时使用
     Servlet::ptr m_default;
 };
@@ -0,0 +1,206 @@
+#include "io_uring.h"
+#include "log.h"
+#include "macro.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace hr {
+
+static hr::Logger::ptr g_logger = HR_LOG_NAME("system");
+
+static int io_uring_setup(uint32_t entries, io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, uint32_t to_submit, uint32_t min_complete
+                          ,uint32_t flags, void* arg, size_t argsz) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int io_uring_register(int fd, uint32_t opcode, void* arg, uint32_t nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+bool IoUring::IsSupported() {
+    static bool s_supported = []() {
+        IoUring ring(4);
+        if(!ring.isValid()) {
+            return false;
+        }
+        if(!(ring.m_features & IORING_FEAT_EXT_ARG)
+                || !(ring.m_features & IORING_FEAT_NODROP)) {
+            HR_LOG_INFO(g_logger) << "io_uring features=" << ring.m_features
+                << " missing EXT_ARG or NODROP";
+            return false;
+        }
+
+        static const int MAX_OPS = 256;
+        size_t size = sizeof(io_uring_probe) + MAX_OPS * sizeof(io_uring_probe_op);
+        io_uring_probe* probe = (io_uring_probe*)calloc(1, size);
+        int rt = io_uring_register(ring.getFd(), IORING_REGISTER_PROBE, probe, MAX_OPS);
+        bool ok = rt == 0;
+        static const int s_ops[] = {IORING_OP_READ, IORING_OP_WRITE
+            ,IORING_OP_READV, IORING_OP_WRITEV, IORING_OP_RECV, IORING_OP_SEND
+            ,IORING_OP_RECVMSG, IORING_OP_SENDMSG, IORING_OP_ACCEPT
+            ,IORING_OP_CONNECT, IORING_OP_POLL_ADD, IORING_OP_ASYNC_CANCEL};
+        for(size_t i = 0; ok && i < sizeof(s_ops) / sizeof(s_ops[0]); ++i) {
+            int op = s_ops[i];
+            if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                HR_LOG_INFO(g_logger) << "io_uring opcode " << op << " not supported";
+                ok = false;
+            }
+        }
+        free(probe);
+        return ok;
+    }();
+    return s_supported;
+}
+
+IoUring::IoUring(uint32_t entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    m_fd = io_uring_setup(entries, &p);
+    if(m_fd < 0) {
+        HR_LOG_INFO(g_logger) << "io_uring_setup(" << entries << ") errno="
+            << errno << " errstr=" << strerror(errno);
+        m_fd = -1;
+        return;
+    }
+    m_features = p.features;
+
+    m_sqRingSize = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    m_cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single) {
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+    }
+    m_sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE
+                    ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if(single) {
+        m_cqRing = m_sqRing;
+    } else if(m_sqRing != MAP_FAILED) {
+        m_cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE
+                        ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+    }
+    m_sqesSize = p.sq_entries * sizeof(io_uring_sqe);
+    if(m_sqRing != MAP_FAILED && m_cqRing != MAP_FAILED) {
+        m_sqes = (io_uring_sqe*)mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE
+                        ,MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    }
+    if(m_sqRing == MAP_FAILED || m_cqRing == MAP_FAILED
+            || m_sqes == (io_uring_sqe*)MAP_FAILED) {
+        HR_LOG_ERROR(g_logger) << "io_uring mmap fail errno=" << errno
+            << " errstr=" << strerror(errno);
+        if(m_sqes == (io_uring_sqe*)MAP_FAILED) {
+            m_sqes = nullptr;
+        }
+        if(m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+        }
+        if(m_sqRing == MAP_FAILED) {
+            m_sqRing = nullptr;
+        }
+        release();
+        return;
+    }
+
+    char* sq = (char*)m_sqRing;
+    m_sqHead = (uint32_t*)(sq + p.sq_off.head);
+    m_sqTail = (uint32_t*)(sq + p.sq_off.tail);
+    m_sqMask = *(uint32_t*)(sq + p.sq_off.ring_mask);
+    m_sqEntries = p.sq_entries;
+    m_sqeTail = *m_sqTail;
+    //sqe下标和提交队列位置一一对应,只需要设置一次
+    uint32_t* array = (uint32_t*)(sq + p.sq_off.array);
+    for(uint32_t i = 0; i < m_sqEntries; ++i) {
+        array[i] = i;
+    }
+
+    char* cq = (char*)m_cqRing;
+    m_cqHead = (uint32_t*)(cq + p.cq_off.head);
+    m_cqTail = (uint32_t*)(cq + p.cq_off.tail);
+    m_cqMask = *(uint32_t*)(cq + p.cq_off.ring_mask);
+    m_cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+}
+
+IoUring::~IoUring() {
+    release();
+}
+
+void IoUring::release() {
+    if(m_sqes) {
+        munmap(m_sqes, m_sqesSize);
+        m_sqes = nullptr;
+    }
+    if(m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingSize);
+    }
+    m_cqRing = nullptr;
+    if(m_sqRing) {
+        munmap(m_sqRing, m_sqRingSize);
+        m_sqRing = nullptr;
+    }
+    if(m_fd >= 0) {
+        close(m_fd);
+        m_fd = -1;
+    }
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    uint32_t head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if(SYLAR_UNLIKELY(m_sqeTail - head >= m_sqEntries)) {
+        flush();
+        head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+        if(m_sqeTail - head >= m_sqEntries) {
+            return nullptr;
+        }
+    }
+    io_uring_sqe* sqe = &m_sqes[m_sqeTail & m_sqMask];
+    ++m_sqeTail;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+uint32_t IoUring::publish() {
+    __atomic_store_n(m_sqTail, m_sqeTail, __ATOMIC_RELEASE);
+    return m_sqeTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+}
+
+int IoUring::flush() {
+    uint32_t to_submit = publish();
+    if(to_submit == 0) {
+        return 0;
+    }
+    return io_uring_enter(m_fd, to_submit, 0, 0, nullptr, 0);
+}
+
+int IoUring::wait(uint32_t wait_nr, int timeout_ms) {
+    uint32_t to_submit = 0;
+    {
+        MutexType::Lock lock(m_mutex);
+        to_submit = publish();
+    }
+    if(wait_nr == 0) {
+        return to_submit ? io_uring_enter(m_fd, to_submit, 0, 0, nullptr, 0) : 0;
+    }
+    uint32_t flags = IORING_ENTER_GETEVENTS;
+    if(timeout_ms < 0) {
+        return io_uring_enter(m_fd, to_submit, wait_nr, flags, nullptr, 0);
+    }
+    __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000ll;
+    io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    flags |= IORING_ENTER_EXT_ARG;
+    return io_uring_enter(m_fd, to_submit, wait_nr, flags, &arg, sizeof(arg));
+}
+
+}
@@ -0,0 +1,102 @@
+//io_uring的简单封装,直接使用系统调用,不依赖liburing
+
+#ifndef __SYLAR_IO_URING_H__
+#define __SYLAR_IO_URING_H__
+
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "noncopyable.h"
+#include "mutex.h"
+
+namespace hr {
+
+//一个io_uring实例,提交队列(SQ)和完成队列(CQ)都映射到用户态
+//提交队列可以被多个线程使用: getSqe()和flush()要持有getMutex();
+//完成队列只能由一个线程消费
+class IoUring : Noncopyable {
+public:
+    typedef Mutex MutexType;
+
+    //内核是否支持IOManager需要的特性: 等待带超时(EXT_ARG)、完成事件不丢弃(NODROP)
+    //以及读写、收发、accept、connect、poll、取消这些操作码。结果只检测一次
+    static bool IsSupported();
+
+    //entries 提交队列大小
+    IoUring(uint32_t entries);
+
+    ~IoUring();
+
+    //是否创建成功
+    bool isValid() const { return m_fd >= 0;}
+
+    //io_uring的文件句柄
+    int getFd() const { return m_fd;}
+
+    //返回一个清零的sqe,提交队列满时先提交一次,仍然满返回nullptr
+    //调用时要持有getMutex(),填好后在解锁前不需要提交,由flush()或wait()统一提交
+    io_uring_sqe* getSqe();
+
+    //提交所有填好的sqe,不等待,调用时要持有getMutex()
+    //返回提交的数量,失败返回-1
+    int flush();
+
+    //提交所有填好的sqe并等待至少wait_nr个完成事件,最多等待timeout_ms毫秒(-1一直等)
+    //不能持有getMutex(),等待期间其他线程可以继续提交
+    //返回提交的数量,超时或被信号打断返回-1
+    int wait(uint32_t wait_nr, int timeout_ms);
+
+    //依次处理完成队列里的事件 cb(user_data, res),返回处理的数量
+    template<class Callback>
+    uint32_t reap(Callback cb) {
+        uint32_t head = *m_cqHead;
+        uint32_t tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+        uint32_t count = 0;
+        for(; head != tail; ++head, ++count) {
+            io_uring_cqe& cqe = m_cqes[head & m_cqMask];
+            cb(cqe.user_data, cqe.res);
+        }
+        __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    //提交队列的锁
+    MutexType& getMutex() { return m_mutex;}
+private:
+    //释放映射和句柄
+    void release();
+
+    //把本地的sqe尾部发布给内核,返回还没被内核取走的sqe数量
+    uint32_t publish();
+private:
+    //io_uring文件句柄
+    int m_fd = -1;
+    //内核支持的特性 IORING_FEAT_*
+    uint32_t m_features = 0;
+
+    //SQ和CQ的映射,支持IORING_FEAT_SINGLE_MMAP时是同一块
+    void* m_sqRing = nullptr;
+    size_t m_sqRingSize = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesSize = 0;
+
+    uint32_t* m_sqHead = nullptr;
+    uint32_t* m_sqTail = nullptr;
+    uint32_t m_sqMask = 0;
+    uint32_t m_sqEntries = 0;
+    //已经填好还没发布的sqe尾部
+    uint32_t m_sqeTail = 0;
+
+    uint32_t* m_cqHead = nullptr;
+    uint32_t* m_cqTail = nullptr;
+    uint32_t m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    MutexType m_mutex;
+};
+
+}
+
+#endif
@@ -1,17 +1,48 @@
 #include "iomanager.h"
 #include "macro.h"
 #include "log.h"
+#include "config.h"
+#include "fd_manager.h"
+#include "util.h"
 
 #include <errno.h>
-#include <fcntl.h>
 #include <sys/epoll.h>
+#include <poll.h>
+#include <sched.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <unistd.h>
 
 namespace hr {
 
 static hr::Logger::ptr g_logger = HR_LOG_NAME("system");
 
+//持久注册模式: fd第一次等待时以EPOLLIN|EPOLLOUT|EPOLLET注册一次,
+//就绪状态和等待的协程在用户态记录,事件触发和重新等待都不再调用epoll_ctl
+static hr::ConfigVar<bool>::ptr g_iomanager_persistent_epoll =
+    hr::Config::Lookup("iomanager.persistent_epoll", false, "iomanager register fd once with edge triggered read and write");
+
+//io后端: epoll或者io_uring,内核不支持io_uring时使用epoll
+static hr::ConfigVar<std::string>::ptr g_iomanager_backend =
+    hr::Config::Lookup("iomanager.backend", std::string("epoll"), "iomanager io backend, epoll or io_uring");
+
+//每个线程io_uring的提交队列大小
+static hr::ConfigVar<uint32_t>::ptr g_iomanager_uring_entries =
+    hr::Config::Lookup("iomanager.uring_entries", (uint32_t)1024, "iomanager io_uring queue entries per thread");
+
+//睡眠前自旋: 空闲线程先用0超时的epoll_wait轮询,按最近事件的间隔调整自旋时间,
+//用CPU换掉睡眠、唤醒的延迟。只用于epoll后端
+static hr::ConfigVar<uint32_t>::ptr g_iomanager_busy_poll_us =
+    hr::Config::Lookup("iomanager.busy_poll_us", (uint32_t)0, "iomanager max busy poll microseconds before epoll_wait sleeps, 0 means disabled");
+
+//io_uring完成事件的user_data: 对poller->epfd的POLL_ADD
+static const uint64_t URING_EPOLL_DATA = 1;
+//io_uring完成事件的user_data: 不需要处理的结果(取消请求)
+static const uint64_t URING_IGNORE_DATA = 2;
+
+//当前线程私有的epoll(IOManager::ThreadPoller)
+static thread_local void* t_poller = nullptr;
+
 enum EpollCtlOp {
 };
 
@@ -75,6 +106,7 @@ void IOManager::FdContext::resetContext(EventContext& ctx) {
     ctx.scheduler = nullptr;
     ctx.fiber.reset();
     ctx.cb = nullptr;
+    ctx.thread = -1;
 }
 
 void IOManager::FdContext::triggerEvent(IOManager::Event event) {
@@ -84,36 +116,31 @@ void IOManager::FdContext::triggerEvent(IOManager::Event event) {
     EventContext& ctx = getContext(event);
     //添加到协程任务队列里
     if(ctx.cb) {
-        ctx.scheduler->schedule(&ctx.cb);
+        ctx.scheduler->schedule(&ctx.cb, ctx.thread);
     } else {
-        ctx.scheduler->schedule(&ctx.fiber);
+        ctx.scheduler->schedule(&ctx.fiber, ctx.thread);
     }
     ctx.scheduler = nullptr;
+    ctx.thread = -1;
     return;
 }
 
 IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
-    :Scheduler(threads, use_caller, name) {
-    //创建epoll实例
+    :Scheduler(threads, use_caller, name)
+    ,TimerManager(threads)
+    ,m_persistent(g_iomanager_persistent_epoll->getValue())
+    ,m_busyPollUs(g_iomanager_busy_poll_us->getValue()) {
+    //创建epoll实例,每个线程的私有epoll都挂在它上面,唤醒线程用各自的eventfd
     m_epfd = epoll_create(5000);
     SYLAR_ASSERT(m_epfd > 0);
-    //创建管道
-    int rt = pipe(m_tickleFds);
-    SYLAR_ASSERT(!rt);
-    //注册pipe读句柄的可读事件， 用于tickle调度协程， 通过epoll_event.data.fd保存描述符
-    epoll_event event;
-    memset(&event, 0, sizeof(epoll_event));
-    event.events = EPOLLIN | EPOLLET;
-    event.data.fd = m_tickleFds[0];
-
-    //非阻塞fd
-    rt = fcntl(m_tickleFds[0], F_SETFL, O_NONBLOCK);
-    SYLAR_ASSERT(!rt);
-    //挂上树
-    rt = epoll_ctl(m_epfd, EPOLL_CTL_ADD, m_tickleFds[0], &event);
-    SYLAR_ASSERT(!rt);
 
-    contextResize(32);
+    if(g_iomanager_backend->getValue() == "io_uring") {
+        m_uring = IoUring::IsSupported();
+        if(!m_uring) {
+            HR_LOG_WARN(g_logger) << "name=" << getName()
+                << " io_uring not supported, fallback to epoll";
+        }
+    }
 
     //开启scheduler
     start();
@@ -121,43 +148,50 @@ IOManager::IOManager(size_t threads, bool use_caller, const std::string& name)
 
 IOManager::~IOManager() {
     stop();
-    close(m_epfd);
-    close(m_tickleFds[0]);
-    close(m_tickleFds[1]);
-
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if(m_fdContexts[i]) {
-            delete m_fdContexts[i];
-        }
+    //caller线程比IOManager活得久
+    if(t_poller && ((ThreadPoller*)t_poller)->owner == this) {
+        t_poller = nullptr;
     }
+    for(auto& i : m_pollers) {
+        close(i.second->epfd);
+        close(i.second->tickleFd);
+        delete i.second->ring;
+        delete i.second;
+    }
+    m_pollers.clear();
+    close(m_epfd);
 }
 
-void IOManager::contextResize(size_t size) {
-    m_fdContexts.resize(size);
+IOManager::FdContext* IOManager::getFdContext(int fd) {
+    return m_fdContexts.getOrCreate(fd, [fd]() {
+        FdContext* ctx = new FdContext;
+        ctx->fd = fd;
+        return ctx;
+    });
+}
 
-    for(size_t i = 0; i < m_fdContexts.size(); ++i) {
-        if(!m_fdContexts[i]) {
-            m_fdContexts[i] = new FdContext;
-            m_fdContexts[i]->fd = i;
-        }
-    }
+int IOManager::epollCtl(int epfd, int op, int fd, epoll_event* event) {
+    ++m_epollCtlCount;
+    return epoll_ctl(epfd, op, fd, event);
 }
 
 int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
-    FdContext* fd_ctx = nullptr;
-    RWMutexType::ReadLock lock(m_mutex);
-    //fd存在
-    if((int)m_fdContexts.size() > fd) {
-        fd_ctx = m_fdContexts[fd];
-        lock.unlock();
-    } else {
-        lock.unlock();
-        RWMutexType::WriteLock lock2(m_mutex);
-        contextResize(fd * 1.5);
-        fd_ctx = m_fdContexts[fd];
+    FdContext* fd_ctx = getFdContext(fd);
+    if(SYLAR_UNLIKELY(!fd_ctx)) {
+        HR_LOG_ERROR(g_logger) << "addEvent fd=" << fd << " out of range";
+        return -1;
+    }
+
+    //fd号复用后FdCtx的generation会变,在锁外取
+    uint32_t gen = 0;
+    if(m_persistent) {
+        FdCtx::ptr ctx = FdMgr::GetInstance()->get(fd);
+        if(ctx) {
+            gen = ctx->getGeneration();
+        }
     }
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
     if(SYLAR_UNLIKELY(fd_ctx->events & event)) {
         HR_LOG_ERROR(g_logger) << "addEvent assert fd=" << fd
                     << " event=" << (EPOLL_EVENTS)event
@@ -165,18 +199,58 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         SYLAR_ASSERT(!(fd_ctx->events & event));
     }
 
-    int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
-    epoll_event epevent;
-    epevent.events = EPOLLET | fd_ctx->events | event;
-    epevent.data.ptr = fd_ctx;
+    //句柄没有经过cancelAll就关闭了(没有hook的线程里close),原来的注册已经随句柄失效
+    if(SYLAR_UNLIKELY(fd_ctx->registered && fd_ctx->generation != gen)) {
+        epoll_event epevent;
+        epevent.events = 0;
+        epevent.data.ptr = fd_ctx;
+        epollCtl(fd_ctx->epfd, EPOLL_CTL_DEL, fd, &epevent);
+        fd_ctx->registered = false;
+        fd_ctx->ready = NONE;
+    }
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        HR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
-            << (EPOLL_EVENTS)fd_ctx->events;
-        return -1;
+    //持久注册模式下已经注册过的fd不需要epoll_ctl
+    if(!fd_ctx->registered) {
+        int op = fd_ctx->events ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+        if(op == EPOLL_CTL_ADD) {
+            fd_ctx->epfd = m_epfd;
+            //指定了线程的协程注册到线程私有的epoll，事件由本线程直接处理
+            if(Scheduler::GetTaskThread() != -1 && Scheduler::GetThis() == this) {
+                ThreadPoller* poller = getThreadPoller();
+                if(poller) {
+                    fd_ctx->epfd = poller->epfd;
+                }
+            }
+        }
+        epoll_event epevent;
+        epevent.events = m_persistent ? (EPOLLIN | EPOLLOUT | EPOLLET)
+                            : (EPOLLET | fd_ctx->events | event);
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epollCtl(fd_ctx->epfd, op, fd, &epevent);
+        if(rt) {
+            HR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ") fd_ctx->events="
+                << (EPOLL_EVENTS)fd_ctx->events;
+            return -1;
+        }
+        if(m_persistent) {
+            fd_ctx->registered = true;
+            fd_ctx->ready = NONE;
+            fd_ctx->generation = gen;
+        }
+    }
+
+    //等待之前边沿已经到了,之后不会再通知。
+    //就绪可能已经过时(数据已经被读完),调用方重试会再得到EAGAIN,再次等待
+    if(fd_ctx->ready & event) {
+        fd_ctx->ready = (Event)(fd_ctx->ready & ~event);
+        if(!cb) {
+            return 1;
+        }
+        Scheduler::GetThis()->schedule(cb, Scheduler::GetTaskThread());
+        return 0;
     }
 
     //等待执行事件+1
@@ -188,6 +262,8 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
                 && !event_ctx.cb);
 
     event_ctx.scheduler = Scheduler::GetThis();
+    //指定了线程的任务,事件触发后回到原线程
+    event_ctx.thread = Scheduler::GetTaskThread();
     if(cb) {
         event_ctx.cb.swap(cb);
     } else {
@@ -195,34 +271,36 @@ int IOManager::addEvent(int fd, Event event, std::function<void()> cb) {
         SYLAR_ASSERT2(event_ctx.fiber->getState() == Fiber::EXEC
                       ,"state=" << event_ctx.fiber->getState());
     }
+
     return 0;
 }
 
 bool IOManager::delEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = m_fdContexts.get(fd);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
     if(SYLAR_UNLIKELY(!(fd_ctx->events & event))) {
         return false;
     }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        HR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    //持久注册模式只清除用户态的等待
+    if(!fd_ctx->registered) {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epollCtl(fd_ctx->epfd, op, fd, &epevent);
+        if(rt) {
+            HR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     --m_pendingEventCount;
@@ -235,30 +313,34 @@ bool IOManager::delEvent(int fd, Event event) {
 
 //取消事件会触发一次
 bool IOManager::cancelEvent(int fd, Event event) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = m_fdContexts.get(fd);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    if(fd_ctx->getRequest(event)) {
+        return cancelUring(fd_ctx, event, false);
+    }
     if(SYLAR_UNLIKELY(!(fd_ctx->events & event))) {
         return false;
     }
 
     Event new_events = (Event)(fd_ctx->events & ~event);
-    int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-    epoll_event epevent;
-    epevent.events = EPOLLET | new_events;
-    epevent.data.ptr = fd_ctx;
-
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        HR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-            << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
-            << rt << " (" << errno << ") (" << strerror(errno) << ")";
-        return false;
+    //持久注册模式只清除用户态的等待
+    if(!fd_ctx->registered) {
+        int op = new_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        epoll_event epevent;
+        epevent.events = EPOLLET | new_events;
+        epevent.data.ptr = fd_ctx;
+
+        int rt = epollCtl(fd_ctx->epfd, op, fd, &epevent);
+        if(rt) {
+            HR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
+                << rt << " (" << errno << ") (" << strerror(errno) << ")";
+            return false;
+        }
     }
 
     fd_ctx->triggerEvent(event);
@@ -268,16 +350,24 @@ bool IOManager::cancelEvent(int fd, Event event) {
 
 //取消一个fd所有事件，并且全部触发一次
 bool IOManager::cancelAll(int fd) {
-    RWMutexType::ReadLock lock(m_mutex);
-    if((int)m_fdContexts.size() <= fd) {
+    FdContext* fd_ctx = m_fdContexts.get(fd);
+    if(!fd_ctx) {
         return false;
     }
-    FdContext* fd_ctx = m_fdContexts[fd];
-    lock.unlock();
 
-    FdContext::MutexType::Lock lock2(fd_ctx->mutex);
-    if(!fd_ctx->events) {
-        return false;
+    FdContext::MutexType::Lock lock(fd_ctx->mutex);
+    //io_uring请求马上释放fd,完成事件到达后再唤醒协程
+    bool uring_cancelled = false;
+    if(fd_ctx->uringRead) {
+        uring_cancelled |= cancelUring(fd_ctx, READ, true);
+    }
+    if(fd_ctx->uringWrite) {
+        uring_cancelled |= cancelUring(fd_ctx, WRITE, true);
+    }
+    //持久注册的fd没有等待的事件也在epoll上,关闭前注销。
+    //dup出来的句柄还开着时内核不会自动移除,之后的事件会落到复用了fd号的新句柄上
+    if(!fd_ctx->events && !fd_ctx->registered) {
+        return uring_cancelled;
     }
 
     int op = EPOLL_CTL_DEL;
@@ -285,9 +375,16 @@ bool IOManager::cancelAll(int fd) {
     epevent.events = 0;
     epevent.data.ptr = fd_ctx;
 
-    int rt = epoll_ctl(m_epfd, op, fd, &epevent);
-    if(rt) {
-        HR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
+    int rt = epollCtl(fd_ctx->epfd, op, fd, &epevent);
+    if(fd_ctx->registered) {
+        //注销失败(句柄已经从epoll移除)不影响唤醒等待的协程
+        fd_ctx->registered = false;
+        fd_ctx->ready = NONE;
+        if(!fd_ctx->events) {
+            return uring_cancelled;
+        }
+    } else if(rt) {
+        HR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
             << (EpollCtlOp)op << ", " << fd << ", " << (EPOLL_EVENTS)epevent.events << "):"
             << rt << " (" << errno << ") (" << strerror(errno) << ")";
         return false;
@@ -311,18 +408,146 @@ IOManager* IOManager::GetThis() {
     return dynamic_cast<IOManager*>(Scheduler::GetThis());
 }
 
-//通知调度器有任务
+static void write_eventfd(int fd) {
+    uint64_t one = 1;
+    int rt = write(fd, &one, sizeof(one));
+    SYLAR_ASSERT(rt == sizeof(one));
+}
+
+//通知调度器有任务,只唤醒一个睡眠中的线程
 void IOManager::tickle() {
-    if(!hasIdleThreads()) {
+    RWMutexType::ReadLock lock(m_pollerMutex);
+    //自旋中的线程最快看到任务,改状态就行
+    if(m_busyPollUs) {
+        for(auto& i : m_pollers) {
+            int expected = ThreadPoller::SPINNING;
+            if(i.second->state.compare_exchange_strong(expected, ThreadPoller::NOTIFIED)) {
+                ++m_tickleSuppressedCount;
+                return;
+            }
+        }
+    }
+    for(auto& i : m_pollers) {
+        int expected = ThreadPoller::SLEEPING;
+        if(i.second->state.compare_exchange_strong(expected, ThreadPoller::NOTIFIED)) {
+            write_eventfd(i.second->tickleFd);
+            ++m_tickleCount;
+            return;
+        }
+    }
+    //没有睡眠的线程: 标记一个醒着的线程,让它睡眠前再检查一次任务队列,
+    //避免它检查完队列、还没进入等待时丢掉通知
+    for(auto& i : m_pollers) {
+        int expected = ThreadPoller::RUNNING;
+        if(i.second->state.compare_exchange_strong(expected, ThreadPoller::NOTIFIED)) {
+            break;
+        }
+    }
+    ++m_tickleSuppressedCount;
+}
+
+void IOManager::tickleThread(int thread) {
+    ThreadPoller* poller = nullptr;
+    {
+        RWMutexType::ReadLock lock(m_pollerMutex);
+        auto it = m_pollers.find(thread);
+        if(it != m_pollers.end()) {
+            poller = it->second;
+        }
+    }
+    //还没有空闲过的线程,创建私有epoll时按已通知处理,第一次等待前会检查任务队列
+    if(!poller) {
+        ++m_tickleSuppressedCount;
         return;
     }
-    int rt = write(m_tickleFds[1], "T", 1);
-    SYLAR_ASSERT(rt == 1);
+    wakeup(poller);
+}
+
+bool IOManager::wakeup(ThreadPoller* poller) {
+    //不检查空闲线程数，避免目标线程检查完任务队列、还没计入空闲时丢掉通知
+    if(poller->state.exchange(ThreadPoller::NOTIFIED) != ThreadPoller::SLEEPING) {
+        ++m_tickleSuppressedCount;
+        return false;
+    }
+    write_eventfd(poller->tickleFd);
+    ++m_tickleCount;
+    return true;
+}
+
+uint64_t IOManager::getBusyPollTime(ThreadPoller* poller) const {
+    if(!m_busyPollUs || poller->ring) {
+        return 0;
+    }
+    if(poller->eventGapUs == 0) {
+        return m_busyPollUs;
+    }
+    if(poller->eventGapUs > m_busyPollUs) {
+        return 0;
+    }
+    return std::min(poller->eventGapUs * 2, m_busyPollUs);
+}
+
+IOManager::ThreadPoller* IOManager::getThreadPoller() {
+    ThreadPoller* poller = (ThreadPoller*)t_poller;
+    if(poller && poller->owner == this) {
+        return poller;
+    }
+    poller = new ThreadPoller;
+    poller->owner = this;
+    poller->epfd = epoll_create1(EPOLL_CLOEXEC);
+    poller->tickleFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(poller->epfd < 0 || poller->tickleFd < 0) {
+        HR_LOG_ERROR(g_logger) << "create thread poller fail errno=" << errno
+            << " errstr=" << strerror(errno);
+        if(poller->epfd >= 0) {
+            close(poller->epfd);
+        }
+        if(poller->tickleFd >= 0) {
+            close(poller->tickleFd);
+        }
+        delete poller;
+        return nullptr;
+    }
+
+    epoll_event event;
+    memset(&event, 0, sizeof(epoll_event));
+    event.events = EPOLLIN | EPOLLET;
+    event.data.fd = poller->tickleFd;
+    int rt = epoll_ctl(poller->epfd, EPOLL_CTL_ADD, poller->tickleFd, &event);
+    SYLAR_ASSERT(!rt);
+    //共用的epoll水平触发，没取完的事件下次还会通知。
+    //EPOLLEXCLUSIVE: 共用的句柄有事件时只唤醒一个等待中的线程,老内核不支持时退回普通注册
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.fd = m_epfd;
+    rt = epoll_ctl(poller->epfd, EPOLL_CTL_ADD, m_epfd, &event);
+    if(rt && errno == EINVAL) {
+        event.events = EPOLLIN;
+        rt = epoll_ctl(poller->epfd, EPOLL_CTL_ADD, m_epfd, &event);
+    }
+    SYLAR_ASSERT(!rt);
+
+    //io_uring创建失败的线程继续用epoll
+    if(m_uring) {
+        poller->ring = new IoUring(g_iomanager_uring_entries->getValue());
+        if(!poller->ring->isValid()) {
+            delete poller->ring;
+            poller->ring = nullptr;
+        }
+    }
+
+    {
+        RWMutexType::WriteLock lock(m_pollerMutex);
+        m_pollers[hr::GetThreadId()] = poller;
+    }
+    t_poller = poller;
+    return poller;
 }
 
 bool IOManager::stopping(uint64_t& timeout) {
     timeout = getNextTimer();
+    //其他线程的分片还有定时器时也不能停止
     return timeout == ~0ull
+        && !hasTimer()
         && m_pendingEventCount == 0
         && Scheduler::stopping();
 
@@ -347,24 +572,91 @@ void IOManager::idle() {
         if(SYLAR_UNLIKELY(stopping(next_timeout))) {
             HR_LOG_INFO(g_logger) << "name=" << getName()
                                      << " idle stopping exit";
+            //依次唤醒还在睡眠的线程退出,不用等到epoll_wait超时
+            releaseShard();
+            tickle();
             break;
         }
 
+        //每个线程等待自己的私有epoll，共用的epoll挂在它上面
+        //io_uring后端每个线程还有自己的io_uring
+        ThreadPoller* poller = getThreadPoller();
+        //上次只因为tickle醒来,回到调度后没有执行任何任务
+        if(poller && poller->tickled) {
+            poller->tickled = false;
+            if(Scheduler::GetTaskCount() == poller->taskCount) {
+                ++m_spuriousWakeupCount;
+            }
+        }
         int rt = 0;
-        do {
-            static const int MAX_TIMEOUT = 3000;
-            if(next_timeout != ~0ull) {
-                next_timeout = (int)next_timeout > MAX_TIMEOUT
-                                ? MAX_TIMEOUT : next_timeout;
-            } else {
-                next_timeout = MAX_TIMEOUT;
+        static const int MAX_TIMEOUT = 3000;
+        if(next_timeout != ~0ull) {
+            next_timeout = (int)next_timeout > MAX_TIMEOUT
+                            ? MAX_TIMEOUT : next_timeout;
+        } else {
+            next_timeout = MAX_TIMEOUT;
+        }
+        //睡眠前自旋,期间有事件或者被通知就不再睡眠
+        //不自旋时也记录等待开始的时间,事件变密集后可以重新开始自旋
+        uint64_t wait_start = (poller && m_busyPollUs && !poller->ring) ? GetCurrentUS() : 0;
+        uint64_t spin = wait_start ? std::min(getBusyPollTime(poller), next_timeout * 1000) : 0;
+        bool hit = false;
+        int expected = ThreadPoller::RUNNING;
+        if(spin && poller->state.compare_exchange_strong(expected, ThreadPoller::SPINNING)) {
+            ++m_busyPollCount;
+            uint64_t now = wait_start;
+            do {
+                ++m_epollWaitCount;
+                rt = epoll_wait(poller->epfd, events, MAX_EVENTS, 0);
+                if(rt == 0) {
+                    sched_yield();
+                }
+                now = GetCurrentUS();
+            } while(rt == 0 && poller->state == ThreadPoller::SPINNING
+                    && now - wait_start < spin);
+            rt = rt < 0 ? 0 : rt;
+            expected = ThreadPoller::SPINNING;
+            if(!poller->state.compare_exchange_strong(expected, ThreadPoller::RUNNING) || rt > 0) {
+                hit = true;
+                ++m_busyPollHitCount;
+            }
+            //自旋用掉的时间从睡眠时间里扣掉,不推迟定时器
+            uint64_t used = (now - wait_start) / 1000;
+            next_timeout = next_timeout > used ? next_timeout - used : 0;
+        }
+        if(!hit) {
+            //进入睡眠,之后的通知需要写eventfd。
+            //醒着的时候收到过通知就不睡眠,取完已经就绪的事件回到调度检查任务队列
+            if(poller) {
+                expected = ThreadPoller::RUNNING;
+                if(!poller->state.compare_exchange_strong(expected, ThreadPoller::SLEEPING)) {
+                    poller->state = ThreadPoller::RUNNING;
+                    next_timeout = 0;
+                }
             }
-            rt = epoll_wait(m_epfd, events, MAX_EVENTS, (int)next_timeout);
-            if(rt < 0 && errno == EINTR) {
+            if(poller && poller->ring) {
+                rt = waitUring(poller, events, MAX_EVENTS, (int)next_timeout);
             } else {
-                break;
+                do {
+                    ++m_epollWaitCount;
+                    rt = epoll_wait(poller ? poller->epfd : m_epfd, events, MAX_EVENTS, (int)next_timeout);
+                    if(rt < 0 && errno == EINTR) {
+                    } else {
+                        break;
+                    }
+                } while(true);
             }
-        } while(true);
+        }
+        if(poller) {
+            poller->state = ThreadPoller::RUNNING;
+        }
+        //记录从进入等待到有事件的间隔,超时醒来不算。很久没有事件时
+        //间隔按上限的4倍计,一次长时间空闲不会让自旋停很久
+        if(wait_start && (rt > 0 || hit)) {
+            uint64_t gap = std::min(GetCurrentUS() - wait_start, m_busyPollUs * 4);
+            poller->eventGapUs = poller->eventGapUs
+                            ? (poller->eventGapUs * 7 + gap) / 8 : gap;
+        }
 
         //超时
         std::vector<std::function<void()> >cbs;
@@ -376,66 +668,241 @@ void IOManager::idle() {
         }
 
         //事件触发
-        for(int i = 0; i < rt; ++i) {
-            epoll_event& event = events[i];
+        handleEvents(poller, events, rt, MAX_EVENTS);
+
+        Fiber::ptr cur = Fiber::GetThis();
+        auto raw_ptr = cur.get();
+        cur.reset();
+        //回到调度协程
+        raw_ptr->swapOut();
+    }
+}
+
+void IOManager::handleEvents(ThreadPoller* poller, epoll_event* events, int rt, int max_events) {
+    for(int i = 0; i < rt; ++i) {
+        epoll_event& event = events[i];
+        if(poller) {
             //唤醒
-            if(event.data.fd == m_tickleFds[0]) {
-                uint8_t dummy[256];
-                while(read(m_tickleFds[0], dummy, sizeof(dummy)) > 0);
+            if(event.data.fd == poller->tickleFd) {
+                uint64_t dummy;
+                while(read(poller->tickleFd, &dummy, sizeof(dummy)) > 0);
+                poller->tickled = true;
+                poller->taskCount = Scheduler::GetTaskCount();
                 continue;
             }
-
-            //有事件触发
-            FdContext* fd_ctx = (FdContext*)event.data.ptr;
-            FdContext::MutexType::Lock lock(fd_ctx->mutex);
-            if(event.events & (EPOLLERR | EPOLLHUP)) {
-                event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+            //共用的epoll上有事件，取出来接在后面一起处理
+            if(event.data.fd == m_epfd) {
+                if(rt < max_events) {
+                    ++m_epollWaitCount;
+                    int n = epoll_wait(m_epfd, events + rt, max_events - rt, 0);
+                    if(n > 0) {
+                        rt += n;
+                    }
+                }
+                continue;
             }
+        }
+
+        //有事件触发
+        FdContext* fd_ctx = (FdContext*)event.data.ptr;
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        if(fd_ctx->registered) {
+            //持久注册: 有协程等待的事件触发,其余的记为就绪,不调用epoll_ctl
             int real_events = NONE;
-            if(event.events & EPOLLIN) {
+            if(event.events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
                 real_events |= READ;
             }
-            if(event.events & EPOLLOUT) {
+            if(event.events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
                 real_events |= WRITE;
             }
-
-            if((fd_ctx->events & real_events) == NONE) {
-                continue;
-            }
-
-            //将剩下的事件添加上去
-            int left_events = (fd_ctx->events & ~real_events);
-            int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
-            event.events = EPOLLET | left_events;
-
-            int rt2 = epoll_ctl(m_epfd, op, fd_ctx->fd, &event);
-            if(rt2) {
-                HR_LOG_ERROR(g_logger) << "epoll_ctl(" << m_epfd << ", "
-                    << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
-                    << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
-                continue;
-            }
-
-            if(real_events & READ) {
+            int fire_events = fd_ctx->events & real_events;
+            fd_ctx->ready = (Event)(fd_ctx->ready | (real_events & ~fire_events));
+            if(fire_events & READ) {
                 fd_ctx->triggerEvent(READ);
                 --m_pendingEventCount;
             }
-            if(real_events & WRITE) {
+            if(fire_events & WRITE) {
                 fd_ctx->triggerEvent(WRITE);
                 --m_pendingEventCount;
             }
+            continue;
+        }
+        if(event.events & (EPOLLERR | EPOLLHUP)) {
+            event.events |= (EPOLLIN | EPOLLOUT) & fd_ctx->events;
+        }
+        int real_events = NONE;
+        if(event.events & EPOLLIN) {
+            real_events |= READ;
+        }
+        if(event.events & EPOLLOUT) {
+            real_events |= WRITE;
         }
 
-        Fiber::ptr cur = Fiber::GetThis();
-        auto raw_ptr = cur.get();
-        cur.reset();
-        //回到调度协程
-        raw_ptr->swapOut();
+        if((fd_ctx->events & real_events) == NONE) {
+            continue;
+        }
+
+        //将剩下的事件添加上去
+        int left_events = (fd_ctx->events & ~real_events);
+        int op = left_events ? EPOLL_CTL_MOD : EPOLL_CTL_DEL;
+        event.events = EPOLLET | left_events;
+
+        int rt2 = epollCtl(fd_ctx->epfd, op, fd_ctx->fd, &event);
+        if(rt2) {
+            HR_LOG_ERROR(g_logger) << "epoll_ctl(" << fd_ctx->epfd << ", "
+                << (EpollCtlOp)op << ", " << fd_ctx->fd << ", " << (EPOLL_EVENTS)event.events << "):"
+                << rt2 << " (" << errno << ") (" << strerror(errno) << ")";
+            continue;
+        }
+
+        if(real_events & READ) {
+            fd_ctx->triggerEvent(READ);
+            --m_pendingEventCount;
+        }
+        if(real_events & WRITE) {
+            fd_ctx->triggerEvent(WRITE);
+            --m_pendingEventCount;
+        }
+    }
+}
+
+bool IOManager::submitIo(int fd, Event event, const io_uring_sqe& sqe, int& res) {
+    if(!m_uring) {
+        return false;
+    }
+    ThreadPoller* poller = getThreadPoller();
+    FdContext* fd_ctx = getFdContext(fd);
+    if(!poller || !poller->ring || !fd_ctx) {
+        return false;
+    }
+
+    UringRequest req;
+    req.fdCtx = fd_ctx;
+    req.ring = poller->ring;
+    req.fiber = Fiber::GetThis();
+    req.thread = Scheduler::GetTaskThread();
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        UringRequest*& slot = fd_ctx->getRequest(event);
+        if(SYLAR_UNLIKELY(slot || (fd_ctx->events & event))) {
+            HR_LOG_ERROR(g_logger) << "submitIo fd=" << fd << " event=" << event
+                << " already waiting";
+            return false;
+        }
+        slot = &req;
+    }
+    {
+        IoUring::MutexType::Lock lock(poller->ring->getMutex());
+        io_uring_sqe* s = poller->ring->getSqe();
+        if(SYLAR_UNLIKELY(!s)) {
+            lock.unlock();
+            FdContext::MutexType::Lock lock2(fd_ctx->mutex);
+            fd_ctx->getRequest(event) = nullptr;
+            return false;
+        }
+        *s = sqe;
+        s->user_data = (uint64_t)(uintptr_t)&req;
+    }
+    ++m_uringSqeCount;
+    ++m_pendingEventCount;
+    //请求在本线程回到idle时批量提交,完成事件也由本线程收取,切出之前不会被唤醒
+    Fiber::YieldToHold();
+    res = req.res;
+    return true;
+}
+
+void IOManager::onUringComplete(UringRequest* req, int res) {
+    FdContext* fd_ctx = req->fdCtx;
+    {
+        FdContext::MutexType::Lock lock(fd_ctx->mutex);
+        //被cancelAll释放过的fd可能已经有新的请求
+        if(fd_ctx->uringRead == req) {
+            fd_ctx->uringRead = nullptr;
+        } else if(fd_ctx->uringWrite == req) {
+            fd_ctx->uringWrite = nullptr;
+        }
+    }
+    req->res = res;
+    Fiber::ptr fiber;
+    fiber.swap(req->fiber);
+    int thread = req->thread;
+    --m_pendingEventCount;
+    //调度之后协程随时会返回,不能再访问req
+    schedule(fiber, thread);
+}
+
+bool IOManager::cancelUring(FdContext* fd_ctx, Event event, bool detach) {
+    UringRequest*& slot = fd_ctx->getRequest(event);
+    UringRequest* req = slot;
+    if(!req) {
+        return false;
+    }
+    if(detach) {
+        slot = nullptr;
+    }
+    //请求可能在别的线程的io_uring上,取消请求马上提交,不等那个线程回到idle
+    IoUring::MutexType::Lock lock(req->ring->getMutex());
+    io_uring_sqe* sqe = req->ring->getSqe();
+    if(!sqe) {
+        HR_LOG_ERROR(g_logger) << "cancelUring fd=" << fd_ctx->fd << " queue full";
+        return false;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)req;
+    sqe->user_data = URING_IGNORE_DATA;
+    req->ring->flush();
+    return true;
+}
+
+int IOManager::waitUring(ThreadPoller* poller, epoll_event* events, int max_events, int timeout) {
+    IoUring* ring = poller->ring;
+    if(!poller->epollArmed) {
+        IoUring::MutexType::Lock lock(ring->getMutex());
+        io_uring_sqe* sqe = ring->getSqe();
+        if(sqe) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = poller->epfd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = URING_EPOLL_DATA;
+            poller->epollArmed = true;
+        }
+    }
+
+    ++m_uringEnterCount;
+    int rt = ring->wait(1, timeout);
+    if(rt < 0 && errno != ETIME && errno != EINTR && errno != EBUSY) {
+        HR_LOG_ERROR(g_logger) << "io_uring_enter(" << ring->getFd() << ") errno="
+            << errno << " errstr=" << strerror(errno);
+    }
+
+    bool epoll_ready = false;
+    ring->reap([this, poller, &epoll_ready](uint64_t data, int res) {
+        if(data == URING_EPOLL_DATA) {
+            poller->epollArmed = false;
+            epoll_ready = true;
+        } else if(data != URING_IGNORE_DATA) {
+            onUringComplete((UringRequest*)(uintptr_t)data, res);
+        }
+    });
+    if(!epoll_ready) {
+        return 0;
+    }
+    ++m_epollWaitCount;
+    rt = epoll_wait(poller->epfd, events, max_events, 0);
+    return rt < 0 ? 0 : rt;
+}
+
+void IOManager::onTimerInsertedAtFront(int thread) {
+    if(thread == -1) {
+        tickle();
+    } else {
+        tickleThread(thread);
     }
 }
 
-void IOManager::onTimerInsertedAtFront() {
-    tickle();
+int IOManager::getThreadIndex() {
+    return Scheduler::GetThis() == this ? Scheduler::GetThreadIndex() : -1;
 }
 
 }
\ No newline at end of file
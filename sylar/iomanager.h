@@ -5,6 +5,10 @@
 
 #include "scheduler.h"
 #include "timer.h"
+#include "fd_table.h"
+#include "io_uring.h"
+#include <map>
+#include <sys/epoll.h>
 
 namespace hr {
 
@@ -25,6 +29,22 @@ public:
     };
 
 private:
+    struct FdContext;
+
+    //io_uring后端里提交了还没完成的请求,放在发起请求的协程栈上,完成后协程才会返回
+    struct UringRequest {
+        //请求所属fd的上下文
+        FdContext* fdCtx = nullptr;
+        //提交到的io_uring
+        IoUring* ring = nullptr;
+        //等待完成的协程
+        Fiber::ptr fiber;
+        //完成后执行的线程id，-1表示任意线程
+        int thread = -1;
+        //系统调用的结果,失败是-errno
+        int res = 0;
+    };
+
     //Socket事件上下文类
     struct FdContext {
         typedef Mutex MutexType;
@@ -37,6 +57,8 @@ private:
             Fiber::ptr fiber;
             //事件的回调函数
             std::function<void()> cb;
+            //事件触发后执行的线程id，-1表示任意线程
+            int thread = -1;
         };
 
         //获取事件上下文类
@@ -52,18 +74,71 @@ private:
         //event 事件类型
         void triggerEvent(Event event);
 
+        //返回事件对应的io_uring请求
+        UringRequest*& getRequest(Event event) {
+            return event == READ ? uringRead : uringWrite;
+        }
+
         //读事件上下文
         EventContext read;
         //写事件上下文
         EventContext write;
         //事件关联的句柄
         int fd = 0;
+        //句柄注册所在的epoll，共用的m_epfd或者线程私有的epoll
+        int epfd = -1;
         //当前的事件
         Event events = NONE;
+        //持久注册模式下是否已经注册到epoll(EPOLLIN|EPOLLOUT|EPOLLET)
+        bool registered = false;
+        //持久注册模式下已经就绪、还没有协程等待的事件
+        Event ready = NONE;
+        //注册时句柄的generation,不一致说明fd号已经被复用
+        uint32_t generation = 0;
+        //io_uring后端正在进行的读请求
+        UringRequest* uringRead = nullptr;
+        //io_uring后端正在进行的写请求
+        UringRequest* uringWrite = nullptr;
         //事件的Mutex
         MutexType mutex;
     };
 
+    //线程私有的epoll，每个调度线程第一次空闲时创建。
+    //指定了线程的协程等待的句柄注册在这里，事件直接由该线程处理，不经过其他线程转交。
+    //共用的m_epfd以EPOLLEXCLUSIVE挂在上面，一次只唤醒一个空闲线程
+    struct ThreadPoller {
+        //线程状态
+        enum State {
+            //在执行任务或者处理事件,睡眠前会检查任务队列
+            RUNNING = 0,
+            //在epoll_wait里等待,需要写eventfd唤醒
+            SLEEPING = 1,
+            //已经通知过,下次等待不睡眠
+            NOTIFIED = 2,
+            //睡眠前自旋轮询,通知只需要改状态,不需要写eventfd
+            SPINNING = 3
+        };
+
+        //所属的IOManager
+        IOManager* owner = nullptr;
+        //epoll文件句柄
+        int epfd = -1;
+        //只唤醒这个线程的eventfd
+        int tickleFd = -1;
+        //线程状态,新建的线程可能错过了创建之前的通知,先按通知过处理
+        std::atomic<int> state = {NOTIFIED};
+        //上次被唤醒时是否只有tickle,用于统计空唤醒
+        bool tickled = false;
+        //上次被唤醒时线程执行过的任务数
+        uint64_t taskCount = 0;
+        //最近从进入等待到有事件的平均间隔(微秒),决定自旋多久
+        uint64_t eventGapUs = 0;
+        //io_uring后端: 本线程发起的请求提交到这里,由本线程收取完成事件
+        IoUring* ring = nullptr;
+        //io_uring后端: epfd的POLL_ADD是否已经提交,epoll上的事件通过它唤醒线程
+        bool epollArmed = false;
+    };
+
 public:
     //构造函数
     //threads 线程数量
@@ -79,6 +154,8 @@ public:
     //event 事件类型
     //cb 事件回调函数
     // return 添加成功返回0，失败返回-1
+    //持久注册模式下事件已经就绪时不注册等待: 有cb马上调度cb返回0,
+    //没有cb返回1,调用方直接重试io,不用切出协程
     int addEvent(int fd, Event event, std::function<void()> cb = nullptr);
 
     //删除事件
@@ -95,37 +172,134 @@ public:
 
     //取消所有事件
     //fd socket句柄
+    //持久注册模式下同时从epoll上注销
     bool cancelAll(int fd);
 
+    //是否是持久注册模式: fd只在第一次等待时注册一次读写事件,之后不再调用epoll_ctl
+    bool isPersistent() const { return m_persistent;}
+
+    //返回处理fd事件调用epoll_ctl的次数
+    uint64_t getEpollCtlCount() const { return m_epollCtlCount;}
+
+    //返回调用epoll_wait的次数
+    uint64_t getEpollWaitCount() const { return m_epollWaitCount;}
+
+    //是否使用io_uring后端: hook的读写、accept、connect直接提交到io_uring,
+    //不再先尝试系统调用再等待可读写
+    bool isUring() const { return m_uring;}
+
+    //io_uring后端: 把sqe提交到当前线程的io_uring,挂起当前协程直到请求完成
+    //fd 请求的句柄
+    //event 请求占用的事件,同一个fd同一个事件同时只能有一个请求
+    //sqe 填好操作码和参数的sqe,user_data会被覆盖
+    //res 返回系统调用的结果,失败是-errno
+    //不能提交(不是io_uring后端、队列满)返回false,调用方使用epoll的流程
+    bool submitIo(int fd, Event event, const io_uring_sqe& sqe, int& res);
+
+    //返回调用io_uring_enter等待完成事件的次数
+    uint64_t getUringEnterCount() const { return m_uringEnterCount;}
+
+    //返回提交到io_uring的请求数量
+    uint64_t getUringSqeCount() const { return m_uringSqeCount;}
+
+    //返回写eventfd唤醒线程的次数
+    uint64_t getTickleCount() const { return m_tickleCount;}
+
+    //返回因为目标线程醒着而省掉的唤醒次数
+    uint64_t getTickleSuppressedCount() const { return m_tickleSuppressedCount;}
+
+    //返回空唤醒的次数: 只因为tickle醒来,回到调度后没有执行任何任务
+    uint64_t getSpuriousWakeupCount() const { return m_spuriousWakeupCount;}
+
+    //返回睡眠前自旋的次数
+    uint64_t getBusyPollCount() const { return m_busyPollCount;}
+
+    //返回自旋期间等到事件或者任务、没有睡眠的次数
+    uint64_t getBusyPollHitCount() const { return m_busyPollHitCount;}
+
     //返回当前的IOManager
     static IOManager* GetThis();
 
 protected:
     void tickle() override;
+    void tickleThread(int thread) override;
     bool stopping() override;
     void idle() override;
-    void onTimerInsertedAtFront() override;
+    void onTimerInsertedAtFront(int thread) override;
+    int getThreadIndex() override;
+
+    //返回fd的事件上下文,不存在时创建
+    FdContext* getFdContext(int fd);
 
-    //重置socket句柄上下文的容器大小
-    //size 容量大小
-    void contextResize(size_t size);
+    //带计数的epoll_ctl
+    int epollCtl(int epfd, int op, int fd, epoll_event* event);
 
     //判断是否可以停止
     //timeout 最近要出发的定时器事件间隔
     //返回是否可以停止
     bool stopping(uint64_t& timeout);
 
+    //返回当前线程私有的epoll，没有则创建，失败返回nullptr
+    ThreadPoller* getThreadPoller();
+
+    //返回这次等待前自旋的时间(微秒): 最近事件间隔的2倍,不超过配置的上限,
+    //间隔超过上限说明自旋多半等不到事件,不自旋
+    uint64_t getBusyPollTime(ThreadPoller* poller) const;
+
+    //通知线程有任务: 睡眠中写eventfd唤醒,醒着只标记为已通知
+    //返回是否写了eventfd
+    bool wakeup(ThreadPoller* poller);
+
+    //io_uring后端的等待: 提交本线程攒下的请求,等待完成事件并唤醒对应的协程
+    //epoll上的事件(tickle、addEvent注册的句柄)通过对poller->epfd的POLL_ADD唤醒,
+    //有事件时取到events里,返回数量
+    int waitUring(ThreadPoller* poller, epoll_event* events, int max_events, int timeout);
+
+    //处理epoll返回的事件
+    void handleEvents(ThreadPoller* poller, epoll_event* events, int rt, int max_events);
+
+    //io_uring请求完成
+    void onUringComplete(UringRequest* req, int res);
+
+    //取消fd上正在进行的io_uring请求,请求以-ECANCELED完成后唤醒协程
+    //调用时持有fd_ctx->mutex,detach为true时释放请求占用的事件,fd号可以马上复用
+    bool cancelUring(FdContext* fd_ctx, Event event, bool detach);
+
 private:
-    //epoll文件句柄
+    //共用的epoll文件句柄,没有指定线程的句柄注册在这里
     int m_epfd = 0;
-    //pipe文件句柄
-    int m_tickleFds[2];
     //当前等待执行的事件数量
     std::atomic<size_t> m_pendingEventCount = {0};
-    //IOManager的Mutex
-    RWMutexType m_mutex;
-    //socket事件上下文的容器
-    std::vector<FdContext*> m_fdContexts;
+    //socket事件上下文,按fd索引,读不加锁
+    FdTable<FdContext> m_fdContexts;
+    //线程id到线程私有epoll的映射
+    std::map<int, ThreadPoller*> m_pollers;
+    //m_pollers的Mutex
+    RWMutexType m_pollerMutex;
+    //是否是持久注册模式
+    bool m_persistent = false;
+    //epoll_ctl调用次数
+    std::atomic<uint64_t> m_epollCtlCount = {0};
+    //epoll_wait调用次数
+    std::atomic<uint64_t> m_epollWaitCount = {0};
+    //是否使用io_uring后端
+    bool m_uring = false;
+    //io_uring_enter等待次数
+    std::atomic<uint64_t> m_uringEnterCount = {0};
+    //提交的io_uring请求数量
+    std::atomic<uint64_t> m_uringSqeCount = {0};
+    //写eventfd唤醒的次数
+    std::atomic<uint64_t> m_tickleCount = {0};
+    //省掉的唤醒次数
+    std::atomic<uint64_t> m_tickleSuppressedCount = {0};
+    //空唤醒次数
+    std::atomic<uint64_t> m_spuriousWakeupCount = {0};
+    //睡眠前自旋的时间上限(微秒),0表示不自旋
+    uint64_t m_busyPollUs = 0;
+    //自旋次数
+    std::atomic<uint64_t> m_busyPollCount = {0};
+    //自旋命中次数
+    std::atomic<uint64_t> m_busyPollHitCount = {0};
 };
 
 
@@ -1,5 +1,12 @@
 #include "log.h"
-
+#include "config.h"
+#include "macro.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace hr {
 
@@ -43,6 +50,59 @@ LogLevel::Level LogLevel::FromString(const std::string& str) {
 #undef XX
 }
 
+LogBuffer::LogBuffer()
+    :m_data(m_inline) {
+}
+
+LogBuffer::~LogBuffer() {
+    if(m_data != m_inline) {
+        free(m_data);
+    }
+}
+
+void LogBuffer::grow(size_t need) {
+    size_t cap = m_capacity * 2;
+    if(cap < need) {
+        cap = need;
+    }
+    if(m_data == m_inline) {
+        char* data = (char*)malloc(cap);
+        memcpy(data, m_inline, m_size);
+        m_data = data;
+    } else {
+        m_data = (char*)realloc(m_data, cap);
+    }
+    m_capacity = cap;
+}
+
+void LogBuffer::reset() {
+    if(m_data != m_inline) {
+        free(m_data);
+        m_data = m_inline;
+        m_capacity = INLINE_SIZE;
+    }
+    m_size = 0;
+}
+
+void LogBuffer::appendUInt(uint64_t v) {
+    char tmp[20];
+    char* p = tmp + sizeof(tmp);
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    append(p, tmp + sizeof(tmp) - p);
+}
+
+void LogBuffer::appendInt(int64_t v) {
+    if(v < 0) {
+        append('-');
+        appendUInt(-(uint64_t)v);
+    } else {
+        appendUInt(v);
+    }
+}
+
 LogEventWrap::LogEventWrap(LogEvent::ptr e)
      :m_event(e){
 }
@@ -60,15 +120,25 @@ void LogEvent::format(const char* fmt, ...) {
 }
 
 void LogEvent::format(const char* fmt, va_list al) {
-    char* buf = nullptr;
-    int len = vasprintf(&buf, fmt, al);
-    if(len != -1) {
-        m_ss << std::string(buf, len);
-        free(buf);
+    //先按剩余空间写，不够时扩容再写一次
+    va_list copy;
+    va_copy(copy, al);
+    size_t avail = m_content.capacity() - m_content.size();
+    int len = vsnprintf(m_content.prepare(0), avail, fmt, copy);
+    va_end(copy);
+    if(len < 0) {
+        return;
     }
+    if((size_t)len >= avail) {
+        len = vsnprintf(m_content.prepare(len + 1), len + 1, fmt, al);
+        if(len < 0) {
+            return;
+        }
+    }
+    m_content.commit(len);
 }
 
-std::stringstream& LogEventWrap::getSS() {
+std::ostream& LogEventWrap::getSS() {
     return m_event->getSS();
 }
 
@@ -84,153 +154,177 @@ LogEvent::LogEvent(std::shared_ptr<Logger> logger, LogLevel::Level level
     ,m_fiberId(fiber_id)
     ,m_time(time)
     ,m_threadName(thread_name)
+    ,m_streambuf(m_content)
+    ,m_ss(&m_streambuf)
     ,m_logger(logger)
     ,m_level(level)
         {
 
 }
 
-LogFormatter::LogFormatter(const std::string& pattern)
-    :m_pattern(pattern) {
-        init();
-}
+//复用的日志内容超过该大小时释放，避免一条大日志长期占用内存
+static const size_t s_event_pool_max_content = 64 * 1024;
 
-std::string LogFormatter::format(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) {
-    std::stringstream ss;
-    for(auto& i : m_items) {
-        i->format(ss, logger, level, event);
-    }
-    return ss.str();
-}
+//每个线程复用的日志事件
+//引用计数为1(只被池持有)时表示空闲
+struct LogEventPool {
+    static const int SIZE = 4;
 
-std::ostream& LogFormatter::format(std::ostream& ofs, std::shared_ptr<Logger>logger, LogLevel::Level level, LogEvent::ptr event) {
-    for(auto& i : m_items) {
-        i->format(ofs, logger, level, event);
-    }
-    return ofs;
-}
+    ~LogEventPool();
 
-class MessageFormatItem : public LogFormatter::FormatItem {
-public:
-    MessageFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getContent();
-    }
+    LogEvent::ptr events[SIZE];
 };
 
-class LevelFormatItem : public LogFormatter::FormatItem {
-public:
-    LevelFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << LogLevel::ToString(level);
-    }
-};
+//线程退出时池已经析构，之后的日志不再复用
+static thread_local bool t_event_pool_destroyed = false;
+static thread_local LogEventPool t_event_pool;
 
-class ElapseFormatItem : public LogFormatter::FormatItem {
-public:
-    ElapseFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getElapse();
-    }
-};
-
-class NameFormatItem : public LogFormatter::FormatItem{
-public:
-    NameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLogger()->getName();
-    }
-};
-
-class ThreadIdFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadId();
-    }
-};
-
-class FiberIdFormatItem : public LogFormatter::FormatItem {
-public:
-    FiberIdFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFiberId();
-    }
-};
+LogEventPool::~LogEventPool() {
+    t_event_pool_destroyed = true;
+}
 
-class ThreadNameFormatItem : public LogFormatter::FormatItem {
-public:
-    ThreadNameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getThreadName();
+LogEvent::ptr LogEvent::Create(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+            ,const char* file, int32_t line, uint32_t elapse
+            ,uint32_t thread_id, uint32_t fiber_id, uint32_t time
+            ,const std::string& thread_name) {
+    if(SYLAR_UNLIKELY(t_event_pool_destroyed)) {
+        return LogEvent::ptr(new LogEvent(logger, level, file, line, elapse
+                    ,thread_id, fiber_id, time, thread_name));
     }
-};
-
-class DateTimeFormatItem : public LogFormatter::FormatItem {
-public:
-    DateTimeFormatItem(const std::string& format = "%Y-%m-%d %H:%M:%S")
-        :m_format(format) {
-        if(m_format.empty()) {
-            m_format = "%Y-%m-%d %H:%M:%S";
+    for(auto& i : t_event_pool.events) {
+        if(!i) {
+            i.reset(new LogEvent(logger, level, file, line, elapse
+                        ,thread_id, fiber_id, time, thread_name));
+            return i;
+        }
+        if(i.use_count() != 1) {
+            continue;
+        }
+        //其他线程(异步输出)释放引用之前的读操作，要在这里的写操作之前完成
+        std::atomic_thread_fence(std::memory_order_acquire);
+        LogEvent* e = i.get();
+        e->m_file = file;
+        e->m_line = line;
+        e->m_elapse = elapse;
+        e->m_threadId = thread_id;
+        e->m_fiberId = fiber_id;
+        e->m_time = time;
+        if(e->m_threadName != thread_name) {
+            e->m_threadName = thread_name;
+        }
+        if(e->m_logger != logger) {
+            e->m_logger = logger;
         }
+        e->m_level = level;
+        if(e->m_content.capacity() > s_event_pool_max_content) {
+            e->m_content.reset();
+        } else {
+            e->m_content.clear();
+        }
+        //恢复上一条日志修改过的流状态
+        e->m_ss.clear();
+        e->m_ss.flags(std::ios_base::skipws | std::ios_base::dec);
+        e->m_ss.precision(6);
+        e->m_ss.width(0);
+        e->m_ss.fill(' ');
+        return i;
     }
+    return LogEvent::ptr(new LogEvent(logger, level, file, line, elapse
+                ,thread_id, fiber_id, time, thread_name));
+}
 
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
-    }
-private:
-    std::string m_format;
-};
+//LogFormatter的唯一id，0表示无效
+static std::atomic<uint64_t> s_formatter_id = {0};
 
-class FilenameFormatItem : public LogFormatter::FormatItem {
-public:
-    FilenameFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getFile();
-    }
-};
+LogFormatter::LogFormatter(const std::string& pattern)
+    :m_pattern(pattern)
+    ,m_id(++s_formatter_id) {
+        init();
+}
 
-class LineFormatItem : public LogFormatter::FormatItem {
-public:
-    LineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << event->getLine();
-    }
-};
+std::string LogFormatter::format(std::shared_ptr<Logger> logger,LogLevel::Level level, LogEvent::ptr event) {
+    LogBuffer buf;
+    format(buf, logger, level, event);
+    return buf.toString();
+}
 
-class NewLineFormatItem : public LogFormatter::FormatItem {
-public:
-    NewLineFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << std::endl;
-    }
-};
+std::ostream& LogFormatter::format(std::ostream& ofs, std::shared_ptr<Logger>logger, LogLevel::Level level, LogEvent::ptr event) {
+    LogBuffer buf;
+    format(buf, logger, level, event);
+    ofs.write(buf.data(), buf.size());
+    return ofs;
+}
 
-class StringFormatItem : public LogFormatter::FormatItem {
-public:
-    StringFormatItem(const std::string& str)
-        :m_string(str) {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << m_string;
-    }
-private:
-    std::string m_string;
+//线程内缓存最近一次格式化的时间，同一秒内的日志不再调用localtime_r/strftime
+struct DateTimeCache {
+    uint64_t id;
+    size_t index;
+    time_t time;
+    size_t len;
+    char buf[64];
 };
 
-class TabFormatItem : public LogFormatter::FormatItem {
-public:
-    TabFormatItem(const std::string& str = "") {}
-    void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override {
-        os << "\t";
+static thread_local DateTimeCache t_datetime_cache;
+
+void LogFormatter::format(LogBuffer& buf, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event) {
+    for(size_t i = 0; i < m_items.size(); ++i) {
+        const FormatItem& item = m_items[i];
+        switch(item.type) {
+            case FormatItem::STRING:
+                buf.append(item.str);
+                break;
+            case FormatItem::MESSAGE: {
+                const LogBuffer& content = event->getBuffer();
+                buf.append(content.data(), content.size());
+                break;
+            }
+            case FormatItem::LEVEL:
+                buf.append(LogLevel::ToString(level));
+                break;
+            case FormatItem::ELAPSE:
+                buf.appendUInt(event->getElapse());
+                break;
+            case FormatItem::NAME:
+                buf.append(event->getLogger()->getName());
+                break;
+            case FormatItem::THREAD_ID:
+                buf.appendUInt(event->getThreadId());
+                break;
+            case FormatItem::NEWLINE:
+                buf.append('\n');
+                break;
+            case FormatItem::DATETIME: {
+                DateTimeCache& cache = t_datetime_cache;
+                time_t time = event->getTime();
+                if(cache.id != m_id || cache.index != i || cache.time != time) {
+                    struct tm tm;
+                    localtime_r(&time, &tm);
+                    cache.len = strftime(cache.buf, sizeof(cache.buf), item.str.c_str(), &tm);
+                    cache.id = m_id;
+                    cache.index = i;
+                    cache.time = time;
+                }
+                buf.append(cache.buf, cache.len);
+                break;
+            }
+            case FormatItem::FILENAME:
+                buf.append(event->getFile());
+                break;
+            case FormatItem::LINE:
+                buf.appendInt(event->getLine());
+                break;
+            case FormatItem::TAB:
+                buf.append('\t');
+                break;
+            case FormatItem::FIBER_ID:
+                buf.appendUInt(event->getFiberId());
+                break;
+            case FormatItem::THREAD_NAME:
+                buf.append(event->getThreadName());
+                break;
+        }
     }
-private:
-    std::string m_string;
-};
+}
 
 //解析模板
 //str, format, type
@@ -306,35 +400,46 @@ void LogFormatter::init() {
     if(!nstr.empty()) {
         vec.push_back(std::make_tuple(nstr, "", 0));
     }
-    static std::map<std::string, std::function<FormatItem::ptr(const std::string& str)> > s_format_items = {
-#define XX(str, C) \
-        {#str, [](const std::string& fmt) { return FormatItem::ptr(new C(fmt));}}
-
-        XX(m, MessageFormatItem),           //m:消息
-        XX(p, LevelFormatItem),             //p:日志级别
-        XX(r, ElapseFormatItem),            //r:累计毫秒数
-        XX(c, NameFormatItem),              //c:日志名称
-        XX(t, ThreadIdFormatItem),          //t:线程id
-        XX(n, NewLineFormatItem),           //n:换行
-        XX(d, DateTimeFormatItem),          //d:时间
-        XX(f, FilenameFormatItem),          //f:文件名
-        XX(l, LineFormatItem),              //l:行号
-        XX(T, TabFormatItem),               //T:Tab
-        XX(F, FiberIdFormatItem),           //F:协程id
-        XX(N, ThreadNameFormatItem),        //N:线程名称
+    static std::map<std::string, FormatItem::Type> s_format_items = {
+#define XX(str, T) \
+        {#str, FormatItem::T}
+
+        XX(m, MESSAGE),             //m:消息
+        XX(p, LEVEL),               //p:日志级别
+        XX(r, ELAPSE),              //r:累计毫秒数
+        XX(c, NAME),                //c:日志名称
+        XX(t, THREAD_ID),           //t:线程id
+        XX(n, NEWLINE),             //n:换行
+        XX(d, DATETIME),            //d:时间
+        XX(f, FILENAME),            //f:文件名
+        XX(l, LINE),                //l:行号
+        XX(T, TAB),                 //T:Tab
+        XX(F, FIBER_ID),            //F:协程id
+        XX(N, THREAD_NAME),         //N:线程名称
 #undef XX
     };
 
     for(auto& i : vec) {
         if(std::get<2>(i) == 0) {
-            m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+            //相邻的固定字符串合并成一项
+            if(!m_items.empty() && m_items.back().type == FormatItem::STRING) {
+                m_items.back().str.append(std::get<0>(i));
+            } else {
+                m_items.push_back(FormatItem(FormatItem::STRING, std::get<0>(i)));
+            }
         } else {
             auto it = s_format_items.find(std::get<0>(i));
             if(it == s_format_items.end()) {
-                m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
+                m_items.push_back(FormatItem(FormatItem::STRING, "<<error_format %" + std::get<0>(i) + ">>"));
                 m_error = true;
+            } else if(it->second == FormatItem::DATETIME) {
+                std::string fmt = std::get<1>(i);
+                if(fmt.empty()) {
+                    fmt = "%Y-%m-%d %H:%M:%S";
+                }
+                m_items.push_back(FormatItem(FormatItem::DATETIME, fmt));
             } else {
-                m_items.push_back(it->second(std::get<1>(i)));
+                m_items.push_back(FormatItem(it->second));
             }
         }
 
@@ -367,21 +472,23 @@ Logger::Logger(const std::string& name)
 
 void Logger::log(LogLevel::Level level, LogEvent::ptr event) {
     if(level >= m_level) {
-        /*
-        std::enable_shared_from_this 能让一个
-        对象（假设其名为 t ，且已被一个 std::shared_ptr 对象 pt 管理）
-        安全地生成其他额外的 std::shared_ptr 实例（假设名为 pt1, pt2, ... ） ，
-        它们与 pt 共享对象 t 的所有权。
-        类似weak_ptr
-        */
-        auto self = shared_from_this();
+        //事件已经持有产生它的日志器，直接传给日志目标，不用每条日志都shared_from_this
+        //(格式化时的日志名称本来就取自事件的日志器)
+        const Logger::ptr& logger = event->getLogger();
         MutexType::Lock lock(m_mutex);
         if(!m_appenders.empty()) {
+            if(SYLAR_UNLIKELY(!logger)) {
+                auto self = shared_from_this();
+                for(auto& i : m_appenders) {
+                    i->log(self, level, event);
+                }
+                return;
+            }
             for(auto& i : m_appenders) {
-                i->log(self, level, event);
+                i->log(logger, level, event);
             }
         } else if(m_root) {
-            //???????主日志器输出？
+            //没有日志目标时由主日志器输出
             m_root->log(level, event);
         }
     }
@@ -487,7 +594,10 @@ std::string Logger::toYamlString() {
 void StdoutLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
     if(level >= m_level) {
         MutexType::Lock lock(m_mutex);
-        m_formatter->format(std::cout, logger, level, event);
+        m_buffer.clear();
+        m_formatter->format(m_buffer, logger, level, event);
+        std::cout.write(m_buffer.data(), m_buffer.size());
+        std::cout.flush();
     }
 }
 
@@ -506,23 +616,204 @@ std::string StdoutLogAppender::toYamlString() {
     return ss.str();
 }
 
+//外部通知重新打开的版本号，信号处理函数中只做原子自增
+static std::atomic<uint64_t> s_file_reopen_version = {0};
+
+FileLogAppender::RotateMode FileLogAppender::RotateFromString(const std::string& str) {
+    if(str == "hourly" || str == "HOURLY") {
+        return ROTATE_HOURLY;
+    }
+    if(str == "daily" || str == "DAILY") {
+        return ROTATE_DAILY;
+    }
+    return ROTATE_NONE;
+}
+
+const char* FileLogAppender::RotateToString(RotateMode mode) {
+    switch(mode) {
+        case ROTATE_HOURLY:
+            return "hourly";
+        case ROTATE_DAILY:
+            return "daily";
+        default:
+            return "none";
+    }
+}
+
 FileLogAppender::FileLogAppender(const std::string& filename)
     :m_filename(filename) {
+    m_reopenVersion = s_file_reopen_version;
+    m_lastFlush = GetCurrentMS();
+    m_buffer.reserve(m_bufferSize);
     reopen();
 }
 
+FileLogAppender::~FileLogAppender() {
+    MutexType::Lock lock(m_mutex);
+    flushBuffer();
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
 void FileLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
     if(level >= m_level) {
-        uint64_t now = event->getTime();
-        if(now >= (m_lastTime + 3)) {
-            reopen();
-            m_lastTime = now;
-        }
         MutexType::Lock lock(m_mutex);
-        if(!m_formatter->format(m_filestream, logger, level, event)) {
-            std::cout << "error" << std::endl;
+        if(SYLAR_UNLIKELY(m_reopenVersion != s_file_reopen_version)) {
+            m_reopenVersion = s_file_reopen_version;
+            flushBuffer();
+            openFile();
+        }
+        if(m_rotate != ROTATE_NONE && (time_t)event->getTime() >= m_nextRotate) {
+            rotate();
+        }
+        m_formatter->format(m_buffer, logger, level, event);
+        //缓冲区满、ERROR以上级别或距上次写入超过刷新间隔时写入文件
+        //不用后台线程定时刷新，空闲时缓冲区里的日志在下一条日志、flush()或析构时写入
+        if(m_buffer.size() >= m_bufferSize || level >= LogLevel::ERROR
+                || GetCurrentMS() >= m_lastFlush + m_flushInterval) {
+            flushBuffer();
+        }
+    }
+}
+
+void FileLogAppender::flush() {
+    MutexType::Lock lock(m_mutex);
+    flushBuffer();
+}
+
+void FileLogAppender::flushBuffer() {
+    m_lastFlush = GetCurrentMS();
+    if(m_buffer.empty()) {
+        return;
+    }
+    if(m_fd >= 0) {
+        size_t offset = 0;
+        while(offset < m_buffer.size()) {
+            ssize_t rt = write(m_fd, m_buffer.data() + offset, m_buffer.size() - offset);
+            if(rt < 0) {
+                if(errno == EINTR) {
+                    continue;
+                }
+                std::cout << "FileLogAppender write " << m_filename << " fail errno="
+                          << errno << " errstr=" << strerror(errno) << std::endl;
+                break;
+            }
+            offset += rt;
         }
+        m_size += offset;
+    }
+    m_buffer.clear();
+    if(m_maxSize && m_size >= m_maxSize) {
+        rotate();
+    }
+}
+
+void FileLogAppender::rotate() {
+    if(!m_buffer.empty()) {
+        //先写完当前缓冲区，避免flushBuffer里再次触发滚动
+        uint64_t max_size = m_maxSize;
+        m_maxSize = 0;
+        flushBuffer();
+        m_maxSize = max_size;
+    }
+
+    time_t now = time(0);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char buf[64];
+    strftime(buf, sizeof(buf), ".%Y%m%d-%H%M%S", &tm);
+    std::string target = m_filename + buf;
+    //同一秒内多次滚动时加序号
+    for(int i = 1; access(target.c_str(), F_OK) == 0; ++i) {
+        target = m_filename + buf + "." + std::to_string(i);
+    }
+    if(m_size && rename(m_filename.c_str(), target.c_str())) {
+        std::cout << "FileLogAppender rename " << m_filename << " to " << target
+                  << " fail errno=" << errno << " errstr=" << strerror(errno) << std::endl;
+    }
+    openFile();
+}
+
+void FileLogAppender::updateRotateTime(time_t now) {
+    if(m_rotate == ROTATE_NONE) {
+        m_nextRotate = 0;
+        return;
+    }
+    struct tm tm;
+    localtime_r(&now, &tm);
+    tm.tm_min = 0;
+    tm.tm_sec = 0;
+    if(m_rotate == ROTATE_HOURLY) {
+        tm.tm_hour += 1;
+    } else {
+        tm.tm_hour = 0;
+        tm.tm_mday += 1;
     }
+    tm.tm_isdst = -1;
+    m_nextRotate = mktime(&tm);
+}
+
+bool FileLogAppender::openFile() {
+    if(m_fd >= 0) {
+        close(m_fd);
+    }
+    m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(m_fd < 0) {
+        std::cout << "FileLogAppender open " << m_filename << " fail errno="
+                  << errno << " errstr=" << strerror(errno) << std::endl;
+        m_size = 0;
+        return false;
+    }
+    struct stat st;
+    m_size = fstat(m_fd, &st) ? 0 : st.st_size;
+    updateRotateTime(time(0));
+    return true;
+}
+
+bool FileLogAppender::reopen() {
+    MutexType::Lock lock(m_mutex);
+    flushBuffer();
+    return openFile();
+}
+
+void FileLogAppender::setMaxSize(uint64_t val) {
+    MutexType::Lock lock(m_mutex);
+    m_maxSize = val;
+}
+
+void FileLogAppender::setRotate(RotateMode val) {
+    MutexType::Lock lock(m_mutex);
+    m_rotate = val;
+    updateRotateTime(time(0));
+}
+
+void FileLogAppender::setFlushInterval(uint32_t val) {
+    MutexType::Lock lock(m_mutex);
+    m_flushInterval = val;
+}
+
+void FileLogAppender::setBufferSize(uint32_t val) {
+    MutexType::Lock lock(m_mutex);
+    m_bufferSize = val;
+    m_buffer.reserve(val);
+}
+
+void FileLogAppender::ReopenAll() {
+    ++s_file_reopen_version;
+}
+
+static void OnReopenSignal(int sig) {
+    FileLogAppender::ReopenAll();
+}
+
+void FileLogAppender::InstallReopenSignal(int sig) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &OnReopenSignal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, nullptr);
 }
 
 std::string FileLogAppender::toYamlString() {
@@ -530,6 +821,14 @@ std::string FileLogAppender::toYamlString() {
     YAML::Node node;
     node["type"] = "FileLogAppender";
     node["file"] = m_filename;
+    if(m_maxSize) {
+        node["max_size"] = m_maxSize;
+    }
+    if(m_rotate != ROTATE_NONE) {
+        node["rotate"] = RotateToString(m_rotate);
+    }
+    node["flush_interval"] = m_flushInterval;
+    node["buffer_size"] = m_bufferSize;
     if(m_level != LogLevel::UNKNOW) {
         node["level"] = LogLevel::ToString(m_level);
     }
@@ -541,15 +840,223 @@ std::string FileLogAppender::toYamlString() {
     return ss.str();
 }
 
-bool FileLogAppender::reopen() {
+AsyncLogAppender::OverflowPolicy AsyncLogAppender::PolicyFromString(const std::string& str) {
+    if(str == "drop" || str == "DROP") {
+        return DROP;
+    }
+    if(str == "sample" || str == "SAMPLE") {
+        return SAMPLE;
+    }
+    return BLOCK;
+}
+
+const char* AsyncLogAppender::PolicyToString(OverflowPolicy policy) {
+    switch(policy) {
+        case DROP:
+            return "drop";
+        case SAMPLE:
+            return "sample";
+        default:
+            return "block";
+    }
+}
+
+AsyncLogAppender::AsyncLogAppender(const std::string& filename, size_t capacity
+                                   ,OverflowPolicy policy, uint32_t sample_rate)
+    :m_filename(filename)
+    ,m_policy(policy)
+    ,m_sampleRate(sample_rate ? sample_rate : 1) {
+    size_t size = 2;
+    while(size < capacity) {
+        size <<= 1;
+    }
+    m_mask = size - 1;
+    m_cells = new Cell[size];
+    for(size_t i = 0; i < size; ++i) {
+        m_cells[i].seq = i;
+    }
+
+    if(m_filename.empty()) {
+        m_fd = STDOUT_FILENO;
+    } else {
+        m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(m_fd < 0) {
+            std::cout << "AsyncLogAppender open " << m_filename << " fail errno="
+                      << errno << " errstr=" << strerror(errno) << std::endl;
+        }
+    }
+    m_thread.reset(new Thread(std::bind(&AsyncLogAppender::run, this), "async_log"));
+}
+
+AsyncLogAppender::~AsyncLogAppender() {
+    m_stop = true;
+    wakeup();
+    m_thread->join();
+    if(m_fd > STDERR_FILENO) {
+        close(m_fd);
+    }
+    delete[] m_cells;
+}
+
+uint64_t AsyncLogAppender::push(Logger::ptr& logger, LogLevel::Level level, LogEvent::ptr& event) {
+    uint64_t pos = m_tail.load(std::memory_order_relaxed);
+    while(true) {
+        Cell& cell = m_cells[pos & m_mask];
+        uint64_t seq = cell.seq.load(std::memory_order_acquire);
+        int64_t diff = (int64_t)seq - (int64_t)pos;
+        if(diff == 0) {
+            if(m_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.logger = logger;
+                cell.level = level;
+                cell.event = event;
+                cell.seq.store(pos + 1, std::memory_order_release);
+                return pos + 1;
+            }
+        } else if(diff < 0) {
+            //队列满
+            return 0;
+        } else {
+            pos = m_tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void AsyncLogAppender::wakeup() {
+    //和run()里的栅栏配对: 生产者先写cell.seq再读m_waiting,后台线程先写m_waiting再读cell.seq,
+    //没有全序栅栏时两边可能都读到旧值,后台线程睡下去而生产者不唤醒
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(m_waiting.load() && m_waiting.exchange(false)) {
+        m_sem.notify();
+    }
+}
+
+void AsyncLogAppender::waitWritten(uint64_t ticket) {
+    while(m_written < ticket && !m_stop) {
+        wakeup();
+        usleep(100);
+    }
+}
+
+void AsyncLogAppender::flush() {
+    waitWritten(m_tail);
+}
+
+void AsyncLogAppender::log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) {
+    if(level < m_level) {
+        return;
+    }
+    if(m_policy == SAMPLE && level < LogLevel::ERROR
+            && m_tail - m_head >= (m_mask + 1) / 4 * 3) {
+        if(m_sampled++ % m_sampleRate) {
+            ++m_dropped;
+            return;
+        }
+    }
+
+    uint64_t ticket = push(logger, level, event);
+    while(!ticket) {
+        if(m_policy != BLOCK) {
+            ++m_dropped;
+            return;
+        }
+        wakeup();
+        sched_yield();
+        ticket = push(logger, level, event);
+    }
+    wakeup();
+
+    //进程可能马上退出，保证日志落地
+    if(level >= m_flushLevel) {
+        waitWritten(ticket);
+    }
+}
+
+//一批日志已经格式化到同一块连续缓冲区,一次write就相当于writev,不需要再拆成iovec
+void AsyncLogAppender::writeAll(const LogBuffer& buf) {
+    if(m_fd < 0) {
+        return;
+    }
+    size_t offset = 0;
+    while(offset < buf.size()) {
+        ssize_t rt = write(m_fd, buf.data() + offset, buf.size() - offset);
+        if(rt < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        offset += rt;
+    }
+}
+
+void AsyncLogAppender::run() {
+    static const size_t BATCH = 256;
+    LogBuffer buf;
+    buf.reserve(64 * 1024);
+    uint64_t head = m_head;
+    while(true) {
+        LogFormatter::ptr fmt = getFormatter();
+        size_t count = 0;
+        while(count < BATCH) {
+            Cell& cell = m_cells[head & m_mask];
+            if(cell.seq.load(std::memory_order_acquire) != head + 1) {
+                break;
+            }
+            Logger::ptr logger = std::move(cell.logger);
+            LogEvent::ptr event = std::move(cell.event);
+            LogLevel::Level level = cell.level;
+            cell.seq.store(head + m_mask + 1, std::memory_order_release);
+            m_head = ++head;
+            ++count;
+            if(fmt) {
+                fmt->format(buf, logger, level, event);
+            }
+        }
+
+        if(count) {
+            writeAll(buf);
+            buf.clear();
+            m_written += count;
+            continue;
+        }
+
+        if(m_stop) {
+            break;
+        }
+        //队列为空，等待生产者唤醒
+        m_waiting = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(m_cells[head & m_mask].seq.load(std::memory_order_acquire) == head + 1 || m_stop) {
+            if(m_waiting.exchange(false)) {
+                continue;
+            }
+        }
+        m_sem.wait();
+    }
+}
+
+std::string AsyncLogAppender::toYamlString() {
     MutexType::Lock lock(m_mutex);
-    if(m_filestream) {
-        m_filestream.close();
+    YAML::Node node;
+    node["type"] = "AsyncLogAppender";
+    if(!m_filename.empty()) {
+        node["file"] = m_filename;
+    }
+    node["capacity"] = m_mask + 1;
+    node["overflow"] = PolicyToString(m_policy);
+    if(m_policy == SAMPLE) {
+        node["sample_rate"] = m_sampleRate;
+    }
+    node["flush_level"] = LogLevel::ToString(m_flushLevel);
+    if(m_level != LogLevel::UNKNOW) {
+        node["level"] = LogLevel::ToString(m_level);
     }
-    m_filestream.open(m_filename);
-    
-    //！！是转换为真正的0和1
-    return !!m_filestream;
+    if(m_hasFormatter && m_formatter) {
+        node["formatter"] = m_formatter->getPattern();
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
 }
 
 LoggerManager::LoggerManager() {
@@ -590,6 +1097,277 @@ std::string LoggerManager::toYamlString() {
     return ss.str();
 }
 
+//日志输出目标配置
+struct LogAppenderDefine {
+    //1 File, 2 Stdout, 3 Async
+    int type = 0;
+    LogLevel::Level level = LogLevel::UNKNOW;
+    std::string formatter;
+    std::string file;
+    //以下为FileLogAppender的配置
+    uint64_t max_size = 0;
+    std::string rotate = "none";
+    uint32_t flush_interval = 1000;
+    uint32_t buffer_size = 64 * 1024;
+    //以下为AsyncLogAppender的配置
+    uint32_t capacity = 65536;
+    std::string overflow = "block";
+    uint32_t sample_rate = 10;
+    LogLevel::Level flush_level = LogLevel::FATAL;
+
+    bool operator==(const LogAppenderDefine& oth) const {
+        return type == oth.type
+            && level == oth.level
+            && formatter == oth.formatter
+            && file == oth.file
+            && max_size == oth.max_size
+            && rotate == oth.rotate
+            && flush_interval == oth.flush_interval
+            && buffer_size == oth.buffer_size
+            && capacity == oth.capacity
+            && overflow == oth.overflow
+            && sample_rate == oth.sample_rate
+            && flush_level == oth.flush_level;
+    }
+};
+
+//日志器配置
+struct LogDefine {
+    std::string name;
+    LogLevel::Level level = LogLevel::UNKNOW;
+    std::string formatter;
+    std::vector<LogAppenderDefine> appenders;
+
+    bool operator==(const LogDefine& oth) const {
+        return name == oth.name
+            && level == oth.level
+            && formatter == oth.formatter
+            && appenders == oth.appenders;
+    }
+
+    bool operator<(const LogDefine& oth) const {
+        return name < oth.name;
+    }
+
+    bool isValid() const {
+        return !name.empty();
+    }
+};
+
+template<>
+class LexicalCast<std::string, LogDefine> {
+public:
+    LogDefine operator()(const std::string& v) {
+        YAML::Node n = YAML::Load(v);
+        LogDefine ld;
+        if(!n["name"].IsDefined()) {
+            std::cout << "log config error: name is null, " << n
+                      << std::endl;
+            throw std::logic_error("log config name is null");
+        }
+        ld.name = n["name"].as<std::string>();
+        ld.level = LogLevel::FromString(n["level"].IsDefined() ? n["level"].as<std::string>() : "");
+        if(n["formatter"].IsDefined()) {
+            ld.formatter = n["formatter"].as<std::string>();
+        }
+
+        if(n["appenders"].IsDefined()) {
+            for(size_t x = 0; x < n["appenders"].size(); ++x) {
+                auto a = n["appenders"][x];
+                if(!a["type"].IsDefined()) {
+                    std::cout << "log config error: appender type is null, " << a
+                              << std::endl;
+                    continue;
+                }
+                std::string type = a["type"].as<std::string>();
+                LogAppenderDefine lad;
+                if(type == "FileLogAppender") {
+                    lad.type = 1;
+                    if(!a["file"].IsDefined()) {
+                        std::cout << "log config error: fileappender file is null, " << a
+                              << std::endl;
+                        continue;
+                    }
+                    lad.file = a["file"].as<std::string>();
+                    if(a["max_size"].IsDefined()) {
+                        lad.max_size = a["max_size"].as<uint64_t>();
+                    }
+                    if(a["rotate"].IsDefined()) {
+                        lad.rotate = a["rotate"].as<std::string>();
+                    }
+                    if(a["flush_interval"].IsDefined()) {
+                        lad.flush_interval = a["flush_interval"].as<uint32_t>();
+                    }
+                    if(a["buffer_size"].IsDefined()) {
+                        lad.buffer_size = a["buffer_size"].as<uint32_t>();
+                    }
+                } else if(type == "StdoutLogAppender") {
+                    lad.type = 2;
+                } else if(type == "AsyncLogAppender") {
+                    lad.type = 3;
+                    if(a["file"].IsDefined()) {
+                        lad.file = a["file"].as<std::string>();
+                    }
+                    if(a["capacity"].IsDefined()) {
+                        lad.capacity = a["capacity"].as<uint32_t>();
+                    }
+                    if(a["overflow"].IsDefined()) {
+                        lad.overflow = a["overflow"].as<std::string>();
+                    }
+                    if(a["sample_rate"].IsDefined()) {
+                        lad.sample_rate = a["sample_rate"].as<uint32_t>();
+                    }
+                    if(a["flush_level"].IsDefined()) {
+                        lad.flush_level = LogLevel::FromString(a["flush_level"].as<std::string>());
+                    }
+                } else {
+                    std::cout << "log config error: appender type is invalid, " << a
+                              << std::endl;
+                    continue;
+                }
+                if(a["level"].IsDefined()) {
+                    lad.level = LogLevel::FromString(a["level"].as<std::string>());
+                }
+                if(a["formatter"].IsDefined()) {
+                    lad.formatter = a["formatter"].as<std::string>();
+                }
+                ld.appenders.push_back(lad);
+            }
+        }
+        return ld;
+    }
+};
+
+template<>
+class LexicalCast<LogDefine, std::string> {
+public:
+    std::string operator()(const LogDefine& i) {
+        YAML::Node n;
+        n["name"] = i.name;
+        if(i.level != LogLevel::UNKNOW) {
+            n["level"] = LogLevel::ToString(i.level);
+        }
+        if(!i.formatter.empty()) {
+            n["formatter"] = i.formatter;
+        }
+
+        for(auto& a : i.appenders) {
+            YAML::Node na;
+            if(a.type == 1) {
+                na["type"] = "FileLogAppender";
+                na["file"] = a.file;
+                if(a.max_size) {
+                    na["max_size"] = a.max_size;
+                }
+                na["rotate"] = a.rotate;
+                na["flush_interval"] = a.flush_interval;
+                na["buffer_size"] = a.buffer_size;
+            } else if(a.type == 2) {
+                na["type"] = "StdoutLogAppender";
+            } else if(a.type == 3) {
+                na["type"] = "AsyncLogAppender";
+                if(!a.file.empty()) {
+                    na["file"] = a.file;
+                }
+                na["capacity"] = a.capacity;
+                na["overflow"] = a.overflow;
+                na["sample_rate"] = a.sample_rate;
+                na["flush_level"] = LogLevel::ToString(a.flush_level);
+            }
+            if(a.level != LogLevel::UNKNOW) {
+                na["level"] = LogLevel::ToString(a.level);
+            }
+            if(!a.formatter.empty()) {
+                na["formatter"] = a.formatter;
+            }
+            n["appenders"].push_back(na);
+        }
+        std::stringstream ss;
+        ss << n;
+        return ss.str();
+    }
+};
+
+hr::ConfigVar<std::set<LogDefine> >::ptr g_log_defines =
+    hr::Config::Lookup("logs", std::set<LogDefine>(), "logs config");
+
+//根据配置创建日志输出目标
+static LogAppender::ptr CreateAppender(const LogAppenderDefine& a) {
+    LogAppender::ptr ap;
+    if(a.type == 1) {
+        FileLogAppender::ptr file(new FileLogAppender(a.file));
+        file->setMaxSize(a.max_size);
+        file->setRotate(FileLogAppender::RotateFromString(a.rotate));
+        file->setFlushInterval(a.flush_interval);
+        file->setBufferSize(a.buffer_size);
+        ap = file;
+    } else if(a.type == 2) {
+        ap.reset(new StdoutLogAppender);
+    } else if(a.type == 3) {
+        AsyncLogAppender::ptr async(new AsyncLogAppender(a.file, a.capacity
+                    ,AsyncLogAppender::PolicyFromString(a.overflow), a.sample_rate));
+        if(a.flush_level != LogLevel::UNKNOW) {
+            async->setFlushLevel(a.flush_level);
+        }
+        ap = async;
+    } else {
+        return nullptr;
+    }
+    if(a.level != LogLevel::UNKNOW) {
+        ap->setLevel(a.level);
+    }
+    if(!a.formatter.empty()) {
+        LogFormatter::ptr fmt(new LogFormatter(a.formatter));
+        if(!fmt->isError()) {
+            ap->setFormatter(fmt);
+        } else {
+            std::cout << "log appender type=" << a.type
+                      << " formatter=" << a.formatter << " is invalid" << std::endl;
+        }
+    }
+    return ap;
+}
+
+struct LogIniter {
+    LogIniter() {
+        g_log_defines->addListener([](const std::set<LogDefine>& old_value,
+                    const std::set<LogDefine>& new_value){
+            HR_LOG_INFO(HR_LOG_ROOT()) << "on_logger_conf_changed";
+            for(auto& i : new_value) {
+                auto it = old_value.find(i);
+                if(it != old_value.end() && i == *it) {
+                    //没有变化
+                    continue;
+                }
+                //新增或修改
+                Logger::ptr logger = HR_LOG_NAME(i.name);
+                logger->setLevel(i.level);
+                if(!i.formatter.empty()) {
+                    logger->setFormatter(i.formatter);
+                }
+
+                logger->clearAppenders();
+                for(auto& a : i.appenders) {
+                    LogAppender::ptr ap = CreateAppender(a);
+                    if(ap) {
+                        logger->addAppender(ap);
+                    }
+                }
+            }
+
+            for(auto& i : old_value) {
+                auto it = new_value.find(i);
+                if(it == new_value.end()) {
+                    //删除，关闭日志输出
+                    Logger::ptr logger = HR_LOG_NAME(i.name);
+                    logger->setLevel((LogLevel::Level)100);
+                    logger->clearAppenders();
+                }
+            }
+        });
+    }
+};
 
+static LogIniter __log_init;
 
-}
\ No newline at end of file
+}
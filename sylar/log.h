@@ -4,6 +4,7 @@
 #define __SYLAR_LOG_H__
 
 #include <stdio.h>
+#include <string.h>
 #include <memory>
 #include <string>
 #include <stdint.h>
@@ -25,9 +26,9 @@
 //使用流式方式将日志级别level的日志写入到logger
 #define HR_LOG_LEVEL(logger, level) \
     if(logger->getLevel() <= level) \
-        hr::LogEventWrap(hr::LogEvent::ptr(new hr::LogEvent(logger, level, \
+        hr::LogEventWrap(hr::LogEvent::Create(logger, level, \
                     __FILE__, __LINE__, 0, hr::GetThreadId(), \
-                hr::GetFiberId(), time(0), hr::Thread::GetName()))).getSS()
+                hr::GetFiberId(), time(0), hr::Thread::GetName())).getSS()
 
 //使用流式方式将日志级别debug的日志写入到logger
 #define HR_LOG_DEBUG(logger) HR_LOG_LEVEL(logger, hr::LogLevel::DEBUG)
@@ -48,9 +49,9 @@
 //使用格式化方式将日志级别Level的日志写入到logger
 #define HR_LOG_FMT_LEVEL(logger, level, fmt, ...) \
     if(logger->getLevel() <= level) \
-        hr::LogEventWrap(hr::LogEvent::ptr(new hr::LogEvent(logger, level, \
+        hr::LogEventWrap(hr::LogEvent::Create(logger, level, \
                 __FILE__, __LINE__, 0, hr::GetThreadId(), \
-                hr::GetFiberId(), time(0), hr::Thread::GetName()))).getEvent()->format(fmt, __VA_ARGS__)
+                hr::GetFiberId(), time(0), hr::Thread::GetName())).getEvent()->format(fmt, __VA_ARGS__)
 
 //使用格式化方式将日志级别debug的日志写入到logger
 #define HR_LOG_FMT_DEBUG(logger, fmt, ...) HR_LOG_FMT_LEVEL(logger, hr::LogLevel::DEBUG, fmt, __VA_ARGS__)
@@ -103,6 +104,107 @@ public:
     static LogLevel::Level FromString(const std::string& str);
 };
 
+//只追加的日志缓冲区
+//内容不超过内置空间时不分配内存，clear()后保留已分配的空间
+class LogBuffer {
+public:
+    //内置空间大小
+    static const size_t INLINE_SIZE = 256;
+
+    LogBuffer();
+    ~LogBuffer();
+
+    //追加数据
+    void append(const char* str, size_t len) {
+        if(m_size + len > m_capacity) {
+            grow(m_size + len);
+        }
+        memcpy(m_data + m_size, str, len);
+        m_size += len;
+    }
+
+    //追加字符串
+    void append(const std::string& str) { append(str.data(), str.size());}
+
+    //追加以'\0'结尾的字符串
+    void append(const char* str) { append(str, strlen(str));}
+
+    //追加字符
+    void append(char c) {
+        if(m_size == m_capacity) {
+            grow(m_size + 1);
+        }
+        m_data[m_size++] = c;
+    }
+
+    //追加十进制整数
+    void appendUInt(uint64_t v);
+    void appendInt(int64_t v);
+
+    //返回至少有len字节可写空间的写入位置，写入后调用commit
+    char* prepare(size_t len) {
+        if(m_size + len > m_capacity) {
+            grow(m_size + len);
+        }
+        return m_data + m_size;
+    }
+
+    //确认prepare之后写入的len字节
+    void commit(size_t len) { m_size += len;}
+
+    const char* data() const { return m_data;}
+    size_t size() const { return m_size;}
+    size_t capacity() const { return m_capacity;}
+    bool empty() const { return m_size == 0;}
+
+    //清空内容，保留空间
+    void clear() { m_size = 0;}
+
+    //清空内容，并释放堆上的空间
+    void reset();
+
+    //预留总共cap字节的空间
+    void reserve(size_t cap) {
+        if(cap > m_capacity) {
+            grow(cap);
+        }
+    }
+
+    std::string toString() const { return std::string(m_data, m_size);}
+private:
+    LogBuffer(const LogBuffer&) = delete;
+    LogBuffer& operator=(const LogBuffer&) = delete;
+
+    //扩容到至少need字节
+    void grow(size_t need);
+private:
+    char* m_data;
+    size_t m_size = 0;
+    size_t m_capacity = INLINE_SIZE;
+    char m_inline[INLINE_SIZE];
+};
+
+//把ostream的输出直接写入LogBuffer
+class LogStreamBuf : public std::streambuf {
+public:
+    LogStreamBuf(LogBuffer& buf)
+        :m_buf(buf) {}
+protected:
+    int_type overflow(int_type c) override {
+        if(c != traits_type::eof()) {
+            m_buf.append((char)c);
+        }
+        return c;
+    }
+
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        m_buf.append(s, n);
+        return n;
+    }
+private:
+    LogBuffer& m_buf;
+};
+
 //日志事件
 class LogEvent {
 public:
@@ -125,6 +227,13 @@ public:
             ,uint32_t thread_id, uint32_t fiber_id, uint32_t time
             ,const std::string& thread_name);
 
+    //获取日志事件，参数同构造函数
+    //优先复用当前线程的空闲事件，没有空闲事件时(嵌套日志、异步输出还未写出)新建
+    static LogEvent::ptr Create(const std::shared_ptr<Logger>& logger, LogLevel::Level level
+            ,const char* file, int32_t line, uint32_t elapse
+            ,uint32_t thread_id, uint32_t fiber_id, uint32_t time
+            ,const std::string& thread_name);
+
     //返回文件名
     const char* getFile() const {return m_file;}
 
@@ -147,16 +256,19 @@ public:
     const std::string& getThreadName() const { return m_threadName;}
 
     //返回日志内容
-    std::string getContent() const { return m_ss.str();}
+    std::string getContent() const { return m_content.toString();}
+
+    //返回日志内容缓冲区
+    const LogBuffer& getBuffer() const { return m_content;}
 
     //返回日志器
-    std::shared_ptr<Logger> getLogger() const { return m_logger;}
+    const std::shared_ptr<Logger>& getLogger() const { return m_logger;}
 
     //返回日志级别
     LogLevel::Level getLevel() const { return m_level;}
 
-    //返回日志内容字符串流
-    std::stringstream& getSS() { return m_ss;}
+    //返回日志内容流
+    std::ostream& getSS() { return m_ss;}
 
     //格式化写入日志内容
     void format(const char* fmt, ...);
@@ -179,8 +291,12 @@ private:
     uint64_t m_time = 0;
     /// 线程名称
     std::string m_threadName;
+    /// 日志内容
+    LogBuffer m_content;
+    /// 写入m_content的streambuf
+    LogStreamBuf m_streambuf;
     /// 日志内容流
-    std::stringstream m_ss;
+    std::ostream m_ss;
     /// 日志器
     std::shared_ptr<Logger> m_logger;
     /// 日志等级
@@ -201,7 +317,7 @@ public:
     LogEvent::ptr getEvent() const {return m_event;}
 
     //获取日志内容流
-    std::stringstream& getSS();
+    std::ostream& getSS();
 
 private:
     //日志事件
@@ -240,20 +356,48 @@ public:
     std::string format(std::shared_ptr<Logger>logger, LogLevel::Level level, LogEvent::ptr event);
     std::ostream& format(std::ostream& ofs, std::shared_ptr<Logger>logger, LogLevel::Level level, LogEvent::ptr event);
 
+    //格式化日志追加到buf，不分配内存
+    void format(LogBuffer& buf, const std::shared_ptr<Logger>& logger, LogLevel::Level level, const LogEvent::ptr& event);
+
 public:
-    //日志内容项格式化
-    class FormatItem {
-    public:
-        typedef std::shared_ptr<FormatItem> ptr;
-        //析构函数
-        virtual ~FormatItem() {}
-
-        //格式化日志到流
-        // os          日志输出流
-        // logger      日志器
-        // level       日志等级
-        // event       日志事件
-        virtual void format(std::ostream& os, std::shared_ptr<Logger>logger, LogLevel::Level level, LogEvent::ptr event) = 0;
+    //日志内容项，解析模板时确定类型，格式化时按类型直接写入缓冲区
+    struct FormatItem {
+        enum Type {
+            //固定字符串
+            STRING,
+            //%m 消息
+            MESSAGE,
+            //%p 日志级别
+            LEVEL,
+            //%r 累计毫秒数
+            ELAPSE,
+            //%c 日志名称
+            NAME,
+            //%t 线程id
+            THREAD_ID,
+            //%n 换行
+            NEWLINE,
+            //%d 时间
+            DATETIME,
+            //%f 文件名
+            FILENAME,
+            //%l 行号
+            LINE,
+            //%T 制表符
+            TAB,
+            //%F 协程id
+            FIBER_ID,
+            //%N 线程名称
+            THREAD_NAME
+        };
+
+        FormatItem(Type t, const std::string& s = "")
+            :type(t), str(s) {}
+
+        //类型
+        Type type;
+        //STRING的内容，DATETIME的时间格式
+        std::string str;
     };
 
     //初始化，解析日志模板
@@ -266,7 +410,9 @@ private:
     //日志格式模板
     std::string m_pattern;
     //日志解析后格式
-    std::vector<FormatItem::ptr> m_items;
+    std::vector<FormatItem> m_items;
+    //唯一id，用于线程内缓存格式化后的时间
+    uint64_t m_id;
     //是否有错误
     bool m_error = false;
 };
@@ -402,26 +548,204 @@ public:
     typedef std::shared_ptr<StdoutLogAppender> ptr;
     void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
     std::string toYamlString() override;
+private:
+    //格式化缓冲区
+    LogBuffer m_buffer;
 };
 
 //输出到文件的Appender
+//以追加方式打开，日志先写入缓冲区，缓冲区满、超过刷新间隔或ERROR以上级别时写入文件
+//支持按大小和按时间滚动，外部轮转(logrotate)后通过ReopenAll()/信号重新打开
 class FileLogAppender : public LogAppender {
 public:
     typedef std::shared_ptr<FileLogAppender> ptr;
+
+    //按时间滚动的周期
+    enum RotateMode {
+        //不按时间滚动
+        ROTATE_NONE = 0,
+        //每小时
+        ROTATE_HOURLY = 1,
+        //每天
+        ROTATE_DAILY = 2
+    };
+
+    //将字符串转换成滚动周期，无法识别时返回ROTATE_NONE
+    static RotateMode RotateFromString(const std::string& str);
+    //将滚动周期转换成字符串
+    static const char* RotateToString(RotateMode mode);
+
     FileLogAppender(const std::string& filename);
+    ~FileLogAppender();
     void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
     std::string toYamlString() override;
 
     //重新打开日志文件
     //成功返回true
     bool reopen();
+
+    //将缓冲区写入文件
+    void flush();
+
+    //设置单个文件最大字节数，超过后滚动，0表示不限制
+    void setMaxSize(uint64_t val);
+    //设置按时间滚动的周期
+    void setRotate(RotateMode val);
+    //设置缓冲区刷新间隔(毫秒)，写日志时距上次写入超过该间隔就写入文件，0表示每条日志都写入
+    void setFlushInterval(uint32_t val);
+    //设置缓冲区大小(字节)
+    void setBufferSize(uint32_t val);
+
+    //通知所有FileLogAppender重新打开文件，可以在信号处理函数中调用
+    static void ReopenAll();
+
+    //安装信号处理函数，收到sig时重新打开所有日志文件
+    static void InstallReopenSignal(int sig);
+private:
+    //打开文件，需要持有锁
+    bool openFile();
+    //写入缓冲区，需要持有锁
+    void flushBuffer();
+    //滚动文件，需要持有锁
+    void rotate();
+    //计算下一次按时间滚动的时间点
+    void updateRotateTime(time_t now);
+private:
+    //文件路径
+    std::string m_filename;
+    //文件句柄
+    int m_fd = -1;
+    //当前文件大小
+    uint64_t m_size = 0;
+    //单个文件最大字节数
+    uint64_t m_maxSize = 0;
+    //按时间滚动的周期
+    RotateMode m_rotate = ROTATE_NONE;
+    //下一次按时间滚动的时间点(秒)
+    time_t m_nextRotate = 0;
+    //刷新间隔(毫秒)
+    uint32_t m_flushInterval = 1000;
+    //缓冲区大小
+    uint32_t m_bufferSize = 64 * 1024;
+    //写缓冲区
+    LogBuffer m_buffer;
+    //上次写入文件时间(毫秒)
+    uint64_t m_lastFlush = 0;
+    //已处理的重新打开通知
+    uint64_t m_reopenVersion = 0;
+};
+
+//异步输出的Appender
+//日志事件放入无锁环形队列(多生产者单消费者)，由后台线程批量格式化到同一缓冲区后写入
+//调用线程只做入队，不阻塞在磁盘IO上
+class AsyncLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<AsyncLogAppender> ptr;
+
+    //队列满时的处理策略
+    enum OverflowPolicy {
+        //等待队列有空位
+        BLOCK = 0,
+        //直接丢弃
+        DROP = 1,
+        //队列使用超过3/4后，低于ERROR级别的日志按采样率保留，队列满时丢弃
+        SAMPLE = 2
+    };
+
+    //将字符串转换成队列满处理策略，无法识别时返回BLOCK
+    static OverflowPolicy PolicyFromString(const std::string& str);
+    //将队列满处理策略转换成字符串
+    static const char* PolicyToString(OverflowPolicy policy);
+
+    //构造函数
+    // filename 日志文件路径，为空时输出到标准输出
+    // capacity 队列容量，向上取整为2的幂
+    // policy 队列满时的处理策略
+    // sample_rate SAMPLE策略下每sample_rate条保留1条
+    AsyncLogAppender(const std::string& filename, size_t capacity = 65536
+                    ,OverflowPolicy policy = BLOCK, uint32_t sample_rate = 10);
+
+    //析构函数，写完队列中剩余的日志
+    ~AsyncLogAppender();
+
+    void log(Logger::ptr logger, LogLevel::Level level, LogEvent::ptr event) override;
+    std::string toYamlString() override;
+
+    //等待当前队列中的日志全部写入
+    void flush();
+
+    //设置同步刷新的日志级别，大于等于该级别的日志返回前保证已经写入
+    void setFlushLevel(LogLevel::Level val) {m_flushLevel = val;}
+
+    //返回同步刷新的日志级别
+    LogLevel::Level getFlushLevel() const {return m_flushLevel;}
+
+    //返回丢弃的日志数
+    uint64_t getDropped() const {return m_dropped;}
+
+    //返回已写入的日志数
+    uint64_t getWritten() const {return m_written;}
+
+private:
+    //队列单元
+    struct Cell {
+        //序号，等于位置+1时可读，等于位置时可写
+        std::atomic<uint64_t> seq;
+        Logger::ptr logger;
+        LogLevel::Level level;
+        LogEvent::ptr event;
+    };
+
+    //入队，成功返回该日志的序号(从1开始)，队列满返回0
+    uint64_t push(Logger::ptr& logger, LogLevel::Level level, LogEvent::ptr& event);
+
+    //等待序号ticket之前的日志写入
+    void waitWritten(uint64_t ticket);
+
+    //唤醒后台线程
+    void wakeup();
+
+    //后台线程执行函数
+    void run();
+
+    //写出一批日志
+    void writeAll(const LogBuffer& buf);
+
 private:
     //文件路径
     std::string m_filename;
-    //文件流
-    std::ofstream m_filestream;
-    //上次重新打开时间
-    uint64_t m_lastTime = 0;
+    //输出句柄
+    int m_fd = -1;
+    //队列满处理策略
+    OverflowPolicy m_policy;
+    //采样率
+    uint32_t m_sampleRate;
+    //同步刷新的日志级别
+    LogLevel::Level m_flushLevel = LogLevel::FATAL;
+    //队列容量-1
+    uint64_t m_mask;
+    //环形队列
+    Cell* m_cells;
+    //生产者位置
+    std::atomic<uint64_t> m_tail = {0};
+    //避免和生产者位置在同一缓存行
+    char m_pad[64];
+    //消费者位置
+    std::atomic<uint64_t> m_head = {0};
+    //已写入的日志数
+    std::atomic<uint64_t> m_written = {0};
+    //丢弃的日志数
+    std::atomic<uint64_t> m_dropped = {0};
+    //SAMPLE策略计数
+    std::atomic<uint64_t> m_sampled = {0};
+    //后台线程是否在等待
+    std::atomic<bool> m_waiting = {false};
+    //是否停止
+    std::atomic<bool> m_stop = {false};
+    //后台线程等待的信号量
+    Semaphore m_sem;
+    //后台线程
+    Thread::ptr m_thread;
 };
 
 //日志器管理类
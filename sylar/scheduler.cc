@@ -1,4 +1,5 @@
 #include "scheduler.h"
+#include "config.h"
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
@@ -7,10 +8,28 @@ namespace hr {
 
 static hr::Logger::ptr g_logger = HR_LOG_NAME("system");
 
+//是否使用工作窃取模式
+static hr::ConfigVar<bool>::ptr g_scheduler_work_stealing =
+    hr::Config::Lookup("scheduler.work_stealing", false, "scheduler work stealing mode");
+
+//工作窃取模式下每个线程本地队列的容量
+static hr::ConfigVar<uint32_t>::ptr g_scheduler_local_queue_size =
+    hr::Config::Lookup("scheduler.local_queue_size", (uint32_t)256, "scheduler local queue size");
+
 //调度器，同一调度器下的所有线程都指向同一个调度器实例
 static thread_local Scheduler* t_scheduler = nullptr;
 //当前线程的调度协程，每个线程独一份，包括caller线程
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+//工作窃取模式下当前线程的本地队列
+static thread_local void* t_work_queue = nullptr;
+//窃取时选择随机起点的种子
+static thread_local uint32_t t_steal_seed = 0;
+//当前执行的任务指定的线程id
+static thread_local int t_task_thread = -1;
+//当前线程执行过的任务数量
+static thread_local uint64_t t_task_count = 0;
+//当前线程在调度器中的下标
+static thread_local int t_thread_index = -1;
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     :m_name(name){
@@ -38,6 +57,16 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
         m_rootThread = -1;
     }
     m_threadCount = threads;
+
+    m_workStealing = g_scheduler_work_stealing->getValue();
+    if(m_workStealing) {
+        m_localQueueSize = std::max(g_scheduler_local_queue_size->getValue(), 2u);
+        //每个调度线程一个队列，包括caller线程
+        m_queues.resize(m_threadCount + (use_caller ? 1 : 0));
+        for(auto& i : m_queues) {
+            i = new WorkQueue;
+        }
+    }
 }
 
 Scheduler::~Scheduler() {
@@ -45,6 +74,9 @@ Scheduler::~Scheduler() {
     if(GetThis() == this) {
         t_scheduler = nullptr;
     }
+    for(auto& i : m_queues) {
+        delete i;
+    }
 }
 
 Scheduler* Scheduler::GetThis() {
@@ -56,6 +88,18 @@ Fiber* Scheduler::GetMainFiber() {
     return t_scheduler_fiber;
 }
 
+int Scheduler::GetTaskThread() {
+    return t_task_thread;
+}
+
+uint64_t Scheduler::GetTaskCount() {
+    return t_task_count;
+}
+
+int Scheduler::GetThreadIndex() {
+    return t_thread_index;
+}
+
 //创建线程池
 void Scheduler::start() {
     MutexType::Lock lock(m_mutex);
@@ -137,6 +181,16 @@ void Scheduler::run() {
         t_scheduler_fiber = Fiber::GetThis().get();
     }
 
+    size_t idx = m_nextIndex++;
+    t_thread_index = idx;
+    //工作窃取模式下为当前线程分配本地队列
+    if(m_workStealing) {
+        SYLAR_ASSERT(idx < m_queues.size());
+        m_queues[idx]->threadId = hr::GetThreadId();
+        t_work_queue = m_queues[idx];
+        t_steal_seed = hr::GetThreadId() * 2654435761u + 1;
+    }
+
     //创建空闲协程并没有执行
     Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
     Fiber::ptr cb_fiber;
@@ -147,16 +201,20 @@ void Scheduler::run() {
         ft.reset();
         //是否需要通知其他线程进行任务调度
         bool tickle_me = false;
+        //跳过的指定了其他线程的任务，只通知那个线程
+        int other_thread = -1;
         //是否活跃
         bool is_active = false;
-        {
+        if(m_workStealing) {
+            is_active = fetchStealing(ft, tickle_me, other_thread);
+        } else {
             MutexType::Lock lock(m_mutex);
             auto it = m_fibers.begin();
             while(it != m_fibers.end()) {
                 //指定其他线程执行
                 if(it->thread != -1 && it->thread != hr::GetThreadId()) {
+                    other_thread = it->thread;
                     ++it;
-                    tickle_me = true;
                     continue;
                 }
 
@@ -178,7 +236,10 @@ void Scheduler::run() {
             tickle_me |= it != m_fibers.end();
         }
 
-        //如果需要通知就通知其他线程
+        //如果需要通知就通知其他线程，目标线程醒着时不会真的唤醒
+        if(other_thread != -1) {
+            tickleThread(other_thread);
+        }
         if(tickle_me) {
             tickle();
         }
@@ -187,12 +248,15 @@ void Scheduler::run() {
         if(ft.fiber && (ft.fiber->getState() != Fiber::TERM
                         && ft.fiber->getState() != Fiber::EXCEPT)) {
             //执行任务队列的协程
+            t_task_thread = ft.thread;
+            ++t_task_count;
             ft.fiber->swapIn();
+            t_task_thread = -1;
             //如果返回，要么是执行完了要么是暂停了，所以工作线程数量减一
             --m_activeThreadCount;
             //如果状态是READY再添加到任务队列
             if(ft.fiber->getState() == Fiber::READY) {
-                schedule(ft.fiber);
+                schedule(ft.fiber, ft.thread);
             } else if(ft.fiber->getState() != Fiber::TERM
                     && ft.fiber->getState() != Fiber::EXCEPT) {
                 ft.fiber->m_state = Fiber::HOLD;
@@ -207,14 +271,18 @@ void Scheduler::run() {
             } else {
                 cb_fiber.reset(new Fiber(ft.cb));
             }
+            int thread = ft.thread;
             //将ft数据清空
             ft.reset();
             //执行回调函数的协程，执行完后将协程重置，状态为TERM
+            t_task_thread = thread;
+            ++t_task_count;
             cb_fiber->swapIn();
+            t_task_thread = -1;
             //同上
             --m_activeThreadCount;
             if(cb_fiber->getState() == Fiber::READY) {
-                schedule(cb_fiber);
+                schedule(cb_fiber, thread);
                 cb_fiber.reset();
             } else if(cb_fiber->getState() == Fiber::EXCEPT
                     || cb_fiber->getState() == Fiber::TERM) {
@@ -232,6 +300,8 @@ void Scheduler::run() {
             //如果空闲协程状态为TERM说明调度结束退出循环
             if(idle_fiber->getState() == Fiber::TERM) {
                 HR_LOG_INFO(g_logger) << "idle fiber term";
+                t_work_queue = nullptr;
+                t_thread_index = -1;
                 break;
             }
             //空闲线程数加一
@@ -250,6 +320,190 @@ void Scheduler::run() {
     }
 }
 
+bool Scheduler::scheduleStealing(FiberAndThread& ft) {
+    if(ft.thread != -1) {
+        //指定线程的任务放入该线程队列的pinned里
+        for(auto& q : m_queues) {
+            if(q->threadId != ft.thread) {
+                continue;
+            }
+            MutexType::Lock lock(q->mutex);
+            q->pinned.push_back(ft);
+            ++q->size;
+            ++m_localTaskCount;
+            return true;
+        }
+        //目标线程还没开始调度，放入全局队列
+    } else if(t_scheduler == this && t_work_queue) {
+        //调度线程内产生的任务优先放入自己的本地队列
+        WorkQueue* q = (WorkQueue*)t_work_queue;
+        std::vector<FiberAndThread> overflow;
+        {
+            MutexType::Lock lock(q->mutex);
+            if(q->tasks.size() < m_localQueueSize) {
+                q->tasks.push_back(ft);
+                ++q->size;
+                ++m_localTaskCount;
+                //队列由空变为非空时才唤醒空闲线程，窃取到任务的线程会继续唤醒其他线程
+                return q->tasks.size() == 1 && hasIdleThreads();
+            }
+            //本地队列满了，将一半任务连同新任务转移到全局队列
+            size_t n = q->tasks.size() / 2;
+            overflow.reserve(n + 1);
+            for(size_t i = 0; i < n; ++i) {
+                overflow.push_back(q->tasks.back());
+                q->tasks.pop_back();
+            }
+            q->size -= n;
+        }
+        overflow.push_back(ft);
+        {
+            MutexType::Lock lock(m_mutex);
+            m_fibers.insert(m_fibers.end(), overflow.rbegin(), overflow.rend());
+        }
+        //先放入全局队列再减计数，避免stopping()误判
+        m_localTaskCount -= overflow.size() - 1;
+        return true;
+    }
+
+    MutexType::Lock lock(m_mutex);
+    bool need_tickle = m_fibers.empty() || hasIdleThreads();
+    m_fibers.push_back(ft);
+    return need_tickle;
+}
+
+bool Scheduler::popLocal(WorkQueue* q, FiberAndThread& ft) {
+    if(q->size == 0) {
+        return false;
+    }
+    MutexType::Lock lock(q->mutex);
+    for(auto it = q->pinned.begin(); it != q->pinned.end(); ++it) {
+        if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+            continue;
+        }
+        ft = *it;
+        q->pinned.erase(it);
+        --q->size;
+        ++m_activeThreadCount;
+        --m_localTaskCount;
+        return true;
+    }
+    for(auto it = q->tasks.begin(); it != q->tasks.end(); ++it) {
+        if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+            continue;
+        }
+        ft = *it;
+        q->tasks.erase(it);
+        --q->size;
+        ++m_activeThreadCount;
+        --m_localTaskCount;
+        return true;
+    }
+    return false;
+}
+
+bool Scheduler::stealFrom(WorkQueue* self, FiberAndThread& ft, bool& tickle_me, int& other_thread) {
+    size_t count = m_queues.size();
+    t_steal_seed ^= t_steal_seed << 13;
+    t_steal_seed ^= t_steal_seed >> 17;
+    t_steal_seed ^= t_steal_seed << 5;
+    size_t start = t_steal_seed % count;
+
+    std::vector<FiberAndThread> stolen;
+    for(size_t i = 0; i < count; ++i) {
+        WorkQueue* victim = m_queues[(start + i) % count];
+        if(victim == self || victim->size == 0) {
+            continue;
+        }
+        MutexType::Lock lock(victim->mutex);
+        //别的线程有指定的任务，通知它
+        if(!victim->pinned.empty()) {
+            other_thread = victim->threadId;
+        }
+        //从队尾窃取一半，队首留给队列所属线程
+        size_t n = (victim->tasks.size() + 1) / 2;
+        if(n == 0) {
+            continue;
+        }
+        stolen.reserve(n);
+        for(size_t j = 0; j < n; ++j) {
+            stolen.push_back(victim->tasks.back());
+            victim->tasks.pop_back();
+        }
+        victim->size -= n;
+        break;
+    }
+    if(stolen.empty()) {
+        return false;
+    }
+
+    //放入本地队列再取，窃取到的协程可能还没从原来的线程切出(EXEC)，要跳过
+    {
+        MutexType::Lock lock(self->mutex);
+        self->tasks.insert(self->tasks.end(), stolen.rbegin(), stolen.rend());
+        self->size += stolen.size();
+    }
+    if(stolen.size() > 1) {
+        tickle_me = true;
+    }
+    return popLocal(self, ft);
+}
+
+bool Scheduler::fetchStealing(FiberAndThread& ft, bool& tickle_me, int& other_thread) {
+    WorkQueue* self = (WorkQueue*)t_work_queue;
+    //1.本地队列
+    if(popLocal(self, ft)) {
+        return true;
+    }
+
+    //2.全局队列，取出一个任务执行，并顺带搬运一批到本地队列
+    std::vector<FiberAndThread> batch;
+    bool got = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        size_t limit = std::min(m_localQueueSize / 2
+                        ,m_fibers.size() / m_queues.size() + 1);
+        auto it = m_fibers.begin();
+        while(it != m_fibers.end() && batch.size() < limit) {
+            if(it->thread != -1 && it->thread != hr::GetThreadId()) {
+                other_thread = it->thread;
+                ++it;
+                continue;
+            }
+            if(it->fiber && it->fiber->getState() == Fiber::EXEC) {
+                ++it;
+                continue;
+            }
+            if(!got) {
+                ft = *it;
+                ++m_activeThreadCount;
+                got = true;
+            } else if(it->thread == -1) {
+                batch.push_back(*it);
+            } else {
+                ++it;
+                continue;
+            }
+            m_fibers.erase(it++);
+        }
+        //先计数再放入本地队列，避免stopping()误判
+        m_localTaskCount += batch.size();
+        tickle_me |= it != m_fibers.end();
+    }
+    if(!batch.empty()) {
+        MutexType::Lock lock(self->mutex);
+        self->tasks.insert(self->tasks.end(), batch.begin(), batch.end());
+        self->size += batch.size();
+        tickle_me = true;
+    }
+    if(got) {
+        return true;
+    }
+
+    //3.随机选择其他线程窃取
+    return stealFrom(self, ft, tickle_me, other_thread);
+}
+
 void Scheduler::tickle() {
     HR_LOG_INFO(g_logger) << "tickle";
 }
@@ -257,7 +511,8 @@ void Scheduler::tickle() {
 bool Scheduler::stopping() {
     MutexType::Lock lock(m_mutex);
     return m_autoStop && m_stopping
-        && m_fibers.empty() && m_activeThreadCount == 0;
+        && m_fibers.empty() && m_activeThreadCount == 0
+        && m_localTaskCount == 0;
 }
 
 void Scheduler::idle() {
@@ -285,6 +540,8 @@ std::ostream& Scheduler::dump(std::ostream& os) {
        << " active_count=" << m_activeThreadCount
        << " idle_count=" << m_idleThreadCount
        << " stopping=" << m_stopping
+       << " work_stealing=" << m_workStealing
+       << " local_count=" << m_localTaskCount
        << " ]" << std::endl << "    ";
     for(size_t i = 0; i < m_threadIds.size(); ++i) {
         if(i) {
@@ -6,6 +6,7 @@
 #include <memory>
 #include <vector>
 #include <list>
+#include <deque>
 #include <iostream>
 #include "fiber.h"
 #include "thread.h"
@@ -41,6 +42,17 @@ public:
     //返回当前协程调度器的调度协程
     static Fiber* GetMainFiber();
 
+    //返回当前任务指定的执行线程id，-1表示任意线程
+    //指定了线程的协程在IO事件、sleep唤醒后仍然回到这个线程执行
+    static int GetTaskThread();
+
+    //返回当前线程执行过的任务数量
+    static uint64_t GetTaskCount();
+
+    //返回当前线程在调度器中的下标，按进入调度的顺序从0开始，包括caller线程
+    //不在执行调度协程的线程返回-1
+    static int GetThreadIndex();
+
     //启动协程调度器
     void start();
 
@@ -55,13 +67,23 @@ public:
     template<class FiberOrCb>
     void schedule(FiberOrCb fc, int thread = -1) {
         bool need_tickle = false;
+        if(m_workStealing) {
+            FiberAndThread ft(fc, thread);
+            if(ft.fiber || ft.cb) {
+                need_tickle = scheduleStealing(ft);
+            }
+            if(need_tickle) {
+                thread == -1 ? tickle() : tickleThread(thread);
+            }
+            return;
+        }
         {
             MutexType::Lock lock(m_mutex);
             need_tickle = schedulerNoLock(fc, thread);
         }
 
         if(need_tickle) {
-            tickle();
+            thread == -1 ? tickle() : tickleThread(thread);
         }
     }
 
@@ -73,6 +95,19 @@ public:
     template<class InputIterator>
     void schedule(InputIterator begin, InputIterator end) {
         bool need_tickle = false;
+        if(m_workStealing) {
+            while(begin != end) {
+                FiberAndThread ft(&*begin, -1);
+                if(ft.fiber || ft.cb) {
+                    need_tickle = scheduleStealing(ft) || need_tickle;
+                }
+                ++begin;
+            }
+            if(need_tickle) {
+                tickle();
+            }
+            return;
+        }
         {
             MutexType::Lock lock(m_mutex);
             while(begin != end) {
@@ -89,10 +124,19 @@ public:
     void switchTo(int thread = -1);
     std::ostream& dump(std::ostream& os);
 
+    //是否为工作窃取模式(scheduler.work_stealing)
+    bool isWorkStealing() const {return m_workStealing;}
+
+    //返回调度器下所有线程的id(use_caller时包括caller线程)
+    const std::vector<int>& getThreadIds() const {return m_threadIds;}
+
 protected:
     //通知协程调度器有任务了
     virtual void tickle();
 
+    //通知指定线程有任务了，只有这个线程能执行，不能因为没有空闲线程而省略
+    virtual void tickleThread(int thread) { tickle();}
+
     //协程调度函数
     void run();
 
@@ -172,6 +216,36 @@ private:
         }
     };
 
+    //工作窃取模式下每个线程私有的任务队列
+    struct WorkQueue {
+        //队列的Mutex
+        MutexType mutex;
+        //可被其他线程窃取的任务
+        std::deque<FiberAndThread> tasks;
+        //指定在该线程执行的任务，不会被窃取
+        std::list<FiberAndThread> pinned;
+        //队列所属的线程id，线程开始调度前为-1
+        std::atomic<int> threadId = {-1};
+        //队列中的任务数量，用于无锁判断是否为空
+        std::atomic<size_t> size = {0};
+    };
+
+    //工作窃取模式下的调度，返回是否需要通知
+    bool scheduleStealing(FiberAndThread& ft);
+
+    //工作窃取模式下获取任务，依次从本地队列、全局队列、其他线程队列获取
+    // ft 取到的任务
+    // tickle_me 是否需要通知其他线程
+    // other_thread 有指定给这个线程的任务，需要通知它
+    // 取到任务返回true
+    bool fetchStealing(FiberAndThread& ft, bool& tickle_me, int& other_thread);
+
+    //从本地队列中取出一个任务
+    bool popLocal(WorkQueue* q, FiberAndThread& ft);
+
+    //从其他线程的队列中窃取一半任务
+    bool stealFrom(WorkQueue* self, FiberAndThread& ft, bool& tickle_me, int& other_thread);
+
 private:
     //Mutex
     MutexType m_mutex;
@@ -183,6 +257,16 @@ private:
     Fiber::ptr m_rootFiber;
     //协程调度器名称
     std::string m_name;
+    //是否为工作窃取模式，构造时读取配置，运行期间不变
+    bool m_workStealing = false;
+    //本地队列的容量上限，超出部分转移到全局队列
+    size_t m_localQueueSize = 0;
+    //每个线程一个本地队列，构造时分配好，运行期间不会扩容
+    std::vector<WorkQueue*> m_queues;
+    //下一个待分配的线程下标，工作窃取模式下也是本地队列的下标
+    std::atomic<size_t> m_nextIndex = {0};
+    //所有本地队列中的任务总数
+    std::atomic<size_t> m_localTaskCount = {0};
 
 protected:
     //协程下的线程id数组
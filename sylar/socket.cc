@@ -4,12 +4,20 @@
 #include "log.h"
 #include "macro.h"
 #include "hook.h"
+#include "config.h"
+#include <algorithm>
 #include <limits.h>
+#include <sys/sendfile.h>
 
 namespace hr {
 
 static hr::Logger::ptr g_logger = HR_LOG_NAME("system");
 
+//socket的SO_BUSY_POLL: 阻塞读时内核在网卡队列上忙等的时间,需要网卡驱动支持,
+//超过net.core.busy_read的值需要CAP_NET_ADMIN
+static hr::ConfigVar<int>::ptr g_tcp_busy_poll_us =
+    hr::Config::Lookup("tcp.busy_poll_us", 0, "tcp socket SO_BUSY_POLL microseconds, 0 means disabled");
+
 Socket::ptr Socket::CreateTCP(hr::Address::ptr address) {
     Socket::ptr sock(new Socket(address->getFamily(), TCP, 0));
     return sock;
@@ -116,15 +124,58 @@ bool Socket::setOption(int level, int option, const void* result, socklen_t len)
 }
 
 Socket::ptr Socket::accept() {
-    Socket::ptr sock(new Socket(m_family, m_type, m_protocol));
-    int newsock = ::accept(m_sock, nullptr, nullptr);
+    //accept4直接拿到非阻塞的句柄和对端地址,省掉fcntl和getpeername
+    sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int newsock = ::accept4(m_sock, (sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
     if(newsock == -1) {
         HR_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno="
             << errno << " errstr=" << strerror(errno);
         return nullptr;
     }
-    if(sock->init(newsock)) {
-        return sock;
+    return createAccepted(newsock, (sockaddr*)&addr, addrlen);
+}
+
+size_t Socket::acceptBatch(std::vector<Socket::ptr>& socks, size_t max) {
+    Socket::ptr sock = accept();
+    if(!sock) {
+        return 0;
+    }
+    socks.push_back(sock);
+    size_t count = 1;
+    while(count < max) {
+        //backlog里剩下的连接用原始accept4取,取空时返回EAGAIN,不挂起协程
+        sockaddr_storage addr;
+        socklen_t addrlen = sizeof(addr);
+        int newsock = accept4_f(m_sock, (sockaddr*)&addr, &addrlen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(newsock == -1) {
+            if(errno != EAGAIN && errno != EINTR) {
+                HR_LOG_DEBUG(g_logger) << "accept4(" << m_sock << ") errno="
+                    << errno << " errstr=" << strerror(errno);
+            }
+            break;
+        }
+        FdMgr::GetInstance()->get(newsock, true, true);
+        sock = createAccepted(newsock, (sockaddr*)&addr, addrlen);
+        if(sock) {
+            socks.push_back(sock);
+            ++count;
+        }
+    }
+    return count;
+}
+
+Socket::ptr Socket::createAccepted(int sock, const sockaddr* addr, socklen_t addrlen) {
+    Socket::ptr rt(new Socket(m_family, m_type, m_protocol));
+    if(addr->sa_family == AF_INET || addr->sa_family == AF_INET6) {
+        rt->m_remoteAddress = Address::Create(addr, addrlen);
+    }
+    if(rt->init(sock)) {
+        return rt;
+    }
+    //init已经接管句柄时由rt析构关闭
+    if(!rt->isValid()) {
+        ::close(sock);
     }
     return nullptr;
 }
@@ -142,6 +193,104 @@ bool Socket::init(int sock) {
     return false;
 }
 
+bool Socket::attachListen(int sock) {
+    FdCtx::ptr ctx = FdMgr::GetInstance()->get(sock, true);
+    if(!ctx || !ctx->isSocket() || ctx->isClose()) {
+        return false;
+    }
+    m_sock = sock;
+    getLocalAddress();
+    return true;
+}
+
+//一条消息最多带的句柄数,内核上限是253(SCM_MAX_FD)
+static const size_t s_max_fds_per_msg = 64;
+
+bool Socket::sendFds(const std::vector<int>& fds) {
+    size_t pos = 0;
+    do {
+        size_t n = std::min(fds.size() - pos, s_max_fds_per_msg);
+        //消息体是这条消息之后还剩多少个句柄
+        uint32_t left = fds.size() - pos - n;
+        iovec iov;
+        iov.iov_base = &left;
+        iov.iov_len = sizeof(left);
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * s_max_fds_per_msg));
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if(n) {
+            msg.msg_control = &control[0];
+            msg.msg_controllen = CMSG_SPACE(sizeof(int) * n);
+            cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * n);
+            memcpy(CMSG_DATA(cmsg), &fds[pos], sizeof(int) * n);
+        }
+        if(::sendmsg(m_sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(left)) {
+            HR_LOG_ERROR(g_logger) << "sendFds sock=" << m_sock << " errno="
+                << errno << " errstr=" << strerror(errno);
+            return false;
+        }
+        pos += n;
+    } while(pos < fds.size());
+    return true;
+}
+
+bool Socket::recvFds(std::vector<int>& fds) {
+    uint32_t left = 0;
+    do {
+        iovec iov;
+        iov.iov_base = &left;
+        iov.iov_len = sizeof(left);
+        std::vector<char> control(CMSG_SPACE(sizeof(int) * s_max_fds_per_msg));
+
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control[0];
+        msg.msg_controllen = control.size();
+        ssize_t rt = ::recvmsg(m_sock, &msg, MSG_CMSG_CLOEXEC);
+        if(rt != (ssize_t)sizeof(left) || (msg.msg_flags & MSG_CTRUNC)) {
+            HR_LOG_ERROR(g_logger) << "recvFds sock=" << m_sock << " rt=" << rt
+                << " flags=" << msg.msg_flags << " errno=" << errno
+                << " errstr=" << strerror(errno);
+            return false;
+        }
+        for(cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if(cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            size_t n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* data = (const int*)CMSG_DATA(cmsg);
+            fds.insert(fds.end(), data, data + n);
+        }
+    } while(left > 0);
+    return true;
+}
+
+bool Socket::shutdown(int how) {
+    if(m_sock == -1) {
+        return false;
+    }
+    return ::shutdown(m_sock, how) == 0;
+}
+
+bool Socket::setReusePort() {
+    if(!isValid()) {
+        newSock();
+        if(SYLAR_UNLIKELY(!isValid())) {
+            return false;
+        }
+    }
+    int val = 1;
+    return setOption(SOL_SOCKET, SO_REUSEPORT, val);
+}
+
 bool Socket::bind(const Address::ptr addr) {
     //m_localAddress = addr;
     if(!isValid()) {
@@ -251,7 +400,8 @@ bool Socket::close() {
 
 int Socket::send(const void* buffer, size_t length, int flags) {
     if(isConnected()) {
-        return ::send(m_sock, buffer, length, flags);
+        //对端关闭时返回EPIPE,不产生SIGPIPE
+        return ::send(m_sock, buffer, length, flags | MSG_NOSIGNAL);
     }
     return -1;
 }
@@ -262,14 +412,21 @@ int Socket::send(const iovec* buffers, size_t length, int flags) {
         memset(&msg, 0, sizeof(msg));
         msg.msg_iov = (iovec*)buffers;
         msg.msg_iovlen = length;
-        return ::sendmsg(m_sock, &msg, flags);
+        return ::sendmsg(m_sock, &msg, flags | MSG_NOSIGNAL);
+    }
+    return -1;
+}
+
+int Socket::sendFile(int fd, off_t* offset, size_t length) {
+    if(isConnected()) {
+        return ::sendfile(m_sock, fd, offset, length);
     }
     return -1;
 }
 
 int Socket::sendTo(const void* buffer, size_t length, const Address::ptr to, int flags) {
     if(isConnected()) {
-        return ::sendto(m_sock, buffer, length, flags, to->getAddr(), to->getAddrLen());
+        return ::sendto(m_sock, buffer, length, flags | MSG_NOSIGNAL, to->getAddr(), to->getAddrLen());
     }
     return -1;
 }
@@ -282,7 +439,7 @@ int Socket::sendTo(const iovec* buffers, size_t length, const Address::ptr to, i
         msg.msg_iovlen = length;
         msg.msg_name = to->getAddr();
         msg.msg_namelen = to->getAddrLen();
-        return ::sendmsg(m_sock, &msg, flags);
+        return ::sendmsg(m_sock, &msg, flags | MSG_NOSIGNAL);
     }
     return -1;
 }
@@ -450,6 +607,15 @@ void Socket::initSock() {
     setOption(SOL_SOCKET, SO_REUSEADDR, val);
     if(m_type == SOCK_STREAM) {
         setOption(IPPROTO_TCP, TCP_NODELAY, val);
+        int busy_poll = g_tcp_busy_poll_us->getValue();
+        if(busy_poll > 0 && !setOption(SOL_SOCKET, SO_BUSY_POLL, busy_poll)) {
+            //每个连接都会失败,只报一次
+            static std::atomic<bool> s_warned(false);
+            if(!s_warned.exchange(true)) {
+                HR_LOG_WARN(g_logger) << "setsockopt SO_BUSY_POLL=" << busy_poll
+                    << " fail errno=" << errno << " errstr=" << strerror(errno);
+            }
+        }
     }
 }
 
@@ -482,17 +648,18 @@ SSLSocket::SSLSocket(int family, int type, int protocol)
     :Socket(family, type, protocol) {
 }
 
-Socket::ptr SSLSocket::accept() {
-    SSLSocket::ptr sock(new SSLSocket(m_family, m_type, m_protocol));
-    int newsock = ::accept(m_sock, nullptr, nullptr);
-    if(newsock == -1) {
-        HR_LOG_ERROR(g_logger) << "accept(" << m_sock << ") errno="
-            << errno << " errstr=" << strerror(errno);
-        return nullptr;
+Socket::ptr SSLSocket::createAccepted(int sock, const sockaddr* addr, socklen_t addrlen) {
+    SSLSocket::ptr rt(new SSLSocket(m_family, m_type, m_protocol));
+    rt->m_ctx = m_ctx;
+    if(addr->sa_family == AF_INET || addr->sa_family == AF_INET6) {
+        rt->m_remoteAddress = Address::Create(addr, addrlen);
+    }
+    if(rt->init(sock)) {
+        return rt;
     }
-    sock->m_ctx = m_ctx;
-    if(sock->init(newsock)) {
-        return sock;
+    //init已经接管句柄时由rt析构关闭
+    if(!rt->isValid()) {
+        ::close(sock);
     }
     return nullptr;
 }
@@ -545,6 +712,24 @@ int SSLSocket::send(const iovec* buffers, size_t length, int flags) {
     return total;
 }
 
+//SSL需要在用户态加密，读出文件内容后发送
+int SSLSocket::sendFile(int fd, off_t* offset, size_t length) {
+    if(!m_ssl) {
+        return -1;
+    }
+    char buf[16 * 1024];
+    size_t len = std::min(length, sizeof(buf));
+    ssize_t n = pread(fd, buf, len, *offset);
+    if(n <= 0) {
+        return -1;
+    }
+    int rt = SSL_write(m_ssl.get(), buf, n);
+    if(rt > 0) {
+        *offset += rt;
+    }
+    return rt;
+}
+
 int SSLSocket::sendTo(const void* buffer, size_t length, const Address::ptr to, int flags) {
     SYLAR_ASSERT(false);
     return -1;
@@ -159,6 +159,50 @@ public:
      */
     virtual Socket::ptr accept();
 
+    /**
+     * @brief 批量接收连接
+     * @param[out] socks 新连接追加到末尾
+     * @param[in] max 本次最多接收的连接数
+     * @return 接收到的连接数,0表示失败,errno为失败原因
+     * @details 第一个连接和accept一样等待,之后不再等待,
+     *          一直接收到backlog取空(EAGAIN)或者达到max为止
+     */
+    size_t acceptBatch(std::vector<Socket::ptr>& socks, size_t max);
+
+    /**
+     * @brief 接管一个已经在监听的句柄
+     * @param[in] sock 监听句柄,例如热重启时从旧进程收到的句柄
+     * @return 是否成功
+     */
+    bool attachListen(int sock);
+
+    /**
+     * @brief 通过Unix socket把句柄发送给对端(SCM_RIGHTS)
+     * @param[in] fds 要发送的句柄,发送后本进程的句柄仍然有效
+     * @return 是否全部发送成功
+     */
+    bool sendFds(const std::vector<int>& fds);
+
+    /**
+     * @brief 接收sendFds发送的句柄
+     * @param[out] fds 收到的句柄追加到末尾
+     * @return 是否全部接收成功
+     */
+    bool recvFds(std::vector<int>& fds);
+
+    /**
+     * @brief 关闭连接的读端或写端 @see shutdown
+     * @details 句柄不释放,等待中的读写协程会被唤醒
+     */
+    bool shutdown(int how = SHUT_RDWR);
+
+    /**
+     * @brief 开启SO_REUSEPORT,多个socket可以绑定同一个地址,由内核分发连接
+     * @pre 在bind之前调用
+     * @return 是否设置成功
+     */
+    bool setReusePort();
+
     /**
      * @brief 绑定地址
      * @param[in] addr 地址
@@ -212,6 +256,18 @@ public:
      */
     virtual int send(const iovec* buffers, size_t length, int flags = 0);
 
+    /**
+     * @brief 发送文件内容(sendfile)，数据不经过用户态
+     * @param[in] fd 文件句柄
+     * @param[in, out] offset 文件中的开始位置，返回时更新为发送后的位置
+     * @param[in] length 待发送数据的长度
+     * @return
+     *      @retval >0 发送成功对应大小的数据
+     *      @retval =0 socket被关闭
+     *      @retval <0 socket出错
+     */
+    virtual int sendFile(int fd, off_t* offset, size_t length);
+
     /**
      * @brief 发送数据
      * @param[in] buffer 待发送数据的内存
@@ -374,6 +430,14 @@ protected:
      * @brief 初始化sock
      */
     virtual bool init(int sock);
+
+    /**
+     * @brief 用accept4得到的句柄创建新连接的Socket
+     * @param[in] sock 新连接的句柄,失败时关闭
+     * @param[in] addr accept4返回的对端地址
+     * @param[in] addrlen 对端地址长度
+     */
+    virtual Socket::ptr createAccepted(int sock, const sockaddr* addr, socklen_t addrlen);
 protected:
     /// socket句柄
     int m_sock;
@@ -400,13 +464,13 @@ public:
     static SSLSocket::ptr CreateTCPSocket6();
 
     SSLSocket(int family, int type, int protocol = 0);
-    virtual Socket::ptr accept() override;
     virtual bool bind(const Address::ptr addr) override;
     virtual bool connect(const Address::ptr addr, uint64_t timeout_ms = -1) override;
     virtual bool listen(int backlog = SOMAXCONN) override;
     virtual bool close() override;
     virtual int send(const void* buffer, size_t length, int flags = 0) override;
     virtual int send(const iovec* buffers, size_t length, int flags = 0) override;
+    virtual int sendFile(int fd, off_t* offset, size_t length) override;
     virtual int sendTo(const void* buffer, size_t length, const Address::ptr to, int flags = 0) override;
     virtual int sendTo(const iovec* buffers, size_t length, const Address::ptr to, int flags = 0) override;
     virtual int recv(void* buffer, size_t length, int flags = 0) override;
@@ -418,6 +482,7 @@ public:
     virtual std::ostream& dump(std::ostream& os) const override;
 protected:
     virtual bool init(int sock) override;
+    virtual Socket::ptr createAccepted(int sock, const sockaddr* addr, socklen_t addrlen) override;
 private:
     std::shared_ptr<SSL_CTX> m_ctx;
     std::shared_ptr<SSL> m_ssl;
@@ -1,6 +1,12 @@
 #include "tcp_server.h"
 #include "config.h"
 #include "log.h"
+#include "fd_manager.h"
+#include "util.h"
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
 
 namespace hr {
 
@@ -8,6 +14,14 @@ static hr::ConfigVar<uint64_t>::ptr g_tcp_server_read_timeout =
     hr::Config::Lookup("tcp_server.read_timeout", (uint64_t)(60 * 1000 * 2),
             "tcp server read timeout");
 
+static hr::ConfigVar<uint32_t>::ptr g_tcp_server_max_connections =
+    hr::Config::Lookup("tcp_server.max_connections", (uint32_t)0,
+            "tcp server max active connections, 0 means unlimited");
+
+static hr::ConfigVar<uint32_t>::ptr g_tcp_server_accept_batch =
+    hr::Config::Lookup("tcp_server.accept_batch", (uint32_t)64,
+            "tcp server max connections accepted per wakeup");
+
 static hr::Logger::ptr g_logger = HR_LOG_NAME("system");
 
 TcpServer::TcpServer(hr::IOManager* worker,
@@ -18,7 +32,9 @@ TcpServer::TcpServer(hr::IOManager* worker,
     ,m_acceptWorker(accept_worker)
     ,m_recvTimeout(g_tcp_server_read_timeout->getValue())
     ,m_name("hr/1.0.0")
-    ,m_isStop(true) {
+    ,m_isStop(true)
+    ,m_maxConnections(g_tcp_server_max_connections->getValue())
+    ,m_acceptBatch(std::max(g_tcp_server_accept_batch->getValue(), (uint32_t)1)) {
 }
 
 TcpServer::~TcpServer() {
@@ -28,8 +44,19 @@ TcpServer::~TcpServer() {
     m_socks.clear();
 }
 
+void TcpServer::setConf(TcpServerConf::ptr v) {
+    m_conf = v;
+    if(v) {
+        m_reusePort = v->reuseport;
+        m_incomingCpu = v->incoming_cpu;
+        if(v->max_connections > 0) {
+            m_maxConnections = v->max_connections;
+        }
+    }
+}
+
 void TcpServer::setConf(const TcpServerConf& v) {
-    m_conf.reset(new TcpServerConf(v));
+    setConf(std::make_shared<TcpServerConf>(v));
 }
 
 bool TcpServer::bind(hr::Address::ptr addr, bool ssl) {
@@ -43,23 +70,39 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs
                         ,std::vector<Address::ptr>& fails
                         ,bool ssl) {
     m_ssl = ssl;
+    //reuseport模式下每个io线程一个监听socket
+    size_t count = m_reusePort ? m_ioWorker->getThreadIds().size() : 1;
     for(auto& addr : addrs) {
-        Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
-        if(!sock->bind(addr)) {
-            HR_LOG_ERROR(g_logger) << "bind fail errno="
-                << errno << " errstr=" << strerror(errno)
-                << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
-        }
-        if(!sock->listen()) {
-            HR_LOG_ERROR(g_logger) << "listen fail errno="
-                << errno << " errstr=" << strerror(errno)
-                << " addr=[" << addr->toString() << "]";
-            fails.push_back(addr);
-            continue;
+        //端口为0时后面的socket绑定第一个socket分配到的端口
+        Address::ptr bind_addr = addr;
+        for(size_t n = 0; n < count; ++n) {
+            Socket::ptr sock = ssl ? SSLSocket::CreateTCP(addr) : Socket::CreateTCP(addr);
+            if(m_reusePort && !sock->setReusePort()) {
+                HR_LOG_ERROR(g_logger) << "set reuseport fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->bind(bind_addr)) {
+                HR_LOG_ERROR(g_logger) << "bind fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(!sock->listen()) {
+                HR_LOG_ERROR(g_logger) << "listen fail errno="
+                    << errno << " errstr=" << strerror(errno)
+                    << " addr=[" << addr->toString() << "]";
+                fails.push_back(addr);
+                break;
+            }
+            if(n == 0 && sock->getLocalAddress()) {
+                bind_addr = sock->getLocalAddress();
+            }
+            m_socks.push_back(sock);
         }
-        m_socks.push_back(sock);
     }
 
     //一个失败就返回false
@@ -72,30 +115,181 @@ bool TcpServer::bind(const std::vector<Address::ptr>& addrs
         HR_LOG_INFO(g_logger) << "type=" << m_type
             << " name=" << m_name
             << " ssl=" << m_ssl
+            << " reuseport=" << m_reusePort
             << " server bind success: " << *i;
     }
     return true;
 }
 
 void TcpServer::startAccept(Socket::ptr sock) {
+    auto self = shared_from_this();
+    std::vector<Socket::ptr> clients;
     while(!isStop()) {
-        Socket::ptr client = sock->accept();
-        if(client) {
-            client->setRecvTimeout(m_recvTimeout);
-            m_ioWorker->schedule(std::bind(&TcpServer::handleClient,
-                        shared_from_this(), client));
-        } else {
+        //一次唤醒把backlog里的连接都取出来
+        clients.clear();
+        if(sock->acceptBatch(clients, m_acceptBatch) == 0) {
+            //stop关闭监听socket唤醒的接收协程
+            if(isStop()) {
+                break;
+            }
             HR_LOG_ERROR(g_logger) << "accept errno=" << errno
                 << " errstr=" << strerror(errno);
+            //句柄用完时accept会立即失败,等已有连接释放句柄,避免空转
+            if(errno == EMFILE || errno == ENFILE) {
+                usleep(10 * 1000);
+            }
+            continue;
+        }
+        for(auto& client : clients) {
+            if(m_maxConnections && m_active >= (int64_t)m_maxConnections) {
+                ++m_rejected;
+                rejectClient(client);
+                continue;
+            }
+            ++m_accepted;
+            ++m_active;
+            ClientState::ptr state(new ClientState);
+            state->sock = client;
+            {
+                Mutex::Lock lock(m_clientsMutex);
+                m_clients[client.get()] = state;
+            }
+            //超时只在hook里使用,直接写FdCtx,省掉setsockopt
+            FdCtx::ptr ctx = FdMgr::GetInstance()->get(client->getSocket());
+            if(ctx) {
+                ctx->setTimeout(SO_RCVTIMEO, m_recvTimeout);
+            }
+            //reuseport模式下接收协程指定了线程,连接留在本线程处理
+            m_ioWorker->schedule([self, client]() {
+                self->handleClient(client);
+                {
+                    Mutex::Lock lock(self->m_clientsMutex);
+                    self->m_clients.erase(client.get());
+                }
+                --self->m_active;
+            }, Scheduler::GetTaskThread());
         }
     }
 }
 
+void TcpServer::rejectClient(Socket::ptr client) {
+    client->close();
+}
+
+TcpServer::ClientState::ptr TcpServer::getClientState(Socket::ptr client) {
+    Mutex::Lock lock(m_clientsMutex);
+    auto it = m_clients.find(client.get());
+    return it == m_clients.end() ? nullptr : it->second;
+}
+
+bool TcpServer::setClientIdle(ClientState::ptr state, bool idle) {
+    if(state) {
+        state->idle = idle;
+    }
+    //先标记空闲再检查m_draining,和drain的顺序相反,两边至少有一边能看到对方
+    return !idle || !m_draining;
+}
+
+bool TcpServer::drain(uint64_t timeout_ms) {
+    uint64_t deadline = GetCurrentMS() + timeout_ms;
+    stop();
+    m_draining = true;
+    size_t idle = 0;
+    {
+        //只关闭读端,读缓冲里已经到达的数据还能读出来,响应也还能写回去
+        Mutex::Lock lock(m_clientsMutex);
+        for(auto& i : m_clients) {
+            if(i.second->idle) {
+                i.second->sock->shutdown(SHUT_RD);
+                ++idle;
+            }
+        }
+    }
+    HR_LOG_INFO(g_logger) << "drain name=" << m_name << " active=" << m_active
+        << " idle=" << idle << " timeout=" << timeout_ms;
+
+    while(m_active > 0 && GetCurrentMS() < deadline) {
+        usleep(5 * 1000);
+    }
+    if(m_active == 0) {
+        return true;
+    }
+
+    size_t count = 0;
+    {
+        Mutex::Lock lock(m_clientsMutex);
+        for(auto& i : m_clients) {
+            i.second->sock->shutdown(SHUT_RDWR);
+            ++count;
+        }
+    }
+    HR_LOG_WARN(g_logger) << "drain name=" << m_name << " timeout, shutdown "
+        << count << " connections";
+    return false;
+}
+
+bool TcpServer::sendListeners(Socket::ptr sock) {
+    std::vector<int> fds;
+    for(auto& i : m_socks) {
+        fds.push_back(i->getSocket());
+    }
+    return sock->sendFds(fds);
+}
+
+bool TcpServer::recvListeners(Socket::ptr sock, bool ssl) {
+    std::vector<int> fds;
+    if(!sock->recvFds(fds) || fds.empty()) {
+        return false;
+    }
+    m_ssl = ssl;
+    bool ok = true;
+    for(int fd : fds) {
+        sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        Socket::ptr lsock;
+        if(getsockname(fd, (sockaddr*)&addr, &len) == 0) {
+            lsock = ssl ? Socket::ptr(new SSLSocket(addr.ss_family, Socket::TCP, 0))
+                : Socket::ptr(new Socket(addr.ss_family, Socket::TCP, 0));
+        }
+        if(!lsock || !lsock->attachListen(fd)) {
+            HR_LOG_ERROR(g_logger) << "recv listener fd=" << fd << " errno="
+                << errno << " errstr=" << strerror(errno);
+            ::close(fd);
+            ok = false;
+            continue;
+        }
+        m_socks.push_back(lsock);
+        HR_LOG_INFO(g_logger) << "type=" << m_type
+            << " name=" << m_name
+            << " ssl=" << m_ssl
+            << " server recv listener: " << *lsock;
+    }
+    return ok;
+}
+
 bool TcpServer::start() {
     if(!m_isStop) {
         return true;
     }
     m_isStop = false;
+    if(m_reusePort) {
+        //第i个socket由第i个io线程接收,和bind时的顺序对应
+        const std::vector<int>& threads = m_ioWorker->getThreadIds();
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        auto self = shared_from_this();
+        for(size_t i = 0; i < m_socks.size(); ++i) {
+            size_t idx = i % threads.size();
+            int cpu = (m_incomingCpu && ncpu > 0) ? (int)(idx % ncpu) : -1;
+            Socket::ptr sock = m_socks[i];
+            m_ioWorker->schedule([self, sock, cpu]() {
+                if(cpu >= 0) {
+                    BindIncomingCpu(sock, cpu);
+                }
+                self->startAccept(sock);
+            }, threads[idx]);
+        }
+        return true;
+    }
     for(auto& sock : m_socks) {
         m_acceptWorker->schedule(std::bind(&TcpServer::startAccept,
                     shared_from_this(), sock));
@@ -115,6 +309,23 @@ void TcpServer::stop() {
     });
 }
 
+void TcpServer::BindIncomingCpu(Socket::ptr sock, int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if(rt) {
+        HR_LOG_WARN(g_logger) << "pthread_setaffinity_np cpu=" << cpu
+            << " rt=" << rt << " errstr=" << strerror(rt);
+    }
+#ifdef SO_INCOMING_CPU
+    if(!sock->setOption(SOL_SOCKET, SO_INCOMING_CPU, cpu)) {
+        HR_LOG_WARN(g_logger) << "set SO_INCOMING_CPU cpu=" << cpu
+            << " fail errno=" << errno << " errstr=" << strerror(errno);
+    }
+#endif
+}
+
 void TcpServer::handleClient(Socket::ptr client) {
     HR_LOG_INFO(g_logger) << "handleClient: " << *client;
     // char buffer[1024];
@@ -140,6 +351,13 @@ std::string TcpServer::toString(const std::string& prefix) {
        << " name=" << m_name << " ssl=" << m_ssl
        << " worker=" << (m_worker ? m_worker->getName() : "")
        << " accept=" << (m_acceptWorker ? m_acceptWorker->getName() : "")
+       << " reuseport=" << m_reusePort
+       << " incoming_cpu=" << m_incomingCpu
+       << " max_connections=" << m_maxConnections
+       << " accepted=" << m_accepted
+       << " rejected=" << m_rejected
+       << " active=" << m_active
+       << " draining=" << m_draining
        << " recv_timeout=" << m_recvTimeout << "]" << std::endl;
     std::string pfx = prefix.empty() ? "    " : prefix;
     for(auto& i : m_socks) {
@@ -11,6 +11,8 @@
 
 #include <memory>
 #include <functional>
+#include <atomic>
+#include <unordered_map>
 #include "address.h"
 #include "iomanager.h"
 #include "socket.h"
@@ -37,6 +39,12 @@ struct TcpServerConf {
     std::string accept_worker;
     std::string io_worker;
     std::string process_worker;
+    /// 每个io_worker线程一个SO_REUSEPORT监听socket,线程内接收并处理连接
+    int reuseport = 0;
+    /// reuseport时把线程依次绑定到cpu上,并设置SO_INCOMING_CPU
+    int incoming_cpu = 0;
+    /// 最大连接数,超过后新连接直接关闭,0表示使用tcp_server.max_connections
+    int max_connections = 0;
     std::map<std::string, std::string> args;
 
     bool isValid() const {
@@ -54,6 +62,9 @@ struct TcpServerConf {
             && accept_worker == oth.accept_worker
             && io_worker == oth.io_worker
             && process_worker == oth.process_worker
+            && reuseport == oth.reuseport
+            && incoming_cpu == oth.incoming_cpu
+            && max_connections == oth.max_connections
             && args == oth.args
             && id == oth.id
             && type == oth.type;
@@ -78,6 +89,9 @@ public:
         conf.accept_worker = node["accept_worker"].as<std::string>();
         conf.io_worker = node["io_worker"].as<std::string>();
         conf.process_worker = node["process_worker"].as<std::string>();
+        conf.reuseport = node["reuseport"].as<int>(conf.reuseport);
+        conf.incoming_cpu = node["incoming_cpu"].as<int>(conf.incoming_cpu);
+        conf.max_connections = node["max_connections"].as<int>(conf.max_connections);
         conf.args = LexicalCast<std::string
             ,std::map<std::string, std::string> >()(node["args"].as<std::string>(""));
         if(node["address"].IsDefined()) {
@@ -106,6 +120,9 @@ public:
         node["accept_worker"] = conf.accept_worker;
         node["io_worker"] = conf.io_worker;
         node["process_worker"] = conf.process_worker;
+        node["reuseport"] = conf.reuseport;
+        node["incoming_cpu"] = conf.incoming_cpu;
+        node["max_connections"] = conf.max_connections;
         node["args"] = YAML::Load(LexicalCast<std::map<std::string, std::string>
             , std::string>()(conf.args));
         for(auto& i : conf.address) {
@@ -171,6 +188,34 @@ public:
      */
     virtual void stop();
 
+    /**
+     * @brief 优雅停止,需要在协程中调用
+     * @param[in] timeout_ms 等待已有连接结束的最长时间(毫秒)
+     * @return 超时前所有连接都已结束返回true
+     * @details 先关闭监听socket不再接收新连接,等待下一个请求的空闲连接关闭读端后结束,
+     *          正在处理的请求完成后关闭连接,超时后关闭剩下连接的读写两端
+     */
+    virtual bool drain(uint64_t timeout_ms);
+
+    /**
+     * @brief 是否正在优雅停止
+     */
+    bool isDraining() const { return m_draining;}
+
+    /**
+     * @brief 通过Unix socket把监听socket发给新进程(热重启)
+     * @param[in] sock 和新进程相连的Unix socket
+     * @details 之后新旧进程共用同一个监听队列,旧进程再调用drain,不会丢失连接
+     */
+    bool sendListeners(Socket::ptr sock);
+
+    /**
+     * @brief 从旧进程接收监听socket,代替bind
+     * @param[in] sock 和旧进程相连的Unix socket
+     * @param[in] ssl 是否是ssl监听socket
+     */
+    bool recvListeners(Socket::ptr sock, bool ssl = false);
+
     /**
      * @brief 返回读取超时时间(毫秒)
      */
@@ -197,13 +242,72 @@ public:
     bool isStop() const { return m_isStop;}
 
     TcpServerConf::ptr getConf() const { return m_conf;}
-    void setConf(TcpServerConf::ptr v) { m_conf = v;}
+    //设置配置,reuseport和incoming_cpu需要在bind之前设置
+    void setConf(TcpServerConf::ptr v);
     void setConf(const TcpServerConf& v);
 
+    bool isReusePort() const { return m_reusePort;}
+    //开启后bind为m_ioWorker的每个线程创建一个SO_REUSEPORT监听socket
+    void setReusePort(bool v) { m_reusePort = v;}
+
+    bool isIncomingCpu() const { return m_incomingCpu;}
+    void setIncomingCpu(bool v) { m_incomingCpu = v;}
+
+    /**
+     * @brief 返回最大连接数,0表示不限制
+     */
+    uint32_t getMaxConnections() const { return m_maxConnections;}
+
+    /**
+     * @brief 设置最大连接数,活跃连接达到上限后新连接交给rejectClient
+     */
+    void setMaxConnections(uint32_t v) { m_maxConnections = v;}
+
+    /**
+     * @brief 返回每次最多连续接收的连接数
+     */
+    uint32_t getAcceptBatch() const { return m_acceptBatch;}
+    void setAcceptBatch(uint32_t v) { m_acceptBatch = v ? v : 1;}
+
+    /**
+     * @brief 返回接收并交给handleClient的连接总数
+     */
+    uint64_t getAcceptedCount() const { return m_accepted;}
+
+    /**
+     * @brief 返回超过最大连接数被拒绝的连接总数
+     */
+    uint64_t getRejectedCount() const { return m_rejected;}
+
+    /**
+     * @brief 返回handleClient还没有返回的连接数
+     */
+    int64_t getActiveCount() const { return m_active;}
+
     virtual std::string toString(const std::string& prefix = "");
 
     std::vector<Socket::ptr> getSocks() const { return m_socks;}
 protected:
+    /**
+     * @brief 连接状态,drain时据此关闭空闲连接
+     */
+    struct ClientState {
+        typedef std::shared_ptr<ClientState> ptr;
+        Socket::ptr sock;
+        /// 是否在等待下一个请求
+        std::atomic<bool> idle = {false};
+    };
+
+    /**
+     * @brief 返回连接的状态,连接不是startAccept接收的返回nullptr
+     */
+    ClientState::ptr getClientState(Socket::ptr client);
+
+    /**
+     * @brief 标记连接空闲(等待下一个请求)或者忙
+     * @return 标记空闲时正在drain返回false,调用方应结束连接
+     */
+    bool setClientIdle(ClientState::ptr state, bool idle);
 
     /**
      * @brief 处理新连接的Socket类
@@ -214,6 +318,14 @@ protected:
      * @brief 开始接受连接
      */
     virtual void startAccept(Socket::ptr sock);
+
+    /**
+     * @brief 拒绝超过最大连接数的新连接,默认直接关闭
+     */
+    virtual void rejectClient(Socket::ptr client);
+
+    //把当前线程绑定到cpu上,并设置监听socket的SO_INCOMING_CPU
+    static void BindIncomingCpu(Socket::ptr sock, int cpu);
 protected:
     /// 监听Socket数组
     std::vector<Socket::ptr> m_socks;
@@ -232,6 +344,25 @@ protected:
     bool m_isStop;
 
     bool m_ssl = false;
+    /// 每个io线程一个SO_REUSEPORT监听socket
+    bool m_reusePort = false;
+    /// reuseport时设置线程cpu亲和性和SO_INCOMING_CPU
+    bool m_incomingCpu = false;
+    /// 最大连接数,0不限制
+    uint32_t m_maxConnections;
+    /// 每次最多连续接收的连接数
+    uint32_t m_acceptBatch;
+    /// 接收的连接数
+    std::atomic<uint64_t> m_accepted = {0};
+    /// 拒绝的连接数
+    std::atomic<uint64_t> m_rejected = {0};
+    /// 活跃连接数
+    std::atomic<int64_t> m_active = {0};
+    /// 是否正在优雅停止
+    std::atomic<bool> m_draining = {false};
+    /// 活跃连接
+    Mutex m_clientsMutex;
+    std::unordered_map<Socket*, ClientState::ptr> m_clients;
 
     TcpServerConf::ptr m_conf;
 };
@@ -1,30 +1,11 @@
 #include "timer.h"
 #include "util.h"
+#include <algorithm>
 
 namespace hr {
 
-bool Timer::Comparator::operator()(const Timer::ptr& lhs
-                            ,const Timer::ptr& rhs) const {
-    if(!lhs && !rhs) {
-        return false;
-    }
-
-    if(!lhs) {
-        return true;
-    }
-
-    if(!rhs) {
-        return false;
-    }
-
-    if(lhs->m_next < rhs->m_next) {
-        return true;
-    }
-    if(rhs->m_next < lhs->m_next) {
-        return false;
-    }
-    return lhs.get() < rhs.get();
-}
+//时钟被往回调超过1小时，认为发生了回绕，所有定时器立即超时
+static const uint64_t s_rollover_ms = 60 * 60 * 1000;
 
 Timer::Timer(uint64_t ms, std::function<void()> cb,
              bool recurring, TimerManager* manager)
@@ -35,34 +16,33 @@ Timer::Timer(uint64_t ms, std::function<void()> cb,
     m_next = hr::GetCurrentMS() + m_ms;
 }
 
-Timer::Timer(uint64_t next)
-    :m_next(next) {
-}
-
 bool Timer::cancel() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
+    TimerManager::TimerWheel* wheel = m_manager->m_shards[m_shard];
+    //在锁外释放自身引用
+    Timer::ptr self;
+    TimerManager::TimerWheel::MutexType::Lock lock(wheel->mutex);
     if(m_cb) {
         m_cb = nullptr;
-        auto it = m_manager->m_timers.find(shared_from_this());
-        m_manager->m_timers.erase(it);
+        if(m_slot >= 0) {
+            wheel->remove(this);
+            --m_manager->m_count;
+            self.swap(m_self);
+        }
         return true;
     }
     return false;
 }
 
 bool Timer::refresh() {
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_cb) {
-        return false;
-    }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
+    TimerManager::TimerWheel* wheel = m_manager->m_shards[m_shard];
+    TimerManager::TimerWheel::MutexType::Lock lock(wheel->mutex);
+    if(!m_cb || m_slot < 0) {
         return false;
     }
-    m_manager->m_timers.erase(it);
+    wheel->remove(this);
     m_next = hr::GetCurrentMS() + m_ms;
     //重新插入
-    m_manager->m_timers.insert(shared_from_this());
+    wheel->add(this);
     return true;
 }
 
@@ -71,39 +51,228 @@ bool Timer::reset(uint64_t ms, bool from_now) {
         return true;
     }
 
-    TimerManager::RWMutexType::WriteLock lock(m_manager->m_mutex);
-    if(!m_cb) {
-        return false;
+    TimerManager::TimerWheel* wheel = m_manager->m_shards[m_shard];
+    bool at_front = false;
+    {
+        TimerManager::TimerWheel::MutexType::Lock lock(wheel->mutex);
+        if(!m_cb || m_slot < 0) {
+            return false;
+        }
+        wheel->remove(this);
+        uint64_t start = 0;
+        if(from_now) {
+            start = hr::GetCurrentMS();
+        } else {
+            start = m_next - m_ms;
+        }
+        m_ms = ms;
+        m_next = start + m_ms;
+        at_front = m_next < wheel->next;
+        wheel->add(this);
     }
-    auto it = m_manager->m_timers.find(shared_from_this());
-    if(it == m_manager->m_timers.end()) {
-        return false;
+    if(at_front) {
+        m_manager->tickleShard(wheel);
+    }
+    return true;
+}
+
+void TimerManager::TimerWheel::add(Timer* timer) {
+    uint64_t expires = timer->m_next;
+    //已经超时的放入当前槽位
+    if(expires < current) {
+        expires = current;
     }
-    m_manager->m_timers.erase(it);
-    uint64_t start = 0;
-    if(from_now) {
-        start = hr::GetCurrentMS();
+    uint64_t idx = expires - current;
+    int slot = 0;
+    if(idx < ROOT_SIZE) {
+        slot = expires & (ROOT_SIZE - 1);
+        bitmap[slot >> 6] |= 1ull << (slot & 63);
     } else {
-        start = m_next - m_ms;
+        //超出时间轮范围的放入最高层的最远槽位，迁移下来时再重新计算
+        if(idx > 0xffffffffull) {
+            expires = current + 0xffffffffull;
+            idx = 0xffffffffull;
+        }
+        int level = 0;
+        while(level < LEVELS - 1
+                && idx >= (1ull << (ROOT_BITS + (level + 1) * LEVEL_BITS))) {
+            ++level;
+        }
+        slot = ROOT_SIZE + level * LEVEL_SIZE
+            + ((expires >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1));
     }
-    m_ms = ms;
-    m_next = start + m_ms;
-    m_manager->addTimer(shared_from_this(), lock);
-    return true;
+
+    timer->m_slot = slot;
+    timer->m_prev = nullptr;
+    timer->m_after = slots[slot];
+    if(slots[slot]) {
+        slots[slot]->m_prev = timer;
+    }
+    slots[slot] = timer;
+    ++count;
+    if(timer->m_next < next) {
+        next = timer->m_next;
+    }
+}
+
+void TimerManager::TimerWheel::remove(Timer* timer) {
+    int slot = timer->m_slot;
+    if(timer->m_prev) {
+        timer->m_prev->m_after = timer->m_after;
+    } else {
+        slots[slot] = timer->m_after;
+    }
+    if(timer->m_after) {
+        timer->m_after->m_prev = timer->m_prev;
+    }
+    if(slot < ROOT_SIZE && !slots[slot]) {
+        bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+    }
+    timer->m_slot = -1;
+    timer->m_prev = nullptr;
+    timer->m_after = nullptr;
+    --count;
+}
+
+Timer* TimerManager::TimerWheel::takeSlot(int slot) {
+    Timer* head = slots[slot];
+    slots[slot] = nullptr;
+    if(slot < ROOT_SIZE) {
+        bitmap[slot >> 6] &= ~(1ull << (slot & 63));
+    }
+    return head;
+}
+
+void TimerManager::TimerWheel::cascade(int level, int index) {
+    Timer* timer = takeSlot(ROOT_SIZE + level * LEVEL_SIZE + index);
+    while(timer) {
+        Timer* after = timer->m_after;
+        --count;
+        add(timer);
+        timer = after;
+    }
+}
+
+void TimerManager::TimerWheel::advance(uint64_t now, std::vector<Timer::ptr>& expired) {
+    if(now + s_rollover_ms < current) {
+        //时钟回绕，全部超时
+        for(int i = 0; i < ROOT_SIZE + LEVELS * LEVEL_SIZE; ++i) {
+            Timer* timer = takeSlot(i);
+            while(timer) {
+                Timer* after = timer->m_after;
+                timer->m_slot = -1;
+                timer->m_prev = timer->m_after = nullptr;
+                expired.push_back(std::move(timer->m_self));
+                timer = after;
+            }
+        }
+        count = 0;
+        current = now;
+        next = ~0ull;
+        return;
+    }
+
+    while(current <= now && count) {
+        int index = current & (ROOT_SIZE - 1);
+        //第0层转完一圈，从上层迁移下来
+        if(index == 0) {
+            for(int level = 0; level < LEVELS; ++level) {
+                int idx = (current >> (ROOT_BITS + level * LEVEL_BITS)) & (LEVEL_SIZE - 1);
+                cascade(level, idx);
+                if(idx) {
+                    break;
+                }
+            }
+        }
+
+        Timer* timer = takeSlot(index);
+        while(timer) {
+            Timer* after = timer->m_after;
+            timer->m_slot = -1;
+            timer->m_prev = timer->m_after = nullptr;
+            --count;
+            if(timer->m_next > current) {
+                //超出范围被截断的定时器，重新放入
+                add(timer);
+            } else {
+                expired.push_back(std::move(timer->m_self));
+            }
+            timer = after;
+        }
+        ++current;
+
+        //第0层为空时直接跳到下一圈
+        if((current & (ROOT_SIZE - 1))
+                && !(bitmap[0] | bitmap[1] | bitmap[2] | bitmap[3])) {
+            uint64_t round = (current | (ROOT_SIZE - 1)) + 1;
+            current = std::min(round, now + 1);
+        }
+    }
+    if(current <= now) {
+        current = now + 1;
+    }
+    next = nextExpire();
 }
 
-TimerManager::TimerManager() {
-    m_previousTime = hr::GetCurrentMS();
+uint64_t TimerManager::TimerWheel::nextExpire() const {
+    if(count == 0) {
+        return ~0ull;
+    }
+    uint64_t cur = current;
+    //有定时器在上层时，下界为下一圈开始的时间。
+    //current正好在一圈的开始时，这一圈还没从上层迁移下来，下界就是current
+    uint64_t rv = (cur & (ROOT_SIZE - 1)) ? (cur | (ROOT_SIZE - 1)) + 1 : cur;
+    int start = cur & (ROOT_SIZE - 1);
+    for(int i = 0; i <= ROOT_SIZE / 64; ++i) {
+        int word = ((start >> 6) + i) & (ROOT_SIZE / 64 - 1);
+        uint64_t bits = bitmap[word];
+        if(i == 0) {
+            bits &= ~0ull << (start & 63);
+        } else if(i == ROOT_SIZE / 64) {
+            bits &= (1ull << (start & 63)) - 1;
+        }
+        if(bits) {
+            int pos = word * 64 + __builtin_ctzll(bits);
+            uint64_t expires = cur + ((pos - start) & (ROOT_SIZE - 1));
+            return std::min(rv, expires);
+        }
+    }
+    return rv;
+}
+
+TimerManager::TimerManager(size_t threads) {
+    uint64_t now = hr::GetCurrentMS();
+    m_shards.resize(threads + 1);
+    for(auto& i : m_shards) {
+        i = new TimerWheel;
+        i->current = now;
+    }
 }
 
 TimerManager::~TimerManager() {
+    //释放时间轮持有的定时器
+    for(auto& i : m_shards) {
+        for(int j = 0; j < TimerWheel::ROOT_SIZE + TimerWheel::LEVELS * TimerWheel::LEVEL_SIZE; ++j) {
+            Timer* timer = i->takeSlot(j);
+            while(timer) {
+                Timer* after = timer->m_after;
+                timer->m_slot = -1;
+                timer->m_prev = timer->m_after = nullptr;
+                timer->m_self.reset();
+                timer = after;
+            }
+        }
+        delete i;
+    }
 }
 
 Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb
                                   ,bool recurring) {
     Timer::ptr timer(new Timer(ms, cb, recurring, this));
-    RWMutexType::WriteLock lock(m_mutex);
-    addTimer(timer, lock);
+    //调度线程放入自己的分片，其他线程放入公共分片
+    int shard = ownShard();
+    timer->m_shard = shard >= 0 ? shard : m_shards.size() - 1;
+    addTimer(timer);
     return timer;
 }
 
@@ -121,95 +290,118 @@ Timer::ptr TimerManager::addConditionTimer(uint64_t ms, std::function<void()> cb
     return addTimer(ms, std::bind(&OnTimer, weak_cond, cb), recurring);
 }
 
+int TimerManager::ownShard() {
+    int idx = getThreadIndex();
+    if(idx < 0 || (size_t)idx + 1 >= m_shards.size()) {
+        return -1;
+    }
+    TimerWheel* wheel = m_shards[idx];
+    int tid = hr::GetThreadId();
+    if(wheel->owner != tid) {
+        wheel->owner = tid;
+    }
+    return idx;
+}
+
+void TimerManager::releaseShard() {
+    int idx = getThreadIndex();
+    if(idx >= 0 && (size_t)idx + 1 < m_shards.size()) {
+        m_shards[idx]->owner = 0;
+    }
+}
+
 uint64_t TimerManager::getNextTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    m_tickled  = false;
-    if(m_timers.empty()) {
+    int own = ownShard();
+    uint64_t next = ~0ull;
+    for(size_t i = 0; i < m_shards.size(); ++i) {
+        TimerWheel* wheel = m_shards[i];
+        //其他线程的分片由它自己处理
+        if((int)i != own && wheel->owner) {
+            continue;
+        }
+        //先清除通知标记再读取，之后插入到首部的定时器会再通知
+        wheel->tickled = false;
+        next = std::min(next, wheel->next.load());
+    }
+    //定时器都取消了时next还是旧的下界
+    if(next == ~0ull || m_count == 0) {
         return ~0ull;
     }
 
-    const Timer::ptr& next = *m_timers.begin();
     uint64_t now_ms = hr::GetCurrentMS();
-    if(now_ms >= next->m_next) {
+    if(now_ms >= next) {
         return 0;
     } else {
-        return next->m_next - now_ms;
+        return next - now_ms;
     }
 }
 
 void TimerManager::listExpiredCb(std::vector<std::function<void()>>& cbs) {
+    if(m_count == 0) {
+        return;
+    }
+    int own = ownShard();
     uint64_t now_ms = hr::GetCurrentMS();
     std::vector<Timer::ptr> expired;
-    {
-        RWMutexType::ReadLock lock(m_mutex);
-        if(m_timers.empty()) {
-            return;
+    for(size_t idx = 0; idx < m_shards.size(); ++idx) {
+        TimerWheel* i = m_shards[idx];
+        if((int)idx != own && i->owner) {
+            continue;
         }
-    }
-    RWMutexType::WriteLock lock(m_mutex);
-    if(m_timers.empty()) {
-        return;
-    }
-    bool rollover = detectClockRollover(now_ms);
-    //还没开始
-    if(!rollover && ((*m_timers.begin())->m_next > now_ms)) {
-        return;
-    }
-    Timer::ptr now_timer(new Timer(now_ms));
-    auto it = rollover ? m_timers.end() : m_timers.lower_bound(now_timer);
-    while(it != m_timers.end() && (*it)->m_next == now_ms) {
-        ++it;
-    }
-    expired.insert(expired.begin(), m_timers.begin(), it);
-    m_timers.erase(m_timers.begin(), it);
-    cbs.reserve(expired.size());
+        //还没开始,不加锁
+        if(i->next > now_ms && now_ms + s_rollover_ms >= i->current) {
+            continue;
+        }
+        TimerWheel::MutexType::Lock lock(i->mutex);
+        size_t start = expired.size();
+        size_t count = i->count;
+        i->advance(now_ms, expired);
+        m_count -= count - i->count;
 
-    for(auto& timer : expired) {
-        cbs.push_back(timer->m_cb);
-        if(timer->m_recurring) {
-            timer->m_next = now_ms + timer->m_ms;
-            m_timers.insert(timer);
-        } else {
-            timer->m_cb = nullptr;
+        for(size_t j = start; j < expired.size(); ++j) {
+            Timer::ptr& timer = expired[j];
+            cbs.push_back(timer->m_cb);
+            if(timer->m_recurring) {
+                timer->m_next = now_ms + timer->m_ms;
+                timer->m_self = timer;
+                i->add(timer.get());
+                ++m_count;
+            } else {
+                timer->m_cb = nullptr;
+            }
         }
     }
 }
 
-//函数参数传入一个范围锁，整个函数执行期间都是加锁的
-void TimerManager::addTimer(Timer::ptr val, RWMutexType::WriteLock& lock) {
-    /*
-    set的单元素插入返回一个二元组（Pair）。
-    成员 pair::first 被设置为指向新插入元素的迭代器或指向等值的已经存在的元素的迭代器。
-    成员 pair::second 是一个 bool 值，如果新的元素被插入，返回 true，
-    如果等值元素已经存在（即无新元素插入），则返回 false。
-    */
-    auto it = m_timers.insert(val).first;
-    bool at_front = (it == m_timers.begin()) && !m_tickled;
-    if(at_front) {
-        m_tickled = true;
+//加入分片后检查是否需要通知
+void TimerManager::addTimer(Timer::ptr val) {
+    TimerWheel* wheel = m_shards[val->m_shard];
+    bool at_front = false;
+    {
+        TimerWheel::MutexType::Lock lock(wheel->mutex);
+        val->m_self = val;
+        at_front = val->m_next < wheel->next;
+        wheel->add(val.get());
+        ++m_count;
     }
-    lock.unlock();
     if(at_front) {
-        onTimerInsertedAtFront();
+        tickleShard(wheel);
     }
 }
 
-//检测服务器时间是否滞后
-bool TimerManager::detectClockRollover(uint64_t now_ms) {
-    bool rollover = false;
-    if(now_ms < m_previousTime &&
-            now_ms < (m_previousTime - 60 * 60 * 1000)) {
-        rollover = true;
+void TimerManager::tickleShard(TimerWheel* wheel) {
+    int owner = wheel->owner;
+    //拥有者自己插入的，回到idle时会重新计算超时时间
+    if(owner == hr::GetThreadId()) {
+        return;
+    }
+    if(!wheel->tickled.exchange(true)) {
+        onTimerInsertedAtFront(owner ? owner : -1);
     }
-    m_previousTime = now_ms;
-    return rollover;
 }
 
 bool TimerManager::hasTimer() {
-    RWMutexType::ReadLock lock(m_mutex);
-    return !m_timers.empty();
+    return m_count != 0;
 }
 
-
-
-}
\ No newline at end of file
+}
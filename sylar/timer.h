@@ -5,7 +5,7 @@
 
 #include <memory>
 #include <vector>
-#include <set>
+#include <atomic>
 #include "thread.h"
 
 namespace hr {
@@ -39,10 +39,6 @@ private:
     Timer(uint64_t ms, std::function<void()> cb,
           bool recurring, TimerManager* manager);
 
-    //构造函数
-    // next 执行的时间戳(毫秒)
-    Timer(uint64_t next);
-
 private:
     //是否循环定时器
     bool m_recurring = false;
@@ -55,14 +51,15 @@ private:
     //定时器管理器
     TimerManager* m_manager = nullptr;
 
-private:
-    //定时器比较仿函数
-    struct Comparator {
-        //比较定时器的智能指针的大小(按执行时间排序)
-        //lhs 定时器智能指针
-        //rhs 定时器智能指针
-        bool operator()(const Timer::ptr& lhs, const Timer::ptr& rhs) const;
-    };
+    //所在分片
+    uint32_t m_shard = 0;
+    //所在时间轮槽位，-1表示不在时间轮中
+    int m_slot = -1;
+    //槽位双向链表
+    Timer* m_prev = nullptr;
+    Timer* m_after = nullptr;
+    //在时间轮中时持有自身引用
+    Timer::ptr m_self;
 };
 
 
@@ -74,7 +71,8 @@ public:
     typedef RWMutex RWMutexType;
 
     //构造函数
-    TimerManager();
+    // threads 调度线程数量，每个线程一个分片，另外一个公共分片放其他线程添加的定时器
+    TimerManager(size_t threads = 0);
 
     //析构函数
     virtual ~TimerManager();
@@ -96,9 +94,12 @@ public:
                         ,bool recurring = false);
 
     //到最近一个定时器执行的时间间隔(毫秒)
+    //只看当前线程的分片和没有线程在处理的分片(公共分片、拥有者没启动或者已退出)
+    //拥有者在执行任务时，它的定时器等它回到idle再处理
     uint64_t getNextTimer();
 
     //获取需要执行的定时器的回调函数列表
+    //范围和getNextTimer相同，其他线程的分片由它自己处理
     // cbs 回调函数组
     void listExpiredCb(std::vector<std::function<void()>>& cbs);
 
@@ -106,25 +107,72 @@ public:
     bool hasTimer();
 
 protected:
-    //当有新的定时器插入到定时器的首部，执行该函数
-    virtual void onTimerInsertedAtFront() = 0;
+    //当有新的定时器插入到分片的首部，执行该函数
+    // thread 处理该分片的线程id，-1表示没有线程在处理，通知任意空闲线程
+    virtual void onTimerInsertedAtFront(int thread) = 0;
 
-    //将定时器添加到管理器中
-    void addTimer(Timer::ptr val, RWMutexType::WriteLock& lock);
+    //返回当前线程在调度器中的下标，不是调度线程返回-1
+    virtual int getThreadIndex() { return -1;}
+
+    //当前线程不再处理自己的分片，之后由其他线程处理
+    void releaseShard();
 
 private:
-    //检测服务器时间是否被调后了
-    bool detectClockRollover(uint64_t now_ms);
+    //层级时间轮，精度1毫秒
+    //第0层256个槽，第1-4层各64个槽，覆盖2^32毫秒
+    //插入、删除O(1)，超时时逐层向下迁移
+    struct TimerWheel {
+        typedef Mutex MutexType;
+
+        static const int ROOT_BITS = 8;
+        static const int LEVEL_BITS = 6;
+        static const int ROOT_SIZE = 1 << ROOT_BITS;
+        static const int LEVEL_SIZE = 1 << LEVEL_BITS;
+        static const int LEVELS = 4;
+
+        //加入时间轮
+        void add(Timer* timer);
+        //从时间轮中删除
+        void remove(Timer* timer);
+        //推进到now，将到期定时器放入expired
+        void advance(uint64_t now, std::vector<Timer::ptr>& expired);
+        //计算最早超时时间的下界
+        uint64_t nextExpire() const;
+
+        //将槽位链表取出
+        Timer* takeSlot(int slot);
+        //将高层槽位的定时器重新放入时间轮
+        void cascade(int level, int index);
+
+        MutexType mutex;
+        //当前时间轮处理到的时间，加锁修改，其他线程不加锁读取
+        std::atomic<uint64_t> current = {0};
+        //最早超时时间下界，加锁修改，其他线程不加锁读取
+        std::atomic<uint64_t> next = {~0ull};
+        //处理该分片的线程id，0表示没有线程在处理
+        std::atomic<int> owner = {0};
+        //插入到首部时是否已经通知过
+        std::atomic<bool> tickled = {false};
+        //定时器数量
+        size_t count = 0;
+        //第0层非空槽位位图
+        uint64_t bitmap[ROOT_SIZE / 64] = {0};
+        //槽位链表头
+        Timer* slots[ROOT_SIZE + LEVELS * LEVEL_SIZE] = {nullptr};
+    };
+
+    //将定时器添加到管理器中
+    void addTimer(Timer::ptr val);
+    //插入到分片最前面时通知处理它的线程
+    void tickleShard(TimerWheel* wheel);
+    //返回当前线程的分片下标并登记为拥有者，不是调度线程返回-1
+    int ownShard();
 
 private:
-    //Mutex
-    RWMutexType m_mutex;
-    //定时器集合
-    std::set<Timer::ptr, Timer::Comparator> m_timers;
-    //是否触发onTimerInsertedAtFront
-    bool m_tickled = false;
-    //上次执行时间
-    uint64_t m_previousTime = 0;
+    //时间轮分片，最后一个是公共分片
+    std::vector<TimerWheel*> m_shards;
+    //定时器总数
+    std::atomic<size_t> m_count = {0};
 };
 
 }
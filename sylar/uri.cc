@@ -0,0 +1,193 @@
+#include "uri.h"
+#include <sstream>
+#include <string.h>
+
+namespace hr {
+
+static bool is_scheme_char(char c, bool first) {
+    if(isalpha((unsigned char)c)) {
+        return true;
+    }
+    return !first && (isdigit((unsigned char)c) || c == '+' || c == '-' || c == '.');
+}
+
+//不允许出现空白和控制字符
+static bool is_valid(const std::string& str, size_t begin, size_t end) {
+    for(size_t i = begin; i < end; ++i) {
+        unsigned char c = str[i];
+        if(c <= 0x20 || c == 0x7f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Uri::ptr Uri::Create(const std::string& uristr) {
+    if(uristr.empty() || !is_valid(uristr, 0, uristr.size())) {
+        return nullptr;
+    }
+    Uri::ptr uri(new Uri);
+    size_t pos = 0;
+
+    //scheme://authority
+    size_t colon = uristr.find("://");
+    if(colon != std::string::npos) {
+        for(size_t i = 0; i < colon; ++i) {
+            if(!is_scheme_char(uristr[i], i == 0)) {
+                return nullptr;
+            }
+        }
+        if(colon == 0) {
+            return nullptr;
+        }
+        uri->m_scheme = uristr.substr(0, colon);
+        for(auto& c : uri->m_scheme) {
+            c = tolower(c);
+        }
+        pos = colon + 3;
+
+        size_t end = uristr.find_first_of("/?#", pos);
+        if(end == std::string::npos) {
+            end = uristr.size();
+        }
+        size_t at = uristr.rfind('@', end);
+        if(at != std::string::npos && at >= pos) {
+            uri->m_userinfo = uristr.substr(pos, at - pos);
+            pos = at + 1;
+        }
+
+        size_t host_end = pos;
+        if(pos < end && uristr[pos] == '[') {
+            //IPv6: [::1]:8080
+            host_end = uristr.find(']', pos);
+            if(host_end == std::string::npos || host_end > end) {
+                return nullptr;
+            }
+            uri->m_host = uristr.substr(pos + 1, host_end - pos - 1);
+            ++host_end;
+        } else {
+            host_end = uristr.find(':', pos);
+            if(host_end == std::string::npos || host_end > end) {
+                host_end = end;
+            }
+            uri->m_host = uristr.substr(pos, host_end - pos);
+        }
+        if(uri->m_host.empty()) {
+            return nullptr;
+        }
+
+        if(host_end < end) {
+            if(uristr[host_end] != ':') {
+                return nullptr;
+            }
+            int32_t port = 0;
+            for(size_t i = host_end + 1; i < end; ++i) {
+                if(!isdigit((unsigned char)uristr[i])) {
+                    return nullptr;
+                }
+                port = port * 10 + (uristr[i] - '0');
+                if(port > 65535) {
+                    return nullptr;
+                }
+            }
+            if(host_end + 1 < end) {
+                uri->m_port = port;
+            }
+        }
+        pos = end;
+    }
+
+    //path?query#fragment
+    size_t hash = uristr.find('#', pos);
+    if(hash != std::string::npos) {
+        uri->m_fragment = uristr.substr(hash + 1);
+    } else {
+        hash = uristr.size();
+    }
+    size_t question = uristr.find('?', pos);
+    if(question != std::string::npos && question < hash) {
+        uri->m_query = uristr.substr(question + 1, hash - question - 1);
+    } else {
+        question = hash;
+    }
+    uri->m_path = uristr.substr(pos, question - pos);
+    return uri;
+}
+
+Uri::Uri()
+    :m_port(0) {
+}
+
+bool Uri::isDefaultPort() const {
+    if(m_port == 0) {
+        return true;
+    }
+    if(m_scheme == "http"
+            || m_scheme == "ws") {
+        return m_port == 80;
+    } else if(m_scheme == "https"
+            || m_scheme == "wss") {
+        return m_port == 443;
+    }
+    return false;
+}
+
+const std::string& Uri::getPath() const {
+    static std::string s_default_path = "/";
+    return m_path.empty() ? s_default_path : m_path;
+}
+
+int32_t Uri::getPort() const {
+    if(m_port) {
+        return m_port;
+    }
+    if(m_scheme == "http"
+            || m_scheme == "ws") {
+        return 80;
+    } else if(m_scheme == "https"
+            || m_scheme == "wss") {
+        return 443;
+    }
+    return m_port;
+}
+
+std::ostream& Uri::dump(std::ostream& os) const {
+    if(!m_scheme.empty()) {
+        os << m_scheme << "://";
+    }
+    if(!m_userinfo.empty()) {
+        os << m_userinfo << "@";
+    }
+    if(m_host.find(':') != std::string::npos) {
+        os << "[" << m_host << "]";
+    } else {
+        os << m_host;
+    }
+    if(!isDefaultPort()) {
+        os << ":" << m_port;
+    }
+    os << getPath();
+    if(!m_query.empty()) {
+        os << "?" << m_query;
+    }
+    if(!m_fragment.empty()) {
+        os << "#" << m_fragment;
+    }
+    return os;
+}
+
+std::string Uri::toString() const {
+    std::stringstream ss;
+    dump(ss);
+    return ss.str();
+}
+
+Address::ptr Uri::createAddress() const {
+    auto addr = Address::LookupAnyIPAddress(m_host);
+    if(addr) {
+        addr->setPort(getPort());
+    }
+    return addr;
+}
+
+}
@@ -458,34 +458,30 @@ std::string StringUtil::UrlEncode(const std::string& str, bool space_as_plus) {
 }
 
 std::string StringUtil::UrlDecode(const std::string& str, bool space_as_plus) {
-    std::string* ss = nullptr;
-    const char* end = str.c_str() + str.length();
-    for(const char* c = str.c_str(); c < end; ++c) {
+    if(str.find('%') == std::string::npos
+            && (!space_as_plus || str.find('+') == std::string::npos)) {
+        return str;
+    }
+    std::string rt;
+    UrlDecode(str.c_str(), str.size(), rt, space_as_plus);
+    return rt;
+}
+
+void StringUtil::UrlDecode(const char* str, size_t len, std::string& out, bool space_as_plus) {
+    const char* end = str + len;
+    out.reserve(out.size() + len);
+    for(const char* c = str; c < end; ++c) {
         if(*c == '+' && space_as_plus) {
-            if(!ss) {
-                ss = new std::string;
-                ss->append(str.c_str(), c - str.c_str());
-            }
-            ss->append(1, ' ');
+            out.append(1, ' ');
         } else if(*c == '%' && (c + 2) < end
                     && isxdigit(*(c + 1)) && isxdigit(*(c + 2))){
-            if(!ss) {
-                ss = new std::string;
-                ss->append(str.c_str(), c - str.c_str());
-            }
-            ss->append(1, (char)(xdigit_chars[(int)*(c + 1)] << 4 | xdigit_chars[(int)*(c + 2)]));
+            out.append(1, (char)(xdigit_chars[(uint8_t)*(c + 1)] << 4
+                                | xdigit_chars[(uint8_t)*(c + 2)]));
             c += 2;
-        } else if(ss) {
-            ss->append(1, *c);
+        } else {
+            out.append(1, *c);
         }
     }
-    if(!ss) {
-        return str;
-    } else {
-        std::string rt = *ss;
-        delete ss;
-        return rt;
-    }
 }
 
 std::string StringUtil::Trim(const std::string& str, const std::string& delimit) {
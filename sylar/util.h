@@ -282,6 +282,8 @@ public:
 
     static std::string UrlEncode(const std::string& str, bool space_as_plus = true);
     static std::string UrlDecode(const std::string& str, bool space_as_plus = true);
+    //解码str的前len个字节,追加到out
+    static void UrlDecode(const char* str, size_t len, std::string& out, bool space_as_plus = true);
 
     static std::string Trim(const std::string& str, const std::string& delimit = " \t\r\n");
     static std::string TrimLeft(const std::string& str, const std::string& delimit = " \t\r\n");
@@ -0,0 +1,141 @@
+#include "sylar/sylar.h"
+#include "sylar/tcp_server.h"
+#include "sylar/macro.h"
+#include <algorithm>
+#include <sys/resource.h>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static int s_rounds = 20000;
+//请求稀疏的阶段每轮要等2ms,轮数少一些
+static int s_sparse_rounds = 300;
+static uint64_t cpu_us() {
+    rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec * 1000000ull + ru.ru_utime.tv_usec
+        + ru.ru_stime.tv_sec * 1000000ull + ru.ru_stime.tv_usec;
+}
+
+//收到什么回写什么
+class EchoServer : public hr::TcpServer {
+public:
+    typedef std::shared_ptr<EchoServer> ptr;
+    EchoServer(hr::IOManager* worker)
+        :hr::TcpServer(worker, worker, worker) {
+    }
+protected:
+    void handleClient(hr::Socket::ptr client) override {
+        char buf[64];
+        while(true) {
+            int rt = client->recv(buf, sizeof(buf));
+            if(rt <= 0) {
+                break;
+            }
+            if(client->send(buf, rt) != rt) {
+                break;
+            }
+        }
+        client->close();
+    }
+};
+
+//服务端和客户端在不同的IOManager,每次请求两边的线程都要从空闲中醒来
+//gap_us 两次请求之间的间隔,大于自旋上限时自旋应该自己停下来
+static void ping_pong(const std::string& name, uint32_t busy_poll_us, int gap_us, int rounds, int port) {
+    hr::Config::Lookup<uint32_t>("iomanager.busy_poll_us")->setValue(busy_poll_us);
+    hr::IOManager server_iom(1, false, "server");
+    hr::IOManager client_iom(1, false, "client");
+    auto addr = hr::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+    EchoServer::ptr server(new EchoServer(&server_iom));
+    hr::Semaphore sem;
+    //监听socket要在hook开启的线程里创建
+    server_iom.schedule([&]() {
+        while(!server->bind(addr)) {
+            sleep(2);
+        }
+        server->start();
+        sem.notify();
+    });
+    sem.wait();
+
+    std::vector<uint64_t> lat;
+    int errors = 0;
+    uint64_t cpu = 0;
+    uint64_t used = 0;
+    client_iom.schedule([&]() {
+        hr::Socket::ptr sock = hr::Socket::CreateTCP(addr);
+        if(!sock->connect(addr)) {
+            ++errors;
+            sem.notify();
+            return;
+        }
+        sock->setRecvTimeout(3000);
+        cpu = cpu_us();
+        used = hr::GetCurrentUS();
+        char c = 'a';
+        for(int i = 0; i < rounds; ++i) {
+            if(gap_us) {
+                usleep(gap_us);
+            }
+            uint64_t start = hr::GetCurrentUS();
+            char r = 0;
+            if(sock->send(&c, 1) != 1 || sock->recv(&r, 1) != 1 || r != c) {
+                ++errors;
+                break;
+            }
+            lat.push_back(hr::GetCurrentUS() - start);
+            c = 'a' + i % 26;
+        }
+        used = hr::GetCurrentUS() - used;
+        cpu = cpu_us() - cpu;
+        sock->close();
+        sem.notify();
+    });
+    sem.wait();
+    server->stop();
+
+    SYLAR_ASSERT2(errors == 0 && !lat.empty(), name + " echo");
+    if(lat.empty()) {
+        return;
+    }
+    std::sort(lat.begin(), lat.end());
+    uint64_t polls = server_iom.getBusyPollCount() + client_iom.getBusyPollCount();
+    uint64_t hits = server_iom.getBusyPollHitCount() + client_iom.getBusyPollHitCount();
+    HR_LOG_INFO(g_logger) << name << ": busy_poll_us=" << busy_poll_us
+        << " gap=" << gap_us << "us rounds=" << lat.size()
+        << " p50=" << lat[lat.size() / 2] << "us"
+        << " p99=" << lat[lat.size() * 99 / 100] << "us"
+        << " max=" << lat.back() << "us"
+        << " cpu=" << (used ? cpu * 100 / used : 0) << "%"
+        << " server_busy_poll=" << server_iom.getBusyPollCount()
+        << "/" << server_iom.getBusyPollHitCount()
+        << " client_busy_poll=" << client_iom.getBusyPollCount()
+        << "/" << client_iom.getBusyPollHitCount()
+        << " tickle=" << server_iom.getTickleCount() + client_iom.getTickleCount();
+    if(busy_poll_us == 0) {
+        SYLAR_ASSERT2(polls == 0, name + " no busy poll");
+    } else if(gap_us == 0) {
+        //一问一答,对端总是在自旋窗口内回来
+        SYLAR_ASSERT2(hits * 2 > polls && polls > 0, name + " busy poll hit");
+    } else {
+        //服务端的请求间隔远大于自旋上限,自旋应该很快停下来
+        SYLAR_ASSERT2(server_iom.getBusyPollCount() < (uint64_t)rounds / 10, name + " busy poll backoff");
+    }
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_rounds = atoi(argv[1]);
+    }
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    ping_pong("sleep", 0, 0, s_rounds, 8060);
+    ping_pong("spin", 200, 0, s_rounds, 8061);
+    ping_pong("sparse sleep", 0, 2000, s_sparse_rounds, 8062);
+    ping_pong("sparse spin", 200, 2000, s_sparse_rounds, 8063);
+
+    //SO_BUSY_POLL设置失败只告警,连接照常使用
+    hr::Config::Lookup<int>("tcp.busy_poll_us")->setValue(50);
+    ping_pong("so_busy_poll", 200, 0, std::min(s_rounds, 2000), 8064);
+    HR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include "sylar/sylar.h"
+#include "sylar/http/http_server.h"
+#include "sylar/http/http_connection.h"
+#include "sylar/macro.h"
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static int s_conns = 32;
+static int s_rounds = 2000;
+static int s_size = 128;
+//收到什么回写什么
+class EchoServer : public hr::TcpServer {
+public:
+    typedef std::shared_ptr<EchoServer> ptr;
+protected:
+    void handleClient(hr::Socket::ptr client) override {
+        std::vector<char> buf(4096);
+        while(true) {
+            int rt = client->recv(&buf[0], buf.size());
+            if(rt <= 0) {
+                break;
+            }
+            if(client->send(&buf[0], rt) != rt) {
+                break;
+            }
+        }
+        client->close();
+    }
+};
+
+//每个连接发一条消息,收齐回显后再发下一条
+static uint64_t echo_bench(hr::Address::ptr addr, int& errors) {
+    hr::IOManager* iom = hr::IOManager::GetThis();
+    std::atomic<int> left(s_conns);
+    std::atomic<int> errs(0);
+    hr::Fiber::ptr self = hr::Fiber::GetThis();
+    uint64_t start = hr::GetCurrentUS();
+    for(int c = 0; c < s_conns; ++c) {
+        iom->schedule([&]() {
+            hr::Socket::ptr sock = hr::Socket::CreateTCP(addr);
+            if(!sock->connect(addr)) {
+                ++errs;
+            } else {
+                sock->setRecvTimeout(3000);
+                std::string msg(s_size, 'a');
+                std::string rsp(s_size, 0);
+                for(int i = 0; i < s_rounds; ++i) {
+                    msg[i % s_size] = 'a' + i % 26;
+                    if(sock->send(&msg[0], msg.size()) != (int)msg.size()) {
+                        ++errs;
+                        break;
+                    }
+                    size_t got = 0;
+                    while(got < rsp.size()) {
+                        int rt = sock->recv(&rsp[got], rsp.size() - got);
+                        if(rt <= 0) {
+                            break;
+                        }
+                        got += rt;
+                    }
+                    if(rsp != msg) {
+                        ++errs;
+                        break;
+                    }
+                }
+                sock->close();
+            }
+            if(--left == 0) {
+                iom->schedule(self);
+            }
+        });
+    }
+    hr::Fiber::YieldToHold();
+    errors = errs;
+    return hr::GetCurrentUS() - start;
+}
+
+//超时、等待中关闭、连接失败、HTTP长连接在两种后端下表现一致
+static void test_semantics(hr::Address::ptr addr, int port) {
+    hr::Socket::ptr sock = hr::Socket::CreateTCP(addr);
+    sock->connect(addr);
+    sock->setRecvTimeout(100);
+    char c;
+    uint64_t start = hr::GetCurrentMS();
+    int rt = sock->recv(&c, 1);
+    uint64_t used = hr::GetCurrentMS() - start;
+    SYLAR_ASSERT2(rt == -1 && used >= 100 && used < 500, "recv timeout");
+
+    hr::Socket::ptr sock2 = hr::Socket::CreateTCP(addr);
+    sock2->connect(addr);
+    sock2->setRecvTimeout(2000);
+    hr::IOManager::GetThis()->addTimer(50, [sock2]() {
+        sock2->close();
+    });
+    start = hr::GetCurrentMS();
+    rt = sock2->recv(&c, 1);
+    used = hr::GetCurrentMS() - start;
+    SYLAR_ASSERT2(rt == -1 && used < 500, "close while waiting");
+
+    auto bad = hr::Address::LookupAnyIPAddress("127.0.0.1:8049");
+    hr::Socket::ptr sock3 = hr::Socket::CreateTCP(bad);
+    SYLAR_ASSERT2(!sock3->connect(bad), "connect refused");
+
+    auto pool = hr::http::HttpConnectionPool::Create("http://127.0.0.1:" + std::to_string(port + 1)
+                                                    ,"", 4, 0, 0, 0);
+    int ok = 0;
+    for(int i = 0; i < 100; ++i) {
+        auto r = pool->doGet("/", 1000);
+        if(r->result == 0 && r->response && r->response->getBody() == "uring") {
+            ++ok;
+        }
+    }
+    SYLAR_ASSERT2(ok == 100, "http keepalive");
+}
+
+static void run_backend(const std::string& backend, int port) {
+    hr::Config::Lookup<std::string>("iomanager.backend")->setValue(backend);
+    hr::IOManager iom(2, true, backend);
+    iom.schedule([&]() {
+        hr::IOManager* iom = hr::IOManager::GetThis();
+        HR_LOG_INFO(g_logger) << backend << ": io_uring supported="
+            << hr::IoUring::IsSupported() << " using=" << (iom->isUring() ? "io_uring" : "epoll");
+        SYLAR_ASSERT2(iom->isUring() == (backend == "io_uring"
+                        && hr::IoUring::IsSupported()), backend + " backend");
+
+        auto addr = hr::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+        EchoServer::ptr server(new EchoServer);
+        while(!server->bind(addr)) {
+            sleep(2);
+        }
+        server->start();
+
+        auto haddr = hr::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port + 1));
+        hr::http::HttpServer::ptr hserver(new hr::http::HttpServer(true));
+        hserver->getServletDispatch()->addGlobServlet("/*", [](hr::http::HttpRequest::ptr req
+                    ,hr::http::HttpResponse::ptr rsp
+                    ,hr::http::HttpSession::ptr session) {
+            rsp->setBody("uring");
+            return 0;
+        });
+        while(!hserver->bind(haddr)) {
+            sleep(2);
+        }
+        hserver->start();
+
+        test_semantics(addr, port);
+
+        uint64_t enter = iom->getUringEnterCount();
+        uint64_t wait = iom->getEpollWaitCount();
+        uint64_t ctl = iom->getEpollCtlCount();
+        uint64_t sqe = iom->getUringSqeCount();
+        int errors = 0;
+        uint64_t used = echo_bench(addr, errors);
+        double msgs = (double)s_conns * s_rounds;
+        HR_LOG_INFO(g_logger) << backend << ": connections=" << s_conns
+            << " rounds=" << s_rounds << " size=" << s_size << " errors=" << errors
+            << " msg/s=" << (uint64_t)(msgs * 1000000 / used)
+            << " sqe/msg=" << (iom->getUringSqeCount() - sqe) / msgs
+            << " io_uring_enter/msg=" << (iom->getUringEnterCount() - enter) / msgs
+            << " epoll_wait/msg=" << (iom->getEpollWaitCount() - wait) / msgs
+            << " epoll_ctl/msg=" << (iom->getEpollCtlCount() - ctl) / msgs;
+        SYLAR_ASSERT2(errors == 0, backend + " echo");
+        server->stop();
+        hserver->stop();
+    });
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_conns = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        s_rounds = atoi(argv[2]);
+    }
+    if(argc > 3) {
+        s_size = atoi(argv[3]);
+    }
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    run_backend("epoll", 8050);
+    run_backend("io_uring", 8052);
+    HR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
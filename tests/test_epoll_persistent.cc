@@ -0,0 +1,158 @@
+#include "sylar/sylar.h"
+#include "sylar/http/http_server.h"
+#include "sylar/http/http_connection.h"
+#include "sylar/macro.h"
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static int s_conns = 16;
+static int s_requests = 2000;
+//每个请求平均的epoll_ctl/epoll_wait次数
+struct Result {
+    double ctl = 0;
+    double wait = 0;
+    uint64_t qps = 0;
+};
+
+static hr::http::HttpConnection::ptr connect(hr::Address::ptr addr) {
+    hr::Socket::ptr sock = hr::Socket::CreateTCP(addr);
+    if(!sock->connect(addr)) {
+        return nullptr;
+    }
+    sock->setRecvTimeout(3000);
+    return std::make_shared<hr::http::HttpConnection>(sock);
+}
+
+static bool get(hr::http::HttpConnection::ptr conn) {
+    hr::http::HttpRequest::ptr req(new hr::http::HttpRequest);
+    req->setClose(false);
+    req->setHeader("Host", "127.0.0.1");
+    if(conn->sendRequest(req) <= 0) {
+        return false;
+    }
+    auto rsp = conn->recvResponse();
+    return rsp && rsp->getBody() == "ok";
+}
+
+//长连接上请求/响应,统计稳定状态下每个请求的epoll系统调用次数
+static Result keepalive(hr::Address::ptr addr) {
+    hr::IOManager* iom = hr::IOManager::GetThis();
+    std::vector<hr::http::HttpConnection::ptr> conns;
+    for(int i = 0; i < s_conns; ++i) {
+        auto conn = connect(addr);
+        if(conn && get(conn)) {
+            conns.push_back(conn);
+        }
+    }
+    SYLAR_ASSERT2((int)conns.size() == s_conns, "connections");
+
+    std::atomic<int> left(conns.size());
+    std::atomic<int> errors(0);
+    hr::Fiber::ptr self = hr::Fiber::GetThis();
+    uint64_t ctl = iom->getEpollCtlCount();
+    uint64_t wait = iom->getEpollWaitCount();
+    uint64_t start = hr::GetCurrentUS();
+    for(auto& conn : conns) {
+        iom->schedule([&, conn]() {
+            for(int i = 0; i < s_requests; ++i) {
+                if(!get(conn)) {
+                    ++errors;
+                    break;
+                }
+            }
+            if(--left == 0) {
+                iom->schedule(self);
+            }
+        });
+    }
+    hr::Fiber::YieldToHold();
+    double sec = (hr::GetCurrentUS() - start) / 1000000.0;
+    double total = (double)conns.size() * s_requests;
+
+    Result r;
+    r.ctl = (iom->getEpollCtlCount() - ctl) / total;
+    r.wait = (iom->getEpollWaitCount() - wait) / total;
+    r.qps = total / sec;
+    SYLAR_ASSERT2(errors == 0, "keepalive requests");
+    return r;
+}
+
+//短连接不停复用fd号,等待中关闭和超时都能正常返回
+static void churn(hr::Address::ptr addr, const std::string& url) {
+    int errors = 0;
+    for(int i = 0; i < 1000; ++i) {
+        auto r = hr::http::HttpConnection::DoGet(url, 1000);
+        if(r->result != 0 || !r->response || r->response->getBody() != "ok") {
+            ++errors;
+        }
+    }
+    SYLAR_ASSERT2(errors == 0, "short connections");
+
+    hr::Socket::ptr sock = hr::Socket::CreateTCP(addr);
+    sock->connect(addr);
+    sock->setRecvTimeout(100);
+    char c;
+    uint64_t start = hr::GetCurrentMS();
+    int rt = sock->recv(&c, 1);
+    uint64_t used = hr::GetCurrentMS() - start;
+    SYLAR_ASSERT2(rt == -1 && used >= 100 && used < 500, "recv timeout");
+
+    //等待读的时候另一个协程关闭socket
+    hr::Socket::ptr sock2 = hr::Socket::CreateTCP(addr);
+    sock2->connect(addr);
+    sock2->setRecvTimeout(2000);
+    hr::IOManager::GetThis()->addTimer(50, [sock2]() {
+        sock2->close();
+    });
+    start = hr::GetCurrentMS();
+    rt = sock2->recv(&c, 1);
+    used = hr::GetCurrentMS() - start;
+    SYLAR_ASSERT2(rt == -1 && used < 500, "close while waiting");
+}
+
+static Result run_mode(bool persistent, int port) {
+    //比较的是epoll的系统调用次数,固定用epoll后端
+    hr::Config::Lookup<std::string>("iomanager.backend")->setValue("epoll");
+    hr::Config::Lookup<bool>("iomanager.persistent_epoll")->setValue(persistent);
+    Result r;
+    hr::IOManager iom(2, true, persistent ? "persistent" : "oneshot");
+    iom.schedule([&]() {
+        auto addr = hr::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+        hr::http::HttpServer::ptr server(new hr::http::HttpServer(true));
+        server->getServletDispatch()->addGlobServlet("/*", [](hr::http::HttpRequest::ptr req
+                    ,hr::http::HttpResponse::ptr rsp
+                    ,hr::http::HttpSession::ptr session) {
+            rsp->setBody("ok");
+            return 0;
+        });
+        while(!server->bind(addr)) {
+            sleep(2);
+        }
+        server->start();
+
+        SYLAR_ASSERT2(hr::IOManager::GetThis()->isPersistent() == persistent, std::string(persistent ? "persistent" : "oneshot") + " mode");
+        r = keepalive(addr);
+        churn(addr, "http://127.0.0.1:" + std::to_string(port) + "/");
+        HR_LOG_INFO(g_logger) << (persistent ? "persistent" : "oneshot")
+            << ": connections=" << s_conns << " requests=" << s_requests
+            << " epoll_ctl/req=" << r.ctl << " epoll_wait/req=" << r.wait
+            << " qps=" << r.qps;
+        server->stop();
+    });
+    return r;
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_conns = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        s_requests = atoi(argv[2]);
+    }
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    Result oneshot = run_mode(false, 8045);
+    Result persistent = run_mode(true, 8046);
+    SYLAR_ASSERT2(oneshot.ctl >= 1 && persistent.ctl < 0.01, "epoll_ctl eliminated");
+    HR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
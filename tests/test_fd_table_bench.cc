@@ -0,0 +1,175 @@
+#include "./sylar/sylar.h"
+#include "./sylar/fd_table.h"
+#include "./sylar/fd_manager.h"
+#include <atomic>
+#include <sys/resource.h>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static int s_threads = 32;
+static int s_fds = 100000;
+static int s_lookups = 200000;
+
+struct Ctx {
+    int fd;
+};
+
+//原来的实现: 读写锁保护的vector,越界时加写锁扩容到fd * 1.5
+class RWVectorTable {
+public:
+    RWVectorTable() {
+        m_datas.resize(32);
+    }
+
+    ~RWVectorTable() {
+        for(auto i : m_datas) {
+            delete i;
+        }
+    }
+
+    Ctx* get(int fd) {
+        hr::RWMutex::ReadLock lock(m_mutex);
+        return (int)m_datas.size() > fd ? m_datas[fd] : nullptr;
+    }
+
+    Ctx* getOrCreate(int fd) {
+        hr::RWMutex::ReadLock lock(m_mutex);
+        if((int)m_datas.size() > fd && m_datas[fd]) {
+            return m_datas[fd];
+        }
+        lock.unlock();
+        hr::RWMutex::WriteLock lock2(m_mutex);
+        if(fd >= (int)m_datas.size()) {
+            m_datas.resize(fd * 1.5);
+        }
+        if(!m_datas[fd]) {
+            m_datas[fd] = new Ctx{fd};
+        }
+        return m_datas[fd];
+    }
+private:
+    hr::RWMutex m_mutex;
+    std::vector<Ctx*> m_datas;
+};
+
+class RadixTable {
+public:
+    Ctx* get(int fd) {
+        return m_datas.get(fd);
+    }
+
+    Ctx* getOrCreate(int fd) {
+        return m_datas.getOrCreate(fd, [fd]() { return new Ctx{fd};});
+    }
+private:
+    hr::FdTable<Ctx> m_datas;
+};
+
+//所有线程同时启动,返回总耗时(微秒)
+static uint64_t run_threads(std::function<void(int)> cb) {
+    std::vector<hr::Thread::ptr> threads;
+    uint64_t start = hr::GetCurrentUS();
+    for(int i = 0; i < s_threads; ++i) {
+        threads.emplace_back(new hr::Thread(std::bind(cb, i), "bench_" + std::to_string(i)));
+    }
+    for(auto& i : threads) {
+        i->join();
+    }
+    return hr::GetCurrentUS() - start;
+}
+
+template<class Table>
+static void bench(const std::string& name) {
+    Table table;
+    std::atomic<uint64_t> errors(0);
+
+    //注册: 每个线程按步长登记fd,表一边增长一边被其他线程读
+    uint64_t grow = run_threads([&](int t) {
+        for(int fd = t; fd < s_fds; fd += s_threads) {
+            Ctx* ctx = table.getOrCreate(fd);
+            if(!ctx || ctx->fd != fd) {
+                ++errors;
+            }
+            Ctx* other = table.get(fd / 2);
+            if(other && other->fd != fd / 2) {
+                ++errors;
+            }
+        }
+    });
+
+    //查找: 随机读取已经注册的fd
+    uint64_t lookup = run_threads([&](int t) {
+        uint32_t seed = t * 2654435761u + 1;
+        for(int i = 0; i < s_lookups; ++i) {
+            seed = seed * 1103515245 + 12345;
+            int fd = (seed >> 8) % s_fds;
+            Ctx* ctx = table.get(fd);
+            if(!ctx || ctx->fd != fd) {
+                ++errors;
+            }
+        }
+    });
+
+    uint64_t lookups = (uint64_t)s_threads * s_lookups;
+    HR_LOG_INFO(g_logger) << name << ": threads=" << s_threads << " fds=" << s_fds
+        << " grow=" << grow / 1000 << "ms (" << (uint64_t)(s_fds * 1000000.0 / grow) << " fd/s)"
+        << " lookup=" << lookup / 1000 << "ms (" << (uint64_t)(lookups * 1000000.0 / lookup) << " /s)"
+        << " errors=" << errors;
+}
+
+//真实socket上的FdManager查找,数量受RLIMIT_NOFILE限制
+static void bench_fdmanager() {
+    rlimit rl;
+    getrlimit(RLIMIT_NOFILE, &rl);
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+    int count = std::min<int>(s_fds, rl.rlim_cur - 64);
+
+    std::vector<int> fds;
+    for(int i = 0; i < count; ++i) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if(fd < 0) {
+            break;
+        }
+        hr::FdMgr::GetInstance()->get(fd, true);
+        fds.push_back(fd);
+    }
+
+    std::atomic<uint64_t> errors(0);
+    uint64_t used = run_threads([&](int t) {
+        uint32_t seed = t * 2654435761u + 1;
+        for(int i = 0; i < s_lookups; ++i) {
+            seed = seed * 1103515245 + 12345;
+            int fd = fds[(seed >> 8) % fds.size()];
+            auto ctx = hr::FdMgr::GetInstance()->get(fd);
+            if(!ctx || !ctx->isSocket()) {
+                ++errors;
+            }
+        }
+    });
+    uint64_t lookups = (uint64_t)s_threads * s_lookups;
+    HR_LOG_INFO(g_logger) << "FdManager: threads=" << s_threads << " sockets=" << fds.size()
+        << " lookup=" << used / 1000 << "ms (" << (uint64_t)(lookups * 1000000.0 / used) << " /s)"
+        << " errors=" << errors;
+
+    for(int fd : fds) {
+        hr::FdMgr::GetInstance()->del(fd);
+        close(fd);
+    }
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_threads = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        s_fds = atoi(argv[2]);
+    }
+    if(argc > 3) {
+        s_lookups = atoi(argv[3]);
+    }
+    bench<RWVectorTable>("rwlock vector");
+    bench<RadixTable>("radix table");
+    bench_fdmanager();
+    return 0;
+}
@@ -0,0 +1,147 @@
+#include "sylar/sylar.h"
+#include "sylar/macro.h"
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+//在/proc/self/maps里找包含addr的映射,返回起止地址和权限
+static bool find_mapping(uintptr_t addr, uintptr_t& begin, uintptr_t& end, std::string& perms) {
+    std::ifstream ifs("/proc/self/maps");
+    std::string line;
+    while(std::getline(ifs, line)) {
+        std::istringstream iss(line);
+        std::string range;
+        iss >> range >> perms;
+        size_t pos = range.find('-');
+        begin = std::stoull(range.substr(0, pos), nullptr, 16);
+        end = std::stoull(range.substr(pos + 1), nullptr, 16);
+        if(addr >= begin && addr < end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//栈的最低一页下面是一页PROT_NONE保护页
+static void test_guard_page() {
+    const size_t stack_size = 64 * 1024;
+    uintptr_t local = 0;
+    hr::Fiber::ptr fiber(new hr::Fiber([&local]() {
+        int x = 0;
+        local = (uintptr_t)&x;
+    }, stack_size, true));
+    fiber->call();
+
+    uintptr_t begin = 0, end = 0;
+    std::string perms;
+    SYLAR_ASSERT2(find_mapping(local, begin, end, perms) && perms[0] == 'r' && perms[1] == 'w', "stack mapping");
+    //栈所在的映射至少有stack_size大小,紧挨着下面是保护页
+    SYLAR_ASSERT2(end - begin >= stack_size, "stack size");
+    uintptr_t gbegin = 0, gend = 0;
+    std::string gperms;
+    bool found = find_mapping(begin - 1, gbegin, gend, gperms);
+    SYLAR_ASSERT2(found && gend == begin && gperms.substr(0, 3) == "---"
+            && gend - gbegin >= (uintptr_t)getpagesize(), "guard page");
+}
+
+static std::vector<hr::Fiber::ptr> make_fibers(size_t n, size_t stack_size) {
+    std::vector<hr::Fiber::ptr> fibers;
+    for(size_t i = 0; i < n; ++i) {
+        fibers.push_back(hr::Fiber::ptr(new hr::Fiber([]() {}, stack_size)));
+    }
+    return fibers;
+}
+
+//高低水位和madvise: 低水位2,高水位4
+static void test_watermarks() {
+    hr::Config::Lookup<uint32_t>("fiber.stack_pool.low_water")->setValue(2);
+    hr::Config::Lookup<uint32_t>("fiber.stack_pool.high_water")->setValue(4);
+    hr::Config::Lookup<bool>("fiber.stack_pool.madvise")->setValue(true);
+    const size_t stack_size = 96 * 1024;
+
+    hr::Fiber::StackStats st0 = hr::Fiber::GetStackStats();
+    std::vector<hr::Fiber::ptr> fibers = make_fibers(6, stack_size);
+    hr::Fiber::StackStats st1 = hr::Fiber::GetStackStats();
+    SYLAR_ASSERT2(st1.mmaps - st0.mmaps == 6 && st1.in_use - st0.in_use == 6, "mmap new size");
+
+    //依次释放6个: 缓存到第5个超过高水位,释放到低水位,最后剩3个
+    //缓存中已有2个以上时再放入的要madvise,共4次
+    fibers.clear();
+    hr::Fiber::StackStats st2 = hr::Fiber::GetStackStats();
+    HR_LOG_INFO(g_logger) << "release: cached=" << st2.cached - st1.cached
+        << " munmaps=" << st2.munmaps - st1.munmaps
+        << " madvised=" << st2.madvised - st1.madvised;
+    SYLAR_ASSERT2(st2.cached - st1.cached == 3 && st2.munmaps - st1.munmaps == 3, "high water trim");
+    SYLAR_ASSERT2(st2.madvised - st1.madvised == 4, "madvise above low water");
+
+    //再申请3个全部从缓存复用,不再mmap
+    fibers = make_fibers(3, stack_size);
+    hr::Fiber::StackStats st3 = hr::Fiber::GetStackStats();
+    SYLAR_ASSERT2(st3.hits - st2.hits == 3 && st3.mmaps == st2.mmaps, "reuse cached");
+    fibers.clear();
+
+    hr::Config::Lookup<bool>("fiber.stack_pool.madvise")->setValue(false);
+    hr::Config::Lookup<uint32_t>("fiber.stack_pool.low_water")->setValue(16);
+    hr::Config::Lookup<uint32_t>("fiber.stack_pool.high_water")->setValue(64);
+}
+
+//不同大小的栈交替释放,各自缓存,不会互相清掉
+static void test_mixed_sizes() {
+    const size_t small = 32 * 1024;
+    const size_t large = 256 * 1024;
+    //预热两种大小各4个
+    std::vector<hr::Fiber::ptr> a = make_fibers(4, small);
+    std::vector<hr::Fiber::ptr> b = make_fibers(4, large);
+    a.clear();
+    b.clear();
+
+    hr::Fiber::StackStats st0 = hr::Fiber::GetStackStats();
+    for(int i = 0; i < 100; ++i) {
+        a = make_fibers(4, small);
+        b = make_fibers(4, large);
+        a.clear();
+        b.clear();
+    }
+    hr::Fiber::StackStats st1 = hr::Fiber::GetStackStats();
+    HR_LOG_INFO(g_logger) << "mixed: mmaps=" << st1.mmaps - st0.mmaps
+        << " munmaps=" << st1.munmaps - st0.munmaps
+        << " hits=" << st1.hits - st0.hits;
+    SYLAR_ASSERT2(st1.mmaps == st0.mmaps && st1.munmaps == st0.munmaps, "mixed sizes no mmap");
+    SYLAR_ASSERT2(st1.hits - st0.hits == 800, "mixed sizes reuse");
+}
+
+//线程局部对象持有的协程,线程退出时在栈空闲链表析构之后才释放
+struct FiberHolder {
+    hr::Fiber::ptr fiber;
+};
+
+static thread_local FiberHolder t_holder;
+
+//空闲链表已经析构,释放的栈直接munmap,不能再放回链表
+static void test_thread_exit() {
+    const size_t stack_size = 48 * 1024;
+    hr::Fiber::StackStats st0 = hr::Fiber::GetStackStats();
+    hr::Thread::ptr thr(new hr::Thread([stack_size]() {
+        //先构造t_holder,再分配栈构造空闲链表,线程退出时按相反顺序析构
+        t_holder.fiber.reset();
+        t_holder.fiber.reset(new hr::Fiber([]() {}, stack_size));
+    }, "holder"));
+    thr->join();
+    hr::Fiber::StackStats st1 = hr::Fiber::GetStackStats();
+    HR_LOG_INFO(g_logger) << "thread exit: munmaps=" << st1.munmaps - st0.munmaps
+        << " cached=" << st1.cached - st0.cached << " in_use=" << st1.in_use - st0.in_use;
+    SYLAR_ASSERT2(st1.munmaps - st0.munmaps == 1 && st1.cached == st0.cached
+            && st1.in_use == st0.in_use, "free after free lists destroyed");
+}
+
+int main(int argc, char** argv) {
+    hr::Fiber::GetThis();
+    test_guard_page();
+    test_watermarks();
+    test_mixed_sizes();
+    test_thread_exit();
+    HR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
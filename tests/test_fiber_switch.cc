@@ -0,0 +1,95 @@
+#include "./sylar/sylar.h"
+#include "./sylar/fcontext.h"
+#include <ucontext.h>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static const size_t s_stack_size = 128 * 1024;
+static uint64_t s_count = 0;
+
+//两个上下文来回切换，统计每秒切换次数
+static ucontext_t s_uc_main;
+static ucontext_t s_uc_fiber;
+
+static void uc_func() {
+    while(true) {
+        swapcontext(&s_uc_fiber, &s_uc_main);
+    }
+}
+
+double bench_ucontext(uint64_t n) {
+    char* stack = (char*)malloc(s_stack_size);
+    getcontext(&s_uc_fiber);
+    s_uc_fiber.uc_link = nullptr;
+    s_uc_fiber.uc_stack.ss_sp = stack;
+    s_uc_fiber.uc_stack.ss_size = s_stack_size;
+    makecontext(&s_uc_fiber, &uc_func, 0);
+
+    uint64_t start = hr::GetCurrentUS();
+    for(uint64_t i = 0; i < n; ++i) {
+        swapcontext(&s_uc_main, &s_uc_fiber);
+    }
+    uint64_t used = hr::GetCurrentUS() - start;
+    free(stack);
+    return n * 2 * 1e6 / used;
+}
+
+#ifdef SYLAR_HAVE_FCONTEXT
+static hr::fcontext_t s_fc_main;
+static hr::fcontext_t s_fc_fiber;
+
+static void fc_func() {
+    while(true) {
+        hr::hr_swap_fcontext(&s_fc_fiber, s_fc_main);
+    }
+}
+
+double bench_fcontext(uint64_t n) {
+    char* stack = (char*)malloc(s_stack_size);
+    s_fc_fiber = hr::hr_make_fcontext(stack, s_stack_size, &fc_func);
+
+    uint64_t start = hr::GetCurrentUS();
+    for(uint64_t i = 0; i < n; ++i) {
+        hr::hr_swap_fcontext(&s_fc_main, s_fc_fiber);
+    }
+    uint64_t used = hr::GetCurrentUS() - start;
+    free(stack);
+    return n * 2 * 1e6 / used;
+}
+#endif
+
+//Fiber::call/back，使用编译时选择的实现
+double bench_fiber(uint64_t n) {
+    hr::Fiber::GetThis();
+    bool running = true;
+    hr::Fiber* raw = nullptr;
+    hr::Fiber::ptr fiber(new hr::Fiber([&running, &raw](){
+        while(running) {
+            ++s_count;
+            raw->back();
+        }
+    }, 0, true));
+    raw = fiber.get();
+
+    uint64_t start = hr::GetCurrentUS();
+    for(uint64_t i = 0; i < n; ++i) {
+        fiber->call();
+    }
+    uint64_t used = hr::GetCurrentUS() - start;
+    running = false;
+    fiber->call();
+    return n * 2 * 1e6 / used;
+}
+
+int main(int argc, char** argv) {
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    uint64_t n = argc > 1 ? atoll(argv[1]) : 10000000;
+
+    HR_LOG_INFO(g_logger) << "ucontext: " << (uint64_t)bench_ucontext(n) << " switches/s";
+#ifdef SYLAR_HAVE_FCONTEXT
+    HR_LOG_INFO(g_logger) << "fcontext: " << (uint64_t)bench_fcontext(n) << " switches/s";
+#endif
+    HR_LOG_INFO(g_logger) << "Fiber(" << hr::FiberContextBackend() << "): "
+        << (uint64_t)bench_fiber(n) << " switches/s";
+    return 0;
+}
@@ -0,0 +1,300 @@
+#include "./sylar/sylar.h"
+#include "./sylar/http/http_server.h"
+#include "./sylar/http/multipart.h"
+#include "./sylar/macro.h"
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static hr::Address::ptr s_addr;
+static hr::http::HttpServer::ptr s_server;
+
+static uint64_t checksum(const char* data, size_t len, uint64_t sum = 0) {
+    for(size_t i = 0; i < len; ++i) {
+        sum = sum * 131 + (uint8_t)data[i];
+    }
+    return sum;
+}
+
+//读取消息体,返回是否是流式读取、长度和校验和
+int32_t echo_size(hr::http::HttpRequest::ptr req
+                  ,hr::http::HttpResponse::ptr rsp
+                  ,hr::http::HttpSession::ptr session) {
+    uint64_t size = 0;
+    uint64_t sum = 0;
+    auto stream = req->getBodyStream();
+    if(stream) {
+        char buf[32 * 1024];
+        int rt = 0;
+        while((rt = stream->read(buf, sizeof(buf))) > 0) {
+            sum = checksum(buf, rt, sum);
+            size += rt;
+        }
+        if(rt < 0) {
+            rsp->setStatus(hr::http::HttpStatus::BAD_REQUEST);
+        }
+    } else {
+        size = req->getBodySize();
+        sum = checksum(req->getBodyData(), size);
+    }
+    rsp->setBody("stream=" + std::to_string(stream != nullptr)
+            + " size=" + std::to_string(size)
+            + " sum=" + std::to_string(sum));
+    return 0;
+}
+
+int32_t upload(hr::http::HttpRequest::ptr req
+               ,hr::http::HttpResponse::ptr rsp
+               ,hr::http::HttpSession::ptr session) {
+    //流式的消息体要显式解析
+    if(!req->parseMultipart()) {
+        rsp->setStatus(hr::http::HttpStatus::BAD_REQUEST);
+        rsp->setBody("parse fail");
+        return 0;
+    }
+    auto file = req->getFile("file");
+    rsp->setBody("stream=" + std::to_string(req->getBodyStream() != nullptr)
+            + " title=" + req->getParam("title")
+            + " file=" + (file ? file->getFilename() : "null")
+            + " size=" + std::to_string(file ? file->getSize() : 0)
+            + " in_memory=" + std::to_string(file ? file->inMemory() : 1));
+    return 0;
+}
+
+//只取查询参数,不会读流式的消息体
+int32_t query(hr::http::HttpRequest::ptr req
+              ,hr::http::HttpResponse::ptr rsp
+              ,hr::http::HttpSession::ptr session) {
+    auto stream = std::dynamic_pointer_cast<hr::http::HttpBodyStream>(req->getBodyStream());
+    rsp->setBody("q=" + req->getParam("q")
+            + " title=" + req->getParam("title")
+            + " files=" + std::to_string(req->getFiles().size())
+            + " read=" + std::to_string(stream ? stream->getReadSize() : 0));
+    return 0;
+}
+
+//不读消息体
+int32_t ignore(hr::http::HttpRequest::ptr req
+               ,hr::http::HttpResponse::ptr rsp
+               ,hr::http::HttpSession::ptr session) {
+    rsp->setBody("ignored");
+    return 0;
+}
+
+static std::string make_body(size_t len) {
+    std::string body(len, 0);
+    for(size_t i = 0; i < len; ++i) {
+        body[i] = 'a' + (i * 7 + i / 13) % 26;
+    }
+    return body;
+}
+
+static std::string expect(bool stream, const std::string& body) {
+    return "stream=" + std::to_string(stream)
+        + " size=" + std::to_string(body.size())
+        + " sum=" + std::to_string(checksum(body.data(), body.size()));
+}
+
+static std::string chunked(const std::string& body, size_t chunk) {
+    std::string out;
+    char tmp[32];
+    for(size_t i = 0, n = 0; i < body.size(); i += n) {
+        n = std::min(chunk, body.size() - i);
+        snprintf(tmp, sizeof(tmp), "%zx;ext=1\r\n", n);
+        out += tmp;
+        out.append(body, i, n);
+        out += "\r\n";
+        //chunk大小不固定
+        chunk = chunk * 3 / 2 + 1;
+    }
+    out += "0\r\nX-Trailer: end\r\n\r\n";
+    return out;
+}
+
+static bool send_all(hr::Socket::ptr sock, const std::string& data) {
+    size_t offset = 0;
+    while(offset < data.size()) {
+        int rt = sock->send(data.data() + offset, data.size() - offset);
+        if(rt <= 0) {
+            return false;
+        }
+        offset += rt;
+    }
+    return true;
+}
+
+//读取一个响应,返回消息体
+static bool read_response(hr::Socket::ptr sock, std::string& buf, std::string& body
+                          ,bool* close = nullptr) {
+    char tmp[16 * 1024];
+    while(true) {
+        size_t pos = buf.find("\r\n\r\n");
+        if(pos != std::string::npos) {
+            const char* cl = strcasestr(buf.c_str(), "content-length:");
+            size_t length = cl ? strtoull(cl + 15, nullptr, 10) : 0;
+            if(buf.size() >= pos + 4 + length) {
+                if(close) {
+                    *close = strcasestr(buf.substr(0, pos).c_str(), "connection: close") != nullptr;
+                }
+                body = buf.substr(pos + 4, length);
+                buf.erase(0, pos + 4 + length);
+                return true;
+            }
+        }
+        int rt = sock->recv(tmp, sizeof(tmp));
+        if(rt <= 0) {
+            return false;
+        }
+        buf.append(tmp, rt);
+    }
+}
+
+static hr::Socket::ptr connect() {
+    hr::Socket::ptr sock = hr::Socket::CreateTCP(s_addr);
+    SYLAR_ASSERT2(sock->connect(s_addr), "connect " << *s_addr);
+    return sock;
+}
+
+void client() {
+    hr::Socket::ptr sock = connect();
+    std::string buf;
+    std::string rsp;
+
+    //小的消息体还是放在请求里
+    std::string small = make_body(1000);
+    std::string req = "POST /echo HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\nContent-Length: "
+        + std::to_string(small.size()) + "\r\n\r\n" + small;
+    send_all(sock, req);
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(false, small), "small: " << rsp);
+
+    //大的消息体边收边读,后面紧跟一个pipeline的请求
+    std::string big = make_body(8 * 1024 * 1024 + 123);
+    req = "POST /echo HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\nContent-Length: "
+        + std::to_string(big.size()) + "\r\n\r\n" + big
+        + "POST /echo HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\nContent-Length: 1000\r\n\r\n" + small;
+    send_all(sock, req);
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(true, big), "big: " << rsp);
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(false, small), "pipelined: " << rsp);
+
+    //chunked
+    req = "POST /echo HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\nTransfer-Encoding: chunked\r\n\r\n"
+        + chunked(small, 100);
+    send_all(sock, req);
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(false, small), "chunked small: " << rsp);
+
+    std::string mid = make_body(3 * 1024 * 1024 + 7);
+    req = "POST /echo HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\nTransfer-Encoding: chunked\r\n\r\n"
+        + chunked(mid, 1000);
+    send_all(sock, req);
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(true, mid), "chunked big: " << rsp);
+
+    //multipart上传,文件直接写入临时文件
+    std::string file = make_body(2 * 1024 * 1024);
+    std::string body = "--XyZ\r\n"
+        "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+        "hello\r\n"
+        "--XyZ\r\n"
+        "Content-Disposition: form-data; name=\"file\"; filename=\"a.bin\"\r\n"
+        "Content-Type: application/octet-stream\r\n\r\n"
+        + file + "\r\n"
+        "--XyZ--\r\n";
+    req = "POST /upload HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n"
+        "Content-Type: multipart/form-data; boundary=XyZ\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    send_all(sock, req);
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == "stream=1 title=hello file=a.bin size="
+            + std::to_string(file.size()) + " in_memory=0", "upload: " << rsp);
+
+    //没有读完消息体,连接关闭
+    std::string ignored = make_body(1536 * 1024);
+    req = "POST /ignore HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\nContent-Length: "
+        + std::to_string(ignored.size()) + "\r\n\r\n" + ignored;
+    send_all(sock, req);
+    bool close = false;
+    bool got = read_response(sock, buf, rsp, &close);
+    SYLAR_ASSERT2(got && close && rsp == "ignored", "ignore: " << rsp);
+    sock->close();
+
+    //取参数不会读流式的消息体
+    sock = connect();
+    buf.clear();
+    req = "POST /query?q=1 HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n"
+        "Content-Type: multipart/form-data; boundary=XyZ\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+    send_all(sock, req);
+    got = read_response(sock, buf, rsp, &close);
+    SYLAR_ASSERT2(got && close && rsp == "q=1 title= files=0 read=0", "query: " << rsp);
+    sock->close();
+
+    //普通字段超过http.multipart.memory_limit,解析失败
+    sock = connect();
+    buf.clear();
+    std::string field = make_body(2 * 1024 * 1024);
+    std::string big_field = "--XyZ\r\n"
+        "Content-Disposition: form-data; name=\"title\"\r\n\r\n"
+        + field + "\r\n"
+        "--XyZ--\r\n";
+    req = "POST /upload HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n"
+        "Content-Type: multipart/form-data; boundary=XyZ\r\n"
+        "Content-Length: " + std::to_string(big_field.size()) + "\r\n\r\n" + big_field;
+    send_all(sock, req);
+    got = read_response(sock, buf, rsp, &close);
+    SYLAR_ASSERT2(got && close && rsp == "parse fail", "big field: " << rsp);
+    sock->close();
+
+    auto max_stream = hr::Config::Lookup<uint64_t>("http.request.max_stream_size");
+    uint64_t old_max = max_stream->getValue();
+    max_stream->setValue(4 * 1024 * 1024);
+
+    //Content-Length超过http.request.max_stream_size,不读消息体直接关闭
+    sock = connect();
+    buf.clear();
+    req = "POST /echo HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\nContent-Length: "
+        + std::to_string(8 * 1024 * 1024) + "\r\n\r\n";
+    send_all(sock, req);
+    got = read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(!got, "over max stream size: " << rsp);
+    sock->close();
+
+    //chunked读到超过http.request.max_stream_size时读流出错
+    sock = connect();
+    buf.clear();
+    std::string first = make_body(2 * 1024 * 1024);
+    req = "POST /echo HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\nTransfer-Encoding: chunked\r\n\r\n"
+        "200000\r\n" + first + "\r\n300000\r\n";
+    send_all(sock, req);
+    got = read_response(sock, buf, rsp, &close);
+    SYLAR_ASSERT2(got && close && rsp == expect(true, first), "chunked over max stream size: " << rsp);
+    sock->close();
+    max_stream->setValue(old_max);
+
+    HR_LOG_INFO(g_logger) << "all ok";
+    s_server->stop();
+}
+
+void run() {
+    s_addr = hr::Address::LookupAnyIPAddress("127.0.0.1:8031");
+    s_server.reset(new hr::http::HttpServer(true));
+    while(!s_server->bind(s_addr)) {
+        sleep(2);
+    }
+    auto dispatch = s_server->getServletDispatch();
+    dispatch->addServlet("/echo", echo_size);
+    dispatch->addServlet("/upload", upload);
+    dispatch->addServlet("/query", query);
+    dispatch->addServlet("/ignore", ignore);
+    s_server->start();
+    hr::IOManager::GetThis()->schedule(&client);
+}
+
+int main(int argc, char** argv) {
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    hr::IOManager iom(1, true, "body");
+    iom.schedule(run);
+    return 0;
+}
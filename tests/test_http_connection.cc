@@ -0,0 +1,196 @@
+#include "./sylar/sylar.h"
+#include "./sylar/http/http_server.h"
+#include "./sylar/http/http_connection.h"
+#include "./sylar/macro.h"
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static hr::http::HttpServer::ptr s_server;
+static const std::string s_url = "http://127.0.0.1:8033";
+static int s_count = 5000;
+static int s_fibers = 8;
+
+int32_t echo(hr::http::HttpRequest::ptr req
+             ,hr::http::HttpResponse::ptr rsp
+             ,hr::http::HttpSession::ptr session) {
+    rsp->setBody(req->getPath() + "?" + req->getQuery() + " " + req->getBody());
+    return 0;
+}
+
+int32_t chunked(hr::http::HttpRequest::ptr req
+                ,hr::http::HttpResponse::ptr rsp
+                ,hr::http::HttpSession::ptr session) {
+    auto out = session->startResponse(rsp);
+    for(int i = 0; i < 1000; ++i) {
+        std::string line = "line " + std::to_string(i) + "\n";
+        out->write(line.data(), line.size());
+        if(i % 100 == 0) {
+            out->flush();
+        }
+    }
+    return 0;
+}
+
+int32_t slow(hr::http::HttpRequest::ptr req
+             ,hr::http::HttpResponse::ptr rsp
+             ,hr::http::HttpSession::ptr session) {
+    usleep(300 * 1000);
+    rsp->setBody("slow");
+    return 0;
+}
+
+static bool body_is(hr::http::HttpResult::ptr r, const std::string& body) {
+    return r->result == 0 && r->response && r->response->getBody() == body;
+}
+
+void test_api() {
+    auto r = hr::http::HttpConnection::DoGet(s_url + "/a?x=1", 1000);
+    SYLAR_ASSERT2(body_is(r, "/a?x=1 "), "DoGet " << r->toString());
+
+    r = hr::http::HttpConnection::DoPost(s_url + "/b", 1000, {{"Content-Type", "text/plain"}}, "hello");
+    SYLAR_ASSERT2(body_is(r, "/b? hello"), "DoPost " << r->toString());
+
+    std::string lines;
+    for(int i = 0; i < 1000; ++i) {
+        lines += "line " + std::to_string(i) + "\n";
+    }
+    r = hr::http::HttpConnection::DoGet(s_url + "/chunked", 1000);
+    SYLAR_ASSERT2(body_is(r, lines), "chunked " << r->toString());
+
+    r = hr::http::HttpConnection::DoGet(s_url + "/slow", 100);
+    SYLAR_ASSERT2(r->result == (int)hr::http::HttpResult::Error::TIMEOUT, "timeout " << r->toString());
+
+    r = hr::http::HttpConnection::DoGet("http//bad url", 100);
+    SYLAR_ASSERT2(r->result == (int)hr::http::HttpResult::Error::INVALID_URL, "invalid url " << r->toString());
+
+    r = hr::http::HttpConnection::DoGet("http://127.0.0.1:8039/", 100);
+    SYLAR_ASSERT2(r->result == (int)hr::http::HttpResult::Error::CONNECT_FAIL, "connect fail " << r->toString());
+
+    auto pool = hr::http::HttpConnectionPool::Create(s_url, "", 2, 0, 0, 3);
+    for(int i = 0; i < 7; ++i) {
+        r = pool->doGet("/p?i=" + std::to_string(i), 1000);
+        SYLAR_ASSERT2(body_is(r, "/p?i=" + std::to_string(i) + " "), "pool " << r->toString());
+    }
+    r = pool->doGet("/chunked", 1000);
+    SYLAR_ASSERT2(body_is(r, lines), "pool chunked " << r->toString());
+    //每个连接最多3个请求,8个请求用了3个连接
+    SYLAR_ASSERT2(pool->getCreateCount() == 3 && pool->getIdleSize() == 1, "pool reuse");
+
+    //超时的连接被关闭,不会放回连接池
+    r = pool->doGet("/slow", 50);
+    SYLAR_ASSERT2(r->result == (int)hr::http::HttpResult::Error::TIMEOUT
+            && pool->getIdleSize() == 0, "pool timeout " << r->toString());
+    r = pool->doGet("/c", 1000);
+    SYLAR_ASSERT2(body_is(r, "/c? "), "pool after timeout " << r->toString());
+}
+
+//HTTP/1.1响应没有Content-Length,不是chunked,也没有Connection: close
+//消息体读到连接关闭,包括和响应头一起收到的部分
+static void test_read_to_close() {
+    auto addr = hr::Address::LookupAnyIPAddress("127.0.0.1:8047");
+    hr::Socket::ptr listener = hr::Socket::CreateTCP(addr);
+    while(!listener->bind(addr)) {
+        sleep(2);
+    }
+    listener->listen();
+    hr::IOManager::GetThis()->schedule([listener]() {
+        for(int i = 0; i < 2; ++i) {
+            hr::Socket::ptr client = listener->accept();
+            std::string req;
+            char buf[1024];
+            int rt = 0;
+            while(req.find("\r\n\r\n") == std::string::npos
+                    && (rt = client->recv(buf, sizeof(buf))) > 0) {
+                req.append(buf, rt);
+            }
+            std::string head = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\nfirst part";
+            client->send(head.data(), head.size());
+            usleep(20 * 1000);
+            client->send(" second part", 12);
+            client->close();
+        }
+    });
+
+    auto r = hr::http::HttpConnection::DoGet("http://127.0.0.1:8047/", 1000);
+    SYLAR_ASSERT2(body_is(r, "first part second part") && r->response->isClose()
+            , "read to close " << r->toString());
+
+    //读到关闭的连接不放回连接池
+    auto pool = hr::http::HttpConnectionPool::Create("http://127.0.0.1:8047", "", 2, 0, 0, 0);
+    r = pool->doGet("/", 1000);
+    SYLAR_ASSERT2(body_is(r, "first part second part") && pool->getIdleSize() == 0
+            , "pool read to close " << r->toString());
+    listener->close();
+}
+
+//多个协程并发发送请求,返回每秒请求数
+static double bench(const std::string& name, hr::http::HttpConnectionPool::ptr pool) {
+    std::atomic<int> left(s_fibers);
+    std::atomic<int> errors(0);
+    uint64_t start = hr::GetCurrentUS();
+    hr::Fiber::ptr self = hr::Fiber::GetThis();
+    hr::IOManager* iom = hr::IOManager::GetThis();
+    for(int f = 0; f < s_fibers; ++f) {
+        iom->schedule([&, pool]() {
+            for(int i = 0; i < s_count / s_fibers; ++i) {
+                auto r = pool ? pool->doGet("/bench", 1000)
+                    : hr::http::HttpConnection::DoGet(s_url + "/bench", 1000);
+                if(r->result != 0) {
+                    ++errors;
+                }
+            }
+            if(--left == 0) {
+                iom->schedule(self);
+            }
+        });
+    }
+    hr::Fiber::YieldToHold();
+    double sec = (hr::GetCurrentUS() - start) / 1000000.0;
+    double qps = (s_count / s_fibers * s_fibers) / sec;
+    HR_LOG_INFO(g_logger) << name << ": requests=" << s_count / s_fibers * s_fibers
+        << " fibers=" << s_fibers << " errors=" << errors
+        << " req/s=" << (uint64_t)qps
+        << (pool ? " connections=" + std::to_string(pool->getCreateCount()) : "");
+    SYLAR_ASSERT2(errors == 0, name << " errors=" << errors);
+    return qps;
+}
+
+void client() {
+    test_api();
+    test_read_to_close();
+
+    double without = bench("without pool", nullptr);
+    auto pool = hr::http::HttpConnectionPool::Create(s_url, "", s_fibers, 0, 0, 0);
+    double with = bench("with pool", pool);
+    HR_LOG_INFO(g_logger) << "pool speedup " << with / without << "x";
+
+    HR_LOG_INFO(g_logger) << "all ok";
+    s_server->stop();
+}
+
+void run() {
+    auto addr = hr::Address::LookupAnyIPAddress("127.0.0.1:8033");
+    s_server.reset(new hr::http::HttpServer(true));
+    while(!s_server->bind(addr)) {
+        sleep(2);
+    }
+    auto dispatch = s_server->getServletDispatch();
+    dispatch->addServlet("/chunked", chunked);
+    dispatch->addServlet("/slow", slow);
+    dispatch->addGlobServlet("/*", echo);
+    s_server->start();
+    hr::IOManager::GetThis()->schedule(&client);
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_count = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        s_fibers = atoi(argv[2]);
+    }
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    hr::IOManager iom(1, true, "http_conn");
+    iom.schedule(run);
+    return 0;
+}
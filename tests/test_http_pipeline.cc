@@ -0,0 +1,117 @@
+#include "./sylar/sylar.h"
+#include "./sylar/http/http_server.h"
+#include <atomic>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+//类似wrk --pipeline，每个连接一次发送depth个请求，再按顺序读回depth个响应
+static int s_connections = 8;
+static int s_depth = 16;
+static int s_requests = 20000;
+static std::atomic<uint64_t> s_done = {0};
+static std::atomic<uint64_t> s_errors = {0};
+static std::atomic<int> s_finished = {0};
+
+static hr::Address::ptr s_addr;
+static hr::http::HttpServer::ptr s_server;
+static uint64_t s_start = 0;
+
+//从buf中取出一个完整的响应体，数据不够返回false
+static bool take_response(std::string& buf, std::string& body) {
+    size_t pos = buf.find("\r\n\r\n");
+    if(pos == std::string::npos) {
+        return false;
+    }
+    size_t length = 0;
+    const char* cl = strcasestr(buf.c_str(), "content-length:");
+    if(cl && (size_t)(cl - buf.c_str()) < pos) {
+        length = strtoull(cl + 15, nullptr, 10);
+    }
+    if(buf.size() < pos + 4 + length) {
+        return false;
+    }
+    body = buf.substr(pos + 4, length);
+    buf.erase(0, pos + 4 + length);
+    return true;
+}
+
+void client() {
+    hr::Socket::ptr sock = hr::Socket::CreateTCP(s_addr);
+    if(!sock->connect(s_addr)) {
+        HR_LOG_ERROR(g_logger) << "connect " << *s_addr << " fail";
+        ++s_errors;
+        ++s_finished;
+        return;
+    }
+    std::string buf;
+    std::string body;
+    char tmp[16 * 1024];
+    for(int i = 0; i < s_requests; i += s_depth) {
+        int n = std::min(s_depth, s_requests - i);
+        std::string out;
+        for(int j = 0; j < n; ++j) {
+            out += "GET /seq/" + std::to_string(i + j)
+                + " HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n";
+        }
+        if(sock->send(out.data(), out.size()) != (int)out.size()) {
+            ++s_errors;
+            break;
+        }
+        //响应必须和请求顺序一致
+        for(int j = 0; j < n; ++j) {
+            while(!take_response(buf, body)) {
+                int rt = sock->recv(tmp, sizeof(tmp));
+                if(rt <= 0) {
+                    ++s_errors;
+                    ++s_finished;
+                    return;
+                }
+                buf.append(tmp, rt);
+            }
+            if(body != "/seq/" + std::to_string(i + j)) {
+                ++s_errors;
+            }
+            ++s_done;
+        }
+    }
+    sock->close();
+    if(++s_finished == s_connections) {
+        uint64_t used = hr::GetCurrentUS() - s_start;
+        HR_LOG_INFO(g_logger) << "connections=" << s_connections << " depth=" << s_depth
+            << " requests=" << s_done << " errors=" << s_errors;
+        HR_LOG_INFO(g_logger) << (uint64_t)(s_done * 1e6 / used) << " requests/s";
+        s_server->stop();
+    }
+}
+
+void run() {
+    s_addr = hr::Address::LookupAnyIPAddress("127.0.0.1:8030");
+    s_server.reset(new hr::http::HttpServer(true));
+    while(!s_server->bind(s_addr)) {
+        sleep(2);
+    }
+    s_server->getServletDispatch()->addGlobServlet("/seq/*", [](hr::http::HttpRequest::ptr req
+                ,hr::http::HttpResponse::ptr rsp
+                ,hr::http::HttpSession::ptr session) {
+            rsp->setBody(req->getPath());
+            return 0;
+    });
+    s_server->start();
+
+    s_start = hr::GetCurrentUS();
+    for(int i = 0; i < s_connections; ++i) {
+        hr::IOManager::GetThis()->schedule(&client);
+    }
+}
+
+int main(int argc, char** argv) {
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    s_connections = argc > 1 ? atoi(argv[1]) : 8;
+    s_depth = argc > 2 ? atoi(argv[2]) : 16;
+    s_requests = argc > 3 ? atoi(argv[3]) : 20000;
+    int threads = argc > 4 ? atoi(argv[4]) : 1;
+
+    hr::IOManager iom(threads, true, "pipeline");
+    iom.schedule(run);
+    return 0;
+}
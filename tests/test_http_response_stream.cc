@@ -0,0 +1,185 @@
+#include "./sylar/sylar.h"
+#include "./sylar/http/http_server.h"
+#include "./sylar/macro.h"
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static hr::Address::ptr s_addr;
+static hr::http::HttpServer::ptr s_server;
+//1000行小数据,中间一次flush,最后一个大块
+static std::string s_lines;
+static std::string s_big(200 * 1024, 'x');
+
+int32_t stream(hr::http::HttpRequest::ptr req
+               ,hr::http::HttpResponse::ptr rsp
+               ,hr::http::HttpSession::ptr session) {
+    rsp->setHeader("Content-Type", "text/plain");
+    auto out = session->startResponse(rsp);
+    if(!out) {
+        return -1;
+    }
+    for(int i = 0; i < 1000; ++i) {
+        std::string line = "line " + std::to_string(i) + "\n";
+        out->write(line.data(), line.size());
+        if(i == 500) {
+            out->flush();
+        }
+    }
+    out->write(s_big.data(), s_big.size());
+    HR_LOG_INFO(g_logger) << "stream writes=1001 chunks=" << out->getChunks()
+        << " size=" << out->getWriteSize();
+    return 0;
+}
+
+int32_t plain(hr::http::HttpRequest::ptr req
+              ,hr::http::HttpResponse::ptr rsp
+              ,hr::http::HttpSession::ptr session) {
+    rsp->setBody(req->getPath());
+    return 0;
+}
+
+static bool send_all(hr::Socket::ptr sock, const std::string& data) {
+    size_t offset = 0;
+    while(offset < data.size()) {
+        int rt = sock->send(data.data() + offset, data.size() - offset);
+        if(rt <= 0) {
+            return false;
+        }
+        offset += rt;
+    }
+    return true;
+}
+
+static bool fill(hr::Socket::ptr sock, std::string& buf) {
+    char tmp[16 * 1024];
+    int rt = sock->recv(tmp, sizeof(tmp));
+    if(rt <= 0) {
+        return false;
+    }
+    buf.append(tmp, rt);
+    return true;
+}
+
+//读取一个响应,支持content-length、chunked和读到连接关闭
+static bool read_response(hr::Socket::ptr sock, std::string& buf, std::string& head
+                          ,std::string& body) {
+    size_t pos = 0;
+    while((pos = buf.find("\r\n\r\n")) == std::string::npos) {
+        if(!fill(sock, buf)) {
+            return false;
+        }
+    }
+    head = buf.substr(0, pos);
+    buf.erase(0, pos + 4);
+    body.clear();
+    if(strcasestr(head.c_str(), "transfer-encoding: chunked")) {
+        while(true) {
+            size_t eol = 0;
+            while((eol = buf.find("\r\n")) == std::string::npos) {
+                if(!fill(sock, buf)) {
+                    return false;
+                }
+            }
+            size_t size = strtoull(buf.c_str(), nullptr, 16);
+            while(buf.size() < eol + 2 + size + 2) {
+                if(!fill(sock, buf)) {
+                    return false;
+                }
+            }
+            body.append(buf, eol + 2, size);
+            buf.erase(0, eol + 2 + size + 2);
+            if(size == 0) {
+                return true;
+            }
+        }
+    }
+    const char* cl = strcasestr(head.c_str(), "content-length:");
+    if(!cl) {
+        //没有长度,读到连接关闭
+        while(fill(sock, buf));
+        body.swap(buf);
+        return true;
+    }
+    size_t length = strtoull(cl + 15, nullptr, 10);
+    while(buf.size() < length) {
+        if(!fill(sock, buf)) {
+            return false;
+        }
+    }
+    body = buf.substr(0, length);
+    buf.erase(0, length);
+    return true;
+}
+
+void client() {
+    hr::Socket::ptr sock = hr::Socket::CreateTCP(s_addr);
+    if(!sock->connect(s_addr)) {
+        HR_LOG_ERROR(g_logger) << "connect " << *s_addr << " fail";
+        s_server->stop();
+        return;
+    }
+    std::string buf;
+    std::string head;
+    std::string body;
+
+    //pipeline的请求中间夹一个流式响应,顺序不能乱,连接继续复用
+    std::string req;
+    for(auto path : {"/a", "/stream", "/b", "/stream", "/c"}) {
+        req += std::string("GET ") + path
+            + " HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n";
+    }
+    send_all(sock, req);
+    for(auto path : {"/a", "/stream", "/b", "/stream", "/c"}) {
+        bool ok = read_response(sock, buf, head, body);
+        if(std::string(path) == "/stream") {
+            SYLAR_ASSERT2(ok && body == s_lines + s_big
+                    && strcasestr(head.c_str(), "connection: keep-alive")
+                    && !strcasestr(head.c_str(), "content-length"), "chunked");
+        } else {
+            SYLAR_ASSERT2(ok && body == path, path);
+        }
+    }
+
+    //还能继续使用
+    send_all(sock, "GET /d HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    bool ok = read_response(sock, buf, head, body);
+    SYLAR_ASSERT2(ok && body == "/d", "keep-alive");
+    sock->close();
+
+    //HTTP/1.0不支持chunked,读到连接关闭
+    sock = hr::Socket::CreateTCP(s_addr);
+    sock->connect(s_addr);
+    buf.clear();
+    send_all(sock, "GET /stream HTTP/1.0\r\nHost: test\r\nConnection: keep-alive\r\n\r\n");
+    ok = read_response(sock, buf, head, body);
+    SYLAR_ASSERT2(ok && body == s_lines + s_big
+            && strcasestr(head.c_str(), "connection: close")
+            && !strcasestr(head.c_str(), "transfer-encoding"), "http/1.0");
+    sock->close();
+
+    HR_LOG_INFO(g_logger) << "all ok";
+    s_server->stop();
+}
+
+void run() {
+    for(int i = 0; i < 1000; ++i) {
+        s_lines += "line " + std::to_string(i) + "\n";
+    }
+    s_addr = hr::Address::LookupAnyIPAddress("127.0.0.1:8032");
+    s_server.reset(new hr::http::HttpServer(true));
+    while(!s_server->bind(s_addr)) {
+        sleep(2);
+    }
+    auto dispatch = s_server->getServletDispatch();
+    dispatch->addServlet("/stream", stream);
+    dispatch->addGlobServlet("/*", plain);
+    s_server->start();
+    hr::IOManager::GetThis()->schedule(&client);
+}
+
+int main(int argc, char** argv) {
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    hr::IOManager iom(1, true, "rsp_stream");
+    iom.schedule(run);
+    return 0;
+}
@@ -0,0 +1,300 @@
+#include "./sylar/sylar.h"
+#include "./sylar/http/http_server.h"
+#include "./sylar/macro.h"
+#include <fcntl.h>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static hr::Address::ptr s_addr;
+static hr::http::HttpServer::ptr s_server;
+
+static uint64_t checksum(const char* data, size_t len) {
+    uint64_t sum = 0;
+    for(size_t i = 0; i < len; ++i) {
+        sum = sum * 131 + (uint8_t)data[i];
+    }
+    return sum;
+}
+
+//返回消息体的长度和校验和
+int32_t echo_size(hr::http::HttpRequest::ptr req
+                  ,hr::http::HttpResponse::ptr rsp
+                  ,hr::http::HttpSession::ptr session) {
+    rsp->setBody("size=" + std::to_string(req->getBodySize())
+            + " sum=" + std::to_string(checksum(req->getBodyData(), req->getBodySize())));
+    return 0;
+}
+
+//返回Host头在接收缓冲区中的地址,缓冲区复用时地址不变
+int32_t host_addr(hr::http::HttpRequest::ptr req
+                  ,hr::http::HttpResponse::ptr rsp
+                  ,hr::http::HttpSession::ptr session) {
+    hr::http::StringPiece host;
+    req->getHeaders().get(hr::http::HttpHeaders::HOST, host);
+    rsp->setBody(std::to_string((uintptr_t)host.data));
+    return 0;
+}
+
+//保存请求对象,在之后的请求里再读取它的头部和消息体
+static hr::http::HttpRequest::ptr s_kept;
+
+int32_t keep(hr::http::HttpRequest::ptr req
+             ,hr::http::HttpResponse::ptr rsp
+             ,hr::http::HttpSession::ptr session) {
+    s_kept = req;
+    return echo_size(req, rsp, session);
+}
+
+int32_t kept(hr::http::HttpRequest::ptr req
+             ,hr::http::HttpResponse::ptr rsp
+             ,hr::http::HttpSession::ptr session) {
+    if(!s_kept) {
+        rsp->setBody("null");
+        return 0;
+    }
+    echo_size(s_kept, rsp, session);
+    rsp->setBody(rsp->getBody() + " x-kept=" + s_kept->getHeader("X-Kept"));
+    s_kept.reset();
+    return 0;
+}
+
+static const std::string s_file = "/tmp/test_http_session.dat";
+
+//用sendfile返回文件的[offset, offset + length)
+int32_t send_file(hr::http::HttpRequest::ptr req
+                  ,hr::http::HttpResponse::ptr rsp
+                  ,hr::http::HttpSession::ptr session) {
+    uint64_t offset = req->getParamAs<uint64_t>("offset", 0);
+    uint64_t length = req->getParamAs<uint64_t>("length", ~0ull);
+    if(!rsp->setBodyFile(s_file, offset, length)) {
+        rsp->setStatus(hr::http::HttpStatus::NOT_FOUND);
+    }
+    return 0;
+}
+
+static std::string make_body(size_t len) {
+    std::string body(len, 0);
+    for(size_t i = 0; i < len; ++i) {
+        body[i] = 'a' + (i * 7 + i / 13) % 26;
+    }
+    return body;
+}
+
+static std::string expect(const std::string& body) {
+    return "size=" + std::to_string(body.size())
+        + " sum=" + std::to_string(checksum(body.data(), body.size()));
+}
+
+static bool send_all(hr::Socket::ptr sock, const std::string& data) {
+    size_t offset = 0;
+    while(offset < data.size()) {
+        int rt = sock->send(data.data() + offset, data.size() - offset);
+        if(rt <= 0) {
+            return false;
+        }
+        offset += rt;
+    }
+    return true;
+}
+
+//读取一个响应,返回消息体
+static bool read_response(hr::Socket::ptr sock, std::string& buf, std::string& body) {
+    char tmp[16 * 1024];
+    while(true) {
+        size_t pos = buf.find("\r\n\r\n");
+        if(pos != std::string::npos) {
+            const char* cl = strcasestr(buf.c_str(), "content-length:");
+            size_t length = cl ? strtoull(cl + 15, nullptr, 10) : 0;
+            if(buf.size() >= pos + 4 + length) {
+                body = buf.substr(pos + 4, length);
+                buf.erase(0, pos + 4 + length);
+                return true;
+            }
+        }
+        int rt = sock->recv(tmp, sizeof(tmp));
+        if(rt <= 0) {
+            return false;
+        }
+        buf.append(tmp, rt);
+    }
+}
+
+static std::string post(const std::string& path, const std::string& body
+                        ,const std::string& extra = "") {
+    return "POST " + path + " HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n" + extra
+        + "Content-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+//请求头读完后消息体才到,读消息体时缓冲区要挪到新的一块
+static void test_delayed_body(hr::Socket::ptr sock, std::string& buf) {
+    std::string rsp;
+    std::string body = make_body(3000);
+    std::string req = post("/echo", body, "X-Pad: " + std::string(2000, 'p') + "\r\n");
+    std::string head = req.substr(0, req.size() - body.size());
+    send_all(sock, head);
+    usleep(100 * 1000);
+    send_all(sock, body);
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(body), "delayed body: " << rsp);
+}
+
+static std::string get(const std::string& path) {
+    return "GET " + path + " HTTP/1.1\r\nHost: test\r\nConnection: keep-alive\r\n\r\n";
+}
+
+//长连接上依次处理的请求复用同一块缓冲区
+static void test_reuse(hr::Socket::ptr sock, std::string& buf) {
+    std::string first;
+    std::string rsp;
+    send_all(sock, get("/addr"));
+    read_response(sock, buf, first);
+    bool same = true;
+    for(int i = 0; i < 10; ++i) {
+        send_all(sock, i % 2 ? get("/addr") : post("/echo", make_body(1000)));
+        read_response(sock, buf, rsp);
+        same = same && (i % 2 == 0 || rsp == first);
+    }
+    SYLAR_ASSERT2(same, "buffer reuse");
+}
+
+//请求对象在下一个请求读入之后还被持有,它的头部和消息体不能被覆盖
+static void test_outlive(hr::Socket::ptr sock, std::string& buf) {
+    std::string rsp;
+    std::string body1 = make_body(1000);
+    send_all(sock, post("/keep", body1, "X-Kept: first\r\n"));
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(body1), "keep: " << rsp);
+
+    //下一个请求用同样长度的数据填满原来的位置
+    std::string body2(1000, 'z');
+    send_all(sock, post("/echo", body2, "X-Kept: zzzzz\r\n"));
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(body2), "after keep: " << rsp);
+
+    send_all(sock, get("/kept"));
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(body1) + " x-kept=first", "kept request: " << rsp);
+}
+
+//pipeline的第二个请求只有请求头,客户端收到第一个响应后才发送消息体
+//服务端要在等消息体之前发出第一个响应,否则两边互相等待
+static void test_pipeline_partial(hr::Socket::ptr sock, std::string& buf) {
+    std::string rsp;
+    std::string body = make_body(100);
+    std::string req2 = post("/echo", body);
+    send_all(sock, get("/addr") + req2.substr(0, req2.size() - body.size()));
+    sock->setRecvTimeout(2000);
+    bool got = read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(got, "pipeline first response");
+    send_all(sock, body);
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(body), "pipeline partial body: " << rsp);
+}
+
+//文件消息体: 比socket缓冲区大的文件分多次sendfile,指定范围,之后连接继续使用
+static void test_send_file(hr::Socket::ptr sock, std::string& buf, const std::string& file) {
+    std::string rsp;
+    send_all(sock, get("/file"));
+    //客户端晚一点读,服务端的sendfile会写满socket缓冲区
+    usleep(100 * 1000);
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(expect(rsp) == expect(file), "file whole: " << expect(rsp));
+
+    send_all(sock, get("/file?offset=1000&length=5000"));
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(expect(rsp) == expect(file.substr(1000, 5000)), "file range: " << expect(rsp));
+
+    //范围超出文件时截断
+    send_all(sock, get("/file?offset=" + std::to_string(file.size() - 100) + "&length=1000"));
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(expect(rsp) == expect(file.substr(file.size() - 100)), "file tail: " << expect(rsp));
+
+    //文件响应在pipeline中间,前后的响应顺序不变
+    std::string body = make_body(100);
+    send_all(sock, post("/echo", body) + get("/file?offset=7&length=300000") + post("/echo", body));
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(body), "file pipeline before: " << rsp);
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(expect(rsp) == expect(file.substr(7, 300000)), "file pipeline: " << expect(rsp));
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(body), "file pipeline after: " << rsp);
+
+    //toString输出文件内容而不是占位符
+    hr::http::HttpResponse::ptr r(new hr::http::HttpResponse);
+    r->setBodyFile(s_file, 10, 20);
+    std::string str = r->toString();
+    std::string dumped = str.substr(str.find("\r\n\r\n") + 4);
+    SYLAR_ASSERT2(dumped == file.substr(10, 20), "file toString: " << dumped);
+}
+
+//修改http.request.buffer_size后新的请求使用新大小的缓冲区
+//改大时正在等待的请求也可以用新的大小,改小从下一个请求开始生效
+static void test_buffer_size(hr::Socket::ptr sock, std::string& buf) {
+    std::string rsp;
+    std::string body = make_body(100);
+    std::string pad = "X-Pad: " + std::string(10000, 'p') + "\r\n";
+    auto size = hr::Config::Lookup<uint64_t>("http.request.buffer_size");
+    size->setValue(16 * 1024);
+    send_all(sock, post("/echo", body, pad));
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(body), "larger buffer: " << rsp);
+    size->setValue(4 * 1024);
+    send_all(sock, post("/echo", body));
+    read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(rsp == expect(body), "restore buffer: " << rsp);
+
+    //改回4K后放不下的请求头关闭连接
+    send_all(sock, post("/echo", body, pad));
+    bool got = read_response(sock, buf, rsp);
+    SYLAR_ASSERT2(!got, "smaller buffer: " << rsp);
+}
+
+void client() {
+    hr::Socket::ptr sock = hr::Socket::CreateTCP(s_addr);
+    if(!sock->connect(s_addr)) {
+        HR_LOG_ERROR(g_logger) << "connect " << *s_addr << " fail";
+        s_server->stop();
+        return;
+    }
+    std::string file = make_body(16 * 1024 * 1024 + 5);
+    int fd = open(s_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool written = write(fd, file.data(), file.size()) == (ssize_t)file.size();
+    close(fd);
+    SYLAR_ASSERT2(written, "write file");
+
+    std::string buf;
+    test_delayed_body(sock, buf);
+    test_reuse(sock, buf);
+    test_outlive(sock, buf);
+    test_pipeline_partial(sock, buf);
+    test_send_file(sock, buf, file);
+    test_buffer_size(sock, buf);
+    sock->close();
+    unlink(s_file.c_str());
+
+    HR_LOG_INFO(g_logger) << "all ok";
+    s_server->stop();
+}
+
+void run() {
+    s_addr = hr::Address::LookupAnyIPAddress("127.0.0.1:8045");
+    s_server.reset(new hr::http::HttpServer(true));
+    while(!s_server->bind(s_addr)) {
+        sleep(2);
+    }
+    auto dispatch = s_server->getServletDispatch();
+    dispatch->addServlet("/echo", echo_size);
+    dispatch->addServlet("/addr", host_addr);
+    dispatch->addServlet("/keep", keep);
+    dispatch->addServlet("/kept", kept);
+    dispatch->addServlet("/file", send_file);
+    s_server->start();
+    hr::IOManager::GetThis()->schedule(&client);
+}
+
+int main(int argc, char** argv) {
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    hr::IOManager iom(1, true, "session");
+    iom.schedule(run);
+    return 0;
+}
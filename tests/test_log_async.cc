@@ -0,0 +1,215 @@
+#include "sylar/sylar.h"
+#include "sylar/macro.h"
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static hr::Logger::ptr make_logger(hr::AsyncLogAppender::ptr appender) {
+    hr::Logger::ptr logger(new hr::Logger("async_test"));
+    logger->setFormatter(hr::LogFormatter::ptr(new hr::LogFormatter("%p %m%n")));
+    logger->addAppender(appender);
+    return logger;
+}
+
+static std::string read_file(const std::string& path) {
+    std::string rt;
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return rt;
+    }
+    char buf[4096];
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0) {
+        rt.append(buf, n);
+    }
+    close(fd);
+    return rt;
+}
+
+static size_t count_lines(const std::string& str) {
+    return std::count(str.begin(), str.end(), '\n');
+}
+
+//管道读端,构造后后台线程卡在写管道上,start()后开始读,读到写端关闭为止
+class PipeReader {
+public:
+    PipeReader(const std::string& path)
+        :m_path(path) {
+        unlink(path.c_str());
+        mkfifo(path.c_str(), 0644);
+        //先打开读端,AsyncLogAppender打开写端时才不会阻塞
+        m_fd = open(path.c_str(), O_RDONLY | O_NONBLOCK);
+    }
+
+    ~PipeReader() {
+        if(m_thread) {
+            m_thread->join();
+        }
+        close(m_fd);
+        unlink(m_path.c_str());
+    }
+
+    //写一条比管道容量大得多的日志,等后台线程取走后阻塞在write上,队列为空
+    void block(hr::Logger::ptr logger) {
+        HR_LOG_INFO(logger) << std::string(1024 * 1024, 'x');
+        int avail = 0;
+        while(!avail) {
+            ioctl(m_fd, FIONREAD, &avail);
+            usleep(1000);
+        }
+        usleep(10 * 1000);
+    }
+
+    void start() {
+        m_thread.reset(new hr::Thread([this]() {
+            fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_NONBLOCK);
+            char buf[64 * 1024];
+            ssize_t n;
+            while((n = read(m_fd, buf, sizeof(buf))) > 0) {
+                m_data.append(buf, n);
+            }
+        }, "pipe_reader"));
+    }
+
+    //等写端关闭后读到的全部数据
+    const std::string& data() {
+        m_thread->join();
+        m_thread.reset();
+        return m_data;
+    }
+private:
+    std::string m_path;
+    int m_fd;
+    std::string m_data;
+    hr::Thread::ptr m_thread;
+};
+
+//队列满时直接丢弃,只保留队列容量那么多条
+static void test_drop() {
+    PipeReader reader("/tmp/test_log_async.fifo");
+    hr::AsyncLogAppender::ptr appender(new hr::AsyncLogAppender("/tmp/test_log_async.fifo"
+                , 64, hr::AsyncLogAppender::DROP));
+    hr::Logger::ptr logger = make_logger(appender);
+    reader.block(logger);
+    for(int i = 0; i < 100; ++i) {
+        HR_LOG_INFO(logger) << "drop i=" << i;
+    }
+    SYLAR_ASSERT2(appender->getDropped() == 36, "drop count");
+
+    reader.start();
+    logger->delAppender(appender);
+    appender.reset();
+    const std::string& data = reader.data();
+    SYLAR_ASSERT2(count_lines(data) == 1 + 64
+            && data.find("drop i=63\n") != std::string::npos
+            && data.find("drop i=64\n") == std::string::npos, "drop written");
+}
+
+//队列用到3/4后,ERROR以下每10条保留1条,ERROR不采样
+static void test_sample() {
+    PipeReader reader("/tmp/test_log_async.fifo");
+    hr::AsyncLogAppender::ptr appender(new hr::AsyncLogAppender("/tmp/test_log_async.fifo"
+                , 64, hr::AsyncLogAppender::SAMPLE, 10));
+    hr::Logger::ptr logger = make_logger(appender);
+    reader.block(logger);
+    //前48条全部保留,后52条保留第0,10,...,50条共6条
+    for(int i = 0; i < 100; ++i) {
+        HR_LOG_INFO(logger) << "sample i=" << i;
+    }
+    SYLAR_ASSERT2(appender->getDropped() == 46, "sample dropped");
+    for(int i = 0; i < 5; ++i) {
+        HR_LOG_ERROR(logger) << "sample error i=" << i;
+    }
+    SYLAR_ASSERT2(appender->getDropped() == 46, "sample keeps error");
+
+    reader.start();
+    logger->delAppender(appender);
+    appender.reset();
+    const std::string& data = reader.data();
+    SYLAR_ASSERT2(count_lines(data) == 1 + 48 + 6 + 5
+            && data.find("sample i=48\n") != std::string::npos
+            && data.find("sample i=49\n") == std::string::npos
+            && data.find("sample i=58\n") != std::string::npos
+            && data.find("sample error i=4\n") != std::string::npos, "sample written");
+}
+
+//队列满时生产者等待,不丢日志
+static void test_block() {
+    PipeReader reader("/tmp/test_log_async.fifo");
+    hr::AsyncLogAppender::ptr appender(new hr::AsyncLogAppender("/tmp/test_log_async.fifo"
+                , 64, hr::AsyncLogAppender::BLOCK));
+    hr::Logger::ptr logger = make_logger(appender);
+    reader.block(logger);
+    std::atomic<int> logged = {0};
+    hr::Thread::ptr producer(new hr::Thread([&]() {
+        for(int i = 0; i < 100; ++i) {
+            HR_LOG_INFO(logger) << "block i=" << i;
+            ++logged;
+        }
+    }, "producer"));
+    usleep(50 * 1000);
+    SYLAR_ASSERT2(logged == 64, "block waits");
+
+    reader.start();
+    producer->join();
+    SYLAR_ASSERT2(logged == 100 && appender->getDropped() == 0, "block no drop");
+    logger->delAppender(appender);
+    appender.reset();
+    const std::string& data = reader.data();
+    SYLAR_ASSERT2(count_lines(data) == 1 + 100
+            && data.find("block i=99\n") != std::string::npos, "block written");
+}
+
+//FATAL日志返回前已经写入文件,之前的日志也一起写入
+static void test_flush_on_fatal() {
+    const std::string path = "/tmp/test_log_async.log";
+    unlink(path.c_str());
+    hr::AsyncLogAppender::ptr appender(new hr::AsyncLogAppender(path));
+    hr::Logger::ptr logger = make_logger(appender);
+    for(int i = 0; i < 1000; ++i) {
+        HR_LOG_INFO(logger) << "before fatal i=" << i;
+    }
+    HR_LOG_FATAL(logger) << "fatal";
+    std::string data = read_file(path);
+    SYLAR_ASSERT2(count_lines(data) == 1001
+            && data.compare(data.size() - 12, 12, "FATAL fatal\n") == 0, "flush on fatal");
+
+    //调高同步刷新级别后ERROR也同步写入
+    appender->setFlushLevel(hr::LogLevel::ERROR);
+    HR_LOG_ERROR(logger) << "error";
+    data = read_file(path);
+    SYLAR_ASSERT2(count_lines(data) == 1002
+            && data.compare(data.size() - 12, 12, "ERROR error\n") == 0, "flush on error");
+    unlink(path.c_str());
+}
+
+//析构时写完队列中剩下的日志
+static void test_destructor_drain() {
+    const std::string path = "/tmp/test_log_async.log";
+    unlink(path.c_str());
+    hr::AsyncLogAppender::ptr appender(new hr::AsyncLogAppender(path, 1024));
+    hr::Logger::ptr logger = make_logger(appender);
+    for(int i = 0; i < 100000; ++i) {
+        HR_LOG_INFO(logger) << "drain i=" << i;
+    }
+    logger->delAppender(appender);
+    appender.reset();
+    std::string data = read_file(path);
+    SYLAR_ASSERT2(count_lines(data) == 100000
+            && data.find("drain i=99999\n") != std::string::npos, "destructor drain");
+    unlink(path.c_str());
+}
+
+int main(int argc, char** argv) {
+    test_drop();
+    test_sample();
+    test_block();
+    test_flush_on_fatal();
+    test_destructor_drain();
+    HR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "./sylar/sylar.h"
+#include <fstream>
+#include <thread>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+//改造前的FileLogAppender，作为对比基准
+//每条日志在锁内格式化到ofstream，距上次打开超过3秒就重新打开(会清空文件)
+class OldFileLogAppender : public hr::LogAppender {
+public:
+    typedef std::shared_ptr<OldFileLogAppender> ptr;
+    OldFileLogAppender(const std::string& filename)
+        :m_filename(filename) {
+        reopen();
+    }
+
+    void log(hr::Logger::ptr logger, hr::LogLevel::Level level, hr::LogEvent::ptr event) override {
+        if(level >= m_level) {
+            uint64_t now = event->getTime();
+            if(now >= (m_lastTime + 3)) {
+                reopen();
+                m_lastTime = now;
+            }
+            MutexType::Lock lock(m_mutex);
+            m_formatter->format(m_filestream, logger, level, event);
+        }
+    }
+
+    std::string toYamlString() override {
+        return "";
+    }
+
+    bool reopen() {
+        MutexType::Lock lock(m_mutex);
+        if(m_filestream) {
+            m_filestream.close();
+        }
+        m_filestream.open(m_filename);
+        return !!m_filestream;
+    }
+private:
+    std::string m_filename;
+    std::ofstream m_filestream;
+    uint64_t m_lastTime = 0;
+};
+
+//多个线程同时写同一个日志器，统计每秒写入行数
+double bench(hr::Logger::ptr logger, int threads, int lines) {
+    uint64_t start = hr::GetCurrentUS();
+    std::vector<std::thread> ths;
+    for(int t = 0; t < threads; ++t) {
+        ths.emplace_back([logger, t, lines](){
+            for(int i = 0; i < lines; ++i) {
+                HR_LOG_INFO(logger) << "bench line thread=" << t << " i=" << i;
+            }
+        });
+    }
+    for(auto& i : ths) {
+        i.join();
+    }
+    uint64_t used = hr::GetCurrentUS() - start;
+    return (double)threads * lines * 1e6 / used;
+}
+
+int main(int argc, char** argv) {
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int lines = argc > 2 ? atoi(argv[2]) : 200000;
+    std::string path = argc > 3 ? argv[3] : "/tmp/test_log_bench.log";
+
+    hr::Logger::ptr logger = HR_LOG_NAME("bench");
+    //旧实现打开时会清空文件，单独用一个文件
+    OldFileLogAppender::ptr old(new OldFileLogAppender(path + ".old"));
+    logger->addAppender(old);
+    double old_rate = bench(logger, threads, lines);
+
+    logger->clearAppenders();
+    hr::FileLogAppender::ptr file(new hr::FileLogAppender(path));
+    logger->addAppender(file);
+    double file_rate = bench(logger, threads, lines);
+
+    //每条日志都直接写入文件
+    logger->clearAppenders();
+    hr::FileLogAppender::ptr unbuffered(new hr::FileLogAppender(path));
+    unbuffered->setFlushInterval(0);
+    logger->addAppender(unbuffered);
+    double unbuffered_rate = bench(logger, threads, lines);
+
+    logger->clearAppenders();
+    hr::AsyncLogAppender::ptr async(new hr::AsyncLogAppender(path));
+    logger->addAppender(async);
+    double async_rate = bench(logger, threads, lines);
+    async->flush();
+
+    HR_LOG_INFO(g_logger) << "threads=" << threads << " lines=" << (uint64_t)threads * lines;
+    HR_LOG_INFO(g_logger) << "before(reopen every 3s): " << (uint64_t)old_rate << " lines/s";
+    HR_LOG_INFO(g_logger) << "FileLogAppender:  " << (uint64_t)file_rate << " lines/s";
+    HR_LOG_INFO(g_logger) << "FileLogAppender(unbuffered): " << (uint64_t)unbuffered_rate << " lines/s";
+    HR_LOG_INFO(g_logger) << "AsyncLogAppender: " << (uint64_t)async_rate << " lines/s";
+    return 0;
+}
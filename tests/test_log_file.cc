@@ -0,0 +1,196 @@
+#include "sylar/sylar.h"
+#include "sylar/macro.h"
+#include <algorithm>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static const std::string s_dir = "/tmp/test_log_file";
+static const std::string s_path = s_dir + "/app.log";
+
+static hr::Logger::ptr make_logger(hr::FileLogAppender::ptr appender) {
+    hr::Logger::ptr logger(new hr::Logger("file_test"));
+    logger->setFormatter(hr::LogFormatter::ptr(new hr::LogFormatter("%m%n")));
+    logger->addAppender(appender);
+    return logger;
+}
+
+static std::string read_file(const std::string& path) {
+    std::string rt;
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        return rt;
+    }
+    char buf[4096];
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0) {
+        rt.append(buf, n);
+    }
+    close(fd);
+    return rt;
+}
+
+static void write_file(const std::string& path, const std::string& data) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ssize_t rt = write(fd, data.c_str(), data.size());
+    close(fd);
+    SYLAR_ASSERT2(rt == (ssize_t)data.size(), "write " << path);
+}
+
+static size_t count_lines(const std::string& str) {
+    return std::count(str.begin(), str.end(), '\n');
+}
+
+static uint64_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) ? 0 : st.st_size;
+}
+
+//目录下除s_path外的文件(滚动出来的文件)
+static std::vector<std::string> list_rotated() {
+    std::vector<std::string> rt;
+    DIR* dir = opendir(s_dir.c_str());
+    if(!dir) {
+        return rt;
+    }
+    while(dirent* dp = readdir(dir)) {
+        std::string name = s_dir + "/" + dp->d_name;
+        if(name != s_path && name.compare(0, s_path.size() + 1, s_path + ".") == 0) {
+            rt.push_back(name);
+        }
+    }
+    closedir(dir);
+    return rt;
+}
+
+static void clean() {
+    for(auto& i : list_rotated()) {
+        unlink(i.c_str());
+    }
+    unlink(s_path.c_str());
+}
+
+//打开时追加，不清空已有内容
+static void test_append() {
+    clean();
+    write_file(s_path, "existing\n");
+    hr::FileLogAppender::ptr file(new hr::FileLogAppender(s_path));
+    hr::Logger::ptr logger = make_logger(file);
+    for(int i = 0; i < 3; ++i) {
+        HR_LOG_INFO(logger) << "append i=" << i;
+    }
+    file->flush();
+    //同一个文件再打开一次也不清空
+    hr::FileLogAppender::ptr file2(new hr::FileLogAppender(s_path));
+    file->reopen();
+    HR_LOG_INFO(logger) << "append after reopen";
+    file->flush();
+    logger->delAppender(file);
+
+    std::string data = read_file(s_path);
+    SYLAR_ASSERT2(data == "existing\nappend i=0\nappend i=1\nappend i=2\nappend after reopen\n", "append");
+}
+
+//超过最大大小后滚动，每个滚动出去的文件大小在[max_size, max_size+一行)之间
+static void test_rotate_size() {
+    clean();
+    const uint64_t max_size = 4096;
+    hr::FileLogAppender::ptr file(new hr::FileLogAppender(s_path));
+    file->setMaxSize(max_size);
+    file->setFlushInterval(0);
+    hr::Logger::ptr logger = make_logger(file);
+    for(int i = 0; i < 2000; ++i) {
+        HR_LOG_INFO(logger) << "rotate line i=" << i;
+    }
+    file->flush();
+    logger->delAppender(file);
+
+    std::vector<std::string> rotated = list_rotated();
+    size_t lines = count_lines(read_file(s_path));
+    bool sizes = file_size(s_path) < max_size;
+    for(auto& i : rotated) {
+        uint64_t size = file_size(i);
+        sizes = sizes && size >= max_size && size < max_size + 32;
+        lines += count_lines(read_file(i));
+    }
+    HR_LOG_INFO(g_logger) << "rotate: files=" << rotated.size() << " lines=" << lines;
+    SYLAR_ASSERT2(rotated.size() >= 5, "rotate files");
+    SYLAR_ASSERT2(sizes, "rotate sizes");
+    SYLAR_ASSERT2(lines == 2000, "rotate no loss");
+}
+
+//文件被外部改名(logrotate)后通知重新打开，之后的日志写到新文件
+static void test_reopen_after_rename() {
+    clean();
+    hr::FileLogAppender::ptr file(new hr::FileLogAppender(s_path));
+    hr::Logger::ptr logger = make_logger(file);
+    for(int i = 0; i < 10; ++i) {
+        HR_LOG_INFO(logger) << "old i=" << i;
+    }
+    file->flush();
+    rename(s_path.c_str(), (s_path + ".1").c_str());
+
+    //改名后重新打开前，日志还写到改名后的文件
+    HR_LOG_INFO(logger) << "before reopen";
+    hr::FileLogAppender::ReopenAll();
+    for(int i = 0; i < 5; ++i) {
+        HR_LOG_INFO(logger) << "new i=" << i;
+    }
+    file->flush();
+    logger->delAppender(file);
+
+    std::string old_data = read_file(s_path + ".1");
+    std::string new_data = read_file(s_path);
+    SYLAR_ASSERT2(count_lines(old_data) == 11
+            && old_data.find("before reopen\n") != std::string::npos, "reopen old file");
+    SYLAR_ASSERT2(count_lines(new_data) == 5
+            && new_data.compare(0, 8, "new i=0\n") == 0, "reopen new file");
+}
+
+//缓冲区满、ERROR级别、超过刷新间隔时写入文件，不依赖后台线程
+static void test_flush_trigger() {
+    clean();
+    hr::FileLogAppender::ptr file(new hr::FileLogAppender(s_path));
+    file->setBufferSize(1024);
+    file->setFlushInterval(60 * 1000);
+    hr::Logger::ptr logger = make_logger(file);
+
+    HR_LOG_INFO(logger) << "buffered";
+    SYLAR_ASSERT2(file_size(s_path) == 0, "buffered");
+    HR_LOG_ERROR(logger) << "error";
+    SYLAR_ASSERT2(read_file(s_path) == "buffered\nerror\n", "flush on error");
+
+    uint64_t size = file_size(s_path);
+    int n = 0;
+    while(file_size(s_path) == size) {
+        HR_LOG_INFO(logger) << "fill buffer n=" << n++;
+    }
+    SYLAR_ASSERT2(file_size(s_path) - size >= 1024, "flush on buffer size");
+
+    file->flush();
+    file->setFlushInterval(50);
+    size = file_size(s_path);
+    HR_LOG_INFO(logger) << "interval 1";
+    SYLAR_ASSERT2(file_size(s_path) == size, "interval buffered");
+    usleep(100 * 1000);
+    HR_LOG_INFO(logger) << "interval 2";
+    std::string data = read_file(s_path);
+    SYLAR_ASSERT2(data.size() >= 22
+            && data.compare(data.size() - 22, 22, "interval 1\ninterval 2\n") == 0, "flush on interval");
+    logger->delAppender(file);
+}
+
+int main(int argc, char** argv) {
+    mkdir(s_dir.c_str(), 0755);
+    test_append();
+    test_rotate_size();
+    test_reopen_after_rename();
+    test_flush_trigger();
+    clean();
+    rmdir(s_dir.c_str());
+    HR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
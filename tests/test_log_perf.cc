@@ -0,0 +1,68 @@
+#include "./sylar/sylar.h"
+#include <atomic>
+#include <new>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+//统计日志调用过程中的内存分配次数
+static std::atomic<uint64_t> s_allocs = {0};
+
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size ? size : 1);
+    if(!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+struct Result {
+    double ns;
+    double allocs;
+};
+
+//单线程连续写n条日志，统计每条日志的耗时和内存分配次数
+Result bench(hr::Logger::ptr logger, uint64_t n) {
+    //预热，让线程内的日志事件和缓冲区分配好
+    for(int i = 0; i < 1000; ++i) {
+        HR_LOG_INFO(logger) << "warm up i=" << i;
+    }
+    uint64_t allocs = s_allocs;
+    uint64_t start = hr::GetCurrentUS();
+    for(uint64_t i = 0; i < n; ++i) {
+        HR_LOG_INFO(logger) << "perf line i=" << i << " value=" << 3.25;
+        //避免编译器把级别判断提到循环外
+        asm volatile("" ::: "memory");
+    }
+    uint64_t used = hr::GetCurrentUS() - start;
+    Result rt;
+    rt.ns = used * 1000.0 / n;
+    rt.allocs = (double)(s_allocs - allocs) / n;
+    return rt;
+}
+
+int main(int argc, char** argv) {
+    uint64_t n = argc > 1 ? atoll(argv[1]) : 1000000;
+    std::string path = argc > 2 ? argv[2] : "/dev/null";
+
+    hr::Logger::ptr logger = HR_LOG_NAME("perf");
+    hr::FileLogAppender::ptr file(new hr::FileLogAppender(path));
+    logger->addAppender(file);
+    Result enabled = bench(logger, n);
+    file->flush();
+
+    //日志级别过滤掉，只有级别判断的开销
+    logger->setLevel(hr::LogLevel::ERROR);
+    Result disabled = bench(logger, n * 10);
+
+    HR_LOG_INFO(g_logger) << "calls=" << n << " file=" << path;
+    HR_LOG_INFO(g_logger) << "enabled:  " << enabled.ns << " ns/call "
+                          << enabled.allocs << " allocs/call";
+    HR_LOG_INFO(g_logger) << "disabled: " << disabled.ns << " ns/call "
+                          << disabled.allocs << " allocs/call";
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "./sylar/sylar.h"
+#include "./sylar/http/servlet.h"
+#include <fnmatch.h>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+//原来的分发方式: 精准匹配查hash表,然后按顺序fnmatch所有模糊匹配规则
+class LinearDispatch {
+public:
+    void addServlet(const std::string& uri, hr::http::Servlet::ptr slt) {
+        hr::RWMutex::WriteLock lock(m_mutex);
+        m_datas[uri] = slt;
+    }
+
+    void addGlobServlet(const std::string& uri, hr::http::Servlet::ptr slt) {
+        hr::RWMutex::WriteLock lock(m_mutex);
+        m_globs.push_back(std::make_pair(uri, slt));
+    }
+
+    hr::http::Servlet::ptr getMatchedServlet(const std::string& uri) {
+        hr::RWMutex::ReadLock lock(m_mutex);
+        auto mit = m_datas.find(uri);
+        if(mit != m_datas.end()) {
+            return mit->second;
+        }
+        for(auto& i : m_globs) {
+            if(!fnmatch(i.first.c_str(), uri.c_str(), 0)) {
+                return i.second;
+            }
+        }
+        return m_default;
+    }
+private:
+    hr::RWMutex m_mutex;
+    std::unordered_map<std::string, hr::http::Servlet::ptr> m_datas;
+    std::vector<std::pair<std::string, hr::http::Servlet::ptr> > m_globs;
+    hr::http::Servlet::ptr m_default;
+};
+
+class NamedServlet : public hr::http::Servlet {
+public:
+    NamedServlet(const std::string& name)
+        :Servlet(name) {}
+    int32_t handle(hr::http::HttpRequest::ptr request
+                   , hr::http::HttpResponse::ptr response
+                   , hr::http::HttpSession::ptr session) override {
+        return 0;
+    }
+};
+
+static std::string name_of(hr::http::Servlet::ptr slt) {
+    return slt ? slt->getName() : "default";
+}
+
+template<class Dispatch>
+double bench(Dispatch& dispatch, const std::string& uri, int n) {
+    uint64_t start = hr::GetCurrentUS();
+    for(int i = 0; i < n; ++i) {
+        auto slt = dispatch.getMatchedServlet(uri);
+        asm volatile("" ::: "memory");
+    }
+    return (hr::GetCurrentUS() - start) * 1000.0 / n;
+}
+
+//一半精准匹配,四分之一前缀通配,四分之一带参数
+//原来的分发器用 /user{i}/*/profile 模拟参数路由
+void run(int count) {
+    LinearDispatch linear;
+    hr::http::ServletDispatch router;
+    int exact = count / 2;
+    int glob = count / 4;
+    int param = count - exact - glob;
+    for(int i = 0; i < exact; ++i) {
+        std::string uri = "/api/v1/resource" + std::to_string(i) + "/list";
+        hr::http::Servlet::ptr slt(new NamedServlet(uri));
+        linear.addServlet(uri, slt);
+        router.addServlet(uri, slt);
+    }
+    for(int i = 0; i < glob; ++i) {
+        std::string uri = "/static" + std::to_string(i) + "/*";
+        hr::http::Servlet::ptr slt(new NamedServlet(uri));
+        linear.addGlobServlet(uri, slt);
+        router.addGlobServlet(uri, slt);
+    }
+    for(int i = 0; i < param; ++i) {
+        std::string prefix = "/user" + std::to_string(i);
+        hr::http::Servlet::ptr slt(new NamedServlet(prefix));
+        linear.addGlobServlet(prefix + "/*/profile", slt);
+        router.addRoute(prefix + "/:id/profile", slt);
+    }
+
+    std::vector<std::pair<std::string, std::string> > uris = {
+        {"exact", "/api/v1/resource" + std::to_string(exact - 1) + "/list"},
+        {"glob", "/static" + std::to_string(glob - 1) + "/js/app.js"},
+        {"param", "/user" + std::to_string(param - 1) + "/12345/profile"},
+        {"miss", "/not/found/path"}
+    };
+    int n = std::max(2000, 2000000 / count);
+    for(auto& i : uris) {
+        std::string a = name_of(linear.getMatchedServlet(i.second));
+        std::string b = name_of(router.getMatchedServlet(i.second));
+        if(a != b && !(a == "default" && b == "NotFoundServlet")) {
+            HR_LOG_ERROR(g_logger) << "mismatch uri=" << i.second
+                << " linear=" << a << " router=" << b;
+        }
+        double old_ns = bench(linear, i.second, n);
+        double new_ns = bench(router, i.second, n);
+        HR_LOG_INFO(g_logger) << "routes=" << count << " " << i.first
+            << ": linear " << old_ns << " ns  radix " << new_ns << " ns";
+    }
+
+    hr::http::HttpRequest::ptr req(new hr::http::HttpRequest);
+    router.getMatchedServlet(uris[2].second, req.get());
+    if(req->getParam("id") != "12345") {
+        HR_LOG_ERROR(g_logger) << "route param id=" << req->getParam("id");
+    }
+}
+
+//每次修改规则后查找都会重建快照,旧快照要释放
+//快照持有creator的引用,引用数不随重建次数增长说明旧快照已经释放
+void check_rebuild() {
+    hr::http::ServletDispatch router;
+    router.addServlet("/keep", hr::http::Servlet::ptr(new NamedServlet("keep")));
+    for(int i = 0; i < 1000; ++i) {
+        router.addServlet("/tmp" + std::to_string(i), hr::http::Servlet::ptr(new NamedServlet("tmp")));
+        router.getMatchedServlet("/keep");
+    }
+    std::map<std::string, hr::http::IServletCreator::ptr> infos;
+    router.listAllServletCreator(infos);
+    //规则表 + 当前快照 + infos
+    long refs = infos["/keep"].use_count();
+    HR_LOG_INFO(g_logger) << "rebuild 1000 times: creator refs=" << refs;
+    if(refs != 3) {
+        HR_LOG_ERROR(g_logger) << "old route tables not released, refs=" << refs;
+    }
+}
+
+int main(int argc, char** argv) {
+    check_rebuild();
+    if(argc > 1) {
+        run(atoi(argv[1]));
+        return 0;
+    }
+    run(10);
+    run(100);
+    run(1000);
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include "./sylar/sylar.h"
+#include <atomic>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_done = {0};
+
+//叶子任务
+void leaf() {
+    ++s_done;
+}
+
+//每个生产任务在调度线程内扇出一批叶子任务
+void producer(int fanout) {
+    hr::Scheduler* sc = hr::Scheduler::GetThis();
+    for(int i = 0; i < fanout; ++i) {
+        sc->schedule(&leaf);
+    }
+    ++s_done;
+}
+
+double run(bool work_stealing, int threads, int producers, int fanout) {
+    hr::Config::Lookup<bool>("scheduler.work_stealing")->setValue(work_stealing);
+    s_done = 0;
+    uint64_t start = hr::GetCurrentMS();
+    {
+        hr::IOManager iom(threads, false, "bench");
+        for(int i = 0; i < producers; ++i) {
+            iom.schedule(std::bind(&producer, fanout));
+        }
+        //析构时stop，等待所有任务执行完成
+    }
+    uint64_t used = hr::GetCurrentMS() - start;
+    uint64_t total = (uint64_t)producers * (fanout + 1);
+    if(s_done != total) {
+        HR_LOG_ERROR(g_logger) << "done=" << s_done << " expect=" << total;
+    }
+    return used ? total * 1000.0 / used : 0;
+}
+
+int main(int argc, char** argv) {
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int producers = argc > 2 ? atoi(argv[2]) : 1000;
+    int fanout = argc > 3 ? atoi(argv[3]) : 1000;
+
+    double global = run(false, threads, producers, fanout);
+    double stealing = run(true, threads, producers, fanout);
+    HR_LOG_INFO(g_logger) << "threads=" << threads
+        << " tasks=" << (uint64_t)producers * (fanout + 1);
+    HR_LOG_INFO(g_logger) << "global queue:  " << (uint64_t)global << " tasks/s";
+    HR_LOG_INFO(g_logger) << "work stealing: " << (uint64_t)stealing << " tasks/s";
+    return 0;
+}
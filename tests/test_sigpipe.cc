@@ -0,0 +1,116 @@
+#include "sylar/sylar.h"
+#include "sylar/socket.h"
+#include "sylar/macro.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/uio.h>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static const std::string s_file = "/tmp/test_sigpipe.dat";
+
+//建立一条连接后对端立即关闭,返回本端
+static hr::Socket::ptr make_broken(hr::Socket::ptr listener, hr::Address::ptr addr) {
+    hr::Socket::ptr sock = hr::Socket::CreateTCP(addr);
+    if(!sock->connect(addr)) {
+        return nullptr;
+    }
+    hr::Socket::ptr peer = listener->accept();
+    if(!peer) {
+        return nullptr;
+    }
+    peer->close();
+    usleep(10 * 1000);
+    return sock;
+}
+
+//对端关闭后一直写,第一次写触发RST,之后的写返回EPIPE而不是杀死进程
+template<class Fun>
+static void write_until_epipe(const std::string& name, hr::Socket::ptr listener
+                              ,hr::Address::ptr addr, Fun fun) {
+    hr::Socket::ptr sock = make_broken(listener, addr);
+    SYLAR_ASSERT2(sock, name << " connect");
+    int rt = 0;
+    for(int i = 0; i < 100 && (rt = fun(sock)) > 0; ++i) {
+        usleep(1000);
+    }
+    int err = errno;
+    SYLAR_ASSERT2(rt < 0 && err == EPIPE, name << " rt=" << rt << " errno=" << err);
+    HR_LOG_INFO(g_logger) << name << ": EPIPE";
+    sock->close();
+}
+
+//Socket的各个发送接口,hook开启时还有socket上直接write/writev
+//没有开启hook的线程创建的socket不在FdManager中,直接write由调用者自己处理
+static void run_all(const std::string& prefix, hr::Socket::ptr listener, hr::Address::ptr addr, bool raw) {
+    char buf[1024] = {0};
+    write_until_epipe(prefix + "Socket::send", listener, addr, [&](hr::Socket::ptr sock) {
+        return sock->send(buf, sizeof(buf));
+    });
+    write_until_epipe(prefix + "Socket::send iovec", listener, addr, [&](hr::Socket::ptr sock) {
+        iovec iov[2] = {{buf, 512}, {buf + 512, 512}};
+        return sock->send(iov, 2);
+    });
+    write_until_epipe(prefix + "Socket::sendFile", listener, addr, [&](hr::Socket::ptr sock) {
+        int fd = open(s_file.c_str(), O_RDONLY);
+        off_t offset = 0;
+        int rt = sock->sendFile(fd, &offset, sizeof(buf));
+        int err = errno;
+        close(fd);
+        errno = err;
+        return rt;
+    });
+    if(!raw) {
+        return;
+    }
+    write_until_epipe(prefix + "write", listener, addr, [&](hr::Socket::ptr sock) {
+        return (int)write(sock->getSocket(), buf, sizeof(buf));
+    });
+    write_until_epipe(prefix + "writev", listener, addr, [&](hr::Socket::ptr sock) {
+        iovec iov[2] = {{buf, 512}, {buf + 512, 512}};
+        return (int)writev(sock->getSocket(), iov, 2);
+    });
+}
+
+static hr::Socket::ptr make_listener(hr::Address::ptr addr) {
+    hr::Socket::ptr listener = hr::Socket::CreateTCP(addr);
+    while(!listener->bind(addr)) {
+        sleep(2);
+    }
+    listener->listen();
+    return listener;
+}
+
+int main(int argc, char** argv) {
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    //框架不改SIGPIPE的处理方式,由各个发送路径自己避免
+    struct sigaction sa;
+    sigaction(SIGPIPE, nullptr, &sa);
+    SYLAR_ASSERT2(sa.sa_handler == SIG_DFL, "SIGPIPE default");
+
+    int fd = open(s_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    std::string data(1024, 'f');
+    ssize_t rt = write(fd, data.data(), data.size());
+    close(fd);
+    SYLAR_ASSERT2(rt == (ssize_t)data.size(), "write file");
+
+    hr::Address::ptr addr = hr::Address::LookupAnyIPAddress("127.0.0.1:8053");
+    //没有开启hook的线程
+    {
+        hr::Socket::ptr listener = make_listener(addr);
+        run_all("no hook ", listener, addr, false);
+        listener->close();
+    }
+    //IOManager中开启hook的协程
+    {
+        hr::IOManager iom(1, false, "sigpipe");
+        iom.schedule([addr]() {
+            hr::Socket::ptr listener = make_listener(addr);
+            run_all("hook ", listener, addr, true);
+            listener->close();
+        });
+    }
+    unlink(s_file.c_str());
+    HR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}
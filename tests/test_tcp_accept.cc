@@ -0,0 +1,158 @@
+#include "sylar/tcp_server.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "sylar/http/http_server.h"
+#include "sylar/http/http_connection.h"
+#include "sylar/macro.h"
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static int s_count = 10000;
+static int s_fibers = 32;
+//连接一直保持到客户端关闭
+class HoldServer : public hr::TcpServer {
+public:
+    typedef std::shared_ptr<HoldServer> ptr;
+protected:
+    void handleClient(hr::Socket::ptr client) override {
+        char buf[64];
+        while(client->recv(buf, sizeof(buf)) > 0);
+        client->close();
+    }
+};
+
+//接收后马上关闭
+class CloseServer : public hr::TcpServer {
+public:
+    typedef std::shared_ptr<CloseServer> ptr;
+protected:
+    void handleClient(hr::Socket::ptr client) override {
+        client->close();
+    }
+};
+
+void test_admission() {
+    auto addr = hr::Address::LookupAnyIPAddress("127.0.0.1:8037");
+    HoldServer::ptr server(new HoldServer);
+    server->setMaxConnections(8);
+    while(!server->bind(addr)) {
+        sleep(2);
+    }
+    server->start();
+
+    std::vector<hr::Socket::ptr> clients;
+    for(int i = 0; i < 20; ++i) {
+        hr::Socket::ptr sock = hr::Socket::CreateTCP(addr);
+        sock->connect(addr);
+        clients.push_back(sock);
+    }
+    usleep(100 * 1000);
+    HR_LOG_INFO(g_logger) << server->toString();
+    SYLAR_ASSERT2(server->getActiveCount() == 8
+            && server->getAcceptedCount() == 8 && server->getRejectedCount() == 12, "admission limit");
+
+    //被拒绝的连接读到EOF,接收的连接读超时
+    int eof = 0;
+    for(auto& i : clients) {
+        char c;
+        i->setRecvTimeout(50);
+        if(i->recv(&c, 1) == 0) {
+            ++eof;
+        }
+    }
+    SYLAR_ASSERT2(eof == 12, "rejected see eof");
+
+    clients.clear();
+    usleep(100 * 1000);
+    SYLAR_ASSERT2(server->getActiveCount() == 0, "active released");
+
+    hr::Socket::ptr sock = hr::Socket::CreateTCP(addr);
+    sock->connect(addr);
+    usleep(50 * 1000);
+    SYLAR_ASSERT2(server->getActiveCount() == 1
+            && server->getAcceptedCount() == 9, "admit after release");
+    sock->close();
+    usleep(50 * 1000);
+    server->stop();
+}
+
+void test_http_503() {
+    auto addr = hr::Address::LookupAnyIPAddress("127.0.0.1:8038");
+    hr::http::HttpServer::ptr server(new hr::http::HttpServer(true));
+    server->setMaxConnections(1);
+    while(!server->bind(addr)) {
+        sleep(2);
+    }
+    server->start();
+
+    hr::Socket::ptr hold = hr::Socket::CreateTCP(addr);
+    hold->connect(addr);
+    usleep(50 * 1000);
+    auto r = hr::http::HttpConnection::DoGet("http://127.0.0.1:8038/", 1000);
+    SYLAR_ASSERT2(r->result == 0 && r->response
+            && r->response->getStatus() == hr::http::HttpStatus::SERVICE_UNAVAILABLE, "http 503");
+    hold->close();
+    usleep(50 * 1000);
+    r = hr::http::HttpConnection::DoGet("http://127.0.0.1:8038/", 1000);
+    SYLAR_ASSERT2(r->result == 0 && r->response
+            && r->response->getStatus() == hr::http::HttpStatus::NOT_FOUND, "http after release");
+    server->stop();
+}
+
+//多个协程不停建立连接,比较每次唤醒接收一个和批量接收
+static void bench(const std::string& name, uint32_t batch, int port) {
+    auto addr = hr::Address::LookupAnyIPAddress("127.0.0.1:" + std::to_string(port));
+    CloseServer::ptr server(new CloseServer);
+    server->setAcceptBatch(batch);
+    while(!server->bind(addr)) {
+        sleep(2);
+    }
+    server->start();
+
+    std::atomic<int> left(s_fibers);
+    std::atomic<int> errors(0);
+    hr::Fiber::ptr self = hr::Fiber::GetThis();
+    hr::IOManager* iom = hr::IOManager::GetThis();
+    uint64_t start = hr::GetCurrentUS();
+    for(int f = 0; f < s_fibers; ++f) {
+        iom->schedule([&]() {
+            for(int i = 0; i < s_count / s_fibers; ++i) {
+                hr::Socket::ptr sock = hr::Socket::CreateTCP(addr);
+                char c;
+                if(!sock->connect(addr) || sock->recv(&c, 1) != 0) {
+                    ++errors;
+                }
+            }
+            if(--left == 0) {
+                iom->schedule(self);
+            }
+        });
+    }
+    hr::Fiber::YieldToHold();
+    double sec = (hr::GetCurrentUS() - start) / 1000000.0;
+    int total = s_count / s_fibers * s_fibers;
+    HR_LOG_INFO(g_logger) << name << ": batch=" << batch << " connections=" << total
+        << " errors=" << errors << " conn/s=" << (uint64_t)(total / sec)
+        << " accepted=" << server->getAcceptedCount();
+    SYLAR_ASSERT2(errors == 0 && server->getAcceptedCount() == (uint64_t)total, name);
+    server->stop();
+}
+
+void run() {
+    test_admission();
+    test_http_503();
+    bench("accept one", 1, 8040);
+    bench("accept batch", 64, 8041);
+    HR_LOG_INFO(g_logger) << "all ok";
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_count = atoi(argv[1]);
+    }
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    hr::IOManager iom(2, true, "accept");
+    iom.schedule(run);
+    return 0;
+}
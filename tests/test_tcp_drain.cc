@@ -0,0 +1,220 @@
+#include "sylar/tcp_server.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "sylar/http/http_server.h"
+#include "sylar/http/http_connection.h"
+#include "sylar/macro.h"
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static hr::http::HttpServer::ptr create_server(const std::string& addrstr
+                                               ,const std::string& body) {
+    auto addr = hr::Address::LookupAnyIPAddress(addrstr);
+    hr::http::HttpServer::ptr server(new hr::http::HttpServer(true));
+    auto dispatch = server->getServletDispatch();
+    dispatch->addServlet("/slow", [](hr::http::HttpRequest::ptr req
+                ,hr::http::HttpResponse::ptr rsp
+                ,hr::http::HttpSession::ptr session) {
+        usleep(300 * 1000);
+        rsp->setBody("slow");
+        return 0;
+    });
+    dispatch->addServlet("/hang", [](hr::http::HttpRequest::ptr req
+                ,hr::http::HttpResponse::ptr rsp
+                ,hr::http::HttpSession::ptr session) {
+        usleep(1000 * 1000);
+        rsp->setBody("hang");
+        return 0;
+    });
+    dispatch->addGlobServlet("/*", [body](hr::http::HttpRequest::ptr req
+                ,hr::http::HttpResponse::ptr rsp
+                ,hr::http::HttpSession::ptr session) {
+        rsp->setBody(body);
+        return 0;
+    });
+    if(!addrstr.empty()) {
+        while(!server->bind(addr)) {
+            sleep(2);
+        }
+    }
+    return server;
+}
+
+static hr::http::HttpConnection::ptr connect(const std::string& addrstr) {
+    auto addr = hr::Address::LookupAnyIPAddress(addrstr);
+    hr::Socket::ptr sock = hr::Socket::CreateTCP(addr);
+    if(!sock->connect(addr)) {
+        return nullptr;
+    }
+    sock->setRecvTimeout(3000);
+    return std::make_shared<hr::http::HttpConnection>(sock);
+}
+
+static hr::http::HttpResponse::ptr get(hr::http::HttpConnection::ptr conn
+                                       ,const std::string& path) {
+    hr::http::HttpRequest::ptr req(new hr::http::HttpRequest);
+    req->setPath(path);
+    req->setClose(false);
+    req->setHeader("Host", "127.0.0.1");
+    if(conn->sendRequest(req) <= 0) {
+        return nullptr;
+    }
+    return conn->recvResponse();
+}
+
+//空闲连接马上关闭,处理中的请求完成后关闭
+void test_drain() {
+    const std::string addr = "127.0.0.1:8042";
+    auto server = create_server(addr, "ok");
+    server->start();
+
+    std::vector<hr::http::HttpConnection::ptr> idles;
+    for(int i = 0; i < 3; ++i) {
+        auto conn = connect(addr);
+        auto rsp = conn ? get(conn, "/warm") : nullptr;
+        if(rsp && rsp->getBody() == "ok") {
+            idles.push_back(conn);
+        }
+    }
+    SYLAR_ASSERT2(idles.size() == 3, "keepalive connections");
+
+    hr::http::HttpResponse::ptr slow_rsp;
+    bool slow_done = false;
+    hr::IOManager::GetThis()->schedule([&]() {
+        auto conn = connect(addr);
+        slow_rsp = conn ? get(conn, "/slow") : nullptr;
+        slow_done = true;
+    });
+    usleep(50 * 1000);
+
+    uint64_t start = hr::GetCurrentMS();
+    bool drained = server->drain(2000);
+    uint64_t used = hr::GetCurrentMS() - start;
+    HR_LOG_INFO(g_logger) << "drain used " << used << "ms";
+    for(int i = 0; i < 10 && !slow_done; ++i) {
+        usleep(10 * 1000);
+    }
+    SYLAR_ASSERT2(drained && used < 1000 && server->getActiveCount() == 0, "drain finished");
+    SYLAR_ASSERT2(slow_done && slow_rsp
+            && slow_rsp->getBody() == "slow" && slow_rsp->isClose(), "in-flight request served");
+
+    int stale = 0;
+    for(auto& i : idles) {
+        if(i->isStale()) {
+            ++stale;
+        }
+    }
+    SYLAR_ASSERT2(stale == 3, "idle connections closed");
+    hr::http::HttpConnection::ptr late = connect(addr);
+    SYLAR_ASSERT2(late == nullptr, "listener closed");
+}
+
+//超时后关闭还在处理的连接
+void test_deadline() {
+    const std::string addr = "127.0.0.1:8043";
+    auto server = create_server(addr, "ok");
+    server->start();
+
+    hr::http::HttpResponse::ptr rsp;
+    uint64_t done = 0;
+    hr::IOManager::GetThis()->schedule([&]() {
+        auto conn = connect(addr);
+        rsp = conn ? get(conn, "/hang") : nullptr;
+        done = hr::GetCurrentMS();
+    });
+    usleep(50 * 1000);
+
+    uint64_t start = hr::GetCurrentMS();
+    bool drained = server->drain(200);
+    uint64_t used = hr::GetCurrentMS() - start;
+    usleep(100 * 1000);
+    HR_LOG_INFO(g_logger) << "drain used " << used << "ms client done after "
+        << (done ? done - start : 0) << "ms";
+    SYLAR_ASSERT2(!drained && used >= 200 && used < 500, "drain timeout");
+    SYLAR_ASSERT2(done && !rsp && done - start < 500, "client sees close");
+
+    while(server->getActiveCount() > 0) {
+        usleep(50 * 1000);
+    }
+}
+
+//监听socket交给新的服务器,旧服务器drain,客户端没有错误
+void test_handoff() {
+    const std::string addr = "127.0.0.1:8044";
+    const std::string path = "/tmp/hr_test_handoff.sock";
+    auto old_server = create_server(addr, "old");
+    auto new_server = create_server("", "new");
+    old_server->start();
+
+    std::atomic<bool> stop(false);
+    std::atomic<int> left(8);
+    std::atomic<int> errors(0);
+    std::atomic<int> from_old(0);
+    std::atomic<int> from_new(0);
+    hr::Fiber::ptr self = hr::Fiber::GetThis();
+    hr::IOManager* iom = hr::IOManager::GetThis();
+    auto pool = hr::http::HttpConnectionPool::Create("http://" + addr, "", 8, 0, 0, 0);
+    for(int f = 0; f < 8; ++f) {
+        iom->schedule([&]() {
+            while(!stop) {
+                auto r = pool->doGet("/", 1000);
+                if(r->result != 0 || !r->response) {
+                    HR_LOG_INFO(g_logger) << r->toString();
+                    ++errors;
+                } else if(r->response->getBody() == "old") {
+                    ++from_old;
+                } else {
+                    ++from_new;
+                }
+            }
+            if(--left == 0) {
+                iom->schedule(self);
+            }
+        });
+    }
+    usleep(200 * 1000);
+
+    //旧服务器在Unix socket上把监听socket发给新服务器
+    auto uaddr = std::make_shared<hr::UnixAddress>(path);
+    auto ctl = hr::Socket::CreateUnixTCPSocket();
+    ctl->bind(uaddr);
+    ctl->listen();
+    bool sent = false;
+    iom->schedule([&]() {
+        auto peer = ctl->accept();
+        sent = peer && old_server->sendListeners(peer);
+    });
+    auto sock = hr::Socket::CreateUnixTCPSocket();
+    bool received = sock->connect(uaddr) && new_server->recvListeners(sock);
+    new_server->start();
+    bool drained = old_server->drain(1000);
+    SYLAR_ASSERT2(received && sent
+            && new_server->getSocks().size() == 1, "listeners handed off");
+    int old_count = from_old;
+
+    usleep(200 * 1000);
+    stop = true;
+    hr::Fiber::YieldToHold();
+    HR_LOG_INFO(g_logger) << "handoff: old=" << from_old << " new=" << from_new
+        << " errors=" << errors << " connections=" << pool->getCreateCount();
+    SYLAR_ASSERT2(drained && errors == 0 && from_new > 0
+            && from_old == old_count, "handoff without errors");
+    new_server->stop();
+    ctl->close();
+    hr::FSUtil::Unlink(path);
+}
+
+void run() {
+    test_drain();
+    test_deadline();
+    test_handoff();
+    HR_LOG_INFO(g_logger) << "all ok";
+}
+
+int main(int argc, char** argv) {
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    hr::IOManager iom(2, true, "drain");
+    iom.schedule(run);
+    return 0;
+}
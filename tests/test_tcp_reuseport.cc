@@ -0,0 +1,110 @@
+#include "sylar/tcp_server.h"
+#include "sylar/iomanager.h"
+#include "sylar/log.h"
+#include "sylar/util.h"
+#include "sylar/macro.h"
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static int s_threads = 4;
+static int s_count = 10000;
+static int s_fibers = 32;
+
+//处理连接的线程回写给客户端,然后关闭连接
+class TidServer : public hr::TcpServer {
+public:
+    typedef std::shared_ptr<TidServer> ptr;
+
+    TidServer(hr::IOManager* iom)
+        :hr::TcpServer(iom, iom, iom) {
+    }
+
+    //连接是否都在接收它的线程上处理
+    bool isPinned() const { return m_unpinned == 0;}
+protected:
+    void handleClient(hr::Socket::ptr client) override {
+        int tid = hr::GetThreadId();
+        if(isReusePort() && hr::Scheduler::GetTaskThread() != tid) {
+            ++m_unpinned;
+        }
+        client->send(&tid, sizeof(tid));
+        client->close();
+    }
+private:
+    std::atomic<int> m_unpinned = {0};
+};
+
+static void bench(const std::string& name, bool reuseport, bool incoming_cpu
+                  ,const std::string& addr) {
+    hr::TcpServerConf conf;
+    conf.address.push_back(addr);
+    conf.reuseport = reuseport;
+    conf.incoming_cpu = incoming_cpu;
+    TidServer::ptr server(new TidServer(hr::IOManager::GetThis()));
+    server->setConf(conf);
+    auto address = hr::Address::LookupAnyIPAddress(addr);
+    while(!server->bind(address)) {
+        sleep(2);
+    }
+    server->start();
+
+    hr::Mutex mutex;
+    std::map<int, int> threads;
+    std::atomic<int> left(s_fibers);
+    std::atomic<int> errors(0);
+    hr::Fiber::ptr self = hr::Fiber::GetThis();
+    hr::IOManager* iom = hr::IOManager::GetThis();
+    uint64_t start = hr::GetCurrentUS();
+    for(int f = 0; f < s_fibers; ++f) {
+        iom->schedule([&]() {
+            for(int i = 0; i < s_count / s_fibers; ++i) {
+                hr::Socket::ptr sock = hr::Socket::CreateTCP(address);
+                int tid = 0;
+                if(!sock->connect(address) || sock->recv(&tid, sizeof(tid)) != sizeof(tid)) {
+                    ++errors;
+                    continue;
+                }
+                hr::Mutex::Lock lock(mutex);
+                ++threads[tid];
+            }
+            if(--left == 0) {
+                iom->schedule(self);
+            }
+        });
+    }
+    hr::Fiber::YieldToHold();
+    double sec = (hr::GetCurrentUS() - start) / 1000000.0;
+    int total = s_count / s_fibers * s_fibers;
+
+    std::stringstream ss;
+    for(auto& i : threads) {
+        ss << " " << i.first << ":" << i.second;
+    }
+    HR_LOG_INFO(g_logger) << name << ": listeners=" << server->getSocks().size()
+        << " connections=" << total << " errors=" << errors
+        << " conn/s=" << (uint64_t)(total / sec) << " threads=[" << ss.str() << " ]";
+    bool ok = errors == 0 && server->isPinned()
+        && (!reuseport || (int)server->getSocks().size() == s_threads);
+    SYLAR_ASSERT2(ok, name);
+    server->stop();
+}
+
+void run() {
+    bench("single acceptor", false, false, "127.0.0.1:8034");
+    bench("reuseport", true, false, "127.0.0.1:8035");
+    bench("reuseport+incoming_cpu", true, true, "127.0.0.1:8036");
+    HR_LOG_INFO(g_logger) << "all ok";
+}
+
+int main(int argc, char** argv) {
+    if(argc > 1) {
+        s_count = atoi(argv[1]);
+    }
+    if(argc > 2) {
+        s_threads = atoi(argv[2]);
+    }
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    hr::IOManager iom(s_threads, true, "reuseport");
+    iom.schedule(run);
+    return 0;
+}
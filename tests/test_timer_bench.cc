@@ -0,0 +1,147 @@
+#include "./sylar/sylar.h"
+#include "./sylar/macro.h"
+#include <atomic>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+static std::atomic<uint64_t> s_fired = {0};
+static std::atomic<uint64_t> s_cancelled = {0};
+static std::atomic<uint64_t> s_max_late = {0};
+//晚于5ms触发的定时器数量
+static std::atomic<uint64_t> s_late_count = {0};
+
+//模拟do_io里的socket超时：添加条件定时器，IO完成时取消，否则超时
+void worker(int count, std::vector<hr::Timer::ptr>* timers) {
+    hr::IOManager* iom = hr::IOManager::GetThis();
+    std::shared_ptr<int> cond(new int(0));
+    timers->reserve(count);
+    for(int i = 0; i < count; ++i) {
+        uint64_t ms = 1000 + rand() % 2000;
+        uint64_t deadline = hr::GetCurrentMS() + ms;
+        timers->push_back(iom->addConditionTimer(ms, [deadline](){
+            uint64_t now = hr::GetCurrentMS();
+            uint64_t late = now > deadline ? now - deadline : 0;
+            uint64_t cur = s_max_late;
+            while(late > cur && !s_max_late.compare_exchange_weak(cur, late));
+            if(late > 5) {
+                ++s_late_count;
+            }
+            ++s_fired;
+        }, std::weak_ptr<int>(cond)));
+    }
+    //条件一直有效，直到定时器全部触发
+    iom->addTimer(4000, [cond](){});
+}
+
+void canceler(std::vector<hr::Timer::ptr>* timers) {
+    //一半的IO在超时前完成
+    for(size_t i = 0; i < timers->size(); i += 2) {
+        if((*timers)[i]->cancel()) {
+            ++s_cancelled;
+        }
+    }
+}
+
+//threads个线程共添加total个定时器,一半在超时前取消
+static void run(int threads, int total) {
+    int per = total / threads;
+    s_fired = 0;
+    s_cancelled = 0;
+    s_max_late = 0;
+    s_late_count = 0;
+
+    std::vector<std::vector<hr::Timer::ptr> > timers(threads);
+    uint64_t start = hr::GetCurrentUS();
+    uint64_t add_us = 0;
+    uint64_t cancel_us = 0;
+    {
+        hr::IOManager iom(threads, false, "timer");
+        std::atomic<int> done = {0};
+        for(int i = 0; i < threads; ++i) {
+            iom.schedule([i, per, &timers, &done](){
+                worker(per, &timers[i]);
+                ++done;
+            });
+        }
+        while(done != threads) {
+            usleep(1000);
+        }
+        add_us = hr::GetCurrentUS() - start;
+
+        done = 0;
+        start = hr::GetCurrentUS();
+        for(int i = 0; i < threads; ++i) {
+            iom.schedule([i, &timers, &done](){
+                canceler(&timers[i]);
+                ++done;
+            });
+        }
+        while(done != threads) {
+            usleep(1000);
+        }
+        cancel_us = hr::GetCurrentUS() - start;
+        //析构时等待所有定时器结束
+    }
+
+    uint64_t n = (uint64_t)per * threads;
+    HR_LOG_INFO(g_logger) << "timers=" << n << " threads=" << threads;
+    HR_LOG_INFO(g_logger) << "add:    " << (uint64_t)(n * 1e6 / add_us) << " timers/s";
+    HR_LOG_INFO(g_logger) << "cancel: " << (uint64_t)(s_cancelled * 1e6 / cancel_us) << " timers/s";
+    HR_LOG_INFO(g_logger) << "fired=" << s_fired << " cancelled=" << s_cancelled
+                          << " max_late=" << s_max_late << "ms"
+                          << " late_over_5ms=" << s_late_count;
+}
+
+//等待定时器触发,返回从start开始的毫秒数
+static uint64_t wait_fired(std::atomic<uint64_t>& fired, uint64_t start) {
+    while(!fired) {
+        usleep(1000);
+    }
+    return fired - start;
+}
+
+//调度线程只等自己的分片,其他线程插入到它分片首部时要单独唤醒它
+static void test_shards() {
+    hr::IOManager iom(2, false, "shard");
+    std::atomic<uint64_t> fired = {0};
+
+    //非调度线程添加的定时器放入公共分片,任意空闲线程处理
+    uint64_t start = hr::GetCurrentMS();
+    iom.addTimer(50, [&fired](){ fired = hr::GetCurrentMS();});
+    uint64_t used = wait_fired(fired, start);
+    SYLAR_ASSERT2(used >= 50 && used < 500, "outside thread timer " << used << "ms");
+
+    //调度线程添加的定时器在它自己的分片,线程按2秒的超时睡眠
+    hr::Timer::ptr timer;
+    std::atomic<bool> added = {false};
+    fired = 0;
+    iom.schedule([&iom, &timer, &fired, &added](){
+        timer = iom.addTimer(2000, [&fired](){ fired = hr::GetCurrentMS();});
+        added = true;
+    });
+    while(!added) {
+        usleep(1000);
+    }
+    //等线程进入睡眠后从外面改短,要唤醒分片的拥有者
+    usleep(100 * 1000);
+    start = hr::GetCurrentMS();
+    SYLAR_ASSERT(timer->reset(50, true));
+    used = wait_fired(fired, start);
+    SYLAR_ASSERT2(used >= 50 && used < 500, "reset timer " << used << "ms");
+    HR_LOG_INFO(g_logger) << "shards ok";
+}
+
+int main(int argc, char** argv) {
+    HR_LOG_NAME("system")->setLevel(hr::LogLevel::ERROR);
+    test_shards();
+    int threads = argc > 1 ? atoi(argv[1]) : 4;
+    int total = argc > 2 ? atoi(argv[2]) : 1000000;
+    //定时器少、线程空闲时应该准时触发。时间轮算错下一次超时会让一批定时器晚一圈(256ms)。
+    //epoll_wait本身在负载高的机器上也会晚醒几毫秒,只要求95%在5ms内,最多晚50ms
+    run(1, 1000);
+    bool ok = s_late_count * 20 <= s_fired && s_max_late <= 50;
+    HR_LOG_INFO(g_logger) << "idle precision: " << (ok ? "ok" : "FAILED");
+    //大量定时器同时触发时回调本身要排队,延迟只做参考
+    run(threads, total);
+    return ok ? 0 : 1;
+}
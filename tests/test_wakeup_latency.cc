@@ -0,0 +1,98 @@
+#include "./sylar/sylar.h"
+#include "./sylar/macro.h"
+#include <algorithm>
+
+static hr::Logger::ptr g_logger = HR_LOG_ROOT();
+
+//调度延迟: 从schedule到任务开始执行的时间(微秒)
+static void print_latency(const std::string& name, std::vector<uint64_t>& lat) {
+    if(lat.empty()) {
+        HR_LOG_INFO(g_logger) << name << ": count=0";
+        return;
+    }
+    std::sort(lat.begin(), lat.end());
+    HR_LOG_INFO(g_logger) << name << ": count=" << lat.size()
+        << " p50=" << lat[lat.size() / 2] << "us"
+        << " p99=" << lat[lat.size() * 99 / 100] << "us"
+        << " max=" << lat.back() << "us";
+}
+
+static void print_counters(const std::string& name, hr::IOManager& iom
+                           ,uint64_t tickle, uint64_t suppressed, uint64_t spurious) {
+    HR_LOG_INFO(g_logger) << name << ": tickle=" << iom.getTickleCount() - tickle
+        << " suppressed=" << iom.getTickleSuppressedCount() - suppressed
+        << " spurious_wakeup=" << iom.getSpuriousWakeupCount() - spurious;
+}
+
+//工作线程都睡眠时从外部线程调度任务,每次等任务执行完、线程重新睡眠后再调度下一个
+static void test_latency(int count) {
+    hr::IOManager iom(4, false, "latency");
+    const std::vector<int>& ids = iom.getThreadIds();
+    hr::Semaphore sem;
+    std::vector<uint64_t> any;
+    std::vector<uint64_t> pinned;
+
+    usleep(100 * 1000);
+    uint64_t tickle = iom.getTickleCount();
+    uint64_t suppressed = iom.getTickleSuppressedCount();
+    uint64_t spurious = iom.getSpuriousWakeupCount();
+    for(int i = 0; i < count; ++i) {
+        uint64_t start = hr::GetCurrentUS();
+        iom.schedule([&any, &sem, start]() {
+            any.push_back(hr::GetCurrentUS() - start);
+            sem.notify();
+        });
+        sem.wait();
+        usleep(200);
+    }
+    print_latency("any thread", any);
+    print_counters("any thread", iom, tickle, suppressed, spurious);
+    SYLAR_ASSERT2((int)any.size() == count, "any thread");
+
+    tickle = iom.getTickleCount();
+    suppressed = iom.getTickleSuppressedCount();
+    spurious = iom.getSpuriousWakeupCount();
+    for(int i = 0; i < count; ++i) {
+        uint64_t start = hr::GetCurrentUS();
+        int thread = ids[i % ids.size()];
+        iom.schedule([&pinned, &sem, start, thread]() {
+            if(hr::GetThreadId() == thread) {
+                pinned.push_back(hr::GetCurrentUS() - start);
+            }
+            sem.notify();
+        }, thread);
+        sem.wait();
+        usleep(200);
+    }
+    print_latency("pinned thread", pinned);
+    print_counters("pinned thread", iom, tickle, suppressed, spurious);
+    //指定线程的任务只能在那个线程执行
+    SYLAR_ASSERT2((int)pinned.size() == count, "pinned thread");
+
+    //任务连续产生: 线程都醒着,通知应该大部分被省掉
+    tickle = iom.getTickleCount();
+    suppressed = iom.getTickleSuppressedCount();
+    spurious = iom.getSpuriousWakeupCount();
+    std::atomic<int> left(count * 10);
+    uint64_t start = hr::GetCurrentUS();
+    iom.schedule([&]() {
+        for(int i = 0; i < count * 10; ++i) {
+            hr::IOManager::GetThis()->schedule([&]() {
+                if(--left == 0) {
+                    sem.notify();
+                }
+            });
+        }
+    });
+    sem.wait();
+    HR_LOG_INFO(g_logger) << "burst: tasks=" << count * 10
+        << " used=" << (hr::GetCurrentUS() - start) << "us";
+    print_counters("burst", iom, tickle, suppressed, spurious);
+    SYLAR_ASSERT2(iom.getTickleCount() - tickle < (uint64_t)count, "burst tickle suppressed");
+}
+
+int main(int argc, char** argv) {
+    test_latency(argc > 1 ? atoi(argv[1]) : 2000);
+    HR_LOG_INFO(g_logger) << "all ok";
+    return 0;
+}